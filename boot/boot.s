@@ -1,8 +1,76 @@
 .global __kos_start
 __kos_start:
+    // Start the cycle counter and take the boot timestamps
+    mrs x0, pmcr_el0
+    orr x0, x0, #1      // PMCR_EL0.E
+    msr pmcr_el0, x0
+    mov x0, #(1 << 31)  // PMCNTENSET_EL0.C
+    msr pmcntenset_el0, x0
+    isb
+    mrs x19, cntvct_el0
+    mrs x20, pmccntr_el0
+
     // Setup the stack
     ldr x30, =stack_top // Load into X30 the address of the stack
     mov sp, x30         // Mov X30 into SP (Stack Pointer)
     mov x18, 0x2905     // Magic number for debug
+
+    // Exception vectors, no per-CPU data yet
+    ldr x0, =__exception_vectors
+    msr vbar_el1, x0
+    msr tpidr_el1, xzr
+    isb
+
+    // Build the identity map and turn on the MMU and caches
+    bl mmu_early_init
+    bl __mmu_enable
+
+    ldr x0, =kos_boot_cntvct
+    str x19, [x0]
+    ldr x0, =kos_boot_cycles
+    str x20, [x0]
     bl __kos_main
     b .
+
+// Entry point of secondary cores (PSCI CPU_ON), MMU and caches are off
+// X0: struct cpu * (context ID)
+.global __kos_secondary_start
+__kos_secondary_start:
+    mov x19, x0
+    ldr x1, [x19]       // struct cpu.stack_top
+    mov sp, x1
+    msr tpidr_el1, x19  // Per-CPU data
+    ldr x0, =__exception_vectors
+    msr vbar_el1, x0
+    isb
+    ldr x0, =mmu_boot_config
+    ldr x0, [x0]
+    bl __mmu_enable
+    mov x0, x19
+    bl __kos_secondary_main
+    b .
+
+// X0: struct mmu_config * (mair, tcr, ttbr0, sctlr bits to set)
+.global __mmu_enable
+__mmu_enable:
+    cbz x0, 1f
+    ldr x1, [x0]        // MAIR_EL1
+    msr mair_el1, x1
+    ldr x1, [x0, #8]    // TCR_EL1
+    msr tcr_el1, x1
+    ldr x1, [x0, #16]   // TTBR0_EL1
+    msr ttbr0_el1, x1
+    isb
+    tlbi vmalle1
+    dsb nsh
+    isb
+    mrs x1, sctlr_el1
+    ldr x2, [x0, #24]   // SCTLR_EL1.M/C/I
+    orr x1, x1, x2
+    msr sctlr_el1, x1
+    isb
+    ic iallu
+    dsb nsh
+    isb
+1:
+    ret
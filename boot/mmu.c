@@ -0,0 +1,212 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/cache.h>
+#include <kernel/arch/mmu.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/klibc/stdlib.h>
+
+#define MEMORY_DEVICE_TYPE "memory"
+
+// Defined by the linker script
+extern const volatile unsigned int dtb;
+extern const volatile unsigned int kernel_end;
+
+static uint64_t l1_table[MMU_TABLE_ENTRIES] __attribute__((aligned(4096)));
+static uint64_t l2_tables[MMU_MAX_L2_TABLES][MMU_TABLE_ENTRIES] __attribute__((aligned(4096)));
+static size_t n_l2_tables = 0;
+static struct mmu_config config;
+struct mmu_config *mmu_boot_config = NULL;
+
+static uint64_t mmu_block_attributes(enum mmu_memory_type type) {
+  switch (type) {
+    case MMU_MEMORY_NORMAL:
+      return MMU_DESC_ATTR(MMU_ATTR_NORMAL) | MMU_DESC_SH_INNER | MMU_DESC_AF;
+    case MMU_MEMORY_NORMAL_NC:
+      return MMU_DESC_ATTR(MMU_ATTR_NORMAL_NC) | MMU_DESC_SH_INNER | MMU_DESC_AF | MMU_DESC_PXN | MMU_DESC_UXN;
+    case MMU_MEMORY_DEVICE:
+    default:
+      return MMU_DESC_ATTR(MMU_ATTR_DEVICE_nGnRnE) | MMU_DESC_AF | MMU_DESC_PXN | MMU_DESC_UXN;
+  }
+}
+
+static uint64_t *mmu_l2_table(size_t l1_index) {
+  uint64_t entry = l1_table[l1_index];
+  if (entry & MMU_DESC_VALID) {
+    return (uint64_t *) (entry & MMU_DESC_ADDR_MASK);
+  }
+
+  if (n_l2_tables >= MMU_MAX_L2_TABLES) {
+    return NULL;
+  }
+
+  uint64_t *table = l2_tables[n_l2_tables++];
+  memset(table, 0x00, sizeof(uint64_t) * MMU_TABLE_ENTRIES);
+  l1_table[l1_index] = (uint64_t) table | MMU_DESC_TABLE | MMU_DESC_VALID;
+  return table;
+}
+
+struct mmu_config *mmu_early_init() {
+#ifdef KOS_MMU
+  memset(l1_table, 0x00, sizeof(l1_table));
+  n_l2_tables = 0;
+
+  // QEMU virt keeps every on-chip peripheral (GIC, PL011, virtio-mmio...) below 1 GiB
+  l1_table[0] = 0 | mmu_block_attributes(MMU_MEMORY_DEVICE) | MMU_DESC_BLOCK | MMU_DESC_VALID;
+
+  // Only the DTB, the kernel image and the boot stack, in 2 MiB blocks: the
+  // rest of RAM is mapped by mmu_map_ram once the memory map is known
+  pa_address image_start = (pa_address) &dtb;
+  mmu_map(image_start, (pa_address) &kernel_end - image_start, MMU_MEMORY_NORMAL);
+
+  // The tables were written with the MMU off, the walker reads them through
+  // the cache (TCR_EL1 WBWA): drop any stale line of them
+  dcache_inval_range(l1_table, sizeof(l1_table));
+  dcache_inval_range(l2_tables, n_l2_tables * sizeof(l2_tables[0]));
+
+  // Clamp the output address size to what the CPU supports
+  uint64_t pa_range = read_sysreg(id_aa64mmfr0_el1) & 0xF;
+  if (pa_range > 5) {
+    pa_range = 5;
+  }
+
+  config.mair = MMU_MAIR_VALUE;
+  config.tcr = TCR_T0SZ(MMU_VA_BITS) | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | TCR_TG0_4K | TCR_EPD1 | (pa_range << TCR_IPS_SHIFT);
+  config.ttbr0 = (uint64_t) l1_table;
+  config.sctlr = SCTLR_M | SCTLR_C | SCTLR_I;
+  mmu_boot_config = &config;
+  return &config;
+#else
+  return NULL;
+#endif
+}
+
+int mmu_map(pa_address pa, size_t size, enum mmu_memory_type type) {
+#ifdef KOS_MMU
+  pa_address start = pa & ~(MMU_L2_BLOCK_SIZE - 1);
+  pa_address end = (pa + size + MMU_L2_BLOCK_SIZE - 1) & ~(MMU_L2_BLOCK_SIZE - 1);
+  if (end > (1UL << MMU_VA_BITS)) {
+    debug_msg("mmu_map: %#lx is out of the addressable range", pa);
+    return -1;
+  }
+
+  uint64_t attributes = mmu_block_attributes(type) | MMU_DESC_BLOCK | MMU_DESC_VALID;
+  while (start < end) {
+    size_t l1_index = start >> MMU_L1_BLOCK_SHIFT;
+    uint64_t l1_entry = l1_table[l1_index];
+
+    // Already covered by a 1 GiB block
+    if ((l1_entry & MMU_DESC_VALID) && !(l1_entry & MMU_DESC_TABLE)) {
+      start = (start + MMU_L1_BLOCK_SIZE) & ~(MMU_L1_BLOCK_SIZE - 1);
+      continue;
+    }
+
+    // Use a 1 GiB block when the range allows it
+    if (!(l1_entry & MMU_DESC_VALID) && !(start & (MMU_L1_BLOCK_SIZE - 1)) && end - start >= MMU_L1_BLOCK_SIZE) {
+      l1_table[l1_index] = start | attributes;
+      start += MMU_L1_BLOCK_SIZE;
+      continue;
+    }
+
+    uint64_t *l2_table = mmu_l2_table(l1_index);
+    if (!l2_table) {
+      debug_msg("mmu_map: out of translation tables mapping %#lx", start);
+      return -1;
+    }
+
+    size_t l2_index = (start >> MMU_L2_BLOCK_SHIFT) & (MMU_TABLE_ENTRIES - 1);
+    if (!(l2_table[l2_index] & MMU_DESC_VALID)) {
+      l2_table[l2_index] = start | attributes;
+    }
+    start += MMU_L2_BLOCK_SIZE;
+  }
+
+  // Only invalid entries were filled in, no TLB maintenance is needed
+  dsb(ishst);
+  isb();
+#endif
+  return 0;
+}
+
+void mmu_map_ram(const struct memmap *map) {
+  for (uint32_t b = 0; b < map->n_banks; b++) {
+    mmu_map(map->banks[b].start, map->banks[b].end - map->banks[b].start, MMU_MEMORY_NORMAL);
+  }
+}
+
+void fdt_mmu_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name) {
+  struct mmu_dtb_data *data = data_ptr;
+  data->depth++;
+  // Children of a device keep its state, only a new device resets it
+  if (data->depth == 2) {
+    data->is_memory = 0;
+    data->reg = NULL;
+    data->reg_len = 0;
+  }
+}
+
+void fdt_mmu_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct mmu_dtb_data *data = data_ptr;
+  // RAM is mapped by mmu_map_ram, the rest of the reg tuples are registers
+  if (data->depth == 2 && !data->is_memory && data->reg) {
+    const uint32_t *cells = data->reg;
+    uint32_t tuple_cells = data->address_cells + data->size_cells;
+    uint32_t n_cells = data->reg_len / sizeof(uint32_t);
+    while (tuple_cells && n_cells >= tuple_cells) {
+      pa_address address = fdt_read_cells(cells, data->address_cells);
+      size_t size = fdt_read_cells(cells + data->address_cells, data->size_cells);
+      mmu_map(address, size, MMU_MEMORY_DEVICE);
+      cells += tuple_cells;
+      n_cells -= tuple_cells;
+    }
+  }
+  data->depth--;
+}
+
+void fdt_mmu_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
+  struct mmu_dtb_data *data = data_ptr;
+  if (!property->len) {
+    return;
+  }
+
+  if (data->depth == 1) {
+    // Cell sizes used by the nodes below the root
+    if (property->id == FDT_PROP_ID_ADDRESS_CELLS) {
+      data->address_cells = fdt_read_cells(property_value, 1);
+    } else if (property->id == FDT_PROP_ID_SIZE_CELLS) {
+      data->size_cells = fdt_read_cells(property_value, 1);
+    }
+  } else if (data->depth == 2) {
+    // reg and device_type come in any order, the node is mapped at its end
+    if (property->id == FDT_PROP_ID_REG) {
+      data->reg = property_value;
+      data->reg_len = property->len;
+    } else if (property->id == FDT_PROP_ID_DEVICE_TYPE) {
+      data->is_memory = strcmp(property_value, MEMORY_DEVICE_TYPE) == 0;
+    }
+  }
+}
+
+static const struct fdt_ops mmu_ops = {
+  .visit_begin_node = fdt_mmu_begin_node,
+  .visit_end_node = fdt_mmu_end_node,
+  .visit_property = fdt_mmu_property
+};
+
+struct fdt_visitor mmu_devices_visitor(struct mmu_dtb_data *data) {
+  memset(data, 0x00, sizeof(struct mmu_dtb_data));
+
+  // Defaults from the devicetree specification
+  data->address_cells = 2;
+  data->size_cells = 1;
+
+  struct fdt_visitor visitor = { .ops = &mmu_ops, .data_ptr = data };
+  return visitor;
+}
+
+void mmu_map_devices(const struct fdt_header *header) {
+  struct mmu_dtb_data data;
+  struct fdt_visitor visitor = mmu_devices_visitor(&data);
+  fdt_traverse_visitors(header, &visitor, 1);
+}
@@ -5,22 +5,86 @@
 #include <limits.h>
 #include <kernel/klibc/stdlib.h>
 #include <kernel/dtb/dtb.h>
+#include <kernel/dtb/dtb_index.h>
+#include <kernel/arch/fpsimd.h>
+#include <kernel/drivers/driver.h>
+#include <kernel/drivers/virtio_blk.h>
+#include <kernel/arch/mmu.h>
+#include <kernel/arch/sysreg.h>
 #include <kernel/kmalloc.h>
-#include <kernel/system_info.h>
+#include <kernel/kthread.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/perf.h>
+#include <kernel/profile.h>
+#include <kernel/smp.h>
+#include <kernel/sync/lockstat.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
 
 extern const volatile unsigned int dtb;
 
+// Timestamps taken by boot.s before the MMU is enabled
+uint64_t kos_boot_cntvct;
+uint64_t kos_boot_cycles;
+
 void __kos_main() {
   struct fdt_header *header = (struct fdt_header *) &dtb;
+  fpsimd_init();
+  clock_init();
+  profile_init(kos_boot_cntvct);
+  profile_phase("banner");
   debug_msg("Welcome to K OS!");
   debug_msg("By Kellerman Rivero");
-  debug_msg("Running in a %d bit processor", (sizeof(uintptr_t) / sizeof(char)) * CHAR_BIT);
-  parse_device_tree(header);
+  debug_msg("Running in a %zu bit processor", (sizeof(uintptr_t) / sizeof(char)) * CHAR_BIT);
+  if (fdt_check_header(header)) {
+    debug_msg("No valid device tree at %p", header);
+    while (1) {}
+  }
+
+  // A single walk over the DTB feeds every early consumer
+  profile_phase("dtb walk");
+  struct memmap_dtb_data memmap_data;
+  struct fdt_dump_data dump_data;
+  struct mmu_dtb_data mmu_data;
+  struct smp_dtb_data smp_data;
+  struct fdt_visitor visitors[] = {
+    fdt_dump_visitor(&dump_data),
+    memmap_dtb_visitor(&memmap_data, &system_memmap),
+    mmu_devices_visitor(&mmu_data),
+    smp_dtb_visitor(&smp_data)
+  };
+  fdt_traverse_visitors(header, visitors, sizeof(visitors) / sizeof(visitors[0]));
+
+  profile_phase("mmu map ram");
+  mmu_map_ram(&system_memmap);
+  profile_phase("page_alloc");
+  page_alloc_init(&system_memmap, header);
+  memmap_dump(&system_memmap);
+  page_alloc_dump();
+  profile_phase("kmalloc");
+  kmalloc_init();
+  profile_phase("dtb index");
+  if (fdt_index_build(&dtb_index, header) == 0) {
+    debug_msg("DTB index: %d nodes, %d properties", dtb_index.n_nodes, dtb_index.n_props);
+  }
+  profile_phase("smp");
+  smp_init(&smp_data);
+  profile_phase("sched");
+  sched_init();
+  profile_phase("drivers");
+  driver_probe_all(&dtb_index);
+  profile_phase(NULL);
 
-  struct kern_system_info system_info;
-  memset(&system_info, 0x00, sizeof(struct kern_system_info));
-  fetch_sysinfo(&system_info, header);
-  debug_msg("RAM Base Address: %x, Size: %x", system_info.pa_ram_base_address, system_info.pa_ram_size);
-  //kmalloc_init();
+  uint64_t ticks = read_sysreg(cntvct_el0) - kos_boot_cntvct;
+  uint64_t cycles = read_sysreg(pmccntr_el0) - kos_boot_cycles;
+  debug_msg("Boot took %lu us (%lu cycles)", clock_ticks_to_ns(ticks) / NSEC_PER_USEC, cycles);
+  profile_dump();
+  perf_boot_report();
+  lockstat_dump();
+  trace_drain();
+  virtio_blk_self_test();
 
+  // The boot core becomes a regular scheduler core
+  kthread_exit(0);
 }
\ No newline at end of file
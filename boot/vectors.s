@@ -0,0 +1,155 @@
+// Exception vector table for EL1 (VBAR_EL1), see struct exception_frame
+
+.macro kernel_entry
+    sub sp, sp, #272
+    stp x0, x1, [sp, #0]
+    stp x2, x3, [sp, #16]
+    stp x4, x5, [sp, #32]
+    stp x6, x7, [sp, #48]
+    stp x8, x9, [sp, #64]
+    stp x10, x11, [sp, #80]
+    stp x12, x13, [sp, #96]
+    stp x14, x15, [sp, #112]
+    stp x16, x17, [sp, #128]
+    stp x18, x19, [sp, #144]
+    stp x20, x21, [sp, #160]
+    stp x22, x23, [sp, #176]
+    stp x24, x25, [sp, #192]
+    stp x26, x27, [sp, #208]
+    stp x28, x29, [sp, #224]
+    mrs x21, elr_el1
+    stp x30, x21, [sp, #240]
+    mrs x22, spsr_el1
+    mrs x23, esr_el1
+    stp x22, x23, [sp, #256]
+.endm
+
+.macro kernel_exit
+    ldp x30, x21, [sp, #240]
+    ldr x22, [sp, #256]
+    msr elr_el1, x21
+    msr spsr_el1, x22
+    ldp x0, x1, [sp, #0]
+    ldp x2, x3, [sp, #16]
+    ldp x4, x5, [sp, #32]
+    ldp x6, x7, [sp, #48]
+    ldp x8, x9, [sp, #64]
+    ldp x10, x11, [sp, #80]
+    ldp x12, x13, [sp, #96]
+    ldp x14, x15, [sp, #112]
+    ldp x16, x17, [sp, #128]
+    ldp x18, x19, [sp, #144]
+    ldp x20, x21, [sp, #160]
+    ldp x22, x23, [sp, #176]
+    ldp x24, x25, [sp, #192]
+    ldp x26, x27, [sp, #208]
+    ldp x28, x29, [sp, #224]
+    add sp, sp, #272
+    eret
+.endm
+
+// Minimal save for IRQs: the handlers are C functions, which keep x19-x29
+.macro irq_entry
+    sub sp, sp, #176
+    stp x0, x1, [sp, #0]
+    stp x2, x3, [sp, #16]
+    stp x4, x5, [sp, #32]
+    stp x6, x7, [sp, #48]
+    stp x8, x9, [sp, #64]
+    stp x10, x11, [sp, #80]
+    stp x12, x13, [sp, #96]
+    stp x14, x15, [sp, #112]
+    stp x16, x17, [sp, #128]
+    mrs x0, elr_el1
+    stp x18, x30, [sp, #144]
+    mrs x1, spsr_el1
+    stp x0, x1, [sp, #160]
+.endm
+
+.macro irq_exit
+    ldp x0, x1, [sp, #160]
+    msr elr_el1, x0
+    msr spsr_el1, x1
+    ldp x18, x30, [sp, #144]
+    ldp x0, x1, [sp, #0]
+    ldp x2, x3, [sp, #16]
+    ldp x4, x5, [sp, #32]
+    ldp x6, x7, [sp, #48]
+    ldp x8, x9, [sp, #64]
+    ldp x10, x11, [sp, #80]
+    ldp x12, x13, [sp, #96]
+    ldp x14, x15, [sp, #112]
+    ldp x16, x17, [sp, #128]
+    add sp, sp, #176
+    eret
+.endm
+
+.macro vector_entry label
+    .balign 0x80
+    b \label
+.endm
+
+.macro unhandled type
+    kernel_entry
+    mov x0, sp
+    mov x1, #\type
+    bl exception_unhandled
+    b .
+.endm
+
+.balign 0x800
+.global __exception_vectors
+__exception_vectors:
+    // Current EL with SP0
+    vector_entry el1t_unhandled_sync
+    vector_entry el1t_unhandled_irq
+    vector_entry el1t_unhandled_fiq
+    vector_entry el1t_unhandled_serror
+    // Current EL with SPx
+    vector_entry el1h_sync
+    vector_entry el1h_irq
+    vector_entry el1h_unhandled_fiq
+    vector_entry el1h_unhandled_serror
+    // Lower EL using AArch64
+    vector_entry el0_unhandled_sync
+    vector_entry el0_unhandled_irq
+    vector_entry el0_unhandled_fiq
+    vector_entry el0_unhandled_serror
+    // Lower EL using AArch32
+    vector_entry el0_unhandled_sync
+    vector_entry el0_unhandled_irq
+    vector_entry el0_unhandled_fiq
+    vector_entry el0_unhandled_serror
+
+el1h_sync:
+    kernel_entry
+    mov x0, sp
+    bl exception_sync
+    kernel_exit
+
+el1h_irq:
+    irq_entry
+    mov x0, sp
+    bl irq_handle
+    irq_exit
+
+el1t_unhandled_sync:
+    unhandled 0
+el1t_unhandled_irq:
+    unhandled 1
+el1t_unhandled_fiq:
+    unhandled 2
+el1t_unhandled_serror:
+    unhandled 3
+el1h_unhandled_fiq:
+    unhandled 2
+el1h_unhandled_serror:
+    unhandled 3
+el0_unhandled_sync:
+    unhandled 0
+el0_unhandled_irq:
+    unhandled 1
+el0_unhandled_fiq:
+    unhandled 2
+el0_unhandled_serror:
+    unhandled 3
@@ -0,0 +1,34 @@
+# Generates the kernel symbol table (see include/kernel/ksyms.h) from the
+# function symbols of a first link of the kernel:
+#   cmake -DNM=<nm> -DELF=<kernel_nosyms.elf> -DOUTPUT=<ksyms.s> -P ksyms.cmake
+execute_process(
+        COMMAND ${NM} -n --defined-only ${ELF}
+        OUTPUT_VARIABLE symbols
+        RESULT_VARIABLE result
+)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "ksyms: ${NM} failed on ${ELF}")
+endif ()
+
+string(REPLACE "\n" ";" lines "${symbols}")
+set(entries "")
+set(names "")
+set(count 0)
+foreach (line IN LISTS lines)
+    # Text symbols only, nm -n already sorts them by address
+    if (line MATCHES "^([0-9a-fA-F]+) [tTwW] ([A-Za-z_][A-Za-z0-9_.]*)$")
+        string(APPEND entries "    .quad 0x${CMAKE_MATCH_1}, .Lksym_${count}\n")
+        string(APPEND names ".Lksym_${count}: .asciz \"${CMAKE_MATCH_2}\"\n")
+        math(EXPR count "${count} + 1")
+    endif ()
+endforeach ()
+
+file(WRITE ${OUTPUT} "// Generated by cmake/ksyms.cmake from ${ELF}, do not edit
+    .section .ksyms, \"a\"
+    .balign 8
+    .global ksym_count
+ksym_count:
+    .quad ${count}
+    .global ksym_table
+ksym_table:
+${entries}${names}")
@@ -0,0 +1,97 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Throughput of the klibc memory and string routines across sizes and
+// misalignments (of the destination, the source is off by the same amount
+// plus one so both cases are covered)
+//   klibc_bench [MiB per measurement]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include "host_env.h"
+
+#define MAX_SIZE (64 << 10)
+#define PAD 64
+
+enum routine { R_MEMCPY, R_MEMMOVE, R_MEMSET, R_MEMCMP, R_STRLEN, R_STRCMP, N_ROUTINES };
+
+static const char *routine_names[N_ROUTINES] = { "memcpy", "memmove", "memset", "memcmp", "strlen", "strcmp" };
+static const size_t sizes[] = { 8, 16, 64, 256, 1024, 4096, 16384, 65536 };
+static const size_t alignments[] = { 0, 1, 7, 8 };
+
+static uint8_t dst_buffer[MAX_SIZE + PAD] __attribute__((aligned(64)));
+static uint8_t src_buffer[MAX_SIZE + PAD] __attribute__((aligned(64)));
+static volatile size_t sink;
+
+static void prepare(enum routine r, uint8_t *dst, uint8_t *src, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    src[i] = (uint8_t) ('a' + i % 26);
+  }
+  memcpy(dst, src, size);
+  if (r == R_STRLEN || r == R_STRCMP) {
+    // Strings of size bytes, terminator included
+    src[size - 1] = 0;
+    dst[size - 1] = 0;
+  }
+}
+
+static void run(enum routine r, uint8_t *dst, uint8_t *src, size_t size, uint64_t iterations) {
+  size_t acc = 0;
+  for (uint64_t i = 0; i < iterations; i++) {
+    switch (r) {
+      case R_MEMCPY:
+        memcpy(dst, src, size);
+        break;
+      case R_MEMMOVE:
+        memmove(dst, src, size);
+        break;
+      case R_MEMSET:
+        memset(dst, (int) i, size);
+        break;
+      case R_MEMCMP:
+        acc += (size_t) memcmp(dst, src, size);
+        break;
+      case R_STRLEN:
+        acc += strlen((const char *) src);
+        break;
+      case R_STRCMP:
+        acc += (size_t) strcmp((const char *) dst, (const char *) src);
+        break;
+      default:
+        break;
+    }
+  }
+  sink = acc;
+}
+
+int main(int argc, char **argv) {
+  uint64_t budget = (argc > 1 ? strtoull(argv[1], NULL, 0) : 64) << 20;
+
+  printf("%-8s %8s", "routine", "size");
+  for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++) {
+    printf("   align %-2zu", alignments[a]);
+  }
+  printf("   (MB/s)\n");
+
+  for (int r = 0; r < N_ROUTINES; r++) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      size_t size = sizes[s];
+      uint64_t iterations = budget / size;
+      printf("%-8s %8zu", routine_names[r], size);
+      for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++) {
+        uint8_t *dst = dst_buffer + alignments[a];
+        uint8_t *src = src_buffer + alignments[a] + 1;
+        prepare(r, dst, src, size);
+        run(r, dst, src, size, iterations / 16 + 1); // Warm up
+        uint64_t start = host_now_ns();
+        run(r, dst, src, size, iterations);
+        uint64_t elapsed = host_now_ns() - start;
+        printf("  %10.1f", elapsed ? (double) (iterations * size) * 1000.0 / (double) elapsed : 0.0);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Latency distribution of kmalloc and kfree under a mix of sizes, through the
+// slab path alone (no core) and through the per-CPU magazines of core 0
+//   kmalloc_bench [operations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include "host_env.h"
+
+#define RAM_SIZE (256UL << 20)
+#define LIVE 8192
+
+static void *live[LIVE];
+static uint64_t rng_state = 0x9E3779B97F4A7C15UL;
+
+static uint64_t rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Mostly small objects, some medium ones and a few that go to the page allocator
+static size_t random_size() {
+  uint64_t r = rng() % 100;
+  if (r < 70) {
+    return 8 + rng() % 120;
+  } else if (r < 95) {
+    return 128 + rng() % 896;
+  }
+  return 1025 + rng() % (8 << 10);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *name, uint64_t *samples, size_t n) {
+  static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+  if (!n) {
+    return;
+  }
+  qsort(samples, n, sizeof(uint64_t), compare_u64);
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += samples[i];
+  }
+  printf("  %-6s %10zu ops  mean %6.1f", name, n, (double) total / (double) n);
+  for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+    printf("  p%-4g %6lu", percentiles[p], samples[(size_t) ((double) (n - 1) * percentiles[p] / 100.0)]);
+  }
+  printf("  max %8lu (ns)\n", samples[n - 1]);
+}
+
+static void bench(const char *name, uint32_t cpu, size_t operations, uint64_t *alloc_ns, uint64_t *free_ns) {
+  size_t n_alloc = 0;
+  size_t n_free = 0;
+  host_cpu_id = cpu;
+  for (size_t op = 0; op < operations; op++) {
+    void **slot = &live[rng() % LIVE];
+    uint64_t start;
+    if (*slot) {
+      start = host_now_ns();
+      kfree(*slot);
+      free_ns[n_free++] = host_now_ns() - start;
+      *slot = NULL;
+    } else {
+      size_t size = random_size();
+      start = host_now_ns();
+      *slot = kmalloc(size);
+      alloc_ns[n_alloc++] = host_now_ns() - start;
+      if (!*slot) {
+        fprintf(stderr, "kmalloc_bench: kmalloc(%zu) failed\n", size);
+        exit(1);
+      }
+    }
+  }
+  for (size_t i = 0; i < LIVE; i++) {
+    kfree(live[i]);
+    live[i] = NULL;
+  }
+  printf("%s\n", name);
+  report("kmalloc", alloc_ns, n_alloc);
+  report("kfree", free_ns, n_free);
+}
+
+int main(int argc, char **argv) {
+  size_t operations = argc > 1 ? strtoull(argv[1], NULL, 0) : 2000000;
+  uint64_t *alloc_ns = malloc(operations * sizeof(uint64_t));
+  uint64_t *free_ns = malloc(operations * sizeof(uint64_t));
+  if (!alloc_ns || !free_ns) {
+    fprintf(stderr, "kmalloc_bench: no memory for %zu samples\n", operations);
+    return 1;
+  }
+  host_env_init(RAM_SIZE);
+  bench("slab (no core)", UINT32_MAX, operations, alloc_ns, free_ns);
+  bench("magazines (core 0)", 0, operations, alloc_ns, free_ns);
+  free(alloc_ns);
+  free(free_ns);
+  return 0;
+}
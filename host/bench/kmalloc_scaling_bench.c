@@ -0,0 +1,88 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Throughput of kmalloc/kfree pairs as threads are added, each thread playing
+// its own core (magazines) or no core at all (slab locks only)
+//   kmalloc_scaling_bench [max threads] [operations per thread]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/smp.h>
+#include "host_env.h"
+
+#define RAM_SIZE (256UL << 20)
+#define LIVE 1024
+
+struct worker {
+  pthread_t thread;
+  uint32_t cpu;
+  size_t operations;
+  uint64_t seed;
+  void *live[LIVE];
+} __attribute__((aligned(64)));
+
+static struct worker workers[SMP_MAX_CPUS];
+static uint32_t start_line;
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  uint64_t state = w->seed;
+  host_cpu_id = w->cpu;
+  while (!__atomic_load_n(&start_line, __ATOMIC_ACQUIRE)) {}
+  for (size_t op = 0; op < w->operations; op++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    void **slot = &w->live[state % LIVE];
+    if (*slot) {
+      kfree(*slot);
+      *slot = NULL;
+    } else {
+      *slot = kmalloc(16 + (state >> 32) % 496);
+    }
+  }
+  for (size_t i = 0; i < LIVE; i++) {
+    kfree(w->live[i]);
+    w->live[i] = NULL;
+  }
+  return NULL;
+}
+
+static double run(uint32_t n_threads, int per_cpu, size_t operations) {
+  __atomic_store_n(&start_line, 0, __ATOMIC_RELEASE);
+  for (uint32_t t = 0; t < n_threads; t++) {
+    workers[t].cpu = per_cpu ? t : UINT32_MAX;
+    workers[t].operations = operations;
+    workers[t].seed = 0x9E3779B97F4A7C15UL * (t + 1);
+    pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+  }
+  uint64_t start = host_now_ns();
+  __atomic_store_n(&start_line, 1, __ATOMIC_RELEASE);
+  for (uint32_t t = 0; t < n_threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+  }
+  uint64_t elapsed = host_now_ns() - start;
+  return (double) (n_threads * operations) * 1e9 / (double) elapsed;
+}
+
+int main(int argc, char **argv) {
+  uint32_t max_threads = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 0) : 4;
+  size_t operations = argc > 2 ? strtoull(argv[2], NULL, 0) : 2000000;
+  if (max_threads < 1 || max_threads > SMP_MAX_CPUS) {
+    fprintf(stderr, "kmalloc_scaling_bench: between 1 and %d threads\n", SMP_MAX_CPUS);
+    return 1;
+  }
+  host_env_init(RAM_SIZE);
+
+  printf("%8s %16s %16s   (ops/s)\n", "threads", "slab", "magazines");
+  for (uint32_t n = 1; n <= max_threads; n++) {
+    double slab = run(n, 0, operations);
+    double magazines = run(n, 1, operations);
+    printf("%8u %16.0f %16.0f\n", n, slab, magazines);
+  }
+  return 0;
+}
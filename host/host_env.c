@@ -0,0 +1,80 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// RAM and a device tree for host programs that use the allocators
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/kmalloc.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/mm/page_alloc.h>
+#include "host_env.h"
+
+#define HOST_RAM_ALIGN (1UL << 22) // The largest buddy block
+
+// Header, an empty reservation block and a structure block with only the root node
+#define HOST_FDT_RSVMAP 40
+#define HOST_FDT_STRUCT 56
+#define HOST_FDT_SIZE 72
+
+static uint8_t host_fdt[HOST_FDT_SIZE] __attribute__((aligned(8)));
+static struct memmap host_memmap;
+
+static void host_be32(uint8_t *p, uint32_t value) {
+  p[0] = (uint8_t) (value >> 24);
+  p[1] = (uint8_t) (value >> 16);
+  p[2] = (uint8_t) (value >> 8);
+  p[3] = (uint8_t) value;
+}
+
+static void host_fdt_build() {
+  host_be32(host_fdt + 0, 0xD00DFEED);
+  host_be32(host_fdt + 4, HOST_FDT_SIZE);
+  host_be32(host_fdt + 8, HOST_FDT_STRUCT);
+  host_be32(host_fdt + 12, HOST_FDT_SIZE);
+  host_be32(host_fdt + 16, HOST_FDT_RSVMAP);
+  host_be32(host_fdt + 20, 17);
+  host_be32(host_fdt + 24, 16);
+  host_be32(host_fdt + 36, HOST_FDT_SIZE - HOST_FDT_STRUCT);
+  // FDT_BEGIN_NODE "" (padded), FDT_END_NODE, FDT_END
+  host_be32(host_fdt + HOST_FDT_STRUCT, 1);
+  host_be32(host_fdt + HOST_FDT_STRUCT + 8, 2);
+  host_be32(host_fdt + HOST_FDT_STRUCT + 12, 9);
+}
+
+void host_env_init(size_t ram_size) {
+  ram_size = (ram_size + HOST_RAM_ALIGN - 1) & ~(HOST_RAM_ALIGN - 1);
+  void *ram;
+  if (posix_memalign(&ram, HOST_RAM_ALIGN, ram_size)) {
+    fprintf(stderr, "host_env: no memory for %zu bytes of RAM\n", ram_size);
+    exit(1);
+  }
+  host_fdt_build();
+
+  host_memmap.banks[0] = (struct memmap_range) { .start = (pa_address) ram, .end = (pa_address) ram + ram_size, .node = 0 };
+  host_memmap.n_banks = 1;
+  host_memmap.n_nodes = 1;
+  host_memmap.distance[0][0] = MEMMAP_LOCAL_DISTANCE;
+  page_alloc_init(&host_memmap, (const struct fdt_header *) host_fdt);
+  kmalloc_init();
+}
+
+uint64_t host_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+int host_check_failures = 0;
+
+int host_check_report(const char *name) {
+  if (host_check_failures) {
+    fprintf(stderr, "%s: %d failures\n", name, host_check_failures);
+    return 1;
+  }
+  printf("%s: ok\n", name);
+  return 0;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOST_CHECK_MAX 20 // Failures after which a test gives up
+
+// Failed CHECKs of the test program, from any thread
+extern int host_check_failures;
+
+#define CHECK(cond, ...)                                                          \
+  do {                                                                            \
+    if (!(cond)) {                                                                \
+      fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);                        \
+      fprintf(stderr, __VA_ARGS__);                                               \
+      fputc('\n', stderr);                                                        \
+      if (__atomic_add_fetch(&host_check_failures, 1, __ATOMIC_RELAXED) > HOST_CHECK_MAX) { \
+        exit(1);                                                                  \
+      }                                                                           \
+    }                                                                             \
+  } while (0)
+
+// Core the calling thread plays for the per-CPU caches of kmalloc, UINT32_MAX for none
+extern __thread uint32_t host_cpu_id;
+
+/**
+ * Hands a block of host memory to the page allocator as the only RAM bank,
+ * with a minimal device tree reserved in it, and sets up kmalloc. Can only
+ * be called once per process.
+ * @param ram_size the size of the bank in bytes
+ */
+void host_env_init(size_t ram_size);
+
+/**
+ * Returns CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t host_now_ns();
+
+/**
+ * Prints the outcome of a test program
+ * @param name the program
+ * @return its exit status, 1 if a CHECK failed
+ */
+int host_check_report(const char *name);
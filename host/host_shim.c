@@ -0,0 +1,24 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Replaces what the kernel gets from the hardware and the linker script
+
+#include <stdio.h>
+#include <kernel/klibc/stdlib.h>
+
+// Linker script symbols (see main.ld), they never fall inside host "RAM"
+const volatile unsigned int dtb;
+const volatile unsigned int kernel_start;
+const volatile unsigned int kernel_end;
+
+void debug_putc(char c) {
+  fputc(c, stdout);
+}
+
+void debug_write_buffer(const char *buf, size_t len) {
+  fwrite(buf, 1, len, stdout);
+}
+
+// Core the calling thread plays for the per-CPU caches of kmalloc, UINT32_MAX for none
+__thread uint32_t host_cpu_id = UINT32_MAX;
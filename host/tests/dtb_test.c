@@ -0,0 +1,430 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// A small device tree is assembled in memory, then walked with visitors and
+// indexed: traversal order, early stop, cell sizes, lookups and property ids.
+// The memory map visitor is checked on nested nodes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/dtb/dtb_index.h>
+#include <kernel/mm/memmap.h>
+#include "host_env.h"
+
+#define RAM_SIZE (8UL << 20)
+#define BLOB_WORDS 1024
+#define STRINGS_SIZE 1024
+
+// Structure block and strings block of the blob being assembled, native words
+static uint32_t dt_struct[BLOB_WORDS];
+static uint32_t dt_n_words;
+static char dt_strings[STRINGS_SIZE];
+static uint32_t dt_strings_size;
+static uint32_t blob[BLOB_WORDS + STRINGS_SIZE / 4 + 16];
+
+static void dt_word(uint32_t value) {
+  dt_struct[dt_n_words++] = __builtin_bswap32(value);
+}
+
+// Copies bytes after the last word, padded with zeros to a word boundary
+static void dt_bytes(const void *data, size_t len) {
+  uint8_t *out = (uint8_t *) &dt_struct[dt_n_words];
+  memcpy(out, data, len);
+  size_t padded = (len + 3) & ~3UL;
+  memset(out + len, 0, padded - len);
+  dt_n_words += padded / 4;
+}
+
+static uint32_t dt_string(const char *name) {
+  // Names are shared like dtc does
+  for (uint32_t offset = 0; offset < dt_strings_size; offset += strlen(dt_strings + offset) + 1) {
+    if (strcmp(dt_strings + offset, name) == 0) {
+      return offset;
+    }
+  }
+  uint32_t offset = dt_strings_size;
+  memcpy(dt_strings + offset, name, strlen(name) + 1);
+  dt_strings_size += strlen(name) + 1;
+  return offset;
+}
+
+static void dt_begin(const char *name) {
+  dt_word(FDT_BEGIN_NODE);
+  dt_bytes(name, strlen(name) + 1);
+}
+
+static void dt_end() {
+  dt_word(FDT_END_NODE);
+}
+
+static void dt_prop(const char *name, const void *value, uint32_t len) {
+  dt_word(FDT_PROP);
+  dt_word(len);
+  dt_word(dt_string(name));
+  dt_bytes(value, len);
+}
+
+static void dt_prop_cells(const char *name, const uint32_t *cells, uint32_t n) {
+  uint32_t be[8];
+  for (uint32_t i = 0; i < n; i++) {
+    be[i] = __builtin_bswap32(cells[i]);
+  }
+  dt_prop(name, be, n * sizeof(uint32_t));
+}
+
+static void dt_prop_u32(const char *name, uint32_t value) {
+  dt_prop_cells(name, &value, 1);
+}
+
+static void dt_prop_string(const char *name, const char *value) {
+  dt_prop(name, value, strlen(value) + 1);
+}
+
+// Header, an empty reservation block, then the structure and strings blocks
+static const struct fdt_header *dt_finish() {
+  dt_word(FDT_END);
+  uint32_t off_rsvmap = sizeof(struct fdt_header);
+  uint32_t off_struct = off_rsvmap + sizeof(struct fdt_reserve_entry);
+  uint32_t off_strings = off_struct + dt_n_words * 4;
+  uint32_t total = off_strings + dt_strings_size;
+  uint8_t *out = (uint8_t *) blob;
+  memset(blob, 0, sizeof(blob));
+  uint32_t fields[] = { FDT_HEADER_MAGIC, total, off_struct, off_strings, off_rsvmap, 17, 16, 0, dt_strings_size,
+                        dt_n_words * 4 };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    blob[i] = __builtin_bswap32(fields[i]);
+  }
+  memcpy(out + off_struct, dt_struct, dt_n_words * 4);
+  memcpy(out + off_strings, dt_strings, dt_strings_size);
+  return (const struct fdt_header *) blob;
+}
+
+/*
+ * / { #address-cells = 2; #size-cells = 2; model; compatible;
+ *   intc@8000000 { interrupt-controller; phandle = 1; reg = 64-bit };
+ *   soc { #address-cells = 1; #size-cells = 1; interrupt-parent = <1>;
+ *     uart@9000000 { compatible = "arm,pl011", "arm,primecell"; reg };
+ *     virtio_mmio@a000000 { compatible = "virtio,mmio"; reg };
+ *     virtio_mmio@a000200 { compatible = "virtio,mmio"; reg; status = "disabled" };
+ *   };
+ *   memory@40000000 { device_type = "memory"; reg = 64-bit };
+ * }
+ */
+#define TEST_NODES 7
+#define TEST_PROPS 21
+static const char *const test_node_names[TEST_NODES] = {
+  "", "intc@8000000", "soc", "uart@9000000", "virtio_mmio@a000000", "virtio_mmio@a000200", "memory@40000000"
+};
+
+static const struct fdt_header *build_blob() {
+  static const char pl011[] = "arm,pl011\0arm,primecell";
+  dt_begin("");
+  dt_prop_u32(FDT_PROP_ADDRESS_CELLS, 2);
+  dt_prop_u32(FDT_PROP_SIZE_CELLS, 2);
+  dt_prop_string(FDT_PROP_MODEL, "kos-test");
+  dt_prop_string(FDT_PROP_COMPATIBLE, "kos,test-board");
+  dt_begin("intc@8000000");
+  dt_prop_string(FDT_PROP_COMPATIBLE, "arm,gic-v3");
+  dt_prop(FDT_PROP_INTERRUPT_CONTROLLER, NULL, 0);
+  dt_prop_u32(FDT_PROP_INTERRUPT_CELLS, 3);
+  dt_prop_u32(FDT_PROP_PHANDLE, 1);
+  dt_prop_cells(FDT_PROP_REG, (const uint32_t[]) { 0, 0x08000000, 0, 0x10000 }, 4);
+  dt_end();
+  dt_begin("soc");
+  dt_prop_u32(FDT_PROP_ADDRESS_CELLS, 1);
+  dt_prop_u32(FDT_PROP_SIZE_CELLS, 1);
+  dt_prop_u32(FDT_PROP_INTERRUPT_PARENT, 1);
+  dt_begin("uart@9000000");
+  dt_prop(FDT_PROP_COMPATIBLE, pl011, sizeof(pl011));
+  dt_prop_cells(FDT_PROP_REG, (const uint32_t[]) { 0x09000000, 0x1000 }, 2);
+  dt_end();
+  dt_begin("virtio_mmio@a000000");
+  dt_prop_string(FDT_PROP_COMPATIBLE, "virtio,mmio");
+  dt_prop_cells(FDT_PROP_REG, (const uint32_t[]) { 0x0a000000, 0x200 }, 2);
+  dt_end();
+  dt_begin("virtio_mmio@a000200");
+  dt_prop_string(FDT_PROP_COMPATIBLE, "virtio,mmio");
+  dt_prop_cells(FDT_PROP_REG, (const uint32_t[]) { 0x0a000200, 0x200 }, 2);
+  dt_prop_string(FDT_PROP_STATUS, "disabled");
+  dt_end();
+  dt_end();
+  dt_begin("memory@40000000");
+  dt_prop_string(FDT_PROP_DEVICE_TYPE, "memory");
+  dt_prop_cells(FDT_PROP_REG, (const uint32_t[]) { 0, 0x40000000, 0, 0x08000000 }, 4);
+  dt_end();
+  dt_end();
+  return dt_finish();
+}
+
+struct walk_data {
+  uint32_t begun;
+  uint32_t ended;
+  uint32_t depth;
+  uint32_t max_depth;
+  uint32_t n_props;
+  uint32_t n_unknown; // Properties without a well known id
+  uint32_t tokens;
+  uint32_t stop_after; // Nodes after which the visitor is done, 0 for never
+  uint32_t begin_calls;
+  uint32_t end_calls;
+  const char *names[TEST_NODES + 1];
+};
+
+static void walk_begin(void *data_ptr, const struct fdt_header *header) {
+  ((struct walk_data *) data_ptr)->begin_calls++;
+}
+
+static void walk_end(void *data_ptr, const struct fdt_header *header) {
+  ((struct walk_data *) data_ptr)->end_calls++;
+}
+
+static void walk_token(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor) {
+  ((struct walk_data *) data_ptr)->tokens++;
+}
+
+static void walk_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor, const char *name) {
+  struct walk_data *data = data_ptr;
+  if (data->begun < TEST_NODES + 1) {
+    data->names[data->begun] = name;
+  }
+  data->begun++;
+  if (++data->depth > data->max_depth) {
+    data->max_depth = data->depth;
+  }
+}
+
+static void walk_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor) {
+  struct walk_data *data = data_ptr;
+  data->ended++;
+  data->depth--;
+}
+
+static void walk_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor,
+                          const struct fdt_prop_data *property, const void *value) {
+  struct walk_data *data = data_ptr;
+  data->n_props++;
+  const char *name = fdt_prop_get_name(header, property);
+  CHECK(property->id == fdt_prop_lookup(name), "property %s has id %u, lookup says %u", name, property->id,
+        fdt_prop_lookup(name));
+  if (property->id == FDT_PROP_ID_UNKNOWN) {
+    data->n_unknown++;
+  }
+}
+
+static int walk_done(void *data_ptr) {
+  struct walk_data *data = data_ptr;
+  return data->stop_after && data->begun >= data->stop_after;
+}
+
+static const struct fdt_ops walk_ops = {
+  .begin = walk_begin,
+  .end = walk_end,
+  .visit_token = walk_token,
+  .visit_begin_node = walk_begin_node,
+  .visit_end_node = walk_end_node,
+  .visit_property = walk_property,
+  .done = walk_done
+};
+
+static void test_traversal(const struct fdt_header *header) {
+  CHECK(fdt_check_header(header) == 0, "the blob is rejected");
+
+  struct walk_data full;
+  memset(&full, 0, sizeof(full));
+  fdt_traverse(header, &walk_ops, &full);
+  CHECK(full.begun == TEST_NODES && full.ended == TEST_NODES, "%u nodes begun, %u ended", full.begun, full.ended);
+  CHECK(full.max_depth == 3 && full.depth == 0, "depth %u at most, %u at the end", full.max_depth, full.depth);
+  CHECK(full.n_props == TEST_PROPS, "%u properties", full.n_props);
+  CHECK(full.n_unknown == 0, "%u properties without an id", full.n_unknown);
+  CHECK(full.begin_calls == 1 && full.end_calls == 1, "begin called %u times, end %u", full.begin_calls,
+        full.end_calls);
+  for (uint32_t n = 0; n < TEST_NODES && n < full.begun; n++) {
+    CHECK(strcmp(full.names[n], test_node_names[n]) == 0, "node %u is \"%s\", expected \"%s\"", n, full.names[n],
+          test_node_names[n]);
+  }
+
+  // Same walk shared with a visitor that stops after the second node
+  struct walk_data early;
+  struct walk_data shared;
+  memset(&early, 0, sizeof(early));
+  memset(&shared, 0, sizeof(shared));
+  early.stop_after = 2;
+  struct fdt_visitor visitors[] = { { .ops = &walk_ops, .data_ptr = &early }, { .ops = &walk_ops, .data_ptr = &shared } };
+  fdt_traverse_visitors(header, visitors, 2);
+  CHECK(early.begun == 2, "the early visitor saw %u nodes", early.begun);
+  CHECK(early.end_calls == 1, "the early visitor ended %u times", early.end_calls);
+  CHECK(shared.begun == TEST_NODES && shared.n_props == TEST_PROPS, "the other visitor saw %u nodes, %u properties",
+        shared.begun, shared.n_props);
+  CHECK(shared.tokens == full.tokens, "%u tokens shared, %u alone", shared.tokens, full.tokens);
+
+  // Alone it ends the walk
+  memset(&early, 0, sizeof(early));
+  early.stop_after = 2;
+  struct fdt_visitor alone = { .ops = &walk_ops, .data_ptr = &early };
+  fdt_traverse_visitors(header, &alone, 1);
+  CHECK(early.begun == 2 && early.tokens < full.tokens / 2, "stopping after 2 nodes still visited %u tokens of %u",
+        early.tokens, full.tokens);
+  CHECK(early.end_calls == 1, "end called %u times after an early stop", early.end_calls);
+}
+
+static void test_index(const struct fdt_header *header) {
+  struct fdt_index index;
+  CHECK(fdt_index_build(&index, header) == 0, "the index cannot be built");
+  if (!index.n_nodes) {
+    return;
+  }
+  CHECK(index.n_nodes == TEST_NODES && index.n_props == TEST_PROPS, "%u nodes, %u properties", index.n_nodes,
+        index.n_props);
+
+  uint32_t root = fdt_index_find_path(&index, "/");
+  uint32_t intc = fdt_index_find_path(&index, "/intc@8000000");
+  uint32_t soc = fdt_index_find_path(&index, "/soc");
+  uint32_t uart = fdt_index_find_path(&index, "/soc/uart@9000000");
+  uint32_t virtio = fdt_index_find_path(&index, "/soc/virtio_mmio@a000000");
+  uint32_t memory = fdt_index_find_path(&index, "/memory@40000000");
+  CHECK(root == FDT_INDEX_ROOT, "/ is node %u", root);
+  CHECK(intc == 1 && soc == 2 && uart == 3 && virtio == 4 && memory == 6, "paths resolve to %u %u %u %u %u", intc,
+        soc, uart, virtio, memory);
+  CHECK(fdt_index_find_path(&index, "/uart@9000000") == FDT_INDEX_NONE, "a path skipping /soc resolves");
+  CHECK(fdt_index_find_path(&index, "/soc/uart") == FDT_INDEX_NONE, "a path without the unit address resolves");
+  CHECK(fdt_index_find_path(&index, "soc") == FDT_INDEX_NONE, "a relative path resolves");
+  CHECK(index.nodes[uart].parent == soc && index.nodes[soc].first_child == uart, "uart is not the first child of soc");
+  CHECK(index.nodes[uart].next_sibling == virtio, "the sibling of uart is %u", index.nodes[uart].next_sibling);
+
+  CHECK(fdt_index_find_phandle(&index, 1) == intc, "phandle 1 is node %u", fdt_index_find_phandle(&index, 1));
+  CHECK(fdt_index_find_phandle(&index, 2) == FDT_INDEX_NONE, "phandle 2 resolves");
+  CHECK(fdt_index_interrupt_parent(&index, uart) == intc, "the interrupt parent of uart is not inherited from soc");
+
+  // Every string of a list is indexed, equal strings are chained in DTB order
+  const struct fdt_index_compat *compat = fdt_index_find_compatible(&index, "arm,primecell");
+  CHECK(compat && compat->node == uart, "arm,primecell does not find uart");
+  compat = fdt_index_find_compatible(&index, "virtio,mmio");
+  CHECK(compat && compat->node == virtio, "virtio,mmio does not start at the first transport");
+  compat = compat ? fdt_index_next_compatible(&index, compat) : NULL;
+  CHECK(compat && compat->node == virtio + 1, "virtio,mmio does not chain to the second transport");
+  CHECK(!compat || !fdt_index_next_compatible(&index, compat), "virtio,mmio has a third entry");
+  CHECK(fdt_index_find_compatible(&index, "virtio") == NULL, "a prefix of a compatible string matches");
+
+  // Cell sizes come from the parent: 1/1 under /soc, 2/2 under /
+  uint64_t address = 0;
+  uint64_t size = 0;
+  CHECK(index.nodes[soc].address_cells == 1 && index.nodes[soc].size_cells == 1, "/soc has %u/%u cells",
+        index.nodes[soc].address_cells, index.nodes[soc].size_cells);
+  CHECK(fdt_index_reg(&index, uart, 0, &address, &size) == 0 && address == 0x09000000 && size == 0x1000,
+        "uart reg is %#lx+%#lx", address, size);
+  CHECK(fdt_index_reg(&index, uart, 1, &address, &size) != 0, "uart has a second reg tuple");
+  CHECK(fdt_index_reg(&index, memory, 0, &address, &size) == 0 && address == 0x40000000 && size == 0x08000000,
+        "memory reg is %#lx+%#lx", address, size);
+
+  const struct fdt_index_prop *prop = fdt_index_get_prop_id(&index, memory, FDT_PROP_ID_DEVICE_TYPE);
+  CHECK(prop && strcmp(prop->value, "memory") == 0, "memory has no device_type");
+  prop = fdt_index_get_prop(&index, virtio + 1, FDT_PROP_STATUS);
+  CHECK(prop && strcmp(prop->value, "disabled") == 0, "the second transport has no status");
+  CHECK(prop && strcmp(fdt_index_prop_name(&index, prop), FDT_PROP_STATUS) == 0, "the status property is misnamed");
+  CHECK(fdt_index_get_prop_id(&index, uart, FDT_PROP_ID_STATUS) == NULL, "uart has a status");
+  fdt_index_free(&index);
+}
+
+static void test_prop_ids() {
+  for (uint32_t id = 1; id < FDT_PROP_ID_COUNT; id++) {
+    const char *name = fdt_prop_names[id].name;
+    CHECK(fdt_prop_lookup(name) == id, "%s is id %u, expected %u", name, fdt_prop_lookup(name), id);
+  }
+  static const char *const unknown[] = { "", "re", "regs", "status2", "compatiblE", "linux,phandlE", "foo" };
+  for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++) {
+    CHECK(fdt_prop_lookup(unknown[i]) == FDT_PROP_ID_UNKNOWN, "\"%s\" is id %u", unknown[i],
+          fdt_prop_lookup(unknown[i]));
+  }
+  uint32_t cells[] = { __builtin_bswap32(0x12345678), __builtin_bswap32(0x9abcdef0) };
+  CHECK(fdt_read_cells(cells, 1) == 0x12345678, "one cell reads %#lx", fdt_read_cells(cells, 1));
+  CHECK(fdt_read_cells(cells, 2) == 0x123456789abcdef0UL, "two cells read %#lx", fdt_read_cells(cells, 2));
+}
+
+// A compatible list must end with a NUL: an unterminated tail is not indexed
+static void test_unterminated_compatible() {
+  static const char list[] = "kos,a\0kos,b";
+  dt_n_words = 0;
+  dt_strings_size = 0;
+  dt_begin("");
+  dt_prop(FDT_PROP_COMPATIBLE, list, sizeof(list) - 1);
+  dt_begin("dev");
+  dt_prop(FDT_PROP_COMPATIBLE, "kos,c", 5);
+  dt_end();
+  dt_end();
+  const struct fdt_header *header = dt_finish();
+
+  struct fdt_index index;
+  CHECK(fdt_index_build(&index, header) == 0, "the index cannot be built");
+  if (!index.n_nodes) {
+    return;
+  }
+  CHECK(index.n_compats == 1, "%u compatible strings indexed", index.n_compats);
+  CHECK(fdt_index_find_compatible(&index, "kos,a") != NULL, "kos,a is not indexed");
+  CHECK(fdt_index_find_compatible(&index, "kos,b") == NULL, "the unterminated kos,b is indexed");
+  CHECK(fdt_index_find_compatible(&index, "kos,c") == NULL, "the unterminated kos,c is indexed");
+  fdt_index_free(&index);
+}
+
+static void memmap_of(const struct fdt_header *header, struct memmap *map) {
+  struct memmap_dtb_data data;
+  struct fdt_visitor visitor = memmap_dtb_visitor(&data, map);
+  fdt_traverse_visitors(header, &visitor, 1);
+}
+
+// Children must not reset the state of their parent: a /memory node keeps its
+// bank and a disabled /reserved-memory keeps its regions out
+static void test_memmap_nesting() {
+  static const uint32_t bank[] = { 0, 0x40000000, 0, 0x10000000 };
+  static const uint32_t region[] = { 0, 0x48000000, 0, 0x100000 };
+  struct memmap map;
+  for (int disabled = 0; disabled < 2; disabled++) {
+    dt_n_words = 0;
+    dt_strings_size = 0;
+    dt_begin("");
+    dt_prop_u32(FDT_PROP_ADDRESS_CELLS, 2);
+    dt_prop_u32(FDT_PROP_SIZE_CELLS, 2);
+    dt_begin("memory@40000000");
+    dt_prop_string(FDT_PROP_DEVICE_TYPE, "memory");
+    dt_prop_cells(FDT_PROP_REG, bank, 4);
+    dt_prop_u32(FDT_PROP_NUMA_NODE_ID, 1);
+    dt_begin("cache");
+    dt_end();
+    dt_end();
+    dt_begin("reserved-memory");
+    dt_prop_u32(FDT_PROP_ADDRESS_CELLS, 2);
+    dt_prop_u32(FDT_PROP_SIZE_CELLS, 2);
+    if (disabled) {
+      dt_prop_string(FDT_PROP_STATUS, "disabled");
+    }
+    dt_begin("region@48000000");
+    dt_prop_cells(FDT_PROP_REG, region, 4);
+    dt_end();
+    dt_end();
+    dt_end();
+    memmap_of(dt_finish(), &map);
+
+    CHECK(map.n_banks == 1 && map.banks[0].start == 0x40000000 && map.banks[0].end == 0x50000000 &&
+          map.banks[0].node == 1, "%u banks, the first %#lx - %#lx on node %u", map.n_banks, map.banks[0].start,
+          map.banks[0].end, map.banks[0].node);
+    if (disabled) {
+      CHECK(map.n_reserved == 0, "%u ranges reserved under a disabled /reserved-memory", map.n_reserved);
+    } else {
+      CHECK(map.n_reserved == 1 && map.reserved[0].start == 0x48000000 && map.reserved[0].end == 0x48100000,
+            "%u ranges reserved, the first %#lx - %#lx", map.n_reserved, map.reserved[0].start, map.reserved[0].end);
+    }
+  }
+}
+
+int main() {
+  host_env_init(RAM_SIZE);
+  const struct fdt_header *header = build_blob();
+  test_traversal(header);
+  test_index(header);
+  test_prop_ids();
+  test_unterminated_compatible();
+  test_memmap_nesting();
+  return host_check_report("dtb_test");
+}
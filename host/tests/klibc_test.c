@@ -0,0 +1,256 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Randomized comparison of the klibc memory and string routines against
+// byte-at-a-time references, across sizes, alignments and page boundaries
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <kernel/klibc/stdlib.h>
+#include "host_env.h"
+
+#define BUF_SIZE 8192
+#define GUARD 64
+#define ROUNDS 5000
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15UL;
+
+static uint64_t rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Short sizes often, every size up to a few words, large ones sometimes
+static size_t random_size() {
+  switch (rng() % 4) {
+    case 0:
+      return rng() % 40;
+    case 1:
+      return rng() % 300;
+    case 2:
+      return rng() % 2048;
+    default:
+      return rng() % (BUF_SIZE - 2 * GUARD - 32);
+  }
+}
+
+static void fill_random(uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = (uint8_t) rng();
+  }
+}
+
+static int ref_memcmp(const uint8_t *a, const uint8_t *b, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (a[i] != b[i]) {
+      return a[i] - b[i];
+    }
+  }
+  return 0;
+}
+
+static int sign(int v) {
+  return (v > 0) - (v < 0);
+}
+
+static void test_memset() {
+  static uint8_t buf[BUF_SIZE], expected[BUF_SIZE];
+  for (int r = 0; r < ROUNDS; r++) {
+    size_t offset = GUARD + rng() % 16;
+    size_t len = random_size();
+    int c = (rng() % 4) ? (int) (rng() & 0xFF) : 0;
+    fill_random(buf, BUF_SIZE);
+    for (size_t i = 0; i < BUF_SIZE; i++) {
+      expected[i] = buf[i];
+    }
+    memset_reference(expected + offset, c, len);
+    void *ret = memset(buf + offset, c, len);
+    CHECK(ret == buf + offset, "memset returned %p", ret);
+    CHECK(ref_memcmp(buf, expected, BUF_SIZE) == 0, "memset offset %zu len %zu c %#x", offset, len, c);
+  }
+}
+
+static void test_memcpy() {
+  static uint8_t src[BUF_SIZE], dst[BUF_SIZE], expected[BUF_SIZE];
+  for (int r = 0; r < ROUNDS; r++) {
+    size_t src_offset = GUARD + rng() % 16;
+    size_t dst_offset = GUARD + rng() % 16;
+    size_t len = random_size();
+    fill_random(src, BUF_SIZE);
+    fill_random(dst, BUF_SIZE);
+    for (size_t i = 0; i < BUF_SIZE; i++) {
+      expected[i] = dst[i];
+    }
+    for (size_t i = 0; i < len; i++) {
+      expected[dst_offset + i] = src[src_offset + i];
+    }
+    void *ret = memcpy(dst + dst_offset, src + src_offset, len);
+    CHECK(ret == dst + dst_offset, "memcpy returned %p", ret);
+    CHECK(ref_memcmp(dst, expected, BUF_SIZE) == 0, "memcpy src +%zu dst +%zu len %zu", src_offset, dst_offset, len);
+  }
+}
+
+static void test_memmove() {
+  static uint8_t buf[BUF_SIZE], expected[BUF_SIZE], tmp[BUF_SIZE];
+  for (int r = 0; r < ROUNDS; r++) {
+    size_t len = random_size() / 2;
+    size_t src_offset = GUARD + rng() % (BUF_SIZE / 2 - GUARD);
+    // Overlapping both ways most of the time
+    size_t dst_offset = src_offset + (rng() % 64) - 32;
+    if (rng() % 4 == 0) {
+      dst_offset = GUARD + rng() % (BUF_SIZE / 2 - GUARD);
+    }
+    fill_random(buf, BUF_SIZE);
+    for (size_t i = 0; i < BUF_SIZE; i++) {
+      expected[i] = buf[i];
+    }
+    for (size_t i = 0; i < len; i++) {
+      tmp[i] = expected[src_offset + i];
+    }
+    for (size_t i = 0; i < len; i++) {
+      expected[dst_offset + i] = tmp[i];
+    }
+    void *ret = memmove(buf + dst_offset, buf + src_offset, len);
+    CHECK(ret == buf + dst_offset, "memmove returned %p", ret);
+    CHECK(ref_memcmp(buf, expected, BUF_SIZE) == 0, "memmove src +%zu dst +%zu len %zu", src_offset, dst_offset, len);
+  }
+}
+
+static void test_memcmp() {
+  static uint8_t a[BUF_SIZE], b[BUF_SIZE];
+  for (int r = 0; r < ROUNDS; r++) {
+    size_t a_offset = rng() % 16;
+    size_t b_offset = rng() % 16;
+    size_t len = random_size();
+    fill_random(a, BUF_SIZE);
+    for (size_t i = 0; i < len; i++) {
+      b[b_offset + i] = a[a_offset + i];
+    }
+    if (len && rng() % 2) {
+      b[b_offset + rng() % len] = (uint8_t) rng();
+    }
+    int expected = ref_memcmp(a + a_offset, b + b_offset, len);
+    int got = memcmp(a + a_offset, b + b_offset, len);
+    CHECK(sign(got) == sign(expected), "memcmp len %zu: %d, expected %d", len, got, expected);
+  }
+}
+
+// A string that ends right before an unmapped page: scanning past the
+// terminator by more than the aligned word would fault
+static void test_page_end(uint8_t *page, size_t page_size) {
+  for (size_t len = 0; len < 64; len++) {
+    char *s = (char *) page + page_size - len - 1;
+    for (size_t i = 0; i < len; i++) {
+      s[i] = 'a' + (char) (i % 26);
+    }
+    s[len] = '\0';
+    CHECK(strlen(s) == len, "strlen at page end, len %zu", len);
+    CHECK(strcmp(s, s) == 0, "strcmp at page end, len %zu", len);
+  }
+}
+
+static void test_strings() {
+  static char a[BUF_SIZE], b[BUF_SIZE];
+  for (int r = 0; r < ROUNDS; r++) {
+    size_t a_offset = rng() % 16;
+    size_t b_offset = rng() % 16;
+    size_t len = random_size() / 4;
+    for (size_t i = 0; i < len; i++) {
+      a[a_offset + i] = (char) (1 + rng() % 255);
+      b[b_offset + i] = a[a_offset + i];
+    }
+    a[a_offset + len] = '\0';
+    b[b_offset + len] = '\0';
+    if (rng() % 2) {
+      // Differ somewhere, possibly by ending early
+      size_t at = rng() % (len + 1);
+      b[b_offset + at] = (char) (rng() % 256);
+    }
+    CHECK(strlen(a + a_offset) == len, "strlen offset %zu len %zu", a_offset, len);
+
+    const uint8_t *p = (const uint8_t *) a + a_offset, *q = (const uint8_t *) b + b_offset;
+    while (*p && *p == *q) {
+      p++;
+      q++;
+    }
+    int expected = *p - *q;
+    int got = strcmp(a + a_offset, b + b_offset);
+    CHECK(sign(got) == sign(expected), "strcmp len %zu: %d, expected %d", len, got, expected);
+  }
+
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  uint8_t *pages = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(pages != MAP_FAILED, "mmap");
+  if (pages != MAP_FAILED) {
+    mprotect(pages + page_size, page_size, PROT_NONE);
+    test_page_end(pages, page_size);
+    munmap(pages, 2 * page_size);
+  }
+}
+
+static const char *ref_strstr(const char *haystack, const char *needle) {
+  size_t n = 0;
+  while (needle[n]) {
+    n++;
+  }
+  for (const char *h = haystack; ; h++) {
+    size_t i = 0;
+    while (i < n && h[i] == needle[i]) {
+      i++;
+    }
+    if (i == n) {
+      return h;
+    }
+    if (!*h) {
+      return NULL;
+    }
+  }
+}
+
+static void test_strstr() {
+  static char haystack[1024], needle[64];
+  for (int r = 0; r < ROUNDS; r++) {
+    // Small alphabets make periodic needles and partial matches common
+    uint32_t alphabet = 1 + rng() % 4;
+    size_t h_len = rng() % (sizeof(haystack) - 1);
+    size_t n_len = rng() % 12;
+    if (rng() % 8 == 0) {
+      n_len = rng() % (sizeof(needle) - 1);
+    }
+    for (size_t i = 0; i < h_len; i++) {
+      haystack[i] = (char) ('a' + rng() % alphabet);
+    }
+    haystack[h_len] = '\0';
+    if (n_len <= h_len && rng() % 2) {
+      // Taken from the haystack, so it matches
+      size_t at = rng() % (h_len - n_len + 1);
+      for (size_t i = 0; i < n_len; i++) {
+        needle[i] = haystack[at + i];
+      }
+    } else {
+      for (size_t i = 0; i < n_len; i++) {
+        needle[i] = (char) ('a' + rng() % alphabet);
+      }
+    }
+    needle[n_len] = '\0';
+    const char *expected = ref_strstr(haystack, needle);
+    const char *got = strstr(haystack, needle);
+    CHECK(got == expected, "strstr \"%s\" in %zu bytes: +%ld, expected +%ld", needle, h_len,
+          got ? (long) (got - haystack) : -1L, expected ? (long) (expected - haystack) : -1L);
+  }
+}
+
+int main() {
+  test_memset();
+  test_memcpy();
+  test_memmove();
+  test_memcmp();
+  test_strings();
+  test_strstr();
+  return host_check_report("klibc_test");
+}
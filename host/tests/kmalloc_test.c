@@ -0,0 +1,184 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// kmalloc on one core: alignment, zeroing, objects on page boundaries of
+// multi-page slabs, and random churn with a pattern
+// per object that catches overlapping or reused live objects
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/mm/page_alloc.h>
+#include "host_env.h"
+
+#define RAM_SIZE (64UL << 20)
+#define LIVE 4096
+#define OPS 200000
+#define BOUNDARY_OBJECTS 256
+
+struct object {
+  uint8_t *ptr;
+  size_t size;
+  uint8_t tag;
+};
+
+static struct object live[LIVE];
+static uint64_t rng_state = 0x2545F4914F6CDD1DUL;
+
+static uint64_t rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static size_t random_size() {
+  uint64_t r = rng() % 100;
+  if (r < 60) {
+    return 1 + rng() % 64;
+  } else if (r < 85) {
+    return 65 + rng() % 192;
+  } else if (r < 97) {
+    return 257 + rng() % 768;
+  }
+  return 1025 + rng() % (16 << 10);
+}
+
+static void object_fill(struct object *o) {
+  for (size_t i = 0; i < o->size; i++) {
+    o->ptr[i] = (uint8_t) (o->tag + i);
+  }
+}
+
+static int object_intact(const struct object *o) {
+  for (size_t i = 0; i < o->size; i++) {
+    if (o->ptr[i] != (uint8_t) (o->tag + i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void test_sizes() {
+  CHECK(kmalloc(0) == NULL, "kmalloc(0) is not NULL");
+  kfree(NULL);
+  for (size_t size = 1; size <= 20000; size += (size < 2048 ? 1 : 509)) {
+    uint8_t *p = kmalloc(size);
+    CHECK(p != NULL, "kmalloc(%zu) failed", size);
+    if (!p) {
+      continue;
+    }
+    CHECK(((uintptr_t) p & 15) == 0, "kmalloc(%zu) = %p is not 16-byte aligned", size, p);
+    if (size <= 1024) {
+      // Aligned to the size of their class
+      size_t align = 16;
+      while (align < size) {
+        align <<= 1;
+      }
+      CHECK(((uintptr_t) p & (align - 1)) == 0, "kmalloc(%zu) = %p is not %zu-byte aligned", size, p, align);
+    } else {
+      CHECK(((uintptr_t) p & (PAGE_SIZE - 1)) == 0, "kmalloc(%zu) = %p is not page aligned", size, p);
+    }
+    memset(p, 0xA5, size);
+    kfree(p);
+  }
+}
+
+static void test_kzalloc() {
+  // Dirty objects of every class, then ask for zeroed ones of the same sizes
+  static const size_t sizes[] = { 16, 24, 100, 256, 1000, 1024, 4096, 9000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    void *dirty[32];
+    for (int n = 0; n < 32; n++) {
+      dirty[n] = kmalloc(sizes[i]);
+      memset(dirty[n], 0xFF, sizes[i]);
+    }
+    for (int n = 0; n < 32; n++) {
+      kfree(dirty[n]);
+    }
+    for (int n = 0; n < 32; n++) {
+      uint8_t *p = kzalloc(sizes[i]);
+      CHECK(p != NULL, "kzalloc(%zu) failed", sizes[i]);
+      for (size_t b = 0; p && b < sizes[i]; b++) {
+        if (p[b]) {
+          CHECK(0, "kzalloc(%zu): byte %zu is %#x", sizes[i], b, p[b]);
+          break;
+        }
+      }
+      dirty[n] = p;
+    }
+    for (int n = 0; n < 32; n++) {
+      kfree(dirty[n]);
+    }
+  }
+}
+
+// Slabs of the largest class span several pages: objects starting on a page
+// boundary must go back to their slab, not to the page allocator
+static void test_page_boundaries() {
+  static void *objects[BOUNDARY_OBJECTS];
+  size_t after_first = 0;
+  for (int round = 0; round < 8; round++) {
+    size_t on_boundary = 0;
+    for (int i = 0; i < BOUNDARY_OBJECTS; i++) {
+      objects[i] = kmalloc(1024);
+      CHECK(objects[i] != NULL, "kmalloc(1024) failed");
+      on_boundary += objects[i] && ((uintptr_t) objects[i] & (PAGE_SIZE - 1)) == 0;
+    }
+    CHECK(on_boundary > 0, "none of %d objects of 1024 bytes starts a page", BOUNDARY_OBJECTS);
+    for (int i = 0; i < BOUNDARY_OBJECTS; i++) {
+      kfree(objects[i]);
+    }
+    if (round == 0) {
+      after_first = page_free_count();
+    }
+  }
+  CHECK(page_free_count() + 4 >= after_first, "%zu free pages after the last round, %zu after the first",
+        page_free_count(), after_first);
+}
+
+static void churn() {
+  for (uint32_t op = 0; op < OPS; op++) {
+    struct object *o = &live[rng() % LIVE];
+    if (o->ptr) {
+      CHECK(object_intact(o), "object of %zu bytes at %p was overwritten", o->size, o->ptr);
+      kfree(o->ptr);
+      o->ptr = NULL;
+    } else {
+      o->size = random_size();
+      o->tag = (uint8_t) rng();
+      o->ptr = kmalloc(o->size);
+      CHECK(o->ptr != NULL, "kmalloc(%zu) failed", o->size);
+      if (o->ptr) {
+        object_fill(o);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < LIVE; i++) {
+    if (live[i].ptr) {
+      CHECK(object_intact(&live[i]), "object of %zu bytes at %p was overwritten", live[i].size, live[i].ptr);
+      kfree(live[i].ptr);
+      live[i].ptr = NULL;
+    }
+  }
+}
+
+int main() {
+  host_env_init(RAM_SIZE);
+  // Slab path first, then through the magazines of a core
+  for (int pass = 0; pass < 2; pass++) {
+    host_cpu_id = pass ? 0 : UINT32_MAX;
+    test_sizes();
+    test_kzalloc();
+    test_page_boundaries();
+    churn();
+    size_t after_first = page_free_count();
+    churn();
+    // The same workload again must not need more memory
+    CHECK(page_free_count() + 16 >= after_first, "pass %d: %zu free pages after a churn, %zu before", pass,
+          page_free_count(), after_first);
+  }
+  return host_check_report("kmalloc_test");
+}
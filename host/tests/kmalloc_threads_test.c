@@ -0,0 +1,177 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// kmalloc with host threads playing the cores: objects allocated on one core
+// and freed on another, then running out of memory and recovering from it
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/mm/page_alloc.h>
+#include "host_env.h"
+
+#define RAM_SIZE (16UL << 20)
+#define PAIRS 2
+#define RING_SIZE 256
+#define OBJECTS_PER_PAIR 100000
+#define LARGE_SIZE (64UL << 10)
+#define MAX_LARGE ((RAM_SIZE / LARGE_SIZE) + 1)
+#define SMALL_SIZE 100
+
+// Single producer, single consumer
+struct ring {
+  void *objects[RING_SIZE];
+  uint32_t head; // Written by the consumer
+  uint32_t tail; // Written by the producer
+  uint32_t producer_cpu;
+  uint32_t consumer_cpu;
+  uint32_t seed;
+};
+
+static struct ring rings[PAIRS];
+
+static inline uint32_t rng_next(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// Every object starts with its size, the rest is a pattern derived from it
+static void object_fill(uint8_t *object, uint32_t size) {
+  memcpy(object, &size, sizeof(size));
+  for (uint32_t i = sizeof(size); i < size; i++) {
+    object[i] = (uint8_t) (size + i);
+  }
+}
+
+static int object_intact(const uint8_t *object) {
+  uint32_t size;
+  memcpy(&size, object, sizeof(size));
+  for (uint32_t i = sizeof(size); i < size; i++) {
+    if (object[i] != (uint8_t) (size + i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void *producer(void *arg) {
+  struct ring *ring = arg;
+  uint32_t state = ring->seed;
+  host_cpu_id = ring->producer_cpu;
+  for (uint32_t n = 0; n < OBJECTS_PER_PAIR; n++) {
+    uint32_t size = 8 + rng_next(&state) % 1500; // Small classes and a few large objects
+    uint8_t *object = kmalloc(size);
+    CHECK(object != NULL, "kmalloc(%u) failed on core %u", size, host_cpu_id);
+    if (!object) {
+      continue;
+    }
+    object_fill(object, size);
+    while (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+      sched_yield();
+    }
+    ring->objects[ring->tail % RING_SIZE] = object;
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  struct ring *ring = arg;
+  host_cpu_id = ring->consumer_cpu;
+  for (uint32_t n = 0; n < OBJECTS_PER_PAIR; n++) {
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head) {
+      sched_yield();
+    }
+    uint8_t *object = ring->objects[ring->head % RING_SIZE];
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    CHECK(object_intact(object), "object at %p was overwritten before core %u freed it", object, host_cpu_id);
+    kfree(object);
+  }
+  return NULL;
+}
+
+// Each pair allocates on one core and frees on another, the magazines of the
+// consumers fill up with objects of the producers and go through the depots
+static void test_cross_core_free() {
+  pthread_t threads[2 * PAIRS];
+  for (uint32_t p = 0; p < PAIRS; p++) {
+    rings[p] = (struct ring) { .producer_cpu = 2 * p, .consumer_cpu = 2 * p + 1, .seed = 0x9E3779B9u * (p + 1) };
+    pthread_create(&threads[2 * p], NULL, producer, &rings[p]);
+    pthread_create(&threads[2 * p + 1], NULL, consumer, &rings[p]);
+  }
+  for (uint32_t t = 0; t < 2 * PAIRS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+}
+
+static void *small_objects[RAM_SIZE / SMALL_SIZE];
+static void *large_objects[MAX_LARGE];
+
+static size_t fill_large() {
+  size_t n = 0;
+  while (n < MAX_LARGE && (large_objects[n] = kmalloc(LARGE_SIZE))) {
+    n++;
+  }
+  CHECK(n < MAX_LARGE, "more than %lu large objects fit in %lu bytes", MAX_LARGE, RAM_SIZE);
+  return n;
+}
+
+static void *free_small_objects(void *arg) {
+  size_t n = *(size_t *) arg;
+  host_cpu_id = 3;
+  for (size_t i = 0; i < n; i++) {
+    kfree(small_objects[i]);
+  }
+  return NULL;
+}
+
+// Exhausts memory with small objects, frees them on another core and expects the
+// page allocator to get their slabs back (through kmalloc_reclaim for the depots)
+static void test_out_of_memory() {
+  host_cpu_id = 2;
+  size_t n_large = fill_large();
+  CHECK(n_large > 0, "no large object fits");
+  for (size_t i = 0; i < n_large; i++) {
+    kfree(large_objects[i]);
+  }
+
+  size_t n_small = 0;
+  while (n_small < sizeof(small_objects) / sizeof(small_objects[0]) && (small_objects[n_small] = kmalloc(SMALL_SIZE))) {
+    memset(small_objects[n_small], 0x5A, SMALL_SIZE);
+    n_small++;
+  }
+  CHECK(kmalloc(SMALL_SIZE) == NULL, "kmalloc succeeded once memory was exhausted");
+  CHECK(kmalloc(LARGE_SIZE) == NULL, "a large kmalloc succeeded once memory was exhausted");
+  CHECK(n_small * SMALL_SIZE > RAM_SIZE / 2, "only %zu small objects fit", n_small);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, free_small_objects, &n_small);
+  pthread_join(thread, NULL);
+
+  // Magazines of cores 2 and 3 may still pin a few slabs
+  size_t n_recovered = fill_large();
+  CHECK(n_recovered + n_large / 10 >= n_large, "%zu large objects fit after the small ones were freed, %zu before",
+        n_recovered, n_large);
+  for (size_t i = 0; i < n_recovered; i++) {
+    kfree(large_objects[i]);
+  }
+  printf("kmalloc_threads_test: %zu small objects before running out, %zu/%zu large objects after\n", n_small,
+         n_recovered, n_large);
+}
+
+int main() {
+  host_env_init(RAM_SIZE);
+  test_cross_core_free();
+  size_t after_first = page_free_count();
+  test_cross_core_free();
+  CHECK(page_free_count() + 64 >= after_first, "%zu free pages after a second round, %zu after the first",
+        page_free_count(), after_first);
+  test_out_of_memory();
+  return host_check_report("kmalloc_threads_test");
+}
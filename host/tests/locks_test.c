@@ -0,0 +1,174 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Ticket spinlock, MCS lock and rwlock with host threads playing the cores:
+// mutual exclusion of every lock, and a waiting writer keeping new readers out
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/sync/mcs.h>
+#include <kernel/sync/rwlock.h>
+#include <kernel/sync/spinlock.h>
+#include "host_env.h"
+
+#define THREADS 4
+#define ITERATIONS 20000
+#define YIELD_EVERY 64 // Holders are also preempted inside the critical section
+
+enum lock_kind {
+  LOCK_SPIN,
+  LOCK_MCS,
+  LOCK_RWLOCK
+};
+
+static struct spinlock spin = SPINLOCK_INIT("test spin");
+static struct mcs_lock mcs = MCS_LOCK_INIT("test mcs");
+static struct rwlock rw = RWLOCK_INIT("test rwlock");
+
+// Guarded by the lock under test: the increments are deliberately not atomic,
+// and writers keep first == second outside the critical section
+static volatile uint64_t counter;
+static volatile uint64_t first;
+static volatile uint64_t second;
+static uint32_t inside; // Holders (or writers) in the critical section, atomic
+
+struct worker {
+  enum lock_kind kind;
+  uint32_t cpu;
+};
+
+static void critical_section(uint32_t i) {
+  CHECK(__atomic_fetch_add(&inside, 1, __ATOMIC_RELAXED) == 0, "two holders in the critical section");
+  first = first + 1;
+  if (i % YIELD_EVERY == 0) {
+    sched_yield();
+  }
+  counter = counter + 1;
+  second = second + 1;
+  __atomic_fetch_sub(&inside, 1, __ATOMIC_RELAXED);
+}
+
+// Readers only look: they must never see a writer or half of an update
+static void read_section(uint32_t i) {
+  CHECK(__atomic_load_n(&inside, __ATOMIC_RELAXED) == 0, "a reader runs with a writer");
+  uint64_t a = first;
+  if (i % YIELD_EVERY == 0) {
+    sched_yield();
+  }
+  CHECK(a == second, "a reader sees %lu then %lu", a, second);
+}
+
+static void *worker(void *arg) {
+  struct worker *w = arg;
+  host_cpu_id = w->cpu;
+  for (uint32_t i = 0; i < ITERATIONS; i++) {
+    switch (w->kind) {
+      case LOCK_SPIN:
+        spin_lock(&spin);
+        critical_section(i);
+        spin_unlock(&spin);
+        break;
+      case LOCK_MCS: {
+        struct mcs_node node;
+        mcs_lock(&mcs, &node);
+        critical_section(i);
+        mcs_unlock(&mcs, &node);
+        break;
+      }
+      case LOCK_RWLOCK:
+        // One writer for every three reads on odd cores
+        if (w->cpu % 2 == 0 || i % 4 == 0) {
+          rwlock_write_lock(&rw);
+          critical_section(i);
+          rwlock_write_unlock(&rw);
+        } else {
+          rwlock_read_lock(&rw);
+          read_section(i);
+          rwlock_read_unlock(&rw);
+        }
+        break;
+    }
+  }
+  return NULL;
+}
+
+static void test_mutual_exclusion(enum lock_kind kind, const char *name) {
+  pthread_t threads[THREADS];
+  struct worker workers[THREADS];
+  counter = first = second = 0;
+  for (uint32_t t = 0; t < THREADS; t++) {
+    workers[t] = (struct worker) { .kind = kind, .cpu = t };
+    pthread_create(&threads[t], NULL, worker, &workers[t]);
+  }
+  for (uint32_t t = 0; t < THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  uint64_t expected = (uint64_t) THREADS * ITERATIONS;
+  if (kind == LOCK_RWLOCK) {
+    // Even cores always write, odd ones every fourth iteration
+    expected = (uint64_t) (THREADS / 2) * ITERATIONS + (uint64_t) (THREADS / 2) * (ITERATIONS / 4);
+  }
+  CHECK(counter == expected && first == expected && second == expected, "%s: %lu increments, expected %lu", name,
+        counter, expected);
+}
+
+static uint32_t order; // Next acquisition number
+static uint32_t writer_order;
+static uint32_t reader_order;
+
+static void *late_writer(void *arg) {
+  host_cpu_id = 1;
+  rwlock_write_lock(&rw);
+  writer_order = __atomic_add_fetch(&order, 1, __ATOMIC_RELAXED);
+  rwlock_write_unlock(&rw);
+  return NULL;
+}
+
+static void *late_reader(void *arg) {
+  host_cpu_id = 2;
+  rwlock_read_lock(&rw);
+  reader_order = __atomic_add_fetch(&order, 1, __ATOMIC_RELAXED);
+  rwlock_read_unlock(&rw);
+  return NULL;
+}
+
+// A reader holds the lock, a writer waits for it: a reader arriving after the
+// writer must wait too, and get the lock only after the writer had it
+static void test_writer_blocks_readers() {
+  host_cpu_id = 0;
+  rwlock_init(&rw, "test rwlock");
+  rwlock_read_lock(&rw);
+
+  pthread_t writer, reader;
+  pthread_create(&writer, NULL, late_writer, NULL);
+  while (!(__atomic_load_n(&rw.value, __ATOMIC_RELAXED) & RWLOCK_WRITER_WAITING)) {
+    sched_yield();
+  }
+  pthread_create(&reader, NULL, late_reader, NULL);
+  for (uint32_t i = 0; i < 1000; i++) {
+    sched_yield();
+  }
+  CHECK(__atomic_load_n(&order, __ATOMIC_RELAXED) == 0, "the lock was taken while the first reader held it");
+  CHECK((__atomic_load_n(&rw.value, __ATOMIC_RELAXED) & RWLOCK_READERS_MASK) == 1,
+        "%u readers hold the lock behind a waiting writer", rw.value & RWLOCK_READERS_MASK);
+
+  rwlock_read_unlock(&rw);
+  pthread_join(writer, NULL);
+  pthread_join(reader, NULL);
+  CHECK(writer_order == 1 && reader_order == 2, "the writer got the lock %u-th, the late reader %u-th", writer_order,
+        reader_order);
+  CHECK(rw.value == 0, "the lock word is %#x once every holder is gone", rw.value);
+}
+
+int main() {
+  test_mutual_exclusion(LOCK_SPIN, "spinlock");
+  test_mutual_exclusion(LOCK_MCS, "mcs");
+  test_mutual_exclusion(LOCK_RWLOCK, "rwlock");
+  test_writer_blocks_readers();
+  return host_check_report("locks_test");
+}
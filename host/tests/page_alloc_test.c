@@ -0,0 +1,120 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Buddy allocator: blocks of every order, coalescing back to the initial
+// state, block owners, and frees that must be refused without corrupting the
+// free lists
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/mm/page_alloc.h>
+#include "host_env.h"
+
+#define RAM_SIZE (16UL << 20)
+
+static void test_orders() {
+  size_t initial = page_free_count();
+  void *blocks[PAGE_MAX_ORDER + 1];
+  for (unsigned int order = 0; order <= PAGE_MAX_ORDER; order++) {
+    blocks[order] = page_alloc(order);
+    CHECK(blocks[order] != NULL, "page_alloc(%u) failed", order);
+    CHECK(((uintptr_t) blocks[order] & ((PAGE_SIZE << order) - 1)) == 0, "block of order %u at %p is misaligned",
+          order, blocks[order]);
+    CHECK(page_order(blocks[order]) == order, "block of order %u reports order %u", order,
+          page_order(blocks[order]));
+  }
+  for (unsigned int order = 0; order <= PAGE_MAX_ORDER; order++) {
+    page_free(blocks[order]);
+  }
+  CHECK(page_free_count() == initial, "%zu free pages after freeing every block, %zu before", page_free_count(),
+        initial);
+}
+
+// Any address of a block leads to its owner, and freed pages forget it
+static void test_owner() {
+  uint8_t *block = page_alloc(2);
+  CHECK(block && page_owner(block) == NULL, "a new block has the owner %p", block ? page_owner(block) : NULL);
+  if (!block) {
+    return;
+  }
+  page_set_owner(block, &block);
+  for (size_t offset = 0; offset < (PAGE_SIZE << 2); offset += PAGE_SIZE / 2) {
+    CHECK(page_owner(block + offset) == &block, "offset %#zx of the block has the owner %p", offset,
+          page_owner(block + offset));
+  }
+  page_free(block);
+
+  // The same pages, reallocated as single pages, have no owner
+  uint8_t *pages[4];
+  for (int i = 0; i < 4; i++) {
+    pages[i] = page_alloc(0);
+  }
+  for (int i = 0; i < 4; i++) {
+    CHECK(page_owner(block + i * PAGE_SIZE) == NULL, "page %d of a freed block keeps its owner", i);
+  }
+  for (int i = 0; i < 4; i++) {
+    page_free(pages[i]);
+  }
+}
+
+// Every refused free leaves the count alone, and the memory can still be
+// allocated in full without handing out a page twice
+static void test_invalid_frees() {
+  size_t initial = page_free_count();
+
+  uint8_t *page = page_alloc(0);
+  page_free(page);
+  page_free(page);
+  CHECK(page_free_count() == initial, "a double free changed the count: %zu, expected %zu", page_free_count(), initial);
+
+  uint8_t *block = page_alloc(2);
+  page_free(block + PAGE_SIZE);
+  page_free(block + 3 * PAGE_SIZE);
+  page_free(block + 16);
+  CHECK(page_free_count() == initial - 4, "a free inside a block changed the count: %zu, expected %zu",
+        page_free_count(), initial - 4);
+  page_free(block);
+
+  // A block coalesced with its buddy: the old head of the buddy is no head anymore
+  uint8_t *pair = page_alloc(1);
+  page_free(pair);
+  uint8_t *low = page_alloc(0);
+  uint8_t *high = page_alloc(0);
+  page_free(low);
+  page_free(high);
+  page_free(high);
+  page_free(low);
+  CHECK(page_free_count() == initial, "frees of coalesced pages changed the count: %zu, expected %zu",
+        page_free_count(), initial);
+
+  // Drain the allocator page by page: any corruption hands out a page twice
+  size_t n = 0;
+  uint8_t **pages = malloc(initial * sizeof(uint8_t *));
+  while (n < initial && (pages[n] = page_alloc(0))) {
+    *(size_t *) pages[n] = n;
+    n++;
+  }
+  CHECK(n == initial, "%zu pages allocated, %zu were free", n, initial);
+  CHECK(page_alloc(0) == NULL, "a page was allocated past the free count");
+  for (size_t i = 0; i < n; i++) {
+    if (*(size_t *) pages[i] != i) {
+      CHECK(0, "page %p was handed out twice", pages[i]);
+      break;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    page_free(pages[i]);
+  }
+  free(pages);
+  CHECK(page_free_count() == initial, "%zu free pages after the drain, %zu before", page_free_count(), initial);
+}
+
+int main() {
+  host_env_init(RAM_SIZE);
+  test_orders();
+  test_owner();
+  test_invalid_frees();
+  return host_check_report("page_alloc_test");
+}
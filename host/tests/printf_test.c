@@ -0,0 +1,101 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// ksnprintf against the output C99 specifies: integer edge values, pointers,
+// alternate forms, * width and precision, truncation and its return value
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kernel/klibc/stdlib.h>
+#include "host_env.h"
+
+#define OUT_SIZE 128
+
+// Formats into a large buffer and compares both the text and the length
+#define EXPECT(expected, fmt, ...)                                                                  \
+  do {                                                                                              \
+    char out[OUT_SIZE];                                                                             \
+    int len = ksnprintf(out, sizeof(out), fmt, ##__VA_ARGS__);                                      \
+    CHECK(strcmp(out, expected) == 0 && len == (int) strlen(expected), "\"%s\" gives \"%s\" (%d), " \
+          "expected \"%s\"", fmt, out, len, expected);                                              \
+  } while (0)
+
+static void test_integers() {
+  EXPECT("0", "%d", 0);
+  EXPECT("10", "%d", 10);
+  EXPECT("100", "%u", 100);
+  EXPECT("-7", "%i", -7);
+  EXPECT("18446744073709551615", "%lu", UINT64_MAX);
+  EXPECT("-9223372036854775808", "%ld", INT64_MIN);
+  EXPECT("9223372036854775807", "%lld", (long long) INT64_MAX);
+  EXPECT("4294967295", "%u", UINT32_MAX);
+  EXPECT("-2147483648", "%d", INT32_MIN);
+  EXPECT("ffffffffffffffff", "%lx", UINT64_MAX);
+  EXPECT("1777777777777777777777", "%lo", UINT64_MAX);
+  EXPECT("-1 255 65535", "%hhd %hhu %hu", 255, 255, -1);
+  EXPECT("42 42", "%zu %jd", (size_t) 42, (intmax_t) 42);
+  EXPECT("+5 -5  5", "%+d %+d % d", 5, -5, 5);
+}
+
+static void test_alternate_forms() {
+  EXPECT("0x1f 0X1F 0", "%#x %#X %#x", 0x1f, 0x1f, 0);
+  EXPECT("017 0", "%#o %#o", 017, 0);
+  EXPECT("0017", "%#.4o", 017);
+  EXPECT("0x00ff", "%#06x", 0xff);
+  EXPECT("0x1000", "%p", (void *) 0x1000);
+  EXPECT("0xffff000000080000", "%p", (void *) 0xffff000000080000UL);
+  EXPECT("    0x1000", "%10p", (void *) 0x1000);
+  EXPECT("0x1000    |", "%-10p|", (void *) 0x1000);
+}
+
+static void test_width_precision() {
+  EXPECT("   42", "%5d", 42);
+  EXPECT("42   |", "%-5d|", 42);
+  EXPECT("00042", "%05d", 42);
+  EXPECT("-0042", "%05d", -42);
+  EXPECT("  042", "%5.3d", 42);
+  EXPECT("", "%.0d", 0);
+  EXPECT("   42", "%*d", 5, 42);
+  EXPECT("42   |", "%*d|", -5, 42);
+  EXPECT("00042", "%.*d", 5, 42);
+  EXPECT("42", "%.*d", -1, 42);
+  EXPECT("  00042", "%*.*d", 7, 5, 42);
+  EXPECT("  abc", "%5s", "abc");
+  EXPECT("ab", "%.2s", "abc");
+  EXPECT("ab   |", "%-*.*s|", 5, 2, "abc");
+  EXPECT("(null)", "%s", (char *) NULL);
+  EXPECT("  x|x  ", "%3c|%-3c", 'x', 'x');
+  EXPECT("100%", "%d%%", 100);
+}
+
+// snprintf semantics: output stops at size - 1, the return value is the length
+// the whole output would have had
+static void test_truncation() {
+  char out[8];
+  memset(out, '#', sizeof(out));
+  int len = ksnprintf(out, 4, "%d", 123456);
+  CHECK(len == 6 && strcmp(out, "123") == 0 && out[4] == '#', "\"%%d\" into 4 bytes gives \"%s\" (%d)", out, len);
+
+  memset(out, '#', sizeof(out));
+  len = ksnprintf(out, 1, "%s", "abc");
+  CHECK(len == 3 && out[0] == '\0' && out[1] == '#', "\"%%s\" into 1 byte gives \"%s\" (%d)", out, len);
+
+  out[0] = '#';
+  len = ksnprintf(out, 0, "%lu", UINT64_MAX);
+  CHECK(len == 20 && out[0] == '#', "a 0 byte buffer is written, or %d is returned", len);
+
+  len = ksnprintf(NULL, 0, "%#x-%s", 0xabc, "tail");
+  CHECK(len == 10, "measuring with a NULL buffer returns %d", len);
+
+  len = ksnprintf(out, sizeof(out), "%20d", 1);
+  CHECK(len == 20 && strlen(out) == sizeof(out) - 1, "padding is truncated to %zu bytes (%d)", strlen(out), len);
+}
+
+int main() {
+  test_integers();
+  test_alternate_forms();
+  test_width_precision();
+  test_truncation();
+  return host_check_report("printf_test");
+}
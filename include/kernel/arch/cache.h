@@ -0,0 +1,64 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/sysreg.h>
+
+/**
+ * Returns the smallest data cache line size (CTR_EL0.DminLine)
+ */
+static inline size_t dcache_line_size() {
+  return 4UL << ((read_sysreg(ctr_el0) >> 16) & 0xF);
+}
+
+/**
+ * Cleans a memory region to the point of coherency, so observers with the
+ * MMU or caches off (secondary cores, DMA) see the latest data
+ * @param addr the start of the region
+ * @param size the size of the region
+ */
+static inline void dcache_clean_range(const void *addr, size_t size) {
+  size_t line = dcache_line_size();
+  uintptr_t p = (uintptr_t) addr & ~(line - 1);
+  uintptr_t end = (uintptr_t) addr + size;
+  for (; p < end; p += line) {
+    __asm__ volatile("dc cvac, %0" : : "r"(p) : "memory");
+  }
+  dsb(sy);
+}
+
+/**
+ * Cleans and invalidates a memory region to the point of coherency
+ * @param addr the start of the region
+ * @param size the size of the region
+ */
+static inline void dcache_clean_inval_range(const void *addr, size_t size) {
+  size_t line = dcache_line_size();
+  uintptr_t p = (uintptr_t) addr & ~(line - 1);
+  uintptr_t end = (uintptr_t) addr + size;
+  for (; p < end; p += line) {
+    __asm__ volatile("dc civac, %0" : : "r"(p) : "memory");
+  }
+  dsb(sy);
+}
+
+/**
+ * Invalidates a memory region to the point of coherency, discarding any
+ * cached copy, so that cacheable reads see what was written with the MMU or
+ * caches off. Dirty lines are lost: only for regions nobody wrote through the cache.
+ * @param addr the start of the region
+ * @param size the size of the region
+ */
+static inline void dcache_inval_range(const void *addr, size_t size) {
+  size_t line = dcache_line_size();
+  uintptr_t p = (uintptr_t) addr & ~(line - 1);
+  uintptr_t end = (uintptr_t) addr + size;
+  for (; p < end; p += line) {
+    __asm__ volatile("dc ivac, %0" : : "r"(p) : "memory");
+  }
+  dsb(sy);
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// ESR_EL1 exception classes
+#define ESR_EC_SHIFT 26
+#define ESR_EC_MASK 0x3F
+#define ESR_EC_UNKNOWN 0x00
+#define ESR_EC_FP_ASIMD 0x07
+#define ESR_EC_SVC64 0x15
+#define ESR_EC_IABT_CUR 0x21
+#define ESR_EC_DABT_CUR 0x25
+#define ESR_EC_BRK64 0x3C
+
+#define ESR_EC(esr) (((esr) >> ESR_EC_SHIFT) & ESR_EC_MASK)
+
+// Vector table entries (see vectors.s)
+#define EXCEPTION_SYNC 0
+#define EXCEPTION_IRQ 1
+#define EXCEPTION_FIQ 2
+#define EXCEPTION_SERROR 3
+
+/**
+ * Registers saved on exception entry (offsets are used from vectors.s)
+ */
+struct exception_frame {
+  uint64_t x[31];
+  uint64_t elr;
+  uint64_t spsr;
+  uint64_t esr;
+};
+
+/**
+ * Registers saved on IRQ entry: only the ones a C function may clobber
+ * (offsets are used from vectors.s)
+ */
+struct irq_frame {
+  uint64_t x[19];
+  uint64_t lr;
+  uint64_t elr;
+  uint64_t spsr;
+};
+
+/**
+ * Synchronous exception taken from EL1
+ * @param frame the saved registers
+ */
+void exception_sync(struct exception_frame *frame);
+
+/**
+ * Any exception without a handler, prints the state and halts the core
+ * @param frame the saved registers
+ * @param type the kind of exception (EXCEPTION_*)
+ */
+void exception_unhandled(struct exception_frame *frame, uint64_t type);
+
+/* Vector table (see vectors.s) */
+extern char __exception_vectors[];
@@ -0,0 +1,55 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// CPACR_EL1.FPEN
+#define CPACR_FPEN_SHIFT 20
+#define CPACR_FPEN_MASK (3UL << CPACR_FPEN_SHIFT)
+#define CPACR_FPEN_TRAP (0UL << CPACR_FPEN_SHIFT)
+#define CPACR_FPEN_ENABLE (3UL << CPACR_FPEN_SHIFT)
+
+#define FPSIMD_NO_CPU 0xFFFFFFFF
+
+struct kthread;
+
+/**
+ * V0-V31, FPSR and FPCR (offsets are used from fpsimd_regs.s)
+ */
+struct fpsimd_state {
+  __uint128_t v[32];
+  uint32_t fpsr;
+  uint32_t fpcr;
+} __attribute__((aligned(16)));
+
+/**
+ * Makes the first FP/SIMD access of the calling core trap, so the registers
+ * are only saved and restored for threads that use them
+ */
+void fpsimd_init();
+
+/**
+ * Handles the FP/SIMD access trap: loads the state of the current thread and
+ * gives it access to the registers
+ */
+void fpsimd_trap();
+
+/**
+ * Saves the registers of a thread that used them while it was running
+ * @param thread the thread that is being switched out
+ */
+void fpsimd_switch_out(struct kthread *thread);
+
+/**
+ * Grants register access right away when the core still holds the state of
+ * the thread, otherwise arms the trap
+ * @param thread the thread that is being switched in
+ */
+void fpsimd_switch_in(struct kthread *thread);
+
+/* Register save/restore (see fpsimd_regs.s) */
+void __fpsimd_save(struct fpsimd_state *state);
+void __fpsimd_load(struct fpsimd_state *state);
@@ -0,0 +1,132 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/system_info.h>
+
+// 4 KiB granule, 39 bit virtual addresses: translation starts at level 1
+#define MMU_VA_BITS 39
+#define MMU_L1_BLOCK_SHIFT 30 // 1 GiB
+#define MMU_L2_BLOCK_SHIFT 21 // 2 MiB
+#define MMU_L1_BLOCK_SIZE (1UL << MMU_L1_BLOCK_SHIFT)
+#define MMU_L2_BLOCK_SIZE (1UL << MMU_L2_BLOCK_SHIFT)
+#define MMU_TABLE_ENTRIES 512
+#define MMU_MAX_L2_TABLES 16
+
+// Descriptor bits
+#define MMU_DESC_VALID (1UL << 0)
+#define MMU_DESC_TABLE (1UL << 1)
+#define MMU_DESC_BLOCK (0UL << 1)
+#define MMU_DESC_ATTR(index) ((uint64_t) (index) << 2)
+#define MMU_DESC_SH_INNER (3UL << 8)
+#define MMU_DESC_AF (1UL << 10)
+#define MMU_DESC_PXN (1UL << 53)
+#define MMU_DESC_UXN (1UL << 54)
+#define MMU_DESC_ADDR_MASK 0x0000FFFFFFFFF000UL
+
+// MAIR_EL1 attribute indexes
+#define MMU_ATTR_DEVICE_nGnRnE 0
+#define MMU_ATTR_NORMAL 1
+#define MMU_ATTR_NORMAL_NC 2
+#define MMU_MAIR_VALUE ((0x00UL << (8 * MMU_ATTR_DEVICE_nGnRnE)) | \
+                        (0xFFUL << (8 * MMU_ATTR_NORMAL)) |        \
+                        (0x44UL << (8 * MMU_ATTR_NORMAL_NC)))
+
+// TCR_EL1 fields
+#define TCR_T0SZ(bits) ((64UL - (bits)) << 0)
+#define TCR_IRGN0_WBWA (1UL << 8)
+#define TCR_ORGN0_WBWA (1UL << 10)
+#define TCR_SH0_INNER (3UL << 12)
+#define TCR_TG0_4K (0UL << 14)
+#define TCR_EPD1 (1UL << 23)
+#define TCR_IPS_SHIFT 32
+
+// SCTLR_EL1 fields
+#define SCTLR_M (1UL << 0)
+#define SCTLR_C (1UL << 2)
+#define SCTLR_I (1UL << 12)
+
+enum mmu_memory_type {
+  MMU_MEMORY_NORMAL,
+  MMU_MEMORY_NORMAL_NC,
+  MMU_MEMORY_DEVICE
+};
+
+/**
+ * System register values loaded by __mmu_enable (offsets are used from boot.s)
+ */
+struct mmu_config {
+  uint64_t mair;
+  uint64_t tcr;
+  uint64_t ttbr0;
+  uint64_t sctlr;
+};
+
+struct mmu_dtb_data {
+  uint32_t depth;
+  uint32_t address_cells;
+  uint32_t size_cells;
+  // Node below the root being read, mapped at its end
+  uint8_t is_memory; // device_type = "memory"
+  const void *reg;
+  uint32_t reg_len;
+};
+
+/**
+ * Configuration loaded by every core, NULL while the MMU stays off
+ */
+extern struct mmu_config *mmu_boot_config;
+
+/**
+ * Builds the boot identity map: the first GiB (MMIO on QEMU virt) as device
+ * memory and the 2 MiB blocks holding the DTB and the kernel image as normal
+ * cacheable memory. Runs with the MMU off, before __kos_main.
+ * @return the register values to be loaded by __mmu_enable or NULL if the MMU stays off
+ */
+struct mmu_config *mmu_early_init();
+
+/**
+ * Programs MAIR/TCR/TTBR0 and enables SCTLR_EL1.M/C/I (see boot.s)
+ * @param config the register values, nothing is done if NULL
+ */
+void __mmu_enable(struct mmu_config *config);
+
+/**
+ * Identity maps a physical range using 1 GiB / 2 MiB blocks. Ranges that are
+ * already mapped are left untouched.
+ * @param pa the physical address
+ * @param size the size of the range
+ * @param type the memory type
+ * @return 0 on success, -1 if the range cannot be mapped
+ */
+int mmu_map(pa_address pa, size_t size, enum mmu_memory_type type);
+
+/**
+ * Identity maps every RAM bank as normal cacheable memory
+ * @param map the memory map
+ */
+void mmu_map_ram(const struct memmap *map);
+
+/**
+ * Identity maps every MMIO region described by the device tree as device memory
+ * @param header the device tree blob header
+ */
+void mmu_map_devices(const struct fdt_header *header);
+
+/**
+ * Same as mmu_map_devices, as a visitor that can share a walk with others
+ * @param data the visitor data
+ * @return the visitor
+ */
+struct fdt_visitor mmu_devices_visitor(struct mmu_dtb_data *data);
+
+/* MMU DTB functions */
+void fdt_mmu_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name);
+void fdt_mmu_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token);
+void fdt_mmu_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value);
@@ -0,0 +1,19 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// PMCR_EL0
+#define PMCR_E (1 << 0) // Enable
+#define PMCR_P (1 << 1) // Reset the event counters
+#define PMCR_N_SHIFT 11
+#define PMCR_N_MASK 0x1F
+
+#define PMCNTEN_C (1U << 31) // Cycle counter, event counter n is bit n
+
+// Common architectural events, PMCEID0_EL0 tells which ones a core implements
+#define PMU_EVENT_L1D_CACHE_REFILL 0x03
+#define PMU_EVENT_L1D_TLB_REFILL 0x05
+#define PMU_EVENT_INST_RETIRED 0x08
+#define PMU_EVENT_CPU_CYCLES 0x11
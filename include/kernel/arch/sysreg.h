@@ -0,0 +1,41 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#define read_sysreg(reg) ({                          \
+  uint64_t __val;                                    \
+  __asm__ volatile("mrs %0, " #reg : "=r"(__val));   \
+  __val;                                             \
+})
+
+#define write_sysreg(reg, val) \
+  __asm__ volatile("msr " #reg ", %0" : : "r"((uint64_t) (val)))
+
+#define isb() __asm__ volatile("isb" : : : "memory")
+#define dsb(opt) __asm__ volatile("dsb " #opt : : : "memory")
+#define dmb(opt) __asm__ volatile("dmb " #opt : : : "memory")
+#define wfe() __asm__ volatile("wfe" : : : "memory")
+#define sev() __asm__ volatile("sev" : : : "memory")
+
+// Masks IRQs on the calling core, returns the previous DAIF to be restored
+static inline uint64_t local_irq_save() {
+  uint64_t flags = read_sysreg(daif);
+  __asm__ volatile("msr daifset, #2" : : : "memory");
+  return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+  __asm__ volatile("msr daif, %0" : : "r"(flags) : "memory");
+}
+
+static inline void local_irq_enable() {
+  __asm__ volatile("msr daifclr, #2" : : : "memory");
+}
+
+static inline void local_irq_disable() {
+  __asm__ volatile("msr daifset, #2" : : : "memory");
+}
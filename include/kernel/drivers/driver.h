@@ -0,0 +1,83 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/dtb/dtb_index.h>
+
+#define DEVICE_PENDING 0
+#define DEVICE_PROBING 1
+#define DEVICE_BOUND 2
+#define DEVICE_FAILED 3
+#define DEVICE_ABSENT 4 // The node has nothing for its driver, not an error
+
+// Returned by a probe function when the node turns out to have no device for
+// its driver (e.g. an empty virtio-mmio transport)
+#define DRIVER_NO_DEVICE 1
+
+#define DRIVER_MATCH_SLOTS 128
+
+/**
+ * One compatible string handled by a driver, data is handed to the probe
+ * function through device.match
+ */
+struct driver_match {
+  const char *compatible;
+  const void *data;
+};
+
+struct device;
+
+struct driver {
+  const char *name;
+  const struct driver_match *matches; // Terminated by an entry with a NULL compatible
+  int (*probe)(struct device *dev);
+};
+
+/**
+ * A device tree node bound to a driver
+ */
+struct device {
+  const struct fdt_index *index;
+  uint32_t node;
+  uint32_t depends_on; // Device probed first (its interrupt parent) or FDT_INDEX_NONE
+  const struct driver *driver;
+  const struct driver_match *match;
+  void *priv;
+  volatile uint32_t state;
+  int result;
+};
+
+/**
+ * Registers a driver: a pointer to it is placed in the .drivers section (see
+ * main.ld), so drivers need no central list
+ */
+#define DRIVER_REGISTER(drv)                                               \
+  static const struct driver *const __driver_##drv                         \
+      __attribute__((used, section(".drivers"), aligned(sizeof(void *)))) = &drv
+
+/**
+ * Matches every enabled node of the index against the registered drivers and
+ * probes them. A node is bound to the driver of the first (most specific)
+ * string of its compatible list that has one. Devices are probed in waves of
+ * kernel threads, a device only waits for its interrupt parent.
+ * Must run in thread context, after sched_init.
+ * @param index the device tree index
+ * @return the number of devices bound
+ */
+uint32_t driver_probe_all(const struct fdt_index *index);
+
+/**
+ * Reads the n-th (address, size) tuple of the reg property of a device
+ * @return 0 on success, -1 if there is no such tuple
+ */
+static inline int device_reg(const struct device *dev, uint32_t n, uint64_t *address, uint64_t *size) {
+  return fdt_index_reg(dev->index, dev->node, n, address, size);
+}
+
+static inline const char *device_name(const struct device *dev) {
+  return dev->index->nodes[dev->node].name;
+}
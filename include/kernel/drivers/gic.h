@@ -0,0 +1,88 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/drivers/driver.h>
+#include <kernel/sync/spinlock.h>
+
+// Distributor (GICD), shared by GICv2 and GICv3
+#define GICD_CTLR 0x0000
+#define GICD_TYPER 0x0004
+#define GICD_IGROUPR 0x0080
+#define GICD_ISENABLER 0x0100
+#define GICD_ICENABLER 0x0180
+#define GICD_ICPENDR 0x0280
+#define GICD_IPRIORITYR 0x0400
+#define GICD_ITARGETSR 0x0800 // GICv2
+#define GICD_ICFGR 0x0C00
+#define GICD_SGIR 0x0F00      // GICv2
+#define GICD_IROUTER 0x6000   // GICv3, 64 bits per SPI
+
+#define GICD_CTLR_ENABLE (1 << 0)     // GICv2
+#define GICD_CTLR_ENABLE_G1 (1 << 1)  // GICv3
+#define GICD_CTLR_ARE (1 << 4)        // GICv3
+#define GICD_CTLR_RWP (1U << 31)      // GICv3
+#define GICD_TYPER_LINES(typer) ((((typer) & 0x1F) + 1) * 32)
+
+// GICv2 CPU interface (GICC)
+#define GICC_CTLR 0x0000
+#define GICC_PMR 0x0004
+#define GICC_BPR 0x0008
+#define GICC_IAR 0x000C
+#define GICC_EOIR 0x0010
+
+// GICv3 redistributor (GICR): an RD frame followed by an SGI frame
+#define GICR_FRAME_SIZE 0x10000
+#define GICR_CTLR 0x0000
+#define GICR_TYPER 0x0008
+#define GICR_WAKER 0x0014
+#define GICR_SGI_BASE GICR_FRAME_SIZE
+#define GICR_IGROUPR0 (GICR_SGI_BASE + 0x0080)
+#define GICR_ISENABLER0 (GICR_SGI_BASE + 0x0100)
+#define GICR_ICENABLER0 (GICR_SGI_BASE + 0x0180)
+#define GICR_IPRIORITYR (GICR_SGI_BASE + 0x0400)
+#define GICR_ICFGR0 (GICR_SGI_BASE + 0x0C00)
+
+#define GICR_CTLR_RWP (1 << 3)
+#define GICR_TYPER_VLPIS (1 << 1)
+#define GICR_TYPER_LAST (1 << 4)
+#define GICR_TYPER_AFFINITY(typer) ((uint32_t) ((typer) >> 32))
+#define GICR_WAKER_PROCESSOR_SLEEP (1 << 1)
+#define GICR_WAKER_CHILDREN_ASLEEP (1 << 2)
+
+// GICv3 CPU interface system registers
+#define ICC_IAR1_EL1 S3_0_C12_C12_0
+#define ICC_EOIR1_EL1 S3_0_C12_C12_1
+#define ICC_SGI1R_EL1 S3_0_C12_C11_5
+#define ICC_PMR_EL1 S3_0_C4_C6_0
+#define ICC_BPR1_EL1 S3_0_C12_C12_3
+#define ICC_SRE_EL1 S3_0_C12_C12_5
+#define ICC_IGRPEN1_EL1 S3_0_C12_C12_7
+#define ICC_SRE_SRE (1 << 0)
+
+#define GIC_PRIORITY_DEFAULT 0xA0
+#define GIC_PRIORITY_MASK_ALL 0xFF // PMR value that lets every priority through
+
+// Interrupt specifier (3 cells): type, number, flags
+#define GIC_SPEC_SPI 0
+#define GIC_SPEC_PPI 1
+#define GIC_SPEC_EDGE_MASK 0x3 // Rising or falling edge, otherwise level
+
+enum gic_version {
+  GIC_V2 = 2,
+  GIC_V3 = 3
+};
+
+struct gic {
+  enum gic_version version;
+  volatile uint8_t *dist;
+  volatile uint8_t *cpu;    // GICv2 CPU interface
+  volatile uint8_t *redist; // GICv3 redistributors
+  uint64_t redist_size;
+  uint32_t n_lines;
+  struct spinlock lock;     // Read-modify-write of shared distributor registers
+};
@@ -0,0 +1,106 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/drivers/driver.h>
+
+// Register offsets
+#define PL011_DR 0x00
+#define PL011_FR 0x18
+#define PL011_IBRD 0x24
+#define PL011_FBRD 0x28
+#define PL011_LCRH 0x2C
+#define PL011_CR 0x30
+#define PL011_IFLS 0x34
+#define PL011_IMSC 0x38
+#define PL011_MIS 0x40
+#define PL011_ICR 0x44
+
+// Flag register
+#define PL011_FR_BUSY (1 << 3)
+#define PL011_FR_TXFF (1 << 5)
+
+// Line control register
+#define PL011_LCRH_FEN (1 << 4)
+#define PL011_LCRH_WLEN_8 (3 << 5)
+
+// Control register
+#define PL011_CR_UARTEN (1 << 0)
+#define PL011_CR_TXE (1 << 8)
+#define PL011_CR_RXE (1 << 9)
+
+// Interrupts
+#define PL011_INT_TX (1 << 5)
+#define PL011_IFLS_TX_1_8 0 // TX interrupt once the FIFO is down to 1/8
+
+#define PL011_BAUD_RATE 115200
+#define PL011_RING_SIZE 4096 // Power of two
+
+/**
+ * Slot of the TX ring, seq tells producers and the consumer whose turn it is
+ */
+struct pl011_slot {
+  volatile uint32_t seq;
+  char c;
+};
+
+/**
+ * Bounded multi-producer queue of characters waiting for the TX FIFO
+ */
+struct pl011_ring {
+  struct pl011_slot slots[PL011_RING_SIZE];
+  uint32_t head; // Next slot to fill, shared by the producers
+  uint32_t tail; // Next slot to send, owned by whoever holds pl011.draining
+};
+
+struct pl011 {
+  volatile uint32_t *base;
+  uint32_t clock;
+  volatile uint32_t irq_enabled; // TX interrupts drain the ring, writers do not wait
+  volatile uint32_t draining;
+  struct pl011_ring ring;
+};
+
+/**
+ * Writes a character through the ring, drained by the TX interrupt or by the caller
+ * @param uart the UART
+ * @param c the character
+ */
+void pl011_putc(struct pl011 *uart, char c);
+
+/**
+ * Writes characters through the ring, draining it once at the end
+ * @param uart the UART
+ * @param buf the characters
+ * @param len the number of characters
+ */
+void pl011_write_chars(struct pl011 *uart, const char *buf, size_t len);
+
+/**
+ * Writes a character once the TX FIFO has room, without touching the ring
+ * @param uart the UART
+ * @param c the character
+ */
+void pl011_putc_sync(struct pl011 *uart, char c);
+
+/**
+ * Waits until every buffered character has been sent
+ * @param uart the UART
+ */
+void pl011_flush(struct pl011 *uart);
+
+/**
+ * Starts draining the ring from the TX interrupt, writers stop waiting for the FIFO
+ * @param uart the UART
+ */
+void pl011_enable_tx_irq(struct pl011 *uart);
+
+/**
+ * TX interrupt handler: refills the FIFO from the ring
+ * @param uart the UART
+ */
+void pl011_irq(struct pl011 *uart);
@@ -0,0 +1,223 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIRTIO_MMIO_MAGIC 0x74726976 // "virt"
+
+// Register offsets of the MMIO transport
+#define VIRTIO_MMIO_MAGIC_VALUE 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028 // Legacy
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN 0x03C // Legacy
+#define VIRTIO_MMIO_QUEUE_PFN 0x040  // Legacy
+#define VIRTIO_MMIO_QUEUE_READY 0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0A0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH 0x0A4
+#define VIRTIO_MMIO_CONFIG_GENERATION 0x0FC
+#define VIRTIO_MMIO_CONFIG 0x100
+
+#define VIRTIO_MMIO_INT_VRING (1 << 0)
+#define VIRTIO_MMIO_INT_CONFIG (1 << 1)
+
+// Device status
+#define VIRTIO_STATUS_ACKNOWLEDGE (1 << 0)
+#define VIRTIO_STATUS_DRIVER (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK (1 << 2)
+#define VIRTIO_STATUS_FEATURES_OK (1 << 3)
+#define VIRTIO_STATUS_FAILED (1 << 7)
+
+// Device independent feature bits
+#define VIRTIO_F_RING_INDIRECT_DESC (1UL << 28)
+#define VIRTIO_F_RING_EVENT_IDX (1UL << 29)
+#define VIRTIO_F_VERSION_1 (1UL << 32)
+
+// Split virtqueue
+#define VIRTQ_DESC_F_NEXT (1 << 0)
+#define VIRTQ_DESC_F_WRITE (1 << 1) // Written by the device
+#define VIRTQ_DESC_F_INDIRECT (1 << 2)
+#define VIRTQ_AVAIL_F_NO_INTERRUPT (1 << 0)
+#define VIRTQ_USED_F_NO_NOTIFY (1 << 0)
+
+#define VIRTQ_ALIGN 4096 // Of the used ring, what the legacy transport expects
+#define VIRTQ_NONE 0xFFFF
+
+struct virtq_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+struct virtq_avail {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[]; // Followed by used_event
+};
+
+struct virtq_used_elem {
+  uint32_t id;
+  uint32_t len;
+};
+
+struct virtq_used {
+  uint16_t flags;
+  uint16_t idx;
+  struct virtq_used_elem ring[]; // Followed by avail_event
+};
+
+/**
+ * A split virtqueue. Its rings live in one block of the page allocator, laid
+ * out as the legacy transport wants them: descriptors, available ring, then
+ * the used ring on the next VIRTQ_ALIGN boundary.
+ */
+struct virtq {
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+  volatile uint16_t *used_event;  // In the available ring, written by the driver
+  volatile uint16_t *avail_event; // In the used ring, written by the device
+  void *ring;
+  uint16_t index;
+  uint16_t size;       // Power of two
+  uint16_t free_head;  // Free descriptors, chained through next
+  uint16_t n_free;
+  uint16_t avail_idx;  // Next available slot, published by virtq_kick
+  uint16_t kicked_idx; // avail->idx at the last notification
+  uint16_t last_used;  // Next used slot to read
+  uint8_t event_idx;
+};
+
+/**
+ * A virtio-mmio transport, version 1 (legacy) or 2
+ */
+struct virtio_mmio {
+  volatile uint8_t *base;
+  uint32_t version;
+  uint32_t device_id;
+  uint64_t features; // Negotiated
+};
+
+/**
+ * Whether the device must be notified (or must interrupt): event is the index
+ * it asked for, the index moved from old to new_idx since the last time
+ */
+static inline int vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old) {
+  return (uint16_t) (new_idx - event - 1) < (uint16_t) (new_idx - old);
+}
+
+/**
+ * Resets the device behind a transport and acknowledges it
+ * @param dev the transport
+ * @param address the base address of its registers
+ * @return the device ID, 0 if the slot is empty or -1 if it is not virtio-mmio
+ */
+int virtio_mmio_init(struct virtio_mmio *dev, uint64_t address);
+
+/**
+ * Accepts the features offered by the device among the wanted ones
+ * @param wanted the features the driver supports, VIRTIO_F_VERSION_1 is added for version 2
+ * @return 0 on success, -1 if the device refuses them
+ */
+int virtio_mmio_negotiate(struct virtio_mmio *dev, uint64_t wanted);
+
+/**
+ * Allocates the rings of a queue on a NUMA node and hands them to the device
+ * @param vq the queue
+ * @param index the queue index
+ * @param max_size upper bound of the queue size
+ * @param node the NUMA node of the memory
+ * @return 0 on success, -1 if the queue does not exist or there is no memory
+ */
+int virtio_mmio_setup_queue(struct virtio_mmio *dev, struct virtq *vq, uint16_t index, uint16_t max_size, uint32_t node);
+
+/**
+ * Tells the device the driver is ready
+ */
+void virtio_mmio_driver_ok(struct virtio_mmio *dev);
+
+/**
+ * Resets the device and marks it as failed. Once reset it no longer accesses
+ * the queues it was given, so they can be released.
+ */
+void virtio_mmio_fail(struct virtio_mmio *dev);
+
+/**
+ * Acknowledges the pending interrupts of the device
+ * @return the acknowledged VIRTIO_MMIO_INT_* bits
+ */
+uint32_t virtio_mmio_ack_irq(struct virtio_mmio *dev);
+
+/**
+ * Reads the device specific configuration space
+ * @param offset the offset in the configuration space
+ */
+uint32_t virtio_mmio_config_read32(struct virtio_mmio *dev, uint32_t offset);
+uint64_t virtio_mmio_config_read64(struct virtio_mmio *dev, uint32_t offset);
+
+/**
+ * Gives the rings of a queue back to the page allocator
+ */
+void virtq_release(struct virtq *vq);
+
+/**
+ * Takes a chain of descriptors from the free list
+ * @param n the number of descriptors
+ * @return the head of the chain or VIRTQ_NONE if there are not enough
+ */
+uint16_t virtq_alloc_chain(struct virtq *vq, uint16_t n);
+
+/**
+ * Gives a chain back to the free list
+ * @param head the head of the chain
+ */
+void virtq_free_chain(struct virtq *vq, uint16_t head);
+
+/**
+ * Makes a chain available, the device only sees it after virtq_kick
+ * @param head the head of the chain
+ */
+void virtq_add(struct virtq *vq, uint16_t head);
+
+/**
+ * Publishes the chains added since the last call and notifies the device once
+ * for all of them, unless it asked not to be
+ * @return 1 if the device was notified
+ */
+int virtq_kick(struct virtio_mmio *dev, struct virtq *vq);
+
+/**
+ * Takes the next chain the device is done with
+ * @param len receives the number of bytes the device wrote
+ * @return the head of the chain or VIRTQ_NONE if there is none
+ */
+uint16_t virtq_next_used(struct virtq *vq, uint32_t *len);
+
+/**
+ * Asks for an interrupt once the device has used as many chains as were
+ * available before end (just the next one without VIRTIO_F_RING_EVENT_IDX)
+ * @param end the available index past the last chain waited for, kicked_idx
+ *        for every chain in flight
+ * @return 0 if armed, -1 if chains were used meanwhile and must be read first
+ */
+int virtq_arm_interrupt(struct virtq *vq, uint16_t end);
@@ -0,0 +1,135 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/drivers/virtio.h>
+#include <kernel/sync/spinlock.h>
+
+#define VIRTIO_DEVICE_ID_BLOCK 2
+
+// Feature bits
+#define VIRTIO_BLK_F_RO (1UL << 5)
+#define VIRTIO_BLK_F_FLUSH (1UL << 9)
+#define VIRTIO_BLK_F_MQ (1UL << 12)
+
+// Configuration space
+#define VIRTIO_BLK_CONFIG_CAPACITY 0x00
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES 0x20 // 16 bits at 0x22, read with the word it is in
+
+// Request types
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+// Request status, written by the device
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+#define VIRTIO_BLK_MAX_DEVICES 8
+#define VIRTIO_BLK_QUEUE_SIZE 128
+#define VIRTIO_BLK_SEGMENTS 3 // Header, data and status
+
+struct virtio_blk_outhdr {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+struct virtio_blk_batch;
+
+/**
+ * A read, write or flush. The buffer must be physically contiguous (kernel
+ * memory is identity mapped) and its length a multiple of the sector size.
+ */
+struct virtio_blk_request {
+  uint32_t type;
+  uint64_t sector;
+  void *buf;
+  uint32_t len;
+  int status; // VIRTIO_BLK_S_*, set on completion
+  struct virtio_blk_batch *batch;
+};
+
+/**
+ * Per-request DMA memory, indexed by the head descriptor of the request: the
+ * indirect table (or the template of the chain without indirect descriptors),
+ * the header and the status byte
+ */
+struct virtio_blk_slot {
+  struct virtq_desc table[VIRTIO_BLK_SEGMENTS];
+  struct virtio_blk_outhdr hdr;
+  volatile uint8_t status;
+  struct virtio_blk_request *request;
+};
+
+/**
+ * A request queue, cores submit to queue (CPU id % number of queues)
+ */
+struct virtio_blk_queue {
+  struct spinlock lock; // Also taken by the interrupt handler
+  struct virtq vq;
+  struct virtio_blk_slot *slots;
+  struct virtio_blk_batch *oldest; // Batches in flight, in submission order
+  struct virtio_blk_batch *newest;
+} __attribute__((aligned(64)));
+
+struct virtio_blk {
+  struct virtio_mmio mmio;
+  uint64_t capacity; // In sectors
+  uint32_t irq;
+  uint32_t n_queues;
+  uint8_t indirect;
+  uint8_t read_only;
+  struct virtio_blk_queue *queues;
+};
+
+/**
+ * Returns a block device
+ * @param n the index of the device, in probe order
+ * @return the device or NULL if there are fewer devices
+ */
+struct virtio_blk *virtio_blk_get(uint32_t n);
+
+/**
+ * Submits a batch of requests to the queue of the calling core, with a single
+ * notification, and waits for all of them. The calling thread blocks until the
+ * interrupt of the last one, without a thread or an interrupt it polls.
+ * @param blk the device
+ * @param requests the requests, their status is set on return
+ * @param n the number of requests
+ * @return 0 if every request succeeded, -1 otherwise
+ */
+int virtio_blk_submit(struct virtio_blk *blk, struct virtio_blk_request *requests, uint32_t n);
+
+/**
+ * Reads or writes consecutive sectors with a single request
+ * @param blk the device
+ * @param type VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @param sector the first sector
+ * @param buf the buffer
+ * @param len the number of bytes, a multiple of the sector size
+ * @return 0 on success, -1 otherwise
+ */
+int virtio_blk_rw(struct virtio_blk *blk, uint32_t type, uint64_t sector, void *buf, uint32_t len);
+
+#ifdef KOS_VIRTIO_BLK_TEST
+
+/**
+ * Writes batches of sectors to every writable device from one thread per
+ * core, reads them back and compares, then restores what was there. The
+ * outcome is printed per device.
+ */
+void virtio_blk_self_test();
+
+#else
+
+// Without KOS_VIRTIO_BLK_TEST there is no self-test
+#define virtio_blk_self_test() do {} while (0)
+
+#endif
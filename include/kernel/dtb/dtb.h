@@ -9,7 +9,8 @@
 
 #define ALIGN(ptr) fdt_align(ptr, sizeof(ptr))
 
-#define FDT_HEADER_MAGIC 0xedfe0dd0
+#define FDT_HEADER_MAGIC 0xd00dfeed
+#define FDT_LAST_COMP_VERSION 17
 #define FDT_BEGIN_NODE 0x00000001
 #define FDT_END_NODE 0x00000002
 #define FDT_PROP 0x00000003
@@ -18,6 +19,7 @@
 
 // U32 properties
 #define FDT_PROP_PHANDLE "phandle"
+#define FDT_PROP_LINUX_PHANDLE "linux,phandle"
 #define FDT_PROP_INTERRUPT_PARENT "interrupt-parent"
 #define FDT_PROP_INTERRUPT_CELLS "#interrupt-cells"
 #define FDT_PROP_ADDRESS_CELLS "#address-cells"
@@ -28,41 +30,106 @@
 #define FDT_PROP_DEVICE_WIDTH "device-width"
 #define FDT_PROP_LINUX_PCI_DOMAIN "linux,pci-domain"
 #define FDT_PROP_LINUX_CODE "linux,code"
+#define FDT_PROP_CPU_ON "cpu_on"
+#define FDT_PROP_CPU_OFF "cpu_off"
+#define FDT_PROP_CLOCK_FREQUENCY "clock-frequency"
 
 // String properties
 #define FDT_PROP_LABEL "label"
 #define FDT_PROP_MODEL "model"
 #define FDT_PROP_DEVICE_TYPE "device_type"
 #define FDT_PROP_STDOUT_PATH "stdout-path"
+#define FDT_PROP_STATUS "status"
+#define FDT_PROP_ENABLE_METHOD "enable-method"
+#define FDT_PROP_METHOD "method"
+#define FDT_PROP_BOOTARGS "bootargs"
 
 // String list properties
 #define FDT_PROP_COMPATIBLE "compatible"
 #define FDT_PROP_CLOCK_NAMES "clock-names"
 #define FDT_PROP_CLOCK_OUTPUT_NAMES "clock-output-names"
+#define FDT_PROP_INTERRUPT_NAMES "interrupt-names"
+#define FDT_PROP_REG_NAMES "reg-names"
 
-static char *FDT_U32_PROPERTIES[] = {FDT_PROP_PHANDLE,
-                                     FDT_PROP_INTERRUPT_PARENT,
-                                     FDT_PROP_INTERRUPT_CELLS,
-                                     FDT_PROP_ADDRESS_CELLS,
-                                     FDT_PROP_SIZE_CELLS,
-                                     FDT_PROP_CLOCK_CELLS,
-                                     FDT_PROP_GPIO_CELLS,
-                                     FDT_PROP_BANK_WIDTH,
-                                     FDT_PROP_DEVICE_WIDTH,
-                                     FDT_PROP_LINUX_PCI_DOMAIN,
-                                     FDT_PROP_LINUX_CODE};
-
-static char *FDT_STRING_PROPERTIES[] = {FDT_PROP_LABEL,
-                                        FDT_PROP_MODEL,
-                                        FDT_PROP_DEVICE_TYPE,
-                                        FDT_PROP_STDOUT_PATH};
-
-static char *FDT_STRINGLIST_PROPERTIES[] = {FDT_PROP_COMPATIBLE,
-                                            FDT_PROP_CLOCK_NAMES,
-                                            FDT_PROP_CLOCK_OUTPUT_NAMES};
+// Other properties
+#define FDT_PROP_REG "reg"
+#define FDT_PROP_RANGES "ranges"
+#define FDT_PROP_INTERRUPTS "interrupts"
+#define FDT_PROP_INTERRUPTS_EXTENDED "interrupts-extended"
+#define FDT_PROP_INTERRUPT_CONTROLLER "interrupt-controller"
+#define FDT_PROP_CLOCKS "clocks"
+#define FDT_PROP_DMA_COHERENT "dma-coherent"
+#define FDT_PROP_MSI_PARENT "msi-parent"
+#define FDT_PROP_NUMA_NODE_ID "numa-node-id"
+#define FDT_PROP_DISTANCE_MATRIX "distance-matrix"
+#define FDT_PROP_NO_MAP "no-map"
+
+enum fdt_prop_type {
+  FDT_PROP_TYPE_GENERIC,
+  FDT_PROP_TYPE_U32,
+  FDT_PROP_TYPE_STRING,
+  FDT_PROP_TYPE_STRINGLIST
+};
+
+/**
+ * Well known property names, see fdt_prop_lookup
+ */
+enum fdt_prop_id {
+  FDT_PROP_ID_UNKNOWN,
+  FDT_PROP_ID_PHANDLE,
+  FDT_PROP_ID_LINUX_PHANDLE,
+  FDT_PROP_ID_INTERRUPT_PARENT,
+  FDT_PROP_ID_INTERRUPT_CELLS,
+  FDT_PROP_ID_ADDRESS_CELLS,
+  FDT_PROP_ID_SIZE_CELLS,
+  FDT_PROP_ID_CLOCK_CELLS,
+  FDT_PROP_ID_GPIO_CELLS,
+  FDT_PROP_ID_BANK_WIDTH,
+  FDT_PROP_ID_DEVICE_WIDTH,
+  FDT_PROP_ID_LINUX_PCI_DOMAIN,
+  FDT_PROP_ID_LINUX_CODE,
+  FDT_PROP_ID_LABEL,
+  FDT_PROP_ID_MODEL,
+  FDT_PROP_ID_DEVICE_TYPE,
+  FDT_PROP_ID_STDOUT_PATH,
+  FDT_PROP_ID_COMPATIBLE,
+  FDT_PROP_ID_CLOCK_NAMES,
+  FDT_PROP_ID_CLOCK_OUTPUT_NAMES,
+  FDT_PROP_ID_REG,
+  FDT_PROP_ID_RANGES,
+  FDT_PROP_ID_INTERRUPTS,
+  FDT_PROP_ID_INTERRUPTS_EXTENDED,
+  FDT_PROP_ID_INTERRUPT_CONTROLLER,
+  FDT_PROP_ID_INTERRUPT_NAMES,
+  FDT_PROP_ID_STATUS,
+  FDT_PROP_ID_ENABLE_METHOD,
+  FDT_PROP_ID_METHOD,
+  FDT_PROP_ID_CPU_ON,
+  FDT_PROP_ID_CPU_OFF,
+  FDT_PROP_ID_CLOCKS,
+  FDT_PROP_ID_DMA_COHERENT,
+  FDT_PROP_ID_MSI_PARENT,
+  FDT_PROP_ID_BOOTARGS,
+  FDT_PROP_ID_REG_NAMES,
+  FDT_PROP_ID_NUMA_NODE_ID,
+  FDT_PROP_ID_DISTANCE_MATRIX,
+  FDT_PROP_ID_NO_MAP,
+  FDT_PROP_ID_CLOCK_FREQUENCY,
+  FDT_PROP_ID_COUNT
+};
+
+struct fdt_prop_name {
+  const char *name;
+  enum fdt_prop_type type;
+};
+
+extern const struct fdt_prop_name fdt_prop_names[FDT_PROP_ID_COUNT];
 
 typedef uint32_t fdt_token_t;
 
+/**
+ * Flattened device tree header. Every field is big-endian, read them with fdt_header_get.
+ */
 struct fdt_header {
   uint32_t magic;
   uint32_t totalsize;
@@ -76,55 +143,121 @@ struct fdt_header {
   uint32_t size_dt_struct;
 };
 
+/**
+ * Memory reservation block entry. Both fields are big-endian in the blob.
+ */
 struct fdt_reserve_entry {
   uint64_t address;
   uint64_t size;
 };
 
+/**
+ * Property header, decoded to native endianness by fdt_traverse. id is the
+ * interned name (an enum fdt_prop_id), so visitors match it with an integer compare.
+ */
 struct fdt_prop_data {
   uint32_t len;
   uint32_t nameoff;
+  uint32_t id;
 };
 
 struct fdt_ops {
-  void (*begin)(void *data_ptr, struct fdt_header *header);
-  void (*end)(void *data_ptr, struct fdt_header *header);
-  void (*visit_token)(void *data_ptr, struct fdt_header *header, fdt_token_t *cursor);
-  void (*visit_begin_node)(void *data_ptr, struct fdt_header *header, fdt_token_t *cursor, const char *name);
-  void (*visit_end_node)(void *data_ptr, struct fdt_header *header, fdt_token_t *cursor);
-  void (*visit_nop_node)(void *data_ptr, struct fdt_header *header, fdt_token_t *cursor);
-  void (*visit_property)(void *data_ptr, struct fdt_header *header, fdt_token_t *cursor, struct fdt_prop_data *property, void* property_value);
+  void (*begin)(void *data_ptr, const struct fdt_header *header);
+  void (*end)(void *data_ptr, const struct fdt_header *header);
+  void (*visit_token)(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor);
+  void (*visit_begin_node)(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor, const char *name);
+  void (*visit_end_node)(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor);
+  void (*visit_nop_node)(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor);
+  void (*visit_property)(void *data_ptr, const struct fdt_header *header, const fdt_token_t *cursor, const struct fdt_prop_data *property, const void *property_value);
+  // Optional, returns non-zero once the visitor does not need more tokens
+  int (*done)(void *data_ptr);
+};
+
+/**
+ * A set of callbacks and their data, several of them can share one walk (see fdt_traverse_visitors)
+ */
+struct fdt_visitor {
+  const struct fdt_ops *ops;
+  void *data_ptr;
+  uint8_t done;
 };
 
+struct fdt_dump_data {
+  uint32_t nested_levels;
+};
+
+/* Big-endian accessors, the blob is never modified */
+static inline uint32_t fdt_be32(const void *p) {
+  return __builtin_bswap32(*(const uint32_t *) p);
+}
+
+static inline uint64_t fdt_be64(const void *p) {
+  // 64 bit values are only guaranteed to be 4 byte aligned
+  const uint32_t *w = p;
+  return ((uint64_t) fdt_be32(w) << 32) | fdt_be32(w + 1);
+}
+
+#define fdt_header_get(header, field) fdt_be32(&(header)->field)
+
 uintptr_t fdt_align(uintptr_t ptr, size_t size);
-fdt_token_t *fdt_advance_cursor(const fdt_token_t *ptr, size_t offset);
-void fdt_traverse(struct fdt_header *header, struct fdt_ops *ops, void* data_ptr);
-char *fdt_prop_get_name(const struct fdt_header *header,
-                        const struct fdt_prop_data *prop);
-int fdt_prop_of_type(char *name, char **names, size_t len);
-fdt_token_t *fdt_prop_u32_print(const struct fdt_header *header,
-                                const struct fdt_prop_data *prop,
-                                fdt_token_t *cursor);
-fdt_token_t *fdt_prop_string_print(const struct fdt_header *header,
+const fdt_token_t *fdt_advance_cursor(const fdt_token_t *ptr, size_t offset);
+int fdt_check_header(const struct fdt_header *header);
+void fdt_traverse(const struct fdt_header *header, const struct fdt_ops *ops, void* data_ptr);
+
+/**
+ * Walks the structure block once, dispatching every token to each visitor in
+ * order. A visitor stops receiving tokens once its done callback returns
+ * non-zero, and the walk ends as soon as every visitor is done. The end
+ * callbacks are always called.
+ * @param header the device tree blob header
+ * @param visitors the visitors
+ * @param n_visitors the number of visitors
+ */
+void fdt_traverse_visitors(const struct fdt_header *header, struct fdt_visitor *visitors, size_t n_visitors);
+const char *fdt_prop_get_name(const struct fdt_header *header,
+                              const struct fdt_prop_data *prop);
+
+/**
+ * Classifies a property name with a perfect hash over the well known names
+ * @param name the property name
+ * @return its id or FDT_PROP_ID_UNKNOWN
+ */
+enum fdt_prop_id fdt_prop_lookup(const char *name);
+
+/**
+ * Returns the id of the property name at nameoff in the strings block, with
+ * fdt_prop_lookup. Keeps no state, safe from concurrent traversals.
+ * @param header the device tree blob header
+ * @param nameoff the offset of the name in the strings block
+ * @return its id or FDT_PROP_ID_UNKNOWN
+ */
+enum fdt_prop_id fdt_prop_id(const struct fdt_header *header, uint32_t nameoff);
+
+static inline enum fdt_prop_type fdt_prop_type(uint32_t id) {
+  return fdt_prop_names[id].type;
+}
+uint64_t fdt_read_cells(const void *cells, uint32_t n_cells);
+const struct fdt_reserve_entry *fdt_mem_rsvmap(const struct fdt_header *header);
+const void *fdt_prop_u32_print(const struct fdt_header *header,
+                               const struct fdt_prop_data *prop,
+                               const void *cursor);
+const void *fdt_prop_string_print(const struct fdt_header *header,
+                                  const struct fdt_prop_data *prop,
+                                  const void *cursor);
+const void *fdt_prop_string_list_print(const struct fdt_header *header,
+                                       const struct fdt_prop_data *prop,
+                                       const void *cursor);
+const void *fdt_prop_generic_print(const struct fdt_header *header,
                                    const struct fdt_prop_data *prop,
-                                   fdt_token_t *cursor);
-fdt_token_t *fdt_prop_string_list_print(const struct fdt_header *header,
-                                        const struct fdt_prop_data *prop,
-                                        fdt_token_t *cursor);
-fdt_token_t *fdt_prop_generic_print(const struct fdt_header *header,
-                                    const struct fdt_prop_data *prop,
-                                    fdt_token_t *cursor);
-void fdt_reserve_entry_print(struct fdt_reserve_entry *entry);
-void parse_device_tree(struct fdt_header *header);
-
-/* Endianess Fixup */
-void fdt_fixup_header_endianness(void* data_ptr, struct fdt_header *header);
-void fdt_fixup_token_endianness(void* data_ptr, struct fdt_header *header, fdt_token_t *token);
-void fdt_fixup_property_endianness(void* data_ptr, struct fdt_header *header, fdt_token_t *token, struct fdt_prop_data *property, void* property_value);
+                                   const void *cursor);
+void fdt_reserve_entry_print(const struct fdt_reserve_entry *entry);
+void parse_device_tree(const struct fdt_header *header);
+struct fdt_visitor fdt_dump_visitor(struct fdt_dump_data *data);
 
 /* Dump */
-void fdt_dump_header(void* data_ptr, struct fdt_header *header);
-void fdt_dump_begin_node(void* data_ptr, struct fdt_header *header, fdt_token_t *token, const char* name);
-void fdt_dump_end_node(void* data_ptr, struct fdt_header *header, fdt_token_t *token);
-void fdt_dump_token(void* data_ptr, struct fdt_header *header, fdt_token_t *token);
-void fdt_dump_property(void* data_ptr, struct fdt_header *header, fdt_token_t *token, struct fdt_prop_data *property, void* property_value);
+void fdt_dump_header(void* data_ptr, const struct fdt_header *header);
+void fdt_dump_reserved(void* data_ptr, const struct fdt_header *header);
+void fdt_dump_begin_node(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char* name);
+void fdt_dump_end_node(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token);
+void fdt_dump_token(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token);
+void fdt_dump_property(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void* property_value);
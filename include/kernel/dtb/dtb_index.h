@@ -0,0 +1,179 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/dtb/dtb.h>
+
+#define FDT_INDEX_NONE 0xFFFFFFFF
+#define FDT_INDEX_ROOT 0
+#define FDT_INDEX_MAX_DEPTH 16
+
+/**
+ * A node of the flattened tree. Nodes are stored in DTB order, so a node
+ * always comes after its parent and before its next sibling.
+ */
+struct fdt_index_node {
+  const char *name;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t next_sibling;
+  uint32_t first_prop;
+  uint32_t n_props;
+  uint32_t phandle;
+  uint32_t path_hash;
+  uint8_t depth;
+  uint8_t address_cells; // #address-cells of the children
+  uint8_t size_cells;    // #size-cells of the children
+};
+
+/**
+ * A property, len is in bytes and value points into the blob (big-endian)
+ */
+struct fdt_index_prop {
+  uint32_t nameoff;
+  uint32_t id; // enum fdt_prop_id
+  uint32_t len;
+  const void *value;
+};
+
+/**
+ * One string of a compatible list. Entries with the same string are chained
+ * in DTB order through next.
+ */
+struct fdt_index_compat {
+  const char *compatible;
+  uint32_t node;
+  uint32_t next;
+};
+
+/**
+ * Open addressing hash table slot, value is FDT_INDEX_NONE when the slot is empty
+ */
+struct fdt_index_slot {
+  uint32_t hash;
+  uint32_t value;
+  uint32_t tail;
+};
+
+struct fdt_index {
+  const struct fdt_header *header;
+  struct fdt_index_node *nodes;
+  uint32_t n_nodes;
+  struct fdt_index_prop *props;
+  uint32_t n_props;
+  struct fdt_index_compat *compats;
+  uint32_t n_compats;
+  // Every table has a power of two number of slots
+  struct fdt_index_slot *phandles;
+  struct fdt_index_slot *paths;
+  struct fdt_index_slot *compat_slots;
+  uint32_t phandles_mask;
+  uint32_t paths_mask;
+  uint32_t compat_mask;
+};
+
+/**
+ * Index of the boot DTB, filled in by __kos_main
+ */
+extern struct fdt_index dtb_index;
+
+/**
+ * Flattens the tree into node/property arrays and builds the phandle, path
+ * and compatible hash tables. Everything is kept in a single kmalloc block.
+ * @param index the index to fill in
+ * @param header the device tree blob header
+ * @return 0 on success, -1 if the blob is invalid or there is no memory
+ */
+int fdt_index_build(struct fdt_index *index, const struct fdt_header *header);
+
+/**
+ * Releases the memory of an index
+ * @param index the index
+ */
+void fdt_index_free(struct fdt_index *index);
+
+/**
+ * Finds a node by its full path, e.g. "/intc@8000000"
+ * @param index the index
+ * @param path the path, unit addresses included
+ * @return the node or FDT_INDEX_NONE
+ */
+uint32_t fdt_index_find_path(const struct fdt_index *index, const char *path);
+
+/**
+ * Finds the node that declares a phandle
+ * @param index the index
+ * @param phandle the phandle
+ * @return the node or FDT_INDEX_NONE
+ */
+uint32_t fdt_index_find_phandle(const struct fdt_index *index, uint32_t phandle);
+
+/**
+ * Returns the first node (in DTB order) listing a compatible string, iterate
+ * over the rest with fdt_index_next_compatible
+ * @param index the index
+ * @param compatible the compatible string, e.g. "virtio,mmio"
+ * @return a compatible entry or NULL
+ */
+const struct fdt_index_compat *fdt_index_find_compatible(const struct fdt_index *index, const char *compatible);
+const struct fdt_index_compat *fdt_index_next_compatible(const struct fdt_index *index, const struct fdt_index_compat *entry);
+
+/**
+ * Finds a property of a node
+ * @param index the index
+ * @param node the node
+ * @param name the property name
+ * @return the property or NULL
+ */
+const struct fdt_index_prop *fdt_index_get_prop(const struct fdt_index *index, uint32_t node, const char *name);
+
+/**
+ * Finds a well known property of a node
+ * @param index the index
+ * @param node the node
+ * @param id the property id
+ * @return the property or NULL
+ */
+const struct fdt_index_prop *fdt_index_get_prop_id(const struct fdt_index *index, uint32_t node, enum fdt_prop_id id);
+
+/**
+ * Returns the name of a property
+ */
+const char *fdt_index_prop_name(const struct fdt_index *index, const struct fdt_index_prop *prop);
+
+/**
+ * Reads the n-th (address, size) tuple of the reg property, using the cell
+ * sizes of the parent node
+ * @param index the index
+ * @param node the node
+ * @param n the tuple
+ * @param address where the address is stored
+ * @param size where the size is stored
+ * @return 0 on success, -1 if there is no such tuple
+ */
+int fdt_index_reg(const struct fdt_index *index, uint32_t node, uint32_t n, uint64_t *address, uint64_t *size);
+
+/**
+ * Resolves the interrupt controller of a node, following interrupt-parent up
+ * the tree as the devicetree specification describes
+ * @param index the index
+ * @param node the node
+ * @return the interrupt controller node or FDT_INDEX_NONE
+ */
+uint32_t fdt_index_interrupt_parent(const struct fdt_index *index, uint32_t node);
+
+/**
+ * FNV-1a hash of a string, the one used by the index tables
+ */
+uint32_t fdt_hash_string(const char *s);
+
+/* Index DTB functions */
+void fdt_index_count_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name);
+void fdt_index_count_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value);
+void fdt_index_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name);
+void fdt_index_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token);
+void fdt_index_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value);
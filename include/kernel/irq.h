@@ -0,0 +1,110 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/exception.h>
+#include <kernel/dtb/dtb_index.h>
+
+// Interrupt IDs (GIC numbering)
+#define IRQ_SGI_BASE 0
+#define IRQ_PPI_BASE 16
+#define IRQ_SPI_BASE 32
+#define IRQ_PRIVATE 32 // SGIs and PPIs are banked per core
+#define IRQ_MAX 1020   // 1020-1023 are special (1023: spurious)
+#define IRQ_INTID_MASK 0x3FF
+#define IRQ_NONE 0xFFFFFFFF
+
+#define IRQ_TRIGGER_LEVEL 0
+#define IRQ_TRIGGER_EDGE 1
+
+typedef void (*irq_handler_t)(uint32_t intid, void *data);
+
+struct irq_desc {
+  irq_handler_t handler;
+  void *data;
+};
+
+/**
+ * Interrupt controller operations, registered by its driver
+ */
+struct irq_chip {
+  const char *name;
+  uint32_t node; // Controller node in the device tree index
+
+  uint32_t (*ack)();          // Acknowledges the highest priority interrupt, returns the raw IAR
+  void (*eoi)(uint32_t iar);  // Ends an interrupt with what ack returned
+  void (*enable)(uint32_t intid);
+  void (*disable)(uint32_t intid);
+  void (*set_trigger)(uint32_t intid, uint32_t trigger);
+  void (*send_sgi)(uint32_t cpu, uint32_t intid);
+  void (*cpu_init)(); // Brings up the CPU interface of the calling core
+
+  // Decodes an interrupt specifier, returns the INTID or IRQ_NONE
+  uint32_t (*xlate)(const uint32_t *cells, uint32_t n_cells, uint32_t *trigger);
+};
+
+/**
+ * Installs the interrupt controller. Every core brings up its CPU interface
+ * and unmasks IRQs from its scheduler loop (see irq_cpu_online).
+ * @param chip the controller
+ */
+void irq_register_chip(const struct irq_chip *chip);
+
+/**
+ * Installs a handler and enables the interrupt. SPIs are enabled for the
+ * whole system, SGIs and PPIs only on the calling core (see irq_enable).
+ * @param intid the interrupt
+ * @param handler the handler, called with IRQs masked
+ * @param data passed to the handler
+ * @return 0 on success, -1 if there is no controller or the INTID is invalid
+ */
+int irq_request(uint32_t intid, irq_handler_t handler, void *data);
+
+/**
+ * Enables an interrupt, a private one (SGI or PPI) only on the calling core
+ */
+void irq_enable(uint32_t intid);
+
+/**
+ * Disables an interrupt, a private one (SGI or PPI) only on the calling core
+ */
+void irq_disable(uint32_t intid);
+
+/**
+ * Sends a software generated interrupt to a core
+ * @param cpu the target core (struct cpu.id)
+ * @param intid the SGI (0-15)
+ */
+void irq_send_ipi(uint32_t cpu, uint32_t intid);
+
+/**
+ * Decodes the n-th entry of the interrupts property of a node and programs its
+ * trigger type
+ * @param index the device tree index
+ * @param node the node
+ * @param n the entry
+ * @return the INTID or IRQ_NONE if the node has no such interrupt on the registered controller
+ */
+uint32_t irq_of_node(const struct fdt_index *index, uint32_t node, uint32_t n);
+
+/**
+ * Brings up the interrupt controller on the calling core once there is one,
+ * then unmasks IRQs. Cheap once done, called from the scheduler loop.
+ */
+void irq_cpu_online();
+
+/**
+ * Returns the registers of the context an IRQ handler interrupted, NULL
+ * outside of a handler
+ */
+struct irq_frame *irq_current_frame();
+
+/**
+ * IRQ entry (see vectors.s): dispatches every pending interrupt
+ * @param frame the registers saved on entry
+ */
+void irq_handle(struct irq_frame *frame);
@@ -8,25 +8,119 @@
 #include <stddef.h>
 #include <stdarg.h>
 
+#define KPRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+
+/**
+ * Console driver behind debug_putc. putc and write may buffer, putc_sync must
+ * reach the device before returning and flush writes out whatever was buffered.
+ */
+struct debug_console {
+  void (*putc)(char c);
+  void (*putc_sync)(char c);
+  void (*write)(const char *buf, size_t len);
+  void (*flush)();
+};
+
+/**
+ * Output of the formatting functions. Once buf is full it is handed to flush,
+ * or the rest of the output is dropped if there is no flush function.
+ */
+struct kprintf_buffer {
+  char *buf;
+  size_t size;
+  size_t len;
+  size_t total; // Characters produced, including the dropped ones
+  void (*flush)(const char *buf, size_t len);
+};
+
 /**
  * Writes a byte over UART / Serial interface
  * @param c the byte to be write
  */
 void debug_putc(char c);
 
+/**
+ * Writes a byte over UART / Serial interface, bypassing any buffering
+ * @param c the byte to be write
+ */
+void debug_putc_sync(char c);
+
+/**
+ * Routes debug output to a console driver, a polled PL011 is used until then
+ * @param console the console
+ */
+void debug_set_console(const struct debug_console *console);
+
+/**
+ * Flushes the console and makes every later write synchronous, for panics
+ */
+void debug_panic_mode();
+
+/**
+ * Writes a buffer over UART / Serial interface in one go
+ * @param buf the characters
+ * @param len the number of characters
+ */
+void debug_write_buffer(const char *buf, size_t len);
+
+/**
+ * Writes a string over UART / Serial interface
+ * @param string the string
+ */
+void debug_write(const char* string);
+
 /**
  * Writes a new line over UART / Serial interface
  * @param fmt A string with format specifiers (similar to printf)
  * @param ... A variadic list of arguments to be printed
  */
-void debug_msg(const char* fmt, ...);
+void debug_msg(const char* fmt, ...) KPRINTF_FORMAT(1, 2);
 
 /**
  * Prints a debug message over UART / Serial interface
  * @param fmt A string with format specifiers (similar to printf)
  * @param ... A variadic list of arguments to be printed
  */
-void debug_printf(const char* fmt, ...);
+void debug_printf(const char* fmt, ...) KPRINTF_FORMAT(1, 2);
+
+/**
+ * Formats a string like vsnprintf: flags (-0+ #), width and precision (also *),
+ * length modifiers (hh h l ll z j t) and the d i u x X o p c s % conversions
+ * @param buf the destination, always terminated if size is not 0
+ * @param size the size of the destination
+ * @param fmt the format string
+ * @param ap the arguments
+ * @return the length of the whole output, which was truncated if it is >= size
+ */
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+
+/**
+ * Formats a string like snprintf (see kvsnprintf)
+ */
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) KPRINTF_FORMAT(3, 4);
+
+/**
+ * Appends formatted output to a buffer, flushing it whenever it fills up. The
+ * buffer is not terminated.
+ * @param out the buffer
+ * @param fmt the format string (see kvsnprintf)
+ * @param ap the arguments
+ * @return the number of characters produced
+ */
+int kvbprintf(struct kprintf_buffer *out, const char *fmt, va_list ap);
+
+/**
+ * Appends formatted output to a buffer (see kvbprintf)
+ */
+int kbprintf(struct kprintf_buffer *out, const char *fmt, ...) KPRINTF_FORMAT(2, 3);
+
+/**
+ * Appends formatted output to a buffer, taking every argument (strings and
+ * pointers included) from an array of 64-bit values (see kvbprintf)
+ * @param values the arguments
+ * @param n_values the number of arguments, missing ones are 0
+ */
+int kbprintf_values(struct kprintf_buffer *out, const char *fmt, const uint64_t *values, size_t n_values);
 
 /**
  * Sets a memory region with a value
@@ -37,6 +131,51 @@ void debug_printf(const char* fmt, ...);
  */
 void *memset(void *s, int c, size_t len);
 
+/**
+ * Byte-at-a-time memset, kept as the correctness reference for memset
+ * @param s A pointer to the memory region
+ * @param c The value you want to set
+ * @param len The length of the region
+ * @returns A pointer to the region
+ */
+void *memset_reference(void *s, int c, size_t len);
+
+/**
+ * Copies a memory region, the regions must not overlap
+ * @param dest A pointer to the destination region
+ * @param src A pointer to the source region
+ * @param len The number of bytes to copy
+ * @returns A pointer to the destination region
+ */
+void *memcpy(void *restrict dest, const void *restrict src, size_t len);
+
+/**
+ * Copies a memory region, the regions may overlap
+ * @param dest A pointer to the destination region
+ * @param src A pointer to the source region
+ * @param len The number of bytes to copy
+ * @returns A pointer to the destination region
+ */
+void *memmove(void *dest, const void *src, size_t len);
+
+/**
+ * Compares two memory regions byte by byte
+ * @param s1 the first region
+ * @param s2 the second region
+ * @param len The number of bytes to compare
+ * @return 0 if the regions are equal, the difference of the first mismatching bytes otherwise
+ */
+int memcmp(const void *s1, const void *s2, size_t len);
+
+/**
+ * NEON variants of memcpy and memset. They use the FP/SIMD registers, so they
+ * may only be called from thread context (never from exception handlers).
+ * memcpy and memset hand large buffers to them when the calling thread
+ * already owns the registers.
+ */
+void *memcpy_simd(void *restrict dest, const void *restrict src, size_t len);
+void *memset_simd(void *s, int c, size_t len);
+
 /**
  * Swaps bytes in a memory region (useful for changing endianness)
  * @param s A pointer to the memory region
@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <stddef.h>
+
 void kmalloc_init();
 void *kmalloc(size_t);
-void kfree(void*);
\ No newline at end of file
+void *kzalloc(size_t);
+void kfree(void*);
+void kmalloc_dump();
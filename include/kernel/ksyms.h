@@ -0,0 +1,40 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KSYM_NONE 0xFFFFFFFF
+
+/**
+ * A function of the kernel image
+ */
+struct ksym {
+  uint64_t address;
+  const char *name;
+};
+
+/**
+ * Symbol table sorted by address, generated from a first link of kernel.elf
+ * (see cmake/ksyms.cmake). Empty in that first link.
+ */
+extern const uint64_t ksym_count;
+extern const struct ksym ksym_table[];
+
+/**
+ * Finds the function containing an address
+ * @param address a code address
+ * @return the index in ksym_table or KSYM_NONE if it is not in the kernel text
+ */
+uint32_t ksym_find(uint64_t address);
+
+/**
+ * Finds the name of the function containing an address
+ * @param address a code address
+ * @param offset if not NULL, receives the offset of the address in the function
+ * @return the name or NULL if it is not in the kernel text
+ */
+const char *ksym_lookup(uint64_t address, uint64_t *offset);
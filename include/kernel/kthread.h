@@ -0,0 +1,116 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/fpsimd.h>
+#include <kernel/sched/deque.h>
+
+#define KTHREAD_STACK_ORDER 2 // 16 KiB
+
+#define KTHREAD_RUNNABLE 0
+#define KTHREAD_RUNNING 1
+#define KTHREAD_BLOCKED 2
+#define KTHREAD_DEAD 3
+
+// Value of kthread.joiner once the thread has exited
+#define KTHREAD_EXITED ((struct kthread *) 1)
+
+/**
+ * Callee-saved registers (offsets are used from switch.s)
+ */
+struct kthread_context {
+  uint64_t x19, x20, x21, x22, x23, x24, x25, x26, x27, x28;
+  uint64_t fp;
+  uint64_t lr;
+  uint64_t sp;
+};
+
+struct kthread {
+  struct kthread_context context;
+  uint32_t id;
+  uint32_t cpu;
+  uint32_t state;
+  uint32_t on_cpu;
+  int (*fn)(void *);
+  void *arg;
+  int result;
+  void *stack;
+  struct kthread *joiner;
+  uint32_t fpsimd_cpu; // Core that last loaded fpsimd
+  struct fpsimd_state fpsimd;
+};
+
+/**
+ * Scheduler state of a core
+ */
+struct sched_cpu {
+  struct kthread_context context;
+  struct kthread_deque runqueue;
+  uint32_t rng;
+  uint8_t fifo_next;
+  void *stack;
+};
+
+/**
+ * Creates a kernel thread and queues it on the calling core. Idle cores may steal it.
+ * @param fn the function run by the thread, its result is returned by kthread_join
+ * @param arg the argument passed to the function
+ * @return the thread or NULL if there is no memory available
+ */
+struct kthread *kthread_spawn(int (*fn)(void *), void *arg);
+
+/**
+ * Gives up the CPU, the calling thread is queued again
+ */
+void kthread_yield();
+
+/**
+ * Waits for a thread to finish and releases it
+ * @param thread the thread
+ * @return the value returned by the thread function
+ */
+int kthread_join(struct kthread *thread);
+
+/**
+ * Terminates the calling thread
+ * @param result the value returned by kthread_join
+ */
+void kthread_exit(int result);
+
+/**
+ * Returns the thread running on the calling core (NULL in scheduler context)
+ */
+struct kthread *kthread_current();
+
+/**
+ * Makes a blocked thread runnable again on the calling core
+ * @param thread the thread
+ */
+void kthread_wake(struct kthread *thread);
+
+/**
+ * Blocks the calling thread until kthread_wake. The wake-up must be armed
+ * before, with IRQs masked if it comes from an interrupt of the calling core:
+ * the handler would otherwise wait for a thread that never leaves the CPU.
+ */
+void kthread_block();
+
+/**
+ * Sets up the scheduler and turns the calling context (__kos_main) into a thread
+ */
+void sched_init();
+
+/**
+ * Scheduler loop of a core: runs local threads and steals from other cores when idle
+ */
+void sched_loop();
+
+/* Context switch (see switch.s) */
+void __kthread_switch(struct kthread_context *from, struct kthread_context *to);
+void __kthread_trampoline();
+void __sched_trampoline();
+void kthread_entry(struct kthread *thread);
@@ -0,0 +1,129 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/system_info.h>
+
+#define MEMMAP_MAX_BANKS 16
+#define MEMMAP_MAX_RESERVED 32
+#define MEMMAP_MAX_FREE 48
+#define MEMMAP_MAX_NODES 8
+
+// Default NUMA distances, overridden by /distance-map
+#define MEMMAP_LOCAL_DISTANCE 10
+#define MEMMAP_REMOTE_DISTANCE 20
+
+/**
+ * A range of physical memory [start, end) and the NUMA node it belongs to
+ */
+struct memmap_range {
+  pa_address start;
+  pa_address end;
+  uint32_t node;
+};
+
+/**
+ * Physical memory of the system: every RAM bank of the /memory nodes, what
+ * is reserved in it and what is left for the allocators, per NUMA node
+ */
+struct memmap {
+  struct memmap_range banks[MEMMAP_MAX_BANKS]; // Sorted by address
+  uint32_t n_banks;
+  struct memmap_range reserved[MEMMAP_MAX_RESERVED]; // Sorted by address, page aligned
+  uint32_t n_reserved;
+  struct memmap_range free[MEMMAP_MAX_FREE]; // Sorted by node, then address (see memmap_build_free)
+  uint32_t n_free;
+  uint32_t node_free_first[MEMMAP_MAX_NODES];
+  uint32_t node_free_count[MEMMAP_MAX_NODES];
+  uint32_t n_nodes;
+  uint8_t distance[MEMMAP_MAX_NODES][MEMMAP_MAX_NODES];
+};
+
+#define MEMMAP_DTB_DEPTH 4 // Root, its children and the children of /reserved-memory
+
+// Node being read: reg, device_type and status come in any order
+struct memmap_dtb_node {
+  uint8_t is_memory;
+  uint8_t disabled;
+  uint32_t node_id;
+  const void *reg;
+  uint32_t reg_len;
+};
+
+struct memmap_dtb_data {
+  struct memmap *map;
+  uint32_t depth;
+  uint32_t address_cells; // Of the root, used by /memory and /reserved-memory
+  uint32_t size_cells;
+  uint32_t reserved_address_cells; // Of /reserved-memory, used by its children
+  uint32_t reserved_size_cells;
+  uint8_t in_reserved_memory;
+  uint8_t in_distance_map;
+  // One per depth, so a child never clobbers the state of its parent
+  struct memmap_dtb_node nodes[MEMMAP_DTB_DEPTH];
+};
+
+/**
+ * Memory map of the boot DTB, filled in by __kos_main
+ */
+extern struct memmap system_memmap;
+
+/**
+ * Collects every /memory bank (all reg tuples, with numa-node-id), the
+ * children of /reserved-memory and /distance-map
+ * @param data the visitor data
+ * @param map the memory map to fill in
+ * @return the visitor
+ */
+struct fdt_visitor memmap_dtb_visitor(struct memmap_dtb_data *data, struct memmap *map);
+
+/**
+ * Reserves a range, rounded out to pages
+ */
+void memmap_reserve(struct memmap *map, pa_address start, pa_address end);
+
+/**
+ * Reserves the device tree blob and every entry of its memory reservation block
+ */
+void memmap_reserve_fdt(struct memmap *map, const struct fdt_header *header);
+
+/**
+ * Computes the free ranges (banks minus reserved ranges) and groups them per node
+ */
+void memmap_build_free(struct memmap *map);
+
+/**
+ * Takes page aligned memory from the free ranges, from the given node if it
+ * has enough, for data that must exist before the allocators
+ * @param size the size in bytes
+ * @param node the preferred NUMA node
+ * @return the address or 0 if no free range is big enough
+ */
+pa_address memmap_carve(struct memmap *map, size_t size, uint32_t node);
+
+/**
+ * Returns the free ranges of a node
+ * @param node the NUMA node
+ * @param n receives the number of ranges
+ */
+const struct memmap_range *memmap_node_free(const struct memmap *map, uint32_t node, uint32_t *n);
+
+/**
+ * Returns the node of the bank containing an address, 0 if it is not RAM
+ */
+uint32_t memmap_node_of(const struct memmap *map, pa_address address);
+
+/**
+ * Returns the distance between two NUMA nodes (MEMMAP_LOCAL_DISTANCE for itself)
+ */
+uint32_t memmap_distance(const struct memmap *map, uint32_t from, uint32_t to);
+
+/**
+ * Prints the banks, the reserved ranges and the free ranges per node
+ */
+void memmap_dump(const struct memmap *map);
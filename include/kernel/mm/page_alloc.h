@@ -0,0 +1,153 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/system_info.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define PAGE_MAX_ORDER 10 // Largest block is 4 MiB (2^10 pages)
+
+#define PAGE_ALIGN_DOWN(addr) ((addr) & PAGE_MASK)
+#define PAGE_ALIGN_UP(addr) (((addr) + PAGE_SIZE - 1) & PAGE_MASK)
+
+// page_alloc_flags
+#define PAGE_ALLOC_ZERO (1U << 0) // Zero-filled, single pages come from the pre-zeroed pool
+
+#define PAGE_FLAG_RESERVED (1 << 0)
+#define PAGE_FLAG_FREE (1 << 1)      // Head of a free block
+#define PAGE_FLAG_ALLOCATED (1 << 2) // Head of an allocated block, the only pages page_free takes
+
+#define PAGE_MAX_ZONES MEMMAP_MAX_BANKS
+#define PAGE_MAX_RECLAIMERS 4
+
+/**
+ * Descriptor of a physical page frame. Only the first page of a block
+ * carries a meaningful order and a FREE or ALLOCATED flag, the flags of the
+ * other pages are cleared.
+ */
+struct page {
+  struct page *next;
+  union {
+    struct page *prev; // Head of a free block
+    void *owner;       // Every page of an allocated block, see page_set_owner
+  };
+  uint8_t order;
+  uint8_t flags;
+};
+
+/**
+ * A contiguous range of physical memory (a RAM bank) managed by a buddy allocator
+ */
+struct page_zone {
+  pa_address base;
+  uint32_t node;
+  size_t n_pages;
+  size_t free_pages;
+  struct page *pages;
+  struct page *free_lists[PAGE_MAX_ORDER + 1];
+  size_t free_blocks[PAGE_MAX_ORDER + 1];
+};
+
+/**
+ * Gives memory cached by a subsystem back to the page allocator, called when it
+ * runs out of memory, possibly with the locks of the caller held
+ * @return the number of pages released, an estimate
+ */
+typedef size_t (*page_reclaim_fn_t)();
+
+/**
+ * Initializes the physical page allocator with one zone per RAM bank of the memory map.
+ * The kernel image and the DTB are reserved in the map, then every free range of it is
+ * released; the page descriptors of a zone are taken from its own node.
+ * @param map the memory map, its free ranges are computed here
+ * @param header the device tree blob header
+ */
+void page_alloc_init(struct memmap *map, const struct fdt_header *header);
+
+/**
+ * Allocates a block of 2^order contiguous physical pages, from the node of the
+ * calling core if it has one free
+ * @param order the order of the block (0 for a single 4 KiB page)
+ * @return the address of the block or NULL if there is no memory available
+ */
+void *page_alloc(unsigned int order);
+
+/**
+ * Allocates a block of 2^order contiguous physical pages from a NUMA node,
+ * falling back to the nearest nodes
+ * @param order the order of the block
+ * @param node the preferred node
+ * @return the address of the block or NULL if there is no memory available
+ */
+void *page_alloc_node(unsigned int order, uint32_t node);
+
+/**
+ * Allocates a block of 2^order contiguous physical pages from the node of the calling core
+ * @param order the order of the block
+ * @param flags PAGE_ALLOC_ZERO for a zero-filled block: O(1) for a single page while
+ *        the pool idle cores refill has pages, zeroed synchronously otherwise
+ * @return the address of the block or NULL if there is no memory available
+ */
+void *page_alloc_flags(unsigned int order, uint32_t flags);
+
+/**
+ * Registers a reclaim callback, tried in order once the zeroed pool is drained
+ * @param fn the callback
+ * @return 0 on success, -1 if there are PAGE_MAX_RECLAIMERS already
+ */
+int page_reclaim_register(page_reclaim_fn_t fn);
+
+/**
+ * Returns a block previously allocated with page_alloc
+ * @param addr the address of the block
+ */
+void page_free(void *addr);
+
+/**
+ * Records the owner of an allocated block in the descriptor of each of its
+ * pages, so that any address inside the block leads back to it (e.g. a slab)
+ * @param addr the address of the block, as returned by page_alloc
+ * @param owner the owner, NULL once the block is handed back
+ */
+void page_set_owner(void *addr, void *owner);
+
+/**
+ * Returns the owner of the page holding an address, without locking: it is
+ * stable while the block is allocated
+ * @param addr any address inside an allocated block
+ * @return the owner given to page_set_owner, NULL for blocks without one or
+ *         addresses not managed by the allocator
+ */
+void *page_owner(void *addr);
+
+/**
+ * Returns the order of an allocated block
+ * @param addr the address of the block
+ * @return the order of the block
+ */
+unsigned int page_order(void *addr);
+
+/**
+ * Returns the NUMA node of a page
+ * @param addr the address of the page
+ * @return the node, 0 if the page is not managed by the allocator
+ */
+uint32_t page_node(void *addr);
+
+/**
+ * Returns the number of free pages
+ */
+size_t page_free_count();
+
+/**
+ * Prints the free lists of the allocator
+ */
+void page_alloc_dump();
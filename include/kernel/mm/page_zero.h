@@ -0,0 +1,56 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/sync/spinlock.h>
+
+#define PAGE_ZERO_TARGET 256 // Pages kept zeroed per node (1 MiB)
+#define PAGE_ZERO_BATCH 8    // Pages zeroed per call of page_zero_refill
+#define PAGE_ZERO_MIN_FREE 1024 // Free pages left to the allocator before refilling
+
+/**
+ * Single pages zeroed ahead of time by idle cores, one stack per NUMA node.
+ * The first word of a pooled page links to the next one.
+ */
+struct page_zero_pool {
+  struct spinlock lock;
+  void *head;
+  size_t count;
+};
+
+/**
+ * Takes a zeroed page from the pool of a node in O(1)
+ * @param node the NUMA node
+ * @return the page or NULL if the pool is empty
+ */
+void *page_zero_pop(uint32_t node);
+
+/**
+ * Zeroes up to PAGE_ZERO_BATCH pages into the pool of the calling core's node,
+ * meant for idle cores
+ * @return the number of pages zeroed, 0 once the pool is full or memory is short
+ *         (PAGE_ZERO_MIN_FREE)
+ */
+uint32_t page_zero_refill();
+
+/**
+ * Gives every pooled page back to the page allocator
+ * @return the number of pages released
+ */
+size_t page_zero_drain();
+
+/**
+ * Zeroes a page with DC ZVA at the DCZID_EL0 block size, or memset if it is prohibited
+ * @param page the page, in normal memory
+ */
+void page_zero_fill(void *page);
+
+/**
+ * Returns the number of pooled pages of every node
+ */
+size_t page_zero_count();
@@ -0,0 +1,81 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/pmu.h>
+#include <kernel/smp.h>
+
+#define PERF_SAMPLES 2048          // Per CPU, later samples are dropped
+#define PERF_DEFAULT_PERIOD 100000 // Events between samples
+#define PERF_REPORT_TOP 20         // Symbols printed by perf_report
+
+/**
+ * Where a core was when the sampling counter overflowed
+ */
+struct perf_sample {
+  uint64_t pc;
+  uint32_t thread; // kthread id, 0 in scheduler context
+};
+
+/**
+ * Samples of a core, only written by that core's PMU interrupt
+ */
+struct perf_cpu {
+  uint32_t generation;  // Configuration applied to this core (see perf_cpu_sync)
+  uint32_t irq_enabled; // The PMU PPI is enabled on this core
+  uint32_t counter;     // Event counter used for sampling, the last one of the PMU
+  uint32_t n_samples;
+  uint32_t dropped;
+  struct perf_sample samples[PERF_SAMPLES];
+};
+
+/**
+ * Starts sampling: the calling core at once, the others the next time they
+ * go through their scheduler loop. Previous samples are discarded.
+ * @param event the PMU event to count (PMU_EVENT_*)
+ * @param period events between two samples
+ * @return 0 on success, -1 if there is no PMU interrupt or no free counter
+ */
+int perf_start(uint32_t event, uint32_t period);
+
+/**
+ * Stops sampling, the samples are kept for perf_report
+ */
+void perf_stop();
+
+/**
+ * Prints a flat profile: the PERF_REPORT_TOP functions with the most samples
+ * across every core
+ */
+void perf_report();
+
+/**
+ * Applies the latest sampling configuration to the calling core, called from
+ * the scheduler loop
+ */
+void perf_cpu_sync();
+
+/**
+ * Hooks the sampler to the PMU overflow interrupt, called by the PMU driver
+ * @param intid the PPI of the PMU
+ */
+void perf_setup_irq(uint32_t intid);
+
+#ifdef KOS_PERF
+
+/**
+ * Stops the sampling started by perf_setup_irq and prints its report, called
+ * at the end of boot
+ */
+void perf_boot_report();
+
+#else
+
+// Without KOS_PERF boot is not sampled
+#define perf_boot_report() do {} while (0)
+
+#endif
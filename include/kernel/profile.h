@@ -0,0 +1,99 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/pmu.h>
+
+#define PROFILE_COUNTERS 3        // PMEVCNTR0-2_EL0: instructions, L1D refills, L1D TLB refills
+#define PROFILE_MAX_REGIONS 64
+#define PROFILE_NONE 0xFFFFFFFF
+
+/**
+ * Counters of a core at one point in time
+ */
+struct profile_sample {
+  uint64_t time;   // CNTVCT_EL0
+  uint64_t cycles; // PMCCNTR_EL0
+  uint64_t events[PROFILE_COUNTERS];
+  uint32_t cpu;
+};
+
+/**
+ * A boot phase (depth 0) or a scoped region nested in it. The counters are
+ * per core: deltas only mean something if the region ended where it started.
+ */
+struct profile_region {
+  const char *name;
+  uint32_t depth;
+  volatile uint32_t done;
+  struct profile_sample start;
+  struct profile_sample end;
+};
+
+#ifdef KOS_PROFILE
+
+/**
+ * Programs the PMU of the boot core and starts the timeline
+ * @param origin CNTVCT_EL0 value the timeline is relative to (kernel entry)
+ */
+void profile_init(uint64_t origin);
+
+/**
+ * Enables the cycle and event counters of the calling core
+ */
+void profile_cpu_init();
+
+/**
+ * Ends the current boot phase and starts the next one
+ * @param name the phase, a literal; NULL just ends the current phase
+ */
+void profile_phase(const char *name);
+
+/**
+ * Starts a region nested in the current phase (see PROFILE_SCOPE)
+ * @param name the region, it must outlive the timeline
+ * @return the region handle or PROFILE_NONE if the timeline is full
+ */
+uint32_t profile_begin(const char *name);
+
+/**
+ * Ends a region started with profile_begin
+ * @param region the handle
+ */
+void profile_end(uint32_t region);
+
+/**
+ * Prints the timeline: start and duration of every phase and region, with
+ * the cycles, instructions and refills it took
+ */
+void profile_dump();
+
+static inline void __profile_scope_end(uint32_t *region) {
+  profile_end(*region);
+}
+
+#define __PROFILE_CONCAT(a, b) a##b
+#define __PROFILE_SCOPE(name, line) \
+  uint32_t __PROFILE_CONCAT(__profile_scope_, line) __attribute__((cleanup(__profile_scope_end))) = profile_begin(name)
+
+/**
+ * Profiles the rest of the enclosing block as a region
+ */
+#define PROFILE_SCOPE(name) __PROFILE_SCOPE(name, __LINE__)
+
+#else
+
+// Without KOS_PROFILE the instrumentation compiles to nothing
+#define profile_init(origin) do {} while (0)
+#define profile_cpu_init() do {} while (0)
+#define profile_phase(name) do {} while (0)
+#define profile_begin(name) PROFILE_NONE
+#define profile_end(region) do {} while (0)
+#define profile_dump() do {} while (0)
+#define PROFILE_SCOPE(name)
+
+#endif
@@ -0,0 +1,50 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// PSCI 0.2+ function IDs (SMC64 calling convention)
+#define PSCI_FN_PSCI_VERSION 0x84000000
+#define PSCI_FN64_CPU_ON 0xC4000003
+
+#define PSCI_SUCCESS 0
+#define PSCI_NOT_SUPPORTED -1
+#define PSCI_INVALID_PARAMETERS -2
+#define PSCI_DENIED -3
+#define PSCI_ALREADY_ON -4
+#define PSCI_ON_PENDING -5
+#define PSCI_INTERNAL_FAILURE -6
+
+enum psci_conduit {
+  PSCI_CONDUIT_NONE,
+  PSCI_CONDUIT_HVC,
+  PSCI_CONDUIT_SMC
+};
+
+/**
+ * Sets how PSCI calls reach the firmware (the "method" property of /psci)
+ * @param conduit the conduit
+ * @param cpu_on_fn the CPU_ON function ID (0 for the PSCI 0.2 default)
+ */
+void psci_init(enum psci_conduit conduit, uint32_t cpu_on_fn);
+
+/**
+ * Returns the PSCI version implemented by the firmware (major << 16 | minor)
+ */
+int32_t psci_version();
+
+/**
+ * Powers on a core
+ * @param mpidr the affinity of the target core
+ * @param entry the physical address where the core starts executing
+ * @param context_id the value the core receives in X0
+ * @return PSCI_SUCCESS or a PSCI error code
+ */
+int32_t psci_cpu_on(uint64_t mpidr, uint64_t entry, uint64_t context_id);
+
+/* SMC Calling Convention (see smccc.s) */
+uint64_t __smccc_hvc(uint64_t fn, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+uint64_t __smccc_smc(uint64_t fn, uint64_t arg0, uint64_t arg1, uint64_t arg2);
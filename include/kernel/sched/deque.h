@@ -0,0 +1,41 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KTHREAD_DEQUE_SIZE 1024 // Must be a power of 2
+#define KTHREAD_DEQUE_MASK (KTHREAD_DEQUE_SIZE - 1)
+
+struct kthread;
+
+/**
+ * Chase-Lev work-stealing deque. Only the owner core pushes and pops at the
+ * bottom, any core can steal from the top.
+ */
+struct kthread_deque {
+  int64_t top;
+  int64_t bottom;
+  struct kthread *buffer[KTHREAD_DEQUE_SIZE];
+};
+
+/**
+ * Pushes a thread at the bottom of the deque (owner only)
+ * @return 0 on success, -1 if the deque is full
+ */
+int kthread_deque_push(struct kthread_deque *deque, struct kthread *thread);
+
+/**
+ * Pops the most recently pushed thread (owner only)
+ * @return the thread or NULL if the deque is empty
+ */
+struct kthread *kthread_deque_pop(struct kthread_deque *deque);
+
+/**
+ * Steals the oldest thread of the deque (any core)
+ * @return the thread or NULL if the deque is empty or another core won the race
+ */
+struct kthread *kthread_deque_steal(struct kthread_deque *deque);
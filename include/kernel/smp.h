@@ -0,0 +1,110 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/dtb/dtb.h>
+#include <kernel/psci.h>
+
+#define SMP_MAX_CPUS 8
+#define SMP_STACK_ORDER 2 // 16 KiB per core
+#define MPIDR_AFFINITY_MASK 0xFF00FFFFFFUL
+
+// cpu.online
+#define CPU_OFFLINE 0
+#define CPU_ONLINE 1
+#define CPU_ABANDONED 2 // Did not come online in time, its slot is never reused
+
+struct kthread;
+struct irq_frame;
+
+/**
+ * Per-CPU data, reachable through TPIDR_EL1
+ */
+struct cpu {
+  uint64_t stack_top; // Must be the first field (see __kos_secondary_start)
+  uint32_t id;
+  uint64_t mpidr;
+  uint32_t node; // NUMA node, numa-node-id of its /cpus entry
+  void *stack;
+  volatile uint32_t online; // CPU_OFFLINE, CPU_ONLINE or CPU_ABANDONED
+  struct kthread *current;
+  struct kthread *fpsimd_last; // Thread whose FP/SIMD state is in the registers
+  uint32_t irq_online; // CPU interface of the interrupt controller is up, IRQs unmasked
+  struct irq_frame *irq_frame; // Interrupted context while an IRQ is being handled
+};
+
+struct smp_cpu_desc {
+  uint64_t mpidr;
+  uint32_t node;
+  uint8_t psci;
+};
+
+struct smp_dtb_data {
+  uint32_t depth;
+  uint8_t in_cpus;
+  uint8_t in_cpu;
+  uint8_t in_psci;
+  uint8_t seen_cpus;
+  uint8_t seen_psci;
+  uint32_t cpus_address_cells;
+  struct smp_cpu_desc current;
+  uint8_t current_has_reg;
+  struct smp_cpu_desc cpus[SMP_MAX_CPUS];
+  uint32_t n_cpus;
+  enum psci_conduit conduit;
+  uint32_t cpu_on_fn;
+};
+
+extern struct cpu cpus[SMP_MAX_CPUS];
+
+/**
+ * Returns the per-CPU data of the calling core
+ */
+static inline struct cpu *this_cpu() {
+  return (struct cpu *) read_sysreg(tpidr_el1);
+}
+
+/**
+ * Returns the number of cores that are online
+ */
+uint32_t smp_online_cpus();
+
+/**
+ * Returns the number of per-CPU slots handed out, CPU ids are below it. It is
+ * larger than smp_online_cpus if a core was abandoned.
+ */
+uint32_t smp_cpu_slots();
+
+/**
+ * Sets up the per-CPU data of the boot core and starts every core described
+ * in /cpus through PSCI CPU_ON, using the conduit advertised by /psci
+ * @param data what smp_dtb_visitor collected from the device tree
+ */
+void smp_init(const struct smp_dtb_data *data);
+
+/**
+ * Collects /cpus and /psci, done once both nodes have been read
+ * @param data the visitor data
+ * @return the visitor
+ */
+struct fdt_visitor smp_dtb_visitor(struct smp_dtb_data *data);
+
+/**
+ * Common entry point of every core once its stack and MMU are ready, runs the scheduler
+ */
+void cpu_idle();
+
+/* Entry points */
+void __kos_secondary_start(struct cpu *cpu);
+void __kos_secondary_main(struct cpu *cpu);
+
+/* SMP DTB functions */
+void fdt_smp_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name);
+void fdt_smp_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token);
+int fdt_smp_done(void *data_ptr);
+void fdt_smp_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value);
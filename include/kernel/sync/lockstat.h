@@ -0,0 +1,79 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOCKSTAT_REPORT_TOP 16
+
+/**
+ * Contention counters of a lock. Times are in system counter ticks (CNTVCT_EL0),
+ * the only clock every core has running from the start.
+ */
+struct lockstat {
+  const char *name;
+  uint64_t acquisitions;
+  uint64_t contended;      // Acquisitions that had to wait
+  uint64_t wait_ticks;
+  uint64_t hold_ticks;     // Exclusive holds only
+  uint64_t max_hold_ticks;
+  uint64_t acquired_at;    // When the current exclusive holder got the lock
+  struct lockstat *next;   // Registry of the locks used so far
+  uint32_t registered;
+};
+
+#ifdef KOS_LOCKSTAT
+
+#include <kernel/arch/sysreg.h>
+
+#define LOCKSTAT_INIT(lock_name) { .name = (lock_name) }
+
+static inline uint64_t lockstat_now() {
+  return read_sysreg(cntvct_el0);
+}
+
+/**
+ * Accounts a wait for the lock, called once it is acquired
+ * @param stat the counters of the lock
+ * @param start lockstat_now() when the wait began
+ */
+void lockstat_contended(struct lockstat *stat, uint64_t start);
+
+/**
+ * Accounts an acquisition, the lock registers itself on its first one
+ * @param stat the counters of the lock
+ * @param exclusive whether the hold time must be measured (not for readers)
+ */
+void lockstat_acquired(struct lockstat *stat, int exclusive);
+
+/**
+ * Accounts the end of an exclusive hold, called before the lock is released
+ * @param stat the counters of the lock
+ */
+void lockstat_released(struct lockstat *stat);
+
+/**
+ * Prints the most contended locks with their acquisitions, wait and hold times
+ */
+void lockstat_dump();
+
+/**
+ * Clears the counters of every registered lock
+ */
+void lockstat_reset();
+
+#else
+
+// Without KOS_LOCKSTAT locks carry no counters and the hooks compile to nothing
+#define LOCKSTAT_INIT(lock_name) {}
+#define lockstat_now() 0
+#define lockstat_contended(stat, start) ((void) (start))
+#define lockstat_acquired(stat, exclusive) do {} while (0)
+#define lockstat_released(stat) do {} while (0)
+#define lockstat_dump() do {} while (0)
+#define lockstat_reset() do {} while (0)
+
+#endif
@@ -0,0 +1,67 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <kernel/sync/lockstat.h>
+
+/**
+ * Queue entry of a core waiting for or holding an MCS lock, usually on its stack.
+ * Each waiter spins on its own entry, so a handover touches a single remote line.
+ */
+struct mcs_node {
+  struct mcs_node *next;
+  volatile uint32_t locked;
+};
+
+/**
+ * MCS queue lock, for structures contended by many cores. A zeroed lock is unlocked.
+ */
+struct mcs_lock {
+  struct mcs_node *tail;
+#ifdef KOS_LOCKSTAT
+  struct lockstat stat;
+#endif
+};
+
+#ifdef KOS_LOCKSTAT
+#define MCS_LOCK_INIT(lock_name) { .stat = LOCKSTAT_INIT(lock_name) }
+#else
+#define MCS_LOCK_INIT(lock_name) {}
+#endif
+
+/**
+ * Initializes an unlocked MCS lock
+ * @param lock the lock
+ * @param name the name shown by lockstat_dump, it must outlive the lock
+ */
+static inline void mcs_lock_init(struct mcs_lock *lock, const char *name) {
+  *lock = (struct mcs_lock) MCS_LOCK_INIT(name);
+}
+
+/**
+ * Acquires an MCS lock
+ * @param lock the lock
+ * @param node the queue entry of the caller, it must live until mcs_unlock
+ */
+void mcs_lock(struct mcs_lock *lock, struct mcs_node *node);
+
+/**
+ * Releases an MCS lock, handing it to the next queued core
+ * @param lock the lock
+ * @param node the queue entry given to mcs_lock
+ */
+void mcs_unlock(struct mcs_lock *lock, struct mcs_node *node);
+
+/**
+ * Masks IRQs on the calling core and acquires an MCS lock
+ * @return the previous IRQ mask, for mcs_unlock_irqrestore
+ */
+uint64_t mcs_lock_irqsave(struct mcs_lock *lock, struct mcs_node *node);
+
+/**
+ * Releases an MCS lock taken with mcs_lock_irqsave and restores the IRQ mask
+ */
+void mcs_unlock_irqrestore(struct mcs_lock *lock, struct mcs_node *node, uint64_t flags);
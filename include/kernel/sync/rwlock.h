@@ -0,0 +1,62 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <kernel/sync/lockstat.h>
+
+#define RWLOCK_WRITER (1U << 31)
+#define RWLOCK_WRITER_WAITING (1U << 30) // New readers wait, writers do not starve
+#define RWLOCK_READERS_MASK (RWLOCK_WRITER_WAITING - 1)
+
+/**
+ * Reader-writer spinlock: any number of readers or a single writer. A zeroed
+ * lock is unlocked.
+ */
+struct rwlock {
+  volatile uint32_t value;
+#ifdef KOS_LOCKSTAT
+  struct lockstat stat;
+#endif
+};
+
+#ifdef KOS_LOCKSTAT
+#define RWLOCK_INIT(lock_name) { .stat = LOCKSTAT_INIT(lock_name) }
+#else
+#define RWLOCK_INIT(lock_name) {}
+#endif
+
+/**
+ * Initializes an unlocked reader-writer lock
+ * @param lock the lock
+ * @param name the name shown by lockstat_dump, it must outlive the lock
+ */
+static inline void rwlock_init(struct rwlock *lock, const char *name) {
+  *lock = (struct rwlock) RWLOCK_INIT(name);
+}
+
+/**
+ * Acquires a reader-writer lock for reading, waits while a writer holds it or waits for it
+ * @param lock the lock
+ */
+void rwlock_read_lock(struct rwlock *lock);
+
+/**
+ * Releases a read hold
+ * @param lock the lock
+ */
+void rwlock_read_unlock(struct rwlock *lock);
+
+/**
+ * Acquires a reader-writer lock for writing, once every reader is gone
+ * @param lock the lock
+ */
+void rwlock_write_lock(struct rwlock *lock);
+
+/**
+ * Releases a write hold
+ * @param lock the lock
+ */
+void rwlock_write_unlock(struct rwlock *lock);
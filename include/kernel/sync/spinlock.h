@@ -0,0 +1,159 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <kernel/sync/lockstat.h>
+#include <kernel/sync/wait.h>
+#ifndef KOS_HOST
+#include <kernel/arch/sysreg.h>
+#endif
+
+#define SPINLOCK_TICKET_NEXT (1U << 16)
+
+/**
+ * Ticket spinlock: cores are served in the order they took a ticket and wait in
+ * WFE, unlike test-and-set locks whose cache line bounces between every waiter.
+ * A zeroed lock is unlocked.
+ */
+struct spinlock {
+  union {
+    volatile uint32_t ticket;
+    struct {
+      volatile uint16_t owner; // Ticket being served, the low half
+      volatile uint16_t next;  // Next ticket to hand out
+    };
+  };
+#ifdef KOS_LOCKSTAT
+  struct lockstat stat;
+#endif
+};
+
+#ifdef KOS_LOCKSTAT
+#define SPINLOCK_INIT(lock_name) { .stat = LOCKSTAT_INIT(lock_name) }
+#else
+#define SPINLOCK_INIT(lock_name) {}
+#endif
+
+/**
+ * Initializes an unlocked spinlock
+ * @param lock the lock
+ * @param name the name shown by lockstat_dump, it must outlive the lock
+ */
+static inline void spin_lock_init(struct spinlock *lock, const char *name) {
+  *lock = (struct spinlock) SPINLOCK_INIT(name);
+}
+
+// Takes a ticket, returns the lock word before the increment
+static inline uint32_t spin_take_ticket(struct spinlock *lock) {
+#ifdef KOS_HOST
+  return __atomic_fetch_add(&lock->ticket, SPINLOCK_TICKET_NEXT, __ATOMIC_ACQUIRE);
+#else
+  uint32_t old, new, failed;
+  __asm__ volatile(
+      "   prfm pstl1strm, %3\n"
+      "1: ldaxr %w0, %3\n"
+      "   add %w1, %w0, %w4\n"
+      "   stxr %w2, %w1, %3\n"
+      "   cbnz %w2, 1b\n"
+      : "=&r"(old), "=&r"(new), "=&r"(failed), "+Q"(lock->ticket)
+      : "r"(SPINLOCK_TICKET_NEXT)
+      : "memory");
+  return old;
+#endif
+}
+
+/**
+ * Acquires a spinlock
+ * @param lock the lock
+ */
+static inline void spin_lock(struct spinlock *lock) {
+  uint32_t value = spin_take_ticket(lock);
+  uint16_t ticket = value >> 16;
+  if ((uint16_t) value != ticket) {
+    uint64_t start = lockstat_now();
+    // Woken up by every change of the word, the new owner or a new ticket
+    while ((uint16_t) value != ticket) {
+      value = sync_wait_while(&lock->ticket, value);
+    }
+    lockstat_contended(&lock->stat, start);
+  }
+  lockstat_acquired(&lock->stat, 1);
+}
+
+/**
+ * Acquires a spinlock if it is free
+ * @param lock the lock
+ * @return 1 if the lock was acquired, 0 otherwise
+ */
+static inline int spin_trylock(struct spinlock *lock) {
+  uint32_t value = __atomic_load_n(&lock->ticket, __ATOMIC_RELAXED);
+  if ((uint16_t) value != (value >> 16) ||
+      !__atomic_compare_exchange_n(&lock->ticket, &value, value + SPINLOCK_TICKET_NEXT, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  lockstat_acquired(&lock->stat, 1);
+  return 1;
+}
+
+/**
+ * Releases a spinlock, serving the next ticket
+ * @param lock the lock
+ */
+static inline void spin_unlock(struct spinlock *lock) {
+  lockstat_released(&lock->stat);
+  // A 16-bit STLRH: the owner must not carry into the next ticket
+  __atomic_store_n(&lock->owner, (uint16_t) (lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Masks IRQs on the calling core and acquires a spinlock, for locks also taken
+ * by interrupt handlers
+ * @param lock the lock
+ * @return the previous IRQ mask, for spin_unlock_irqrestore
+ */
+static inline uint64_t spin_lock_irqsave(struct spinlock *lock) {
+#ifdef KOS_HOST
+  uint64_t flags = 0;
+#else
+  uint64_t flags = local_irq_save();
+#endif
+  spin_lock(lock);
+  return flags;
+}
+
+/**
+ * Masks IRQs and acquires a spinlock if it is free, restoring the mask otherwise
+ * @param lock the lock
+ * @param flags receives the previous IRQ mask, for spin_unlock_irqrestore
+ * @return 1 if the lock was acquired, 0 otherwise
+ */
+static inline int spin_trylock_irqsave(struct spinlock *lock, uint64_t *flags) {
+#ifdef KOS_HOST
+  *flags = 0;
+  return spin_trylock(lock);
+#else
+  *flags = local_irq_save();
+  if (spin_trylock(lock)) {
+    return 1;
+  }
+  local_irq_restore(*flags);
+  return 0;
+#endif
+}
+
+/**
+ * Releases a spinlock taken with spin_lock_irqsave and restores the IRQ mask
+ * @param lock the lock
+ * @param flags what spin_lock_irqsave returned
+ */
+static inline void spin_unlock_irqrestore(struct spinlock *lock, uint64_t flags) {
+  spin_unlock(lock);
+#ifndef KOS_HOST
+  local_irq_restore(flags);
+#else
+  (void) flags;
+#endif
+}
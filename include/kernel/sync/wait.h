@@ -0,0 +1,50 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#ifdef KOS_HOST
+#include <sched.h>
+#endif
+
+/**
+ * Waits until a word differs from a value, in WFE between checks. LDAXR arms the
+ * exclusive monitor, the store of another core to the word clears it and wakes
+ * the core up, so waiters do not hammer the cache line.
+ * @param addr the word
+ * @param value the value to wait on
+ * @return the new value, read with acquire semantics
+ */
+static inline uint32_t sync_wait_while(volatile uint32_t *addr, uint32_t value) {
+  uint32_t current;
+#ifdef KOS_HOST
+  // Host threads may outnumber the CPUs, the one to wait on could be preempted
+  while ((current = __atomic_load_n(addr, __ATOMIC_ACQUIRE)) == value) {
+    sched_yield();
+  }
+#else
+  __asm__ volatile(
+      "   sevl\n"
+      "1: wfe\n"
+      "   ldaxr %w0, %1\n"
+      "   cmp %w0, %w2\n"
+      "   b.eq 1b\n"
+      : "=&r"(current)
+      : "Q"(*addr), "r"(value)
+      : "cc", "memory");
+#endif
+  return current;
+}
+
+/**
+ * Hints a busy-wait loop that is not worth a WFE
+ */
+static inline void sync_relax() {
+#ifdef KOS_HOST
+  sched_yield();
+#else
+  __asm__ volatile("yield" : : : "memory");
+#endif
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/sync/spinlock.h>
+
+#define NSEC_PER_USEC 1000UL
+#define NSEC_PER_MSEC 1000000UL
+#define NSEC_PER_SEC 1000000000UL
+
+// Timer wheel: TIMER_LEVELS levels of 64 slots, each level 64 times coarser than the one below
+#define TIMER_UNIT_SHIFT 10 // Resolution of the wheel: 1024 ns
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 8      // Horizon: 2^48 units (~9 years), later timers are queued again
+#define TIMER_NEVER UINT64_MAX
+
+// CNTV_CTL_EL0
+#define CNTV_CTL_ENABLE (1 << 0)
+#define CNTV_CTL_IMASK (1 << 1)
+
+struct timer;
+typedef void (*timer_fn_t)(struct timer *timer);
+
+struct timer {
+  struct timer *next;
+  struct timer **pprev; // NULL while the timer is not queued
+  uint64_t expires;     // Deadline in clock_ns time
+  timer_fn_t fn;        // Called from the timer interrupt, with IRQs masked
+  void *data;
+  struct timer_base *base;
+};
+
+/**
+ * Hierarchical timer wheel of a core. Timers are inserted and cancelled in
+ * O(1) and the next deadline is found from the occupancy bitmaps, without
+ * looking at the timers.
+ */
+struct timer_base {
+  struct spinlock lock;
+  uint32_t irq_enabled;    // The timer PPI is enabled on this core
+  uint32_t running;        // Expiring timers, callbacks may queue more
+  uint64_t clk;            // Wheel time in units, everything before it has been processed
+  uint64_t programmed;     // Unit loaded in CNTV_CVAL_EL0, TIMER_NEVER if the timer is off
+  uint64_t occupied[TIMER_LEVELS];
+  struct timer *slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+};
+
+/**
+ * Reads the counter frequency (CNTFRQ_EL0) and sets up clock_ns
+ */
+void clock_init();
+
+/**
+ * Overrides the counter frequency, for firmware that leaves CNTFRQ_EL0 unset
+ * @param frequency the frequency in Hz
+ */
+void clock_set_frequency(uint64_t frequency);
+
+/**
+ * Returns the counter frequency in Hz
+ */
+uint64_t clock_frequency();
+
+/**
+ * Returns the monotonic time in nanoseconds (since the counter started)
+ */
+uint64_t clock_ns();
+
+/**
+ * Converts nanoseconds to counter ticks, rounding up
+ */
+uint64_t clock_ns_to_ticks(uint64_t ns);
+
+/**
+ * Converts counter ticks to nanoseconds, rounding down
+ */
+uint64_t clock_ticks_to_ns(uint64_t ticks);
+
+/**
+ * Prepares a timer
+ * @param timer the timer
+ * @param fn called once the timer expires
+ * @param data for the function
+ */
+void timer_init(struct timer *timer, timer_fn_t fn, void *data);
+
+/**
+ * Queues a timer on the wheel of the calling core, re-arming it if it is queued
+ * @param timer the timer
+ * @param expires the deadline in clock_ns time
+ */
+void timer_add(struct timer *timer, uint64_t expires);
+
+/**
+ * Removes a timer from its wheel, from any core. It does not wait for a
+ * callback that is already running on another core.
+ * @param timer the timer
+ * @return 1 if it was queued, 0 if it already expired or was never added
+ */
+int timer_cancel(struct timer *timer);
+
+/**
+ * Blocks the calling thread for at least ns nanoseconds. Without a thread or
+ * a timer interrupt it spins on the clock.
+ * @param ns the duration
+ */
+void timer_sleep_ns(uint64_t ns);
+
+static inline void timer_sleep_us(uint64_t us) {
+  timer_sleep_ns(us * NSEC_PER_USEC);
+}
+
+/**
+ * Hooks the wheels to the timer interrupt, called by the timer driver
+ * @param intid the PPI of the virtual timer
+ */
+void timer_setup_irq(uint32_t intid);
+
+/**
+ * Enables the timer interrupt on the calling core once its CPU interface is
+ * up, called from the scheduler loop. Timers added before then stay queued,
+ * the pending interrupt is taken as soon as it is enabled.
+ */
+void timer_cpu_sync();
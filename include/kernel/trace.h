@@ -0,0 +1,88 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/smp.h>
+
+#define TRACE_RECORDS 512 // Per CPU, power of two
+#define TRACE_MAX_ARGS 5
+
+/**
+ * A trace event: the format string and its raw arguments, formatted when the
+ * record is consumed. One cache line, aligned so that records after the
+ * buffer indices never straddle two.
+ */
+struct trace_record {
+  volatile uint64_t seq; // Position + 1 once the record is complete, 0 while it is written
+  uint64_t timestamp;    // CNTVCT_EL0
+  const char *fmt;
+  uint64_t args[TRACE_MAX_ARGS];
+} __attribute__((aligned(64)));
+
+/**
+ * Ring of trace records of a core, older records are overwritten when it is full
+ */
+struct trace_buffer {
+  uint64_t head __attribute__((aligned(64))); // Next position to write
+  uint64_t tail __attribute__((aligned(64))); // Next position to consume, owned by trace_drain
+  struct trace_record records[TRACE_RECORDS];
+};
+
+extern struct trace_buffer trace_buffers[SMP_MAX_CPUS];
+
+/**
+ * Records an event in the buffer of the calling core. Safe from any context,
+ * including exception handlers.
+ * @param fmt the format string, it must outlive the record (a literal)
+ */
+static inline void trace_write(const char *fmt, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4) {
+  // TPIDR_EL1 is 0 on the boot core until smp_init
+  struct cpu *cpu = this_cpu();
+  struct trace_buffer *buffer = &trace_buffers[cpu ? cpu->id : 0];
+
+  // A position is only contended by exception handlers of the same core
+  uint64_t pos = __atomic_fetch_add(&buffer->head, 1, __ATOMIC_RELAXED);
+  struct trace_record *record = &buffer->records[pos & (TRACE_RECORDS - 1)];
+  record->seq = 0;
+  dmb(ishst);
+  record->timestamp = read_sysreg(cntvct_el0);
+  record->fmt = fmt;
+  record->args[0] = a0;
+  record->args[1] = a1;
+  record->args[2] = a2;
+  record->args[3] = a3;
+  record->args[4] = a4;
+  __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+#define __TRACE_ARG(x) ((uint64_t) (uintptr_t) (x))
+#define __TRACE_0(fmt) trace_write(fmt, 0, 0, 0, 0, 0)
+#define __TRACE_1(fmt, a) trace_write(fmt, __TRACE_ARG(a), 0, 0, 0, 0)
+#define __TRACE_2(fmt, a, b) trace_write(fmt, __TRACE_ARG(a), __TRACE_ARG(b), 0, 0, 0)
+#define __TRACE_3(fmt, a, b, c) trace_write(fmt, __TRACE_ARG(a), __TRACE_ARG(b), __TRACE_ARG(c), 0, 0)
+#define __TRACE_4(fmt, a, b, c, d) \
+  trace_write(fmt, __TRACE_ARG(a), __TRACE_ARG(b), __TRACE_ARG(c), __TRACE_ARG(d), 0)
+#define __TRACE_5(fmt, a, b, c, d, e) \
+  trace_write(fmt, __TRACE_ARG(a), __TRACE_ARG(b), __TRACE_ARG(c), __TRACE_ARG(d), __TRACE_ARG(e))
+#define __TRACE_PICK(_0, _1, _2, _3, _4, _5, name, ...) name
+
+/**
+ * Records a debug_msg-like event without formatting it: trace("CPU %d", id).
+ * Takes up to TRACE_MAX_ARGS integer or pointer arguments, strings passed
+ * with %s must outlive the record.
+ */
+#define trace(...) \
+  __TRACE_PICK(__VA_ARGS__, __TRACE_5, __TRACE_4, __TRACE_3, __TRACE_2, __TRACE_1, __TRACE_0, _)(__VA_ARGS__)
+
+/**
+ * Formats and prints every record not consumed yet, merging the cores by
+ * timestamp. Records overwritten before being consumed are counted as lost.
+ * Returns at once if another core is draining.
+ * @return the number of records printed
+ */
+uint32_t trace_drain();
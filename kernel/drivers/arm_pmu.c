@@ -0,0 +1,40 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/drivers/driver.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/perf.h>
+
+static int arm_pmu_probe(struct device *dev) {
+  uint32_t irq = irq_of_node(dev->index, dev->node, 0);
+  if (irq == IRQ_NONE) {
+    debug_msg("arm_pmu: no overflow interrupt");
+    return -1;
+  }
+  if (irq >= IRQ_PRIVATE) {
+    // One SPI per core (interrupt-affinity) is not supported yet
+    debug_msg("arm_pmu: INTID %u is not a PPI", irq);
+    return -1;
+  }
+  perf_setup_irq(irq);
+  debug_msg("arm_pmu: overflow IRQ %u", irq);
+  return 0;
+}
+
+static const struct driver_match arm_pmu_matches[] = {
+  { .compatible = "arm,armv8-pmuv3" },
+  { .compatible = "arm,cortex-a57-pmu" },
+  { .compatible = "arm,cortex-a53-pmu" },
+  { .compatible = "arm,cortex-a72-pmu" },
+  { .compatible = NULL }
+};
+
+static const struct driver arm_pmu_driver = {
+  .name = "arm_pmu",
+  .matches = arm_pmu_matches,
+  .probe = arm_pmu_probe
+};
+
+DRIVER_REGISTER(arm_pmu_driver);
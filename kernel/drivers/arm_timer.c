@@ -0,0 +1,46 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/drivers/driver.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/timer.h>
+
+// interrupts: secure physical, non-secure physical, virtual and hypervisor timers
+#define ARM_TIMER_VIRT_IRQ 2
+
+static int arm_timer_probe(struct device *dev) {
+  // Only for firmware that does not set CNTFRQ_EL0
+  const struct fdt_index_prop *frequency = fdt_index_get_prop_id(dev->index, dev->node, FDT_PROP_ID_CLOCK_FREQUENCY);
+  if (frequency && frequency->len >= sizeof(uint32_t)) {
+    clock_set_frequency(fdt_read_cells(frequency->value, 1));
+  }
+  if (!clock_frequency()) {
+    debug_msg("arm_timer: unknown counter frequency");
+    return -1;
+  }
+
+  uint32_t irq = irq_of_node(dev->index, dev->node, ARM_TIMER_VIRT_IRQ);
+  if (irq == IRQ_NONE) {
+    debug_msg("arm_timer: no virtual timer interrupt");
+    return -1;
+  }
+  timer_setup_irq(irq);
+  debug_msg("arm_timer: %lu Hz, virtual timer IRQ %u", clock_frequency(), irq);
+  return 0;
+}
+
+static const struct driver_match arm_timer_matches[] = {
+  { .compatible = "arm,armv8-timer" },
+  { .compatible = "arm,armv7-timer" },
+  { .compatible = NULL }
+};
+
+static const struct driver arm_timer_driver = {
+  .name = "arm_timer",
+  .matches = arm_timer_matches,
+  .probe = arm_timer_probe
+};
+
+DRIVER_REGISTER(arm_timer_driver);
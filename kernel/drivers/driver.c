@@ -0,0 +1,193 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/drivers/driver.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/kthread.h>
+#include <kernel/profile.h>
+#include <kernel/trace.h>
+
+// Defined by the linker script
+extern const struct driver *const __drivers_start[];
+extern const struct driver *const __drivers_end[];
+
+struct driver_slot {
+  uint32_t hash;
+  const struct driver *driver;
+  const struct driver_match *match;
+};
+
+// Open addressing table of every compatible string handled by a driver
+static struct driver_slot driver_slots[DRIVER_MATCH_SLOTS];
+
+static void driver_table_build() {
+  uint32_t n_matches = 0;
+  memset(driver_slots, 0x00, sizeof(driver_slots));
+
+  for (const struct driver *const *d = __drivers_start; d < __drivers_end; d++) {
+    for (const struct driver_match *m = (*d)->matches; m->compatible; m++) {
+      // Keep the load factor under 1/2
+      if (n_matches >= DRIVER_MATCH_SLOTS / 2) {
+        debug_msg("drivers: too many compatible strings, %s is ignored", m->compatible);
+        continue;
+      }
+
+      uint32_t hash = fdt_hash_string(m->compatible);
+      uint32_t i = hash & (DRIVER_MATCH_SLOTS - 1);
+      while (driver_slots[i].match && strcmp(driver_slots[i].match->compatible, m->compatible) != 0) {
+        i = (i + 1) & (DRIVER_MATCH_SLOTS - 1);
+      }
+      if (driver_slots[i].match) {
+        debug_msg("drivers: %s is handled by both %s and %s", m->compatible, driver_slots[i].driver->name, (*d)->name);
+        continue;
+      }
+      driver_slots[i].hash = hash;
+      driver_slots[i].driver = *d;
+      driver_slots[i].match = m;
+      n_matches++;
+    }
+  }
+}
+
+static const struct driver_slot *driver_lookup(const char *compatible) {
+  uint32_t hash = fdt_hash_string(compatible);
+  uint32_t i = hash & (DRIVER_MATCH_SLOTS - 1);
+  while (driver_slots[i].match) {
+    if (driver_slots[i].hash == hash && strcmp(driver_slots[i].match->compatible, compatible) == 0) {
+      return &driver_slots[i];
+    }
+    i = (i + 1) & (DRIVER_MATCH_SLOTS - 1);
+  }
+  return NULL;
+}
+
+static int device_enabled(const struct fdt_index *index, uint32_t node) {
+  const struct fdt_index_prop *status = fdt_index_get_prop_id(index, node, FDT_PROP_ID_STATUS);
+  if (!status || !status->len) {
+    return 1;
+  }
+  return strcmp(status->value, "okay") == 0 || strcmp(status->value, "ok") == 0;
+}
+
+static int driver_probe_device(void *arg) {
+  struct device *dev = arg;
+  PROFILE_SCOPE(dev->driver->name);
+  trace("drivers: probing %s with %s", device_name(dev), dev->driver->name);
+  dev->result = dev->driver->probe(dev);
+  uint32_t state = DEVICE_BOUND;
+  if (dev->result == DRIVER_NO_DEVICE) {
+    trace("drivers: nothing for %s at %s", dev->driver->name, device_name(dev));
+    state = DEVICE_ABSENT;
+  } else if (dev->result) {
+    debug_msg("drivers: %s failed to probe %s (%d)", dev->driver->name, device_name(dev), dev->result);
+    state = DEVICE_FAILED;
+  }
+  __atomic_store_n(&dev->state, state, __ATOMIC_RELEASE);
+  return dev->result;
+}
+
+// Starts every pending device whose dependency is settled, returns how many were started
+static uint32_t driver_probe_wave(struct device *devices, uint32_t n_devices, struct kthread **threads) {
+  uint32_t n_threads = 0;
+  uint32_t n_started = 0;
+  for (uint32_t d = 0; d < n_devices; d++) {
+    struct device *dev = &devices[d];
+    if (dev->state != DEVICE_PENDING) {
+      continue;
+    }
+    if (dev->depends_on != FDT_INDEX_NONE) {
+      uint32_t state = devices[dev->depends_on].state;
+      if (state == DEVICE_PENDING || state == DEVICE_PROBING) {
+        continue;
+      }
+    }
+
+    dev->state = DEVICE_PROBING;
+    n_started++;
+    struct kthread *thread = kthread_spawn(driver_probe_device, dev);
+    if (thread) {
+      threads[n_threads++] = thread;
+    } else {
+      driver_probe_device(dev);
+    }
+  }
+
+  for (uint32_t t = 0; t < n_threads; t++) {
+    kthread_join(threads[t]);
+  }
+  return n_started;
+}
+
+uint32_t driver_probe_all(const struct fdt_index *index) {
+  if (!index->n_nodes) {
+    return 0;
+  }
+  driver_table_build();
+
+  // At most one device per node, node_device maps a node to its device
+  size_t devices_size = index->n_nodes * sizeof(struct device);
+  size_t map_size = index->n_nodes * sizeof(uint32_t);
+  size_t threads_size = index->n_nodes * sizeof(struct kthread *);
+  void *block = kmalloc(devices_size + map_size + threads_size);
+  if (!block) {
+    debug_msg("drivers: no memory to probe %d nodes", index->n_nodes);
+    return 0;
+  }
+  struct device *devices = block;
+  uint32_t *node_device = block + devices_size;
+  struct kthread **threads = block + devices_size + map_size;
+  memset(node_device, 0xFF, map_size);
+
+  // Compatible entries come grouped per node, in list order: the first hit wins
+  uint32_t n_devices = 0;
+  for (uint32_t c = 0; c < index->n_compats; c++) {
+    const struct fdt_index_compat *compat = &index->compats[c];
+    if (node_device[compat->node] != FDT_INDEX_NONE) {
+      continue;
+    }
+    const struct driver_slot *slot = driver_lookup(compat->compatible);
+    if (!slot || !device_enabled(index, compat->node)) {
+      continue;
+    }
+
+    struct device *dev = &devices[n_devices];
+    memset(dev, 0x00, sizeof(struct device));
+    dev->index = index;
+    dev->node = compat->node;
+    dev->driver = slot->driver;
+    dev->match = slot->match;
+    dev->state = DEVICE_PENDING;
+    node_device[compat->node] = n_devices++;
+  }
+
+  // Interrupt controllers are probed before the devices that use them
+  for (uint32_t d = 0; d < n_devices; d++) {
+    uint32_t parent = fdt_index_interrupt_parent(index, devices[d].node);
+    devices[d].depends_on = FDT_INDEX_NONE;
+    if (parent != FDT_INDEX_NONE && parent != devices[d].node) {
+      devices[d].depends_on = node_device[parent];
+    }
+  }
+
+  uint32_t n_probed = 0;
+  while (n_probed < n_devices) {
+    uint32_t n_started = driver_probe_wave(devices, n_devices, threads);
+    if (!n_started) {
+      debug_msg("drivers: dependency cycle, %d devices are not probed", n_devices - n_probed);
+      break;
+    }
+    n_probed += n_started;
+  }
+
+  uint32_t n_bound = 0;
+  for (uint32_t d = 0; d < n_devices; d++) {
+    if (devices[d].state == DEVICE_BOUND) {
+      debug_msg("drivers: %s bound to %s", device_name(&devices[d]), devices[d].driver->name);
+      n_bound++;
+    }
+  }
+  // Bound devices stay alive, drivers keep pointers to them
+  return n_bound;
+}
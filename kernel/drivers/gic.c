@@ -0,0 +1,356 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/drivers/gic.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/smp.h>
+
+#define GIC_PRIORITY_WORD (GIC_PRIORITY_DEFAULT * 0x01010101U)
+
+static struct gic gic = { .lock = SPINLOCK_INIT("gic") };
+
+// Per-core state, filled in by the cpu_init of each core
+static volatile uint8_t *gicr_frames[SMP_MAX_CPUS]; // GICv3 redistributor of the core
+static uint8_t gicv2_cpu_masks[SMP_MAX_CPUS];       // GICv2 CPU interface of the core
+
+static inline uint32_t gic_read(volatile uint8_t *base, uint32_t offset) {
+  return *(volatile uint32_t *) (base + offset);
+}
+
+static inline void gic_write(volatile uint8_t *base, uint32_t offset, uint32_t value) {
+  *(volatile uint32_t *) (base + offset) = value;
+}
+
+static inline uint64_t gic_read64(volatile uint8_t *base, uint32_t offset) {
+  return *(volatile uint64_t *) (base + offset);
+}
+
+static inline void gic_write64(volatile uint8_t *base, uint32_t offset, uint64_t value) {
+  *(volatile uint64_t *) (base + offset) = value;
+}
+
+static void gic_lock() {
+  spin_lock(&gic.lock);
+}
+
+static void gic_unlock() {
+  spin_unlock(&gic.lock);
+}
+
+// Interrupt specifiers have 3 cells: <type number flags>
+static uint32_t gic_xlate(const uint32_t *cells, uint32_t n_cells, uint32_t *trigger) {
+  if (n_cells < 3) {
+    return IRQ_NONE;
+  }
+  uint32_t type = fdt_read_cells(cells, 1);
+  uint32_t number = fdt_read_cells(cells + 1, 1);
+  uint32_t flags = fdt_read_cells(cells + 2, 1);
+  *trigger = (flags & GIC_SPEC_EDGE_MASK) ? IRQ_TRIGGER_EDGE : IRQ_TRIGGER_LEVEL;
+
+  if (type == GIC_SPEC_SPI) {
+    return number + IRQ_SPI_BASE < gic.n_lines ? number + IRQ_SPI_BASE : IRQ_NONE;
+  } else if (type == GIC_SPEC_PPI) {
+    return number < IRQ_PRIVATE - IRQ_PPI_BASE ? number + IRQ_PPI_BASE : IRQ_NONE;
+  }
+  return IRQ_NONE;
+}
+
+// GICD_ICFGR<n> has two bits per interrupt, the upper one selects edge triggering
+static void gic_set_trigger_reg(volatile uint8_t *base, uint32_t offset, uint32_t intid, uint32_t trigger) {
+  uint32_t bit = 2 << ((intid % 16) * 2);
+  gic_lock();
+  uint32_t icfgr = gic_read(base, offset);
+  icfgr = trigger == IRQ_TRIGGER_EDGE ? icfgr | bit : icfgr & ~bit;
+  gic_write(base, offset, icfgr);
+  gic_unlock();
+}
+
+/* GICv2 */
+
+static uint32_t gicv2_ack() {
+  return gic_read(gic.cpu, GICC_IAR);
+}
+
+static void gicv2_eoi(uint32_t iar) {
+  gic_write(gic.cpu, GICC_EOIR, iar);
+}
+
+// Private interrupts are banked in the distributor, so every register is reached the same way
+static void gicv2_enable(uint32_t intid) {
+  gic_write(gic.dist, GICD_ISENABLER + (intid / 32) * 4, 1U << (intid % 32));
+}
+
+static void gicv2_disable(uint32_t intid) {
+  gic_write(gic.dist, GICD_ICENABLER + (intid / 32) * 4, 1U << (intid % 32));
+}
+
+static void gicv2_set_trigger(uint32_t intid, uint32_t trigger) {
+  if (intid >= IRQ_PPI_BASE) {
+    gic_set_trigger_reg(gic.dist, GICD_ICFGR + (intid / 16) * 4, intid, trigger);
+  }
+}
+
+static void gicv2_send_sgi(uint32_t cpu, uint32_t intid) {
+  uint32_t mask = gicv2_cpu_masks[cpu];
+  if (mask) {
+    // Writes to normal memory must be visible to the target first
+    dsb(ishst);
+    gic_write(gic.dist, GICD_SGIR, (mask << 16) | intid);
+  }
+}
+
+static void gicv2_cpu_init() {
+  // GICD_ITARGETSR0-7 are banked and read as the interface of the calling core
+  gicv2_cpu_masks[this_cpu()->id] = gic_read(gic.dist, GICD_ITARGETSR) & 0xFF;
+
+  // SGIs stay enabled, PPIs wait for irq_enable
+  gic_write(gic.dist, GICD_ICENABLER, 0xFFFF0000);
+  gic_write(gic.dist, GICD_ISENABLER, 0x0000FFFF);
+  for (uint32_t intid = 0; intid < IRQ_PRIVATE; intid += 4) {
+    gic_write(gic.dist, GICD_IPRIORITYR + intid, GIC_PRIORITY_WORD);
+  }
+
+  gic_write(gic.cpu, GICC_PMR, GIC_PRIORITY_MASK_ALL);
+  gic_write(gic.cpu, GICC_BPR, 0);
+  gic_write(gic.cpu, GICC_CTLR, 1);
+}
+
+static void gicv2_dist_init() {
+  gic_write(gic.dist, GICD_CTLR, 0);
+
+  // SPIs go to the core probing the controller
+  uint32_t target = gic_read(gic.dist, GICD_ITARGETSR) & 0xFF;
+  for (uint32_t intid = IRQ_SPI_BASE; intid < gic.n_lines; intid += 4) {
+    gic_write(gic.dist, GICD_IPRIORITYR + intid, GIC_PRIORITY_WORD);
+    gic_write(gic.dist, GICD_ITARGETSR + intid, target * 0x01010101U);
+  }
+  for (uint32_t intid = IRQ_SPI_BASE; intid < gic.n_lines; intid += 32) {
+    gic_write(gic.dist, GICD_ICENABLER + intid / 8, 0xFFFFFFFF);
+    gic_write(gic.dist, GICD_ICPENDR + intid / 8, 0xFFFFFFFF);
+  }
+
+  gic_write(gic.dist, GICD_CTLR, GICD_CTLR_ENABLE);
+}
+
+static struct irq_chip gicv2_chip = {
+  .name = "gicv2",
+  .ack = gicv2_ack,
+  .eoi = gicv2_eoi,
+  .enable = gicv2_enable,
+  .disable = gicv2_disable,
+  .set_trigger = gicv2_set_trigger,
+  .send_sgi = gicv2_send_sgi,
+  .cpu_init = gicv2_cpu_init,
+  .xlate = gic_xlate
+};
+
+/* GICv3 */
+
+static void gicv3_wait_rwp(volatile uint8_t *base, uint32_t offset, uint32_t rwp) {
+  while (gic_read(base, offset) & rwp) {}
+}
+
+static uint32_t gicv3_ack() {
+  uint32_t iar = read_sysreg(ICC_IAR1_EL1);
+  // Reads of the device state made by the handler must not pass the acknowledge
+  dsb(sy);
+  return iar;
+}
+
+static void gicv3_eoi(uint32_t iar) {
+  write_sysreg(ICC_EOIR1_EL1, iar);
+}
+
+static void gicv3_enable(uint32_t intid) {
+  if (intid < IRQ_PRIVATE) {
+    volatile uint8_t *rd = gicr_frames[this_cpu()->id];
+    if (rd) {
+      gic_write(rd, GICR_ISENABLER0, 1U << intid);
+    }
+  } else {
+    gic_write(gic.dist, GICD_ISENABLER + (intid / 32) * 4, 1U << (intid % 32));
+  }
+}
+
+static void gicv3_disable(uint32_t intid) {
+  if (intid < IRQ_PRIVATE) {
+    volatile uint8_t *rd = gicr_frames[this_cpu()->id];
+    if (rd) {
+      gic_write(rd, GICR_ICENABLER0, 1U << intid);
+      gicv3_wait_rwp(rd, GICR_CTLR, GICR_CTLR_RWP);
+    }
+  } else {
+    gic_write(gic.dist, GICD_ICENABLER + (intid / 32) * 4, 1U << (intid % 32));
+    gicv3_wait_rwp(gic.dist, GICD_CTLR, GICD_CTLR_RWP);
+  }
+}
+
+static void gicv3_set_trigger(uint32_t intid, uint32_t trigger) {
+  if (intid < IRQ_PPI_BASE) {
+    return;
+  }
+  if (intid < IRQ_PRIVATE) {
+    volatile uint8_t *rd = gicr_frames[this_cpu()->id];
+    if (rd) {
+      gic_set_trigger_reg(rd, GICR_ICFGR0 + 4, intid, trigger);
+    }
+  } else {
+    gic_set_trigger_reg(gic.dist, GICD_ICFGR + (intid / 16) * 4, intid, trigger);
+  }
+}
+
+static void gicv3_send_sgi(uint32_t cpu, uint32_t intid) {
+  // Target list holds Aff0, the rest of the affinity is given in full
+  uint64_t mpidr = cpus[cpu].mpidr;
+  uint64_t sgi1r = (1UL << (mpidr & 0xF)) |
+                   (((mpidr >> 8) & 0xFF) << 16) |
+                   ((uint64_t) intid << 24) |
+                   (((mpidr >> 16) & 0xFF) << 32) |
+                   (((mpidr >> 32) & 0xFF) << 48);
+  dsb(ishst);
+  write_sysreg(ICC_SGI1R_EL1, sgi1r);
+  isb();
+}
+
+// Affinity as GICR_TYPER reports it: Aff3.Aff2.Aff1.Aff0
+static uint32_t gicv3_affinity(uint64_t mpidr) {
+  return (uint32_t) (((mpidr >> 32) & 0xFF) << 24) | (uint32_t) (mpidr & 0xFFFFFF);
+}
+
+static volatile uint8_t *gicv3_find_frame(uint64_t mpidr) {
+  uint32_t affinity = gicv3_affinity(mpidr);
+  uint64_t offset = 0;
+  while (offset + 2 * GICR_FRAME_SIZE <= gic.redist_size) {
+    volatile uint8_t *rd = gic.redist + offset;
+    uint64_t typer = gic_read64(rd, GICR_TYPER);
+    if (GICR_TYPER_AFFINITY(typer) == affinity) {
+      return rd;
+    }
+    if (typer & GICR_TYPER_LAST) {
+      break;
+    }
+    // GICv4 adds two frames for virtual LPIs
+    offset += (typer & GICR_TYPER_VLPIS) ? 4 * GICR_FRAME_SIZE : 2 * GICR_FRAME_SIZE;
+  }
+  return NULL;
+}
+
+static void gicv3_cpu_init() {
+  struct cpu *cpu = this_cpu();
+  volatile uint8_t *rd = gicv3_find_frame(read_sysreg(mpidr_el1));
+  if (!rd) {
+    debug_msg("GIC: no redistributor for CPU %u", cpu->id);
+    return;
+  }
+  gicr_frames[cpu->id] = rd;
+
+  uint32_t waker = gic_read(rd, GICR_WAKER);
+  gic_write(rd, GICR_WAKER, waker & ~GICR_WAKER_PROCESSOR_SLEEP);
+  while (gic_read(rd, GICR_WAKER) & GICR_WAKER_CHILDREN_ASLEEP) {}
+
+  gic_write(rd, GICR_IGROUPR0, 0xFFFFFFFF);
+  gic_write(rd, GICR_ICENABLER0, 0xFFFF0000);
+  gic_write(rd, GICR_ISENABLER0, 0x0000FFFF);
+  for (uint32_t intid = 0; intid < IRQ_PRIVATE; intid += 4) {
+    gic_write(rd, GICR_IPRIORITYR + intid, GIC_PRIORITY_WORD);
+  }
+  gicv3_wait_rwp(rd, GICR_CTLR, GICR_CTLR_RWP);
+
+  write_sysreg(ICC_SRE_EL1, read_sysreg(ICC_SRE_EL1) | ICC_SRE_SRE);
+  isb();
+  write_sysreg(ICC_PMR_EL1, GIC_PRIORITY_MASK_ALL);
+  write_sysreg(ICC_BPR1_EL1, 0);
+  write_sysreg(ICC_IGRPEN1_EL1, 1);
+  isb();
+}
+
+static void gicv3_dist_init() {
+  gic_write(gic.dist, GICD_CTLR, 0);
+  gicv3_wait_rwp(gic.dist, GICD_CTLR, GICD_CTLR_RWP);
+
+  // SPIs go to the core probing the controller
+  uint64_t mpidr = read_sysreg(mpidr_el1);
+  uint64_t route = (mpidr & 0xFFFFFF) | (((mpidr >> 32) & 0xFF) << 32);
+  for (uint32_t intid = IRQ_SPI_BASE; intid < gic.n_lines; intid += 32) {
+    gic_write(gic.dist, GICD_IGROUPR + intid / 8, 0xFFFFFFFF);
+    gic_write(gic.dist, GICD_ICENABLER + intid / 8, 0xFFFFFFFF);
+    gic_write(gic.dist, GICD_ICPENDR + intid / 8, 0xFFFFFFFF);
+  }
+  for (uint32_t intid = IRQ_SPI_BASE; intid < gic.n_lines; intid += 4) {
+    gic_write(gic.dist, GICD_IPRIORITYR + intid, GIC_PRIORITY_WORD);
+  }
+  gicv3_wait_rwp(gic.dist, GICD_CTLR, GICD_CTLR_RWP);
+
+  gic_write(gic.dist, GICD_CTLR, GICD_CTLR_ARE | GICD_CTLR_ENABLE_G1);
+  gicv3_wait_rwp(gic.dist, GICD_CTLR, GICD_CTLR_RWP);
+  for (uint32_t intid = IRQ_SPI_BASE; intid < gic.n_lines; intid++) {
+    gic_write64(gic.dist, GICD_IROUTER + intid * 8, route);
+  }
+}
+
+static struct irq_chip gicv3_chip = {
+  .name = "gicv3",
+  .ack = gicv3_ack,
+  .eoi = gicv3_eoi,
+  .enable = gicv3_enable,
+  .disable = gicv3_disable,
+  .set_trigger = gicv3_set_trigger,
+  .send_sgi = gicv3_send_sgi,
+  .cpu_init = gicv3_cpu_init,
+  .xlate = gic_xlate
+};
+
+static int gic_probe(struct device *dev) {
+  if (gic.dist) {
+    return -1;
+  }
+
+  uint64_t dist_address, dist_size, second_address, second_size;
+  if (device_reg(dev, 0, &dist_address, &dist_size) || device_reg(dev, 1, &second_address, &second_size)) {
+    return -1;
+  }
+
+  gic.version = (enum gic_version) (uintptr_t) dev->match->data;
+  gic.dist = (volatile uint8_t *) dist_address;
+  gic.n_lines = GICD_TYPER_LINES(gic_read(gic.dist, GICD_TYPER));
+  if (gic.n_lines > IRQ_MAX) {
+    gic.n_lines = IRQ_MAX;
+  }
+
+  struct irq_chip *chip;
+  if (gic.version == GIC_V3) {
+    gic.redist = (volatile uint8_t *) second_address;
+    gic.redist_size = second_size;
+    gicv3_dist_init();
+    chip = &gicv3_chip;
+  } else {
+    gic.cpu = (volatile uint8_t *) second_address;
+    gicv2_dist_init();
+    chip = &gicv2_chip;
+  }
+
+  chip->node = dev->node;
+  dev->priv = &gic;
+  irq_register_chip(chip);
+  debug_msg("GIC: v%u at %#lx, %u interrupt lines", gic.version, dist_address, gic.n_lines);
+  return 0;
+}
+
+static const struct driver_match gic_matches[] = {
+  { .compatible = "arm,gic-v3", .data = (const void *) (uintptr_t) GIC_V3 },
+  { .compatible = "arm,gic-400", .data = (const void *) (uintptr_t) GIC_V2 },
+  { .compatible = "arm,cortex-a15-gic", .data = (const void *) (uintptr_t) GIC_V2 },
+  { .compatible = "arm,cortex-a9-gic", .data = (const void *) (uintptr_t) GIC_V2 },
+  { .compatible = NULL }
+};
+
+static const struct driver gic_driver = {
+  .name = "gic",
+  .matches = gic_matches,
+  .probe = gic_probe
+};
+
+DRIVER_REGISTER(gic_driver);
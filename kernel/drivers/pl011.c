@@ -0,0 +1,276 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/drivers/pl011.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+
+#define CHOSEN_NODE_PATH "/chosen"
+#define ALIASES_NODE_PATH "/aliases"
+#define PL011_PATH_MAX 128
+
+static struct pl011 *console_uart = NULL;
+
+static inline uint32_t pl011_read(struct pl011 *uart, uint32_t offset) {
+  return uart->base[offset / sizeof(uint32_t)];
+}
+
+static inline void pl011_write(struct pl011 *uart, uint32_t offset, uint32_t value) {
+  uart->base[offset / sizeof(uint32_t)] = value;
+}
+
+// Bounded MPMC queue (one sequence number per slot), returns -1 when full
+static int pl011_ring_push(struct pl011_ring *ring, char c) {
+  uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  while (1) {
+    struct pl011_slot *slot = &ring->slots[pos & (PL011_RING_SIZE - 1)];
+    int32_t diff = (int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->c = c;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Only called by the owner of pl011.draining, returns -1 when there is nothing ready
+static int pl011_ring_pop(struct pl011_ring *ring, char *c) {
+  uint32_t pos = ring->tail;
+  struct pl011_slot *slot = &ring->slots[pos & (PL011_RING_SIZE - 1)];
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+    return -1;
+  }
+  *c = slot->c;
+  ring->tail = pos + 1;
+  __atomic_store_n(&slot->seq, pos + PL011_RING_SIZE, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int pl011_ring_empty(struct pl011_ring *ring) {
+  uint32_t pos = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&ring->slots[pos & (PL011_RING_SIZE - 1)].seq, __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+// Moves characters from the ring to the TX FIFO, waiting for FIFO room if wait is set
+static void pl011_drain(struct pl011 *uart, int wait) {
+  while (1) {
+    // IRQs are masked so that the TX interrupt cannot spin on a drain it interrupted
+    uint64_t flags = local_irq_save();
+    if (__atomic_exchange_n(&uart->draining, 1, __ATOMIC_ACQUIRE)) {
+      local_irq_restore(flags);
+      return;
+    }
+
+    // Fill the FIFO in bulk, only the flag register is polled between characters
+    char c;
+    while (1) {
+      if (pl011_read(uart, PL011_FR) & PL011_FR_TXFF) {
+        if (!wait) {
+          break;
+        }
+        continue;
+      }
+      if (pl011_ring_pop(&uart->ring, &c)) {
+        break;
+      }
+      pl011_write(uart, PL011_DR, (uint32_t) c);
+    }
+
+    __atomic_store_n(&uart->draining, 0, __ATOMIC_RELEASE);
+    local_irq_restore(flags);
+
+    // A writer may have pushed after the last pop and found the ring busy
+    if (pl011_ring_empty(&uart->ring) || (!wait && (pl011_read(uart, PL011_FR) & PL011_FR_TXFF))) {
+      return;
+    }
+  }
+}
+
+void pl011_putc(struct pl011 *uart, char c) {
+  while (pl011_ring_push(&uart->ring, c)) {
+    // Ring full: make room by sending synchronously
+    pl011_drain(uart, 1);
+  }
+  pl011_drain(uart, !uart->irq_enabled);
+}
+
+void pl011_write_chars(struct pl011 *uart, const char *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    while (pl011_ring_push(&uart->ring, buf[i])) {
+      pl011_drain(uart, 1);
+    }
+  }
+  pl011_drain(uart, !uart->irq_enabled);
+}
+
+void pl011_putc_sync(struct pl011 *uart, char c) {
+  while (pl011_read(uart, PL011_FR) & PL011_FR_TXFF) {}
+  pl011_write(uart, PL011_DR, (uint32_t) c);
+}
+
+void pl011_flush(struct pl011 *uart) {
+  // Another core may be draining without waiting for the FIFO
+  while (!pl011_ring_empty(&uart->ring)) {
+    pl011_drain(uart, 1);
+  }
+  while (pl011_read(uart, PL011_FR) & PL011_FR_BUSY) {}
+}
+
+void pl011_enable_tx_irq(struct pl011 *uart) {
+  pl011_write(uart, PL011_IFLS, PL011_IFLS_TX_1_8);
+  pl011_write(uart, PL011_IMSC, pl011_read(uart, PL011_IMSC) | PL011_INT_TX);
+  __atomic_store_n(&uart->irq_enabled, 1, __ATOMIC_RELEASE);
+}
+
+void pl011_irq(struct pl011 *uart) {
+  if (!(pl011_read(uart, PL011_MIS) & PL011_INT_TX)) {
+    return;
+  }
+  // The FIFO went below its trigger level, writing it full raises the next interrupt
+  pl011_write(uart, PL011_ICR, PL011_INT_TX);
+  pl011_drain(uart, 0);
+}
+
+static void pl011_irq_handler(uint32_t intid, void *data) {
+  pl011_irq(data);
+}
+
+static void pl011_console_putc(char c) {
+  pl011_putc(console_uart, c);
+}
+
+static void pl011_console_write(const char *buf, size_t len) {
+  pl011_write_chars(console_uart, buf, len);
+}
+
+static void pl011_console_putc_sync(char c) {
+  pl011_putc_sync(console_uart, c);
+}
+
+static void pl011_console_flush() {
+  pl011_flush(console_uart);
+}
+
+static const struct debug_console pl011_console = {
+  .putc = pl011_console_putc,
+  .putc_sync = pl011_console_putc_sync,
+  .write = pl011_console_write,
+  .flush = pl011_console_flush
+};
+
+// Resolves /chosen/stdout-path ("/pl011@9000000:115200n8" or an alias)
+static uint32_t pl011_stdout_node(const struct fdt_index *index) {
+  uint32_t chosen = fdt_index_find_path(index, CHOSEN_NODE_PATH);
+  const struct fdt_index_prop *stdout_path = fdt_index_get_prop_id(index, chosen, FDT_PROP_ID_STDOUT_PATH);
+  if (!stdout_path || !stdout_path->len) {
+    return FDT_INDEX_NONE;
+  }
+
+  char path[PL011_PATH_MAX];
+  const char *value = stdout_path->value;
+  size_t len = 0;
+  while (len < stdout_path->len && value[len] && value[len] != ':' && len < PL011_PATH_MAX - 1) {
+    path[len] = value[len];
+    len++;
+  }
+  path[len] = '\0';
+
+  if (path[0] != '/') {
+    const struct fdt_index_prop *alias = fdt_index_get_prop(index, fdt_index_find_path(index, ALIASES_NODE_PATH), path);
+    return alias ? fdt_index_find_path(index, alias->value) : FDT_INDEX_NONE;
+  }
+  return fdt_index_find_path(index, path);
+}
+
+// Frequency of the first clock of the node (its UARTCLK), 0 if unknown
+static uint32_t pl011_clock(const struct fdt_index *index, uint32_t node) {
+  const struct fdt_index_prop *clocks = fdt_index_get_prop_id(index, node, FDT_PROP_ID_CLOCKS);
+  if (!clocks || clocks->len < sizeof(uint32_t)) {
+    return 0;
+  }
+  uint32_t clock = fdt_index_find_phandle(index, fdt_read_cells(clocks->value, 1));
+  const struct fdt_index_prop *frequency = fdt_index_get_prop_id(index, clock, FDT_PROP_ID_CLOCK_FREQUENCY);
+  if (!frequency || frequency->len < sizeof(uint32_t)) {
+    return 0;
+  }
+  return fdt_read_cells(frequency->value, 1);
+}
+
+static void pl011_init(struct pl011 *uart) {
+  // Let the early console finish before reprogramming the line
+  while (pl011_read(uart, PL011_FR) & PL011_FR_BUSY) {}
+  pl011_write(uart, PL011_CR, 0);
+
+  if (uart->clock) {
+    // Divisor in 1/64ths: clock / (16 * baud) * 64
+    uint32_t divisor = (uint32_t) (((uint64_t) uart->clock * 4) / PL011_BAUD_RATE);
+    pl011_write(uart, PL011_IBRD, divisor >> 6);
+    pl011_write(uart, PL011_FBRD, divisor & 0x3F);
+  }
+  pl011_write(uart, PL011_LCRH, PL011_LCRH_FEN | PL011_LCRH_WLEN_8);
+  pl011_write(uart, PL011_IMSC, 0);
+  pl011_write(uart, PL011_ICR, 0x7FF);
+  pl011_write(uart, PL011_CR, PL011_CR_UARTEN | PL011_CR_TXE | PL011_CR_RXE);
+}
+
+static int pl011_probe(struct device *dev) {
+  uint64_t address, size;
+  if (device_reg(dev, 0, &address, &size)) {
+    return -1;
+  }
+
+  uint32_t stdout_node = pl011_stdout_node(dev->index);
+  if (stdout_node != FDT_INDEX_NONE && stdout_node != dev->node) {
+    // Only the console UART is driven for now
+    return DRIVER_NO_DEVICE;
+  }
+  if (console_uart) {
+    return DRIVER_NO_DEVICE;
+  }
+
+  struct pl011 *uart = kmalloc(sizeof(struct pl011));
+  if (!uart) {
+    return -1;
+  }
+  memset(uart, 0x00, sizeof(struct pl011));
+  uart->base = (volatile uint32_t *) address;
+  uart->clock = pl011_clock(dev->index, dev->node);
+  for (uint32_t s = 0; s < PL011_RING_SIZE; s++) {
+    uart->ring.slots[s].seq = s;
+  }
+  dev->priv = uart;
+
+  pl011_init(uart);
+  console_uart = uart;
+  debug_set_console(&pl011_console);
+
+  // Without an interrupt writers keep draining the ring themselves
+  uint32_t irq = irq_of_node(dev->index, dev->node, 0);
+  if (irq != IRQ_NONE && irq_request(irq, pl011_irq_handler, uart) == 0) {
+    pl011_enable_tx_irq(uart);
+  }
+  debug_msg("PL011: console at %#lx (clock %u Hz, IRQ %d)", address, uart->clock, (int) irq);
+  return 0;
+}
+
+static const struct driver_match pl011_matches[] = {
+  { .compatible = "arm,pl011" },
+  { .compatible = NULL }
+};
+
+static const struct driver pl011_driver = {
+  .name = "pl011",
+  .matches = pl011_matches,
+  .probe = pl011_probe
+};
+
+DRIVER_REGISTER(pl011_driver);
@@ -0,0 +1,277 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/drivers/virtio.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/mm/page_alloc.h>
+
+static inline uint32_t virtio_read(struct virtio_mmio *dev, uint32_t offset) {
+  return *(volatile uint32_t *) (dev->base + offset);
+}
+
+static inline void virtio_write(struct virtio_mmio *dev, uint32_t offset, uint32_t value) {
+  *(volatile uint32_t *) (dev->base + offset) = value;
+}
+
+static inline void virtio_set_status(struct virtio_mmio *dev, uint32_t status) {
+  virtio_write(dev, VIRTIO_MMIO_STATUS, virtio_read(dev, VIRTIO_MMIO_STATUS) | status);
+}
+
+// The device is done with its queues once the status reads back as 0
+static void virtio_reset(struct virtio_mmio *dev) {
+  virtio_write(dev, VIRTIO_MMIO_STATUS, 0);
+  while (virtio_read(dev, VIRTIO_MMIO_STATUS)) {}
+}
+
+int virtio_mmio_init(struct virtio_mmio *dev, uint64_t address) {
+  dev->base = (volatile uint8_t *) address;
+  dev->features = 0;
+  if (virtio_read(dev, VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MMIO_MAGIC) {
+    return -1;
+  }
+  dev->version = virtio_read(dev, VIRTIO_MMIO_VERSION);
+  if (dev->version != 1 && dev->version != 2) {
+    return -1;
+  }
+  // QEMU creates every transport, most of them with nothing plugged in
+  dev->device_id = virtio_read(dev, VIRTIO_MMIO_DEVICE_ID);
+  if (!dev->device_id) {
+    return 0;
+  }
+
+  virtio_reset(dev);
+  virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+  virtio_set_status(dev, VIRTIO_STATUS_DRIVER);
+  if (dev->version == 1) {
+    virtio_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+  }
+  return (int) dev->device_id;
+}
+
+int virtio_mmio_negotiate(struct virtio_mmio *dev, uint64_t wanted) {
+  if (dev->version == 2) {
+    wanted |= VIRTIO_F_VERSION_1;
+  }
+  uint64_t offered = 0;
+  for (uint32_t sel = 0; sel < 2; sel++) {
+    virtio_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, sel);
+    offered |= (uint64_t) virtio_read(dev, VIRTIO_MMIO_DEVICE_FEATURES) << (sel * 32);
+  }
+  dev->features = offered & wanted;
+  for (uint32_t sel = 0; sel < 2; sel++) {
+    virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, sel);
+    virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t) (dev->features >> (sel * 32)));
+  }
+  if (dev->version == 1) {
+    // Legacy devices have no FEATURES_OK handshake
+    return 0;
+  }
+
+  // A modern device that cannot be driven the legacy way
+  if (!(dev->features & VIRTIO_F_VERSION_1)) {
+    return -1;
+  }
+  virtio_set_status(dev, VIRTIO_STATUS_FEATURES_OK);
+  return (virtio_read(dev, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK) ? 0 : -1;
+}
+
+static inline size_t virtq_used_offset(uint16_t size) {
+  size_t avail_end = size * sizeof(struct virtq_desc) + sizeof(struct virtq_avail) + (size + 1) * sizeof(uint16_t);
+  return (avail_end + VIRTQ_ALIGN - 1) & ~((size_t) VIRTQ_ALIGN - 1);
+}
+
+static inline size_t virtq_bytes(uint16_t size) {
+  return virtq_used_offset(size) + sizeof(struct virtq_used) + size * sizeof(struct virtq_used_elem) + sizeof(uint16_t);
+}
+
+static inline unsigned int virtq_order(uint16_t size) {
+  unsigned int order = 0;
+  while ((PAGE_SIZE << order) < virtq_bytes(size)) {
+    order++;
+  }
+  return order;
+}
+
+int virtio_mmio_setup_queue(struct virtio_mmio *dev, struct virtq *vq, uint16_t index, uint16_t max_size, uint32_t node) {
+  virtio_write(dev, VIRTIO_MMIO_QUEUE_SEL, index);
+  if (virtio_read(dev, dev->version == 1 ? VIRTIO_MMIO_QUEUE_PFN : VIRTIO_MMIO_QUEUE_READY)) {
+    return -1;
+  }
+  uint32_t size_max = virtio_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if (!size_max) {
+    return -1;
+  }
+  uint16_t size = 1;
+  while (size * 2 <= max_size && size * 2 <= size_max) {
+    size *= 2;
+  }
+
+  unsigned int order = virtq_order(size);
+  void *ring = page_alloc_node(order, node);
+  if (!ring) {
+    return -1;
+  }
+  memset(ring, 0x00, PAGE_SIZE << order);
+
+  memset(vq, 0x00, sizeof(struct virtq));
+  vq->ring = ring;
+  vq->index = index;
+  vq->size = size;
+  vq->desc = ring;
+  vq->avail = (struct virtq_avail *) ((uint8_t *) ring + size * sizeof(struct virtq_desc));
+  vq->used = (struct virtq_used *) ((uint8_t *) ring + virtq_used_offset(size));
+  vq->used_event = &vq->avail->ring[size];
+  vq->avail_event = (volatile uint16_t *) &vq->used->ring[size];
+  vq->event_idx = (dev->features & VIRTIO_F_RING_EVENT_IDX) != 0;
+  for (uint16_t d = 0; d < size; d++) {
+    vq->desc[d].next = d + 1;
+  }
+  vq->free_head = 0;
+  vq->n_free = size;
+
+  virtio_write(dev, VIRTIO_MMIO_QUEUE_NUM, size);
+  uint64_t desc = (uint64_t) vq->desc;
+  uint64_t avail = (uint64_t) vq->avail;
+  uint64_t used = (uint64_t) vq->used;
+  if (dev->version == 1) {
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_ALIGN, VIRTQ_ALIGN);
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t) (desc >> PAGE_SHIFT));
+  } else {
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t) desc);
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t) (desc >> 32));
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_LOW, (uint32_t) avail);
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_HIGH, (uint32_t) (avail >> 32));
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_LOW, (uint32_t) used);
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_HIGH, (uint32_t) (used >> 32));
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_READY, 1);
+  }
+  return 0;
+}
+
+void virtio_mmio_driver_ok(struct virtio_mmio *dev) {
+  // The rings must be visible before the device starts looking at them
+  dmb(oshst);
+  virtio_set_status(dev, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_mmio_fail(struct virtio_mmio *dev) {
+  virtio_reset(dev);
+  virtio_set_status(dev, VIRTIO_STATUS_FAILED);
+}
+
+uint32_t virtio_mmio_ack_irq(struct virtio_mmio *dev) {
+  uint32_t status = virtio_read(dev, VIRTIO_MMIO_INTERRUPT_STATUS);
+  if (status) {
+    virtio_write(dev, VIRTIO_MMIO_INTERRUPT_ACK, status);
+  }
+  return status;
+}
+
+uint32_t virtio_mmio_config_read32(struct virtio_mmio *dev, uint32_t offset) {
+  return virtio_read(dev, VIRTIO_MMIO_CONFIG + offset);
+}
+
+uint64_t virtio_mmio_config_read64(struct virtio_mmio *dev, uint32_t offset) {
+  // Two reads: retried if the device changed its configuration in between
+  uint32_t generation, low, high;
+  do {
+    generation = dev->version == 1 ? 0 : virtio_read(dev, VIRTIO_MMIO_CONFIG_GENERATION);
+    low = virtio_mmio_config_read32(dev, offset);
+    high = virtio_mmio_config_read32(dev, offset + sizeof(uint32_t));
+  } while (dev->version != 1 && generation != virtio_read(dev, VIRTIO_MMIO_CONFIG_GENERATION));
+  return ((uint64_t) high << 32) | low;
+}
+
+void virtq_release(struct virtq *vq) {
+  if (vq->ring) {
+    page_free(vq->ring);
+    vq->ring = NULL;
+  }
+}
+
+uint16_t virtq_alloc_chain(struct virtq *vq, uint16_t n) {
+  if (!n || n > vq->n_free) {
+    return VIRTQ_NONE;
+  }
+  uint16_t head = vq->free_head;
+  uint16_t last = head;
+  for (uint16_t i = 1; i < n; i++) {
+    vq->desc[last].flags = VIRTQ_DESC_F_NEXT;
+    last = vq->desc[last].next;
+  }
+  vq->free_head = vq->desc[last].next;
+  vq->desc[last].flags = 0;
+  vq->n_free -= n;
+  return head;
+}
+
+void virtq_free_chain(struct virtq *vq, uint16_t head) {
+  uint16_t last = head;
+  uint16_t n = 1;
+  while (vq->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+    last = vq->desc[last].next;
+    n++;
+  }
+  vq->desc[last].next = vq->free_head;
+  vq->free_head = head;
+  vq->n_free += n;
+}
+
+void virtq_add(struct virtq *vq, uint16_t head) {
+  vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+  vq->avail_idx++;
+}
+
+int virtq_kick(struct virtio_mmio *dev, struct virtq *vq) {
+  uint16_t old = vq->kicked_idx;
+  uint16_t new_idx = vq->avail_idx;
+  if (old == new_idx) {
+    return 0;
+  }
+  // Descriptors and ring entries before the index, the index before reading
+  // what the device wants to be told
+  dmb(oshst);
+  __atomic_store_n(&vq->avail->idx, new_idx, __ATOMIC_RELAXED);
+  dmb(osh);
+  vq->kicked_idx = new_idx;
+
+  int notify;
+  if (vq->event_idx) {
+    notify = vring_need_event(*vq->avail_event, new_idx, old);
+  } else {
+    notify = !(__atomic_load_n(&vq->used->flags, __ATOMIC_RELAXED) & VIRTQ_USED_F_NO_NOTIFY);
+  }
+  if (notify) {
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+  }
+  return notify;
+}
+
+uint16_t virtq_next_used(struct virtq *vq, uint32_t *len) {
+  if (__atomic_load_n(&vq->used->idx, __ATOMIC_RELAXED) == vq->last_used) {
+    return VIRTQ_NONE;
+  }
+  // The entry is only valid once its index has been seen
+  dmb(oshld);
+  struct virtq_used_elem *elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+  vq->last_used++;
+  if (len) {
+    *len = elem->len;
+  }
+  return (uint16_t) elem->id;
+}
+
+int virtq_arm_interrupt(struct virtq *vq, uint16_t end) {
+  if (!vq->event_idx) {
+    return 0;
+  }
+  // Interrupt once end is reached rather than at every chain. An end already
+  // reached (chains used out of order) or not kicked means the next one.
+  uint16_t ahead = end - vq->last_used;
+  uint16_t in_flight = vq->kicked_idx - vq->last_used;
+  *vq->used_event = ahead && ahead <= in_flight ? end - 1 : vq->last_used;
+  dmb(osh);
+  return __atomic_load_n(&vq->used->idx, __ATOMIC_RELAXED) == vq->last_used ? 0 : -1;
+}
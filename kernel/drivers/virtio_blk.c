@@ -0,0 +1,553 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/drivers/driver.h>
+#include <kernel/drivers/virtio_blk.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/kthread.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/smp.h>
+#include <kernel/sync/wait.h>
+#include <kernel/timer.h>
+
+#define VIRTIO_BLK_FEATURES (VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_MQ | \
+                             VIRTIO_F_RING_INDIRECT_DESC | VIRTIO_F_RING_EVENT_IDX)
+
+/**
+ * Requests of one virtio_blk_submit call in flight on a queue. The thread is
+ * woken by whoever completes the last one, unless it did so itself.
+ */
+struct virtio_blk_batch {
+  volatile uint32_t pending;
+  struct kthread *waiter;
+  uint16_t end; // Available index past its last request
+  struct virtio_blk_batch *prev;
+  struct virtio_blk_batch *next;
+};
+
+// Devices are probed concurrently: a slot is reserved first, filled in once the device works
+static struct spinlock virtio_blk_lock = SPINLOCK_INIT("virtio_blk_devices");
+static struct virtio_blk *virtio_blk_devices[VIRTIO_BLK_MAX_DEVICES];
+static uint32_t virtio_blk_n_devices = 0;
+static uint32_t virtio_blk_reserved = 0;
+
+static inline struct kthread *virtio_blk_current() {
+  struct cpu *cpu = this_cpu();
+  return cpu ? cpu->current : NULL;
+}
+
+static inline struct virtio_blk_queue *virtio_blk_this_queue(struct virtio_blk *blk) {
+  struct cpu *cpu = this_cpu();
+  return &blk->queues[(cpu ? cpu->id : 0) % blk->n_queues];
+}
+
+static inline unsigned int virtio_blk_slots_order(uint16_t size) {
+  unsigned int order = 0;
+  while ((PAGE_SIZE << order) < size * sizeof(struct virtio_blk_slot)) {
+    order++;
+  }
+  return order;
+}
+
+// Posts a request, made available but not published yet. Returns -1 if the queue is full.
+static int virtio_blk_post(struct virtio_blk *blk, struct virtio_blk_queue *q, struct virtio_blk_request *request) {
+  uint16_t n = request->type == VIRTIO_BLK_T_FLUSH ? 2 : VIRTIO_BLK_SEGMENTS;
+  uint16_t head = virtq_alloc_chain(&q->vq, blk->indirect ? 1 : n);
+  if (head == VIRTQ_NONE) {
+    return -1;
+  }
+
+  struct virtio_blk_slot *slot = &q->slots[head];
+  slot->request = request;
+  slot->hdr.type = request->type;
+  slot->hdr.reserved = 0;
+  slot->hdr.sector = request->sector;
+  slot->status = VIRTIO_BLK_S_IOERR;
+
+  struct virtq_desc *table = slot->table;
+  uint16_t s = 0;
+  table[s].addr = (uint64_t) &slot->hdr;
+  table[s].len = sizeof(struct virtio_blk_outhdr);
+  table[s++].flags = 0;
+  if (request->type != VIRTIO_BLK_T_FLUSH) {
+    table[s].addr = (uint64_t) request->buf;
+    table[s].len = request->len;
+    table[s++].flags = request->type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0;
+  }
+  table[s].addr = (uint64_t) &slot->status;
+  table[s].len = sizeof(uint8_t);
+  table[s].flags = VIRTQ_DESC_F_WRITE;
+
+  if (blk->indirect) {
+    // One ring descriptor per request whatever its segments
+    for (uint16_t i = 0; i + 1 < n; i++) {
+      table[i].flags |= VIRTQ_DESC_F_NEXT;
+      table[i].next = i + 1;
+    }
+    q->vq.desc[head].addr = (uint64_t) table;
+    q->vq.desc[head].len = n * sizeof(struct virtq_desc);
+    q->vq.desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+  } else {
+    // The chain already links the descriptors, only copy what they point to
+    uint16_t d = head;
+    for (uint16_t i = 0; i < n; i++) {
+      q->vq.desc[d].addr = table[i].addr;
+      q->vq.desc[d].len = table[i].len;
+      q->vq.desc[d].flags |= table[i].flags;
+      d = q->vq.desc[d].next;
+    }
+  }
+  virtq_add(&q->vq, head);
+  return 0;
+}
+
+static void virtio_blk_batch_push(struct virtio_blk_queue *q, struct virtio_blk_batch *batch) {
+  batch->next = NULL;
+  batch->prev = q->newest;
+  if (q->newest) {
+    q->newest->next = batch;
+  } else {
+    q->oldest = batch;
+  }
+  q->newest = batch;
+}
+
+static void virtio_blk_batch_remove(struct virtio_blk_queue *q, struct virtio_blk_batch *batch) {
+  if (batch->prev) {
+    batch->prev->next = batch->next;
+  } else {
+    q->oldest = batch->next;
+  }
+  if (batch->next) {
+    batch->next->prev = batch->prev;
+  } else {
+    q->newest = batch->prev;
+  }
+}
+
+// The interrupt is due when the oldest batch a thread sleeps on is complete,
+// not at the end of the batches other threads posted after it
+static uint16_t virtio_blk_event(struct virtio_blk_queue *q) {
+  for (struct virtio_blk_batch *batch = q->oldest; batch; batch = batch->next) {
+    if (batch->waiter) {
+      return batch->end;
+    }
+  }
+  return q->vq.kicked_idx;
+}
+
+// Completes what the device is done with, called with the queue lock held
+static void virtio_blk_drain(struct virtio_blk_queue *q, struct kthread *self) {
+  uint16_t head;
+  while ((head = virtq_next_used(&q->vq, NULL)) != VIRTQ_NONE) {
+    struct virtio_blk_slot *slot = &q->slots[head];
+    struct virtio_blk_request *request = slot->request;
+    slot->request = NULL;
+    virtq_free_chain(&q->vq, head);
+    if (!request) {
+      continue;
+    }
+
+    request->status = slot->status;
+    // The batch is on the stack of its submitter: once the last request is
+    // counted, only a submitter that is this very thread keeps it alive
+    struct virtio_blk_batch *batch = request->batch;
+    if (batch->pending == 1) {
+      // Counts only drop with the lock held, this is the last request
+      virtio_blk_batch_remove(q, batch);
+    }
+    struct kthread *waiter = batch->waiter;
+    if (__atomic_sub_fetch(&batch->pending, 1, __ATOMIC_ACQ_REL) || !waiter) {
+      continue;
+    }
+    if (waiter == self) {
+      // Completed by the submitter itself, it must not block
+      batch->waiter = NULL;
+    } else {
+      kthread_wake(waiter);
+    }
+  }
+}
+
+// Drains a queue until the device is asked to interrupt again
+static void virtio_blk_complete(struct virtio_blk_queue *q, struct kthread *self) {
+  do {
+    virtio_blk_drain(q, self);
+  } while (virtq_arm_interrupt(&q->vq, virtio_blk_event(q)));
+}
+
+static void virtio_blk_irq_handler(uint32_t intid, void *data) {
+  struct virtio_blk *blk = data;
+  if (!(virtio_mmio_ack_irq(&blk->mmio) & VIRTIO_MMIO_INT_VRING)) {
+    return;
+  }
+  // The transport has a single interrupt for every queue
+  for (uint32_t i = 0; i < blk->n_queues; i++) {
+    struct virtio_blk_queue *q = &blk->queues[i];
+    spin_lock(&q->lock);
+    virtio_blk_complete(q, NULL);
+    spin_unlock(&q->lock);
+  }
+}
+
+static int virtio_blk_check(const struct virtio_blk *blk, const struct virtio_blk_request *request) {
+  if (request->type == VIRTIO_BLK_T_FLUSH) {
+    return (blk->mmio.features & VIRTIO_BLK_F_FLUSH) ? 0 : -1;
+  }
+  if (request->type != VIRTIO_BLK_T_IN && request->type != VIRTIO_BLK_T_OUT) {
+    return -1;
+  }
+  if (request->type == VIRTIO_BLK_T_OUT && blk->read_only) {
+    return -1;
+  }
+  uint64_t sectors = request->len / VIRTIO_BLK_SECTOR_SIZE;
+  if (!request->len || request->len % VIRTIO_BLK_SECTOR_SIZE || request->sector >= blk->capacity ||
+      sectors > blk->capacity - request->sector) {
+    return -1;
+  }
+  return 0;
+}
+
+int virtio_blk_submit(struct virtio_blk *blk, struct virtio_blk_request *requests, uint32_t n) {
+  int result = 0;
+  for (uint32_t r = 0; r < n; r++) {
+    if (virtio_blk_check(blk, &requests[r])) {
+      requests[r].status = VIRTIO_BLK_S_UNSUPP;
+      result = -1;
+    }
+  }
+  if (result) {
+    return -1;
+  }
+
+  struct kthread *self = virtio_blk_current();
+  int can_block = self && blk->irq != IRQ_NONE;
+  struct virtio_blk_queue *q = virtio_blk_this_queue(blk);
+
+  uint32_t done = 0;
+  while (done < n) {
+    struct virtio_blk_batch batch = { .pending = 0, .waiter = can_block ? self : NULL };
+    uint64_t flags = spin_lock_irqsave(&q->lock);
+    uint32_t posted = 0;
+    while (done + posted < n) {
+      struct virtio_blk_request *request = &requests[done + posted];
+      request->batch = &batch;
+      if (virtio_blk_post(blk, q, request)) {
+        break;
+      }
+      posted++;
+    }
+    if (!posted) {
+      // Full with the requests of other threads sharing the queue
+      virtio_blk_complete(q, self);
+      spin_unlock_irqrestore(&q->lock, flags);
+      if (self) {
+        kthread_yield();
+      } else {
+        sync_relax();
+      }
+      continue;
+    }
+    __atomic_store_n(&batch.pending, posted, __ATOMIC_RELEASE);
+    batch.end = q->vq.avail_idx;
+    virtio_blk_batch_push(q, &batch);
+    virtq_kick(&blk->mmio, &q->vq);
+    // Moves the interrupt to the oldest waited batch, reads what completed meanwhile
+    virtio_blk_complete(q, self);
+
+    if (batch.waiter) {
+      // IRQs stay masked until the thread is off the CPU (see kthread_block)
+      spin_unlock(&q->lock);
+      kthread_block();
+      local_irq_restore(flags);
+    } else {
+      spin_unlock_irqrestore(&q->lock, flags);
+      while (__atomic_load_n(&batch.pending, __ATOMIC_ACQUIRE)) {
+        sync_relax();
+        flags = spin_lock_irqsave(&q->lock);
+        virtio_blk_complete(q, self);
+        spin_unlock_irqrestore(&q->lock, flags);
+      }
+    }
+    done += posted;
+  }
+
+  for (uint32_t r = 0; r < n; r++) {
+    requests[r].batch = NULL;
+    if (requests[r].status != VIRTIO_BLK_S_OK) {
+      result = -1;
+    }
+  }
+  return result;
+}
+
+int virtio_blk_rw(struct virtio_blk *blk, uint32_t type, uint64_t sector, void *buf, uint32_t len) {
+  struct virtio_blk_request request = { .type = type, .sector = sector, .buf = buf, .len = len };
+  return virtio_blk_submit(blk, &request, 1);
+}
+
+#ifdef KOS_VIRTIO_BLK_TEST
+
+#define VIRTIO_BLK_TEST_REQUESTS 16
+#define VIRTIO_BLK_TEST_SPAN 72 // Sectors of a batch: requests of 1 to 8 sectors
+
+struct virtio_blk_test {
+  struct virtio_blk *blk;
+  uint64_t first; // First sector of the thread
+};
+
+// Covers span sectors from first with requests of growing sizes, one batch
+static void virtio_blk_test_batch(struct virtio_blk_request *requests, uint32_t type, uint64_t first, uint8_t *buf) {
+  uint64_t sector = first;
+  for (uint32_t r = 0; r < VIRTIO_BLK_TEST_REQUESTS; r++) {
+    uint32_t n = r % 8 + 1;
+    requests[r] = (struct virtio_blk_request) {
+      .type = type,
+      .sector = sector,
+      .buf = buf + (sector - first) * VIRTIO_BLK_SECTOR_SIZE,
+      .len = n * VIRTIO_BLK_SECTOR_SIZE
+    };
+    sector += n;
+  }
+}
+
+static int virtio_blk_test_thread(void *arg) {
+  struct virtio_blk_test *test = arg;
+  struct virtio_blk_request requests[VIRTIO_BLK_TEST_REQUESTS];
+  size_t len = VIRTIO_BLK_TEST_SPAN * VIRTIO_BLK_SECTOR_SIZE;
+  // Large kmalloc objects are whole pages, contiguous for the device
+  uint8_t *saved = kmalloc(len);
+  uint8_t *pattern = kmalloc(len);
+  uint8_t *readback = kmalloc(len);
+  int result = -1;
+  if (!saved || !pattern || !readback) {
+    debug_msg("virtio_blk: self-test: no memory for the buffers");
+    goto out;
+  }
+
+  // Every word carries its byte offset on the disk, a misplaced sector shows
+  uint64_t *words = (uint64_t *) pattern;
+  for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+    words[i] = (test->first * VIRTIO_BLK_SECTOR_SIZE + i * sizeof(uint64_t)) ^ 0x5A5A5A5A00000000UL;
+  }
+  virtio_blk_test_batch(requests, VIRTIO_BLK_T_IN, test->first, saved);
+  if (virtio_blk_submit(test->blk, requests, VIRTIO_BLK_TEST_REQUESTS)) {
+    debug_msg("virtio_blk: self-test: cannot read sectors %lu+", test->first);
+    goto out;
+  }
+  virtio_blk_test_batch(requests, VIRTIO_BLK_T_OUT, test->first, pattern);
+  int written = virtio_blk_submit(test->blk, requests, VIRTIO_BLK_TEST_REQUESTS);
+  virtio_blk_test_batch(requests, VIRTIO_BLK_T_IN, test->first, readback);
+  if (written || virtio_blk_submit(test->blk, requests, VIRTIO_BLK_TEST_REQUESTS)) {
+    debug_msg("virtio_blk: self-test: cannot write and read back sectors %lu+", test->first);
+  } else if (memcmp(pattern, readback, len)) {
+    size_t offset = 0;
+    while (pattern[offset] == readback[offset]) {
+      offset++;
+    }
+    debug_msg("virtio_blk: self-test: sector %lu differs at byte %lu", test->first + offset / VIRTIO_BLK_SECTOR_SIZE,
+              offset % VIRTIO_BLK_SECTOR_SIZE);
+  } else {
+    result = 0;
+  }
+
+  // The disk is left as it was found
+  virtio_blk_test_batch(requests, VIRTIO_BLK_T_OUT, test->first, saved);
+  if (virtio_blk_submit(test->blk, requests, VIRTIO_BLK_TEST_REQUESTS)) {
+    debug_msg("virtio_blk: self-test: cannot restore sectors %lu+", test->first);
+    result = -1;
+  }
+
+out:
+  kfree(saved);
+  kfree(pattern);
+  kfree(readback);
+  return result;
+}
+
+void virtio_blk_self_test() {
+  struct virtio_blk *blk;
+  for (uint32_t d = 0; (blk = virtio_blk_get(d)); d++) {
+    // Each thread on its own sectors, the threads spread over the queues
+    uint32_t n_threads = smp_online_cpus();
+    if (n_threads > SMP_MAX_CPUS) {
+      n_threads = SMP_MAX_CPUS;
+    }
+    if (n_threads > blk->capacity / VIRTIO_BLK_TEST_SPAN) {
+      n_threads = blk->capacity / VIRTIO_BLK_TEST_SPAN;
+    }
+    if (blk->read_only || !n_threads) {
+      debug_msg("virtio_blk: self-test: device %u is read-only or too small, skipped", d);
+      continue;
+    }
+
+    struct virtio_blk_test tests[SMP_MAX_CPUS];
+    struct kthread *threads[SMP_MAX_CPUS];
+    uint32_t failed = 0;
+    uint64_t start = clock_ns();
+    for (uint32_t t = 0; t < n_threads; t++) {
+      tests[t] = (struct virtio_blk_test) { .blk = blk, .first = t * VIRTIO_BLK_TEST_SPAN };
+      threads[t] = kthread_spawn(virtio_blk_test_thread, &tests[t]);
+      if (!threads[t]) {
+        failed += virtio_blk_test_thread(&tests[t]) != 0;
+      }
+    }
+    for (uint32_t t = 0; t < n_threads; t++) {
+      if (threads[t]) {
+        failed += kthread_join(threads[t]) != 0;
+      }
+    }
+    debug_msg("virtio_blk: self-test of device %u: %u/%u threads passed, %u sectors each, %lu us", d,
+              n_threads - failed, n_threads, VIRTIO_BLK_TEST_SPAN, (clock_ns() - start) / NSEC_PER_USEC);
+  }
+}
+
+#endif
+
+struct virtio_blk *virtio_blk_get(uint32_t n) {
+  return n < __atomic_load_n(&virtio_blk_n_devices, __ATOMIC_ACQUIRE) ? virtio_blk_devices[n] : NULL;
+}
+
+static int virtio_blk_reserve() {
+  uint64_t flags = spin_lock_irqsave(&virtio_blk_lock);
+  int full = virtio_blk_reserved >= VIRTIO_BLK_MAX_DEVICES;
+  if (!full) {
+    virtio_blk_reserved++;
+  }
+  spin_unlock_irqrestore(&virtio_blk_lock, flags);
+  return full ? -1 : 0;
+}
+
+static void virtio_blk_unreserve() {
+  uint64_t flags = spin_lock_irqsave(&virtio_blk_lock);
+  virtio_blk_reserved--;
+  spin_unlock_irqrestore(&virtio_blk_lock, flags);
+}
+
+static void virtio_blk_register(struct virtio_blk *blk) {
+  uint64_t flags = spin_lock_irqsave(&virtio_blk_lock);
+  virtio_blk_devices[virtio_blk_n_devices] = blk;
+  __atomic_store_n(&virtio_blk_n_devices, virtio_blk_n_devices + 1, __ATOMIC_RELEASE);
+  spin_unlock_irqrestore(&virtio_blk_lock, flags);
+}
+
+static void virtio_blk_release(struct virtio_blk *blk, uint32_t n_queues) {
+  for (uint32_t i = 0; i < n_queues; i++) {
+    virtq_release(&blk->queues[i].vq);
+    if (blk->queues[i].slots) {
+      page_free(blk->queues[i].slots);
+    }
+  }
+  kfree(blk->queues);
+  kfree(blk);
+}
+
+static int virtio_blk_setup_queues(struct virtio_blk *blk) {
+  for (uint32_t i = 0; i < blk->n_queues; i++) {
+    struct virtio_blk_queue *q = &blk->queues[i];
+    // Memory of the queue on the node of the core that submits to it
+    uint32_t node = i < SMP_MAX_CPUS ? cpus[i].node : 0;
+    spin_lock_init(&q->lock, "virtio_blk");
+    if (virtio_mmio_setup_queue(&blk->mmio, &q->vq, i, VIRTIO_BLK_QUEUE_SIZE, node)) {
+      return -1;
+    }
+    unsigned int order = virtio_blk_slots_order(q->vq.size);
+    q->slots = page_alloc_node(order, node);
+    if (!q->slots) {
+      return -1;
+    }
+    memset(q->slots, 0x00, PAGE_SIZE << order);
+    // Only asked for an interrupt when requests are in flight
+    virtq_arm_interrupt(&q->vq, q->vq.kicked_idx);
+  }
+  return 0;
+}
+
+static int virtio_blk_probe(struct device *dev) {
+  uint64_t address, size;
+  if (device_reg(dev, 0, &address, &size)) {
+    return -1;
+  }
+
+  struct virtio_mmio mmio;
+  int device_id = virtio_mmio_init(&mmio, address);
+  if (device_id < 0) {
+    return -1;
+  }
+  if (device_id != VIRTIO_DEVICE_ID_BLOCK) {
+    // An empty transport or another kind of device
+    return DRIVER_NO_DEVICE;
+  }
+  if (virtio_blk_reserve()) {
+    debug_msg("virtio_blk: %s: too many devices", device_name(dev));
+    virtio_mmio_fail(&mmio);
+    return -1;
+  }
+  if (virtio_mmio_negotiate(&mmio, VIRTIO_BLK_FEATURES)) {
+    debug_msg("virtio_blk: %s refused the features", device_name(dev));
+    virtio_mmio_fail(&mmio);
+    virtio_blk_unreserve();
+    return -1;
+  }
+
+  struct virtio_blk *blk = kzalloc(sizeof(struct virtio_blk));
+  if (!blk) {
+    virtio_mmio_fail(&mmio);
+    virtio_blk_unreserve();
+    return -1;
+  }
+  blk->mmio = mmio;
+  blk->capacity = virtio_mmio_config_read64(&blk->mmio, VIRTIO_BLK_CONFIG_CAPACITY);
+  blk->indirect = (mmio.features & VIRTIO_F_RING_INDIRECT_DESC) != 0;
+  blk->read_only = (mmio.features & VIRTIO_BLK_F_RO) != 0;
+
+  // A queue per core, as many as the device has
+  uint32_t n_queues = 1;
+  if (mmio.features & VIRTIO_BLK_F_MQ) {
+    n_queues = virtio_mmio_config_read32(&blk->mmio, VIRTIO_BLK_CONFIG_NUM_QUEUES) >> 16;
+  }
+  uint32_t n_cpus = smp_online_cpus();
+  blk->n_queues = n_queues < n_cpus ? n_queues : n_cpus;
+  if (!blk->n_queues) {
+    blk->n_queues = 1;
+  }
+  blk->queues = kzalloc(blk->n_queues * sizeof(struct virtio_blk_queue));
+  if (!blk->queues || virtio_blk_setup_queues(blk)) {
+    debug_msg("virtio_blk: %s: cannot set up %u queues", device_name(dev), blk->n_queues);
+    virtio_mmio_fail(&blk->mmio);
+    virtio_blk_release(blk, blk->queues ? blk->n_queues : 0);
+    virtio_blk_unreserve();
+    return -1;
+  }
+
+  // Polled when there is no interrupt
+  blk->irq = irq_of_node(dev->index, dev->node, 0);
+  if (blk->irq != IRQ_NONE && irq_request(blk->irq, virtio_blk_irq_handler, blk)) {
+    blk->irq = IRQ_NONE;
+  }
+  dev->priv = blk;
+  virtio_mmio_driver_ok(&blk->mmio);
+  virtio_blk_register(blk);
+  debug_msg("virtio_blk: %s at %#lx, %lu sectors%s, %u queues of %u%s%s, IRQ %d", device_name(dev), address,
+            blk->capacity, blk->read_only ? " (read-only)" : "", blk->n_queues, blk->queues[0].vq.size,
+            blk->indirect ? ", indirect" : "", (mmio.features & VIRTIO_F_RING_EVENT_IDX) ? ", event idx" : "",
+            (int) blk->irq);
+  return 0;
+}
+
+static const struct driver_match virtio_blk_matches[] = {
+  { .compatible = "virtio,mmio" },
+  { .compatible = NULL }
+};
+
+static const struct driver virtio_blk_driver = {
+  .name = "virtio_blk",
+  .matches = virtio_blk_matches,
+  .probe = virtio_blk_probe
+};
+
+DRIVER_REGISTER(virtio_blk_driver);
@@ -15,42 +15,73 @@ uintptr_t fdt_align(uintptr_t ptr, size_t size) {
   return ((ptr + (size - 1)) & ~(size - 1));
 }
 
-fdt_token_t *fdt_advance_cursor(const fdt_token_t *cursor, size_t offset) {
+const fdt_token_t *fdt_advance_cursor(const fdt_token_t *cursor, size_t offset) {
   // Move the cursor
   uintptr_t new_cursor = (uintptr_t) cursor;
   new_cursor += offset;
 
   // Align the cursor
-  return (fdt_token_t *) fdt_align(new_cursor, sizeof(fdt_token_t));
+  return (const fdt_token_t *) fdt_align(new_cursor, sizeof(fdt_token_t));
 }
 
-void fdt_traverse(struct fdt_header *header, struct fdt_ops *ops, void *data_ptr) {
+int fdt_check_header(const struct fdt_header *header) {
+  if (fdt_header_get(header, magic) != FDT_HEADER_MAGIC) {
+    debug_msg("DTB: bad magic %#x", fdt_header_get(header, magic));
+    return -1;
+  }
+  if (fdt_header_get(header, last_comp_version) > FDT_LAST_COMP_VERSION) {
+    debug_msg("DTB: unsupported version %d", fdt_header_get(header, last_comp_version));
+    return -1;
+  }
+  return 0;
+}
 
-  if (ops->begin) {
-    ops->begin(data_ptr, header);
+// Calls a callback of every visitor that still wants tokens
+#define FDT_DISPATCH(visitors, n_visitors, callback, ...)                  \
+  for (size_t v = 0; v < n_visitors; v++) {                                \
+    if (!visitors[v].done && visitors[v].ops->callback) {                  \
+      visitors[v].ops->callback(visitors[v].data_ptr, __VA_ARGS__);        \
+    }                                                                      \
+  }
+
+// Returns non-zero once every visitor is done
+static int fdt_visitors_done(struct fdt_visitor *visitors, size_t n_visitors) {
+  int done = 1;
+  for (size_t v = 0; v < n_visitors; v++) {
+    if (!visitors[v].done && visitors[v].ops->done) {
+      visitors[v].done = visitors[v].ops->done(visitors[v].data_ptr) != 0;
+    }
+    done &= visitors[v].done;
+  }
+  return done;
+}
+
+void fdt_traverse_visitors(const struct fdt_header *header, struct fdt_visitor *visitors, size_t n_visitors) {
+
+  for (size_t v = 0; v < n_visitors; v++) {
+    visitors[v].done = 0;
+    if (visitors[v].ops->begin) {
+      visitors[v].ops->begin(visitors[v].data_ptr, header);
+    }
   }
 
   uintptr_t header_start = (uintptr_t) header;
-  uintptr_t block_start = header_start + header->off_dt_struct;
-  uintptr_t block_end = block_start + header->size_dt_struct;
-  fdt_token_t *cursor = (fdt_token_t *) block_start;
+  uintptr_t block_start = header_start + fdt_header_get(header, off_dt_struct);
+  uintptr_t block_end = block_start + fdt_header_get(header, size_dt_struct);
+  const fdt_token_t *cursor = (const fdt_token_t *) block_start;
 
   while ((uintptr_t) cursor < block_end) {
-    if (ops->visit_token) {
-      ops->visit_token(data_ptr, header, cursor);
-    }
+    FDT_DISPATCH(visitors, n_visitors, visit_token, header, cursor);
 
-    fdt_token_t token = *cursor;
+    fdt_token_t token = fdt_be32(cursor);
 
     switch (token) {
       case FDT_BEGIN_NODE: {
         DTB_DEBUG_LOG("FDT_BEGIN_NODE", 0);
-        fdt_token_t *c = cursor;
-        const char *name = (char *) ++cursor;
+        const fdt_token_t *c = cursor;
+        const char *name = (const char *) ++cursor;
 
-        if (ops->visit_begin_node) {
-          ops->visit_begin_node(data_ptr, header, c, name);
-        }
+        FDT_DISPATCH(visitors, n_visitors, visit_begin_node, header, c, name);
 
         // Move the cursor
         cursor = fdt_advance_cursor(cursor, strlen(name) + 1);
@@ -58,35 +89,34 @@ void fdt_traverse(struct fdt_header *header, struct fdt_ops *ops, void *data_ptr
       }
       case FDT_END_NODE: {
         DTB_DEBUG_LOG("FDT_END_NODE", 0);
-        fdt_token_t *c = cursor++;
-        if (ops->visit_end_node) {
-          ops->visit_end_node(data_ptr, header, c);
-        }
+        const fdt_token_t *c = cursor++;
+        FDT_DISPATCH(visitors, n_visitors, visit_end_node, header, c);
         break;
       }
       case FDT_NOP: {
         DTB_DEBUG_LOG("FDT_NOP", 0);
-        fdt_token_t *c = cursor++;
-        if (ops->visit_nop_node) {
-          ops->visit_nop_node(data_ptr, header, c);
-          break;
-        }
+        const fdt_token_t *c = cursor++;
+        FDT_DISPATCH(visitors, n_visitors, visit_nop_node, header, c);
+        break;
       }
       case FDT_PROP: {
         DTB_DEBUG_LOG("FDT_PROP", 0);
-        fdt_token_t *c = cursor;
-        struct fdt_prop_data *property = (struct fdt_prop_data *) ++cursor;
-        void *property_value = NULL;
-        if (property->len) {
-          property_value = property+1;
+        const fdt_token_t *c = cursor++;
+        // Decode the property header on the stack, the blob stays untouched
+        struct fdt_prop_data property = {
+          .len = fdt_be32(cursor),
+          .nameoff = fdt_be32(cursor + 1)
+        };
+        property.id = fdt_prop_id(header, property.nameoff);
+        const void *property_value = NULL;
+        if (property.len) {
+          property_value = cursor + 2;
         }
 
-        if (ops->visit_property) {
-          ops->visit_property(data_ptr, header, c, property, property_value);
-        }
+        FDT_DISPATCH(visitors, n_visitors, visit_property, header, c, &property, property_value);
 
-        // Move the cursor
-        cursor = fdt_advance_cursor(cursor, sizeof(struct fdt_prop_data) + property->len);
+        // Move the cursor past len, nameoff and the value
+        cursor = fdt_advance_cursor(cursor, 2 * sizeof(uint32_t) + property.len);
         break;
       }
       case FDT_END: {
@@ -98,160 +128,158 @@ void fdt_traverse(struct fdt_header *header, struct fdt_ops *ops, void *data_ptr
         goto exit;
       }
     }
+
+    if (fdt_visitors_done(visitors, n_visitors)) {
+      break;
+    }
   }
 
 exit:
-  if (ops->end) {
-    ops->end(data_ptr, header);
+  for (size_t v = 0; v < n_visitors; v++) {
+    if (visitors[v].ops->end) {
+      visitors[v].ops->end(visitors[v].data_ptr, header);
+    }
   }
 }
 
-void fdt_reserve_entry_print(struct fdt_reserve_entry *entry) {
+void fdt_traverse(const struct fdt_header *header, const struct fdt_ops *ops, void *data_ptr) {
+  struct fdt_visitor visitor = { .ops = ops, .data_ptr = data_ptr };
+  fdt_traverse_visitors(header, &visitor, 1);
+}
+
+void fdt_reserve_entry_print(const struct fdt_reserve_entry *entry) {
   debug_msg("=============== Reserved Memory Block =================");
-  debug_msg("Address: %p (size: %p)", entry->address, entry->size);
+  debug_msg("Address: %#lx (size: %#lx)", fdt_be64(&entry->address), fdt_be64(&entry->size));
   debug_msg("=======================================================");
 }
 
-char *fdt_prop_get_name(const struct fdt_header *header,
-                        const struct fdt_prop_data *prop) {
-  void *strings_block = (void *) header;
-  strings_block += header->off_dt_strings;
+const char *fdt_prop_get_name(const struct fdt_header *header,
+                              const struct fdt_prop_data *prop) {
+  const char *strings_block = (const char *) header;
+  strings_block += fdt_header_get(header, off_dt_strings);
   return strings_block + prop->nameoff;
 }
 
-int fdt_prop_of_type(char *name, char **names, size_t len) {
-  for (int c = 0; c < len; c++) {
-    if (strcmp(name, names[c]) == 0) {
-      return 1;
-    }
+uint64_t fdt_read_cells(const void *cells, uint32_t n_cells) {
+  const uint32_t *cell = cells;
+  uint64_t value = 0;
+  while (n_cells--) {
+    value = (value << 32) | fdt_be32(cell++);
   }
-  return 0;
+  return value;
+}
+
+const struct fdt_reserve_entry *fdt_mem_rsvmap(const struct fdt_header *header) {
+  const void *p = header;
+  return p + fdt_header_get(header, off_mem_rsvmap);
 }
 
-fdt_token_t *fdt_prop_u32_print(const struct fdt_header *header,
-                                const struct fdt_prop_data *prop,
-                                fdt_token_t *cursor) {
+const void *fdt_prop_u32_print(const struct fdt_header *header,
+                               const struct fdt_prop_data *prop,
+                               const void *cursor) {
   size_t length = prop->len;
   if (length) {
-    int32_t *data = (int32_t *) cursor;
-    swap_bytes(data, sizeof(int32_t));
-    debug_printf("<%d>", *data);
-    cursor++;
+    debug_printf("<%d>", (int32_t) fdt_be32(cursor));
+    cursor += sizeof(uint32_t);
   }
   return cursor;
 }
 
-fdt_token_t *fdt_prop_string_print(const struct fdt_header *header,
-                                   const struct fdt_prop_data *prop,
-                                   fdt_token_t *cursor) {
+const void *fdt_prop_string_print(const struct fdt_header *header,
+                                  const struct fdt_prop_data *prop,
+                                  const void *cursor) {
   size_t length = prop->len;
   if (length) {
-    void *data = cursor;
-    debug_printf("\"%s\"", data);
-    cursor = data + length;
+    debug_printf("\"%s\"", (const char *) cursor);
+    cursor += length;
   }
   return cursor;
 }
 
-fdt_token_t *fdt_prop_string_list_print(const struct fdt_header *header,
-                                        const struct fdt_prop_data *prop,
-                                        fdt_token_t *cursor) {
+const void *fdt_prop_string_list_print(const struct fdt_header *header,
+                                       const struct fdt_prop_data *prop,
+                                       const void *cursor) {
   size_t length = prop->len;
   if (length) {
-    void *data = cursor;
-    void *data_end = data + length;
+    const char *data = cursor;
+    const char *data_end = data + length;
     while (data < data_end) {
-      data = fdt_prop_string_print(header, prop, cursor);
-      debug_printf(", ");
+      debug_printf("\"%s\", ", data);
+      data += strlen(data) + 1;
     }
-    cursor = (fdt_token_t *) data;
+    cursor = data;
   }
   return cursor;
 }
 
-fdt_token_t *fdt_prop_generic_print(const struct fdt_header *header,
-                                    const struct fdt_prop_data *prop,
-                                    fdt_token_t *cursor) {
+const void *fdt_prop_generic_print(const struct fdt_header *header,
+                                   const struct fdt_prop_data *prop,
+                                   const void *cursor) {
   size_t length = prop->len;
   if (length > 0) {
     uint32_t offset = 0;
-    void *data = cursor;
+    const uint8_t *data = cursor;
     while (offset < length) {
-      char *c = data + offset++;
-      debug_printf("%x ", *c);
+      debug_printf("%02x ", data[offset++]);
     }
     cursor = data + offset;
   }
   return cursor;
 }
 
-void parse_device_tree(struct fdt_header *header) {
-  // Device tree uses big-endian values, so we need to swap bytes
-  struct fdt_ops fixup_ops = {
-          .begin = fdt_fixup_header_endianness,
-          .visit_token = fdt_fixup_token_endianness,
-          .visit_property = fdt_fixup_property_endianness};
-
-  fdt_traverse(header, &fixup_ops, NULL);
-
-  // Dump device tree blob
-  struct fdt_ops dump_ops = {
-          .begin = fdt_dump_header,
-          .visit_begin_node = fdt_dump_begin_node,
-          .visit_end_node = fdt_dump_end_node,
-          .visit_token = fdt_dump_token,
-          .visit_property = fdt_dump_property
-  };
-
-  fdt_traverse(header, &dump_ops, NULL);
-
-  // Print reserved memory regions
-  void *p = header;
-  void *reserve_memory_list = (p + header->off_mem_rsvmap);
-  struct fdt_reserve_entry *entry = reserve_memory_list;
-  while (entry->address) {
-    fdt_reserve_entry_print(entry);
-    entry++;
-  }
+static const struct fdt_ops fdt_dump_ops = {
+  .begin = fdt_dump_header,
+  .end = fdt_dump_reserved,
+  .visit_begin_node = fdt_dump_begin_node,
+  .visit_end_node = fdt_dump_end_node,
+  .visit_token = fdt_dump_token,
+  .visit_property = fdt_dump_property
+};
+
+struct fdt_visitor fdt_dump_visitor(struct fdt_dump_data *data) {
+  data->nested_levels = 0;
+  struct fdt_visitor visitor = { .ops = &fdt_dump_ops, .data_ptr = data };
+  return visitor;
 }
 
-/* Endianness fixup */
-void fdt_fixup_header_endianness(void* data_ptr, struct fdt_header *header) {
-  void *p = header;
-  size_t header_length = sizeof(struct fdt_header);
-  while (header_length) {
-    header_length -= sizeof(int32_t);
-    swap_bytes(p + header_length, sizeof(int32_t));
+void parse_device_tree(const struct fdt_header *header) {
+  if (fdt_check_header(header)) {
+    return;
   }
-}
 
-void fdt_fixup_token_endianness(void* data_ptr, struct fdt_header *header, fdt_token_t *token) {
-  swap_bytes(token, sizeof(fdt_token_t));
-}
-
-void fdt_fixup_property_endianness(void* data_ptr, struct fdt_header *header, fdt_token_t *token, struct fdt_prop_data *property, void *property_value) {
-  swap_bytes(&property->len, sizeof(int32_t));
-  swap_bytes(&property->nameoff, sizeof(int32_t));
+  // Dump device tree blob
+  struct fdt_dump_data dump_data;
+  struct fdt_visitor visitor = fdt_dump_visitor(&dump_data);
+  fdt_traverse_visitors(header, &visitor, 1);
 }
 
 /* Dump */
-static uint32_t nested_levels = 0;
-void fdt_dump_header(void* data_ptr, struct fdt_header *header) {
+void fdt_dump_header(void* data_ptr, const struct fdt_header *header) {
   debug_msg("=============== Device Tree Blob (Header) =================");
-  debug_msg("Version: %d (compatible with: %d)", header->version, header->last_comp_version);
-  debug_msg("Magic: %x", header->magic);
-  debug_msg("Total size: %x", header->totalsize);
-  debug_msg("CPU ID: %d", header->boot_cpuid_phys);
-  debug_msg("Size of structure block: %x", header->size_dt_struct);
-  debug_msg("Offset of structure block: %x", header->off_dt_struct);
-  debug_msg("Size of strings block: %x", header->size_dt_strings);
-  debug_msg("Offset of strings block: %x", header->off_dt_strings);
-  debug_msg("Memory reservation block offset: %x", header->off_mem_rsvmap);
+  debug_msg("Version: %d (compatible with: %d)", fdt_header_get(header, version), fdt_header_get(header, last_comp_version));
+  debug_msg("Magic: %#x", fdt_header_get(header, magic));
+  debug_msg("Total size: %#x", fdt_header_get(header, totalsize));
+  debug_msg("CPU ID: %d", fdt_header_get(header, boot_cpuid_phys));
+  debug_msg("Size of structure block: %#x", fdt_header_get(header, size_dt_struct));
+  debug_msg("Offset of structure block: %#x", fdt_header_get(header, off_dt_struct));
+  debug_msg("Size of strings block: %#x", fdt_header_get(header, size_dt_strings));
+  debug_msg("Offset of strings block: %#x", fdt_header_get(header, off_dt_strings));
+  debug_msg("Memory reservation block offset: %#x", fdt_header_get(header, off_mem_rsvmap));
   debug_msg("===========================================================");
 }
 
-void fdt_dump_begin_node(void* data_ptr, struct fdt_header *header, fdt_token_t *token, const char* name) {
-  nested_levels++;
+void fdt_dump_reserved(void* data_ptr, const struct fdt_header *header) {
+  // Print reserved memory regions, the list ends with an all zero entry
+  const struct fdt_reserve_entry *entry = fdt_mem_rsvmap(header);
+  while (fdt_be64(&entry->address) || fdt_be64(&entry->size)) {
+    fdt_reserve_entry_print(entry);
+    entry++;
+  }
+}
+
+void fdt_dump_begin_node(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char* name) {
+  struct fdt_dump_data *data = data_ptr;
+  data->nested_levels++;
   if (*name) {
     debug_msg("%s {", name);
   } else {
@@ -259,13 +287,15 @@ void fdt_dump_begin_node(void* data_ptr, struct fdt_header *header, fdt_token_t
   }
 }
 
-void fdt_dump_end_node(void* data_ptr, struct fdt_header *header, fdt_token_t *token) {
+void fdt_dump_end_node(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct fdt_dump_data *data = data_ptr;
   debug_msg("\b\b}");
-  nested_levels--;
+  data->nested_levels--;
 }
 
-void fdt_dump_token(void* data_ptr, struct fdt_header *header, fdt_token_t *token) {
-  for (int p = 1; p <= nested_levels; p++) {
+void fdt_dump_token(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct fdt_dump_data *data = data_ptr;
+  for (int p = 1; p <= data->nested_levels; p++) {
     int pp = p;
     while (pp) {
       debug_printf(" ");
@@ -274,22 +304,27 @@ void fdt_dump_token(void* data_ptr, struct fdt_header *header, fdt_token_t *toke
   }
 }
 
-void fdt_dump_property(void* data_ptr, struct fdt_header *header, fdt_token_t *token, struct fdt_prop_data *property, void *property_value) {
+void fdt_dump_property(void* data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
   // Move the cursor ahead of property
-  char *name = fdt_prop_get_name(header, property);
+  const char *name = fdt_prop_get_name(header, property);
   if (property->len == 0) {
     debug_msg("%s", name);
   } else {
     debug_printf("%s = ", name);
-    if (fdt_prop_of_type(name, FDT_STRING_PROPERTIES, sizeof(FDT_STRING_PROPERTIES))) {
-      fdt_prop_string_print(header, property, property_value);
-    } else if (fdt_prop_of_type(name, FDT_STRINGLIST_PROPERTIES, sizeof(FDT_STRINGLIST_PROPERTIES))) {
-      fdt_prop_string_list_print(header, property, property_value);
-    } else if (fdt_prop_of_type(name, FDT_U32_PROPERTIES, sizeof(FDT_U32_PROPERTIES))) {
-      fdt_prop_u32_print(header, property, property_value);
-    } else {
-      fdt_prop_generic_print(header, property, property_value);
+    switch (fdt_prop_type(property->id)) {
+      case FDT_PROP_TYPE_STRING:
+        fdt_prop_string_print(header, property, property_value);
+        break;
+      case FDT_PROP_TYPE_STRINGLIST:
+        fdt_prop_string_list_print(header, property, property_value);
+        break;
+      case FDT_PROP_TYPE_U32:
+        fdt_prop_u32_print(header, property, property_value);
+        break;
+      default:
+        fdt_prop_generic_print(header, property, property_value);
+        break;
     }
-    debug_msg("");
+    debug_write("\n\r");
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,434 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/dtb/dtb_index.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+struct fdt_index_count_data {
+  uint32_t n_nodes;
+  uint32_t n_props;
+  uint32_t n_compats;
+};
+
+struct fdt_index_build_data {
+  struct fdt_index *index;
+  uint32_t depth;
+  uint32_t overflow;
+  uint32_t open_nodes[FDT_INDEX_MAX_DEPTH];
+  uint32_t last_child[FDT_INDEX_MAX_DEPTH];
+};
+
+struct fdt_index dtb_index;
+
+// FNV-1a, can be resumed to hash a path one component at a time
+static uint32_t fdt_hash_bytes(uint32_t hash, const char *s, size_t len) {
+  while (len--) {
+    hash ^= (uint8_t) *s++;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint32_t fdt_hash_string(const char *s) {
+  return fdt_hash_bytes(FNV_OFFSET_BASIS, s, strlen(s));
+}
+
+static uint32_t fdt_hash_u32(uint32_t value) {
+  return value * 0x9E3779B1;
+}
+
+static uint32_t fdt_table_mask(uint32_t n) {
+  uint32_t size = 8;
+  while (size < 2 * n) {
+    size <<= 1;
+  }
+  return size - 1;
+}
+
+static size_t fdt_round(size_t size) {
+  return (size + 7) & ~7UL;
+}
+
+void fdt_index_count_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name) {
+  struct fdt_index_count_data *data = data_ptr;
+  data->n_nodes++;
+}
+
+void fdt_index_count_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
+  struct fdt_index_count_data *data = data_ptr;
+  data->n_props++;
+  if (property->len && property->id == FDT_PROP_ID_COMPATIBLE) {
+    // One entry per string of the list
+    const char *s = property_value;
+    for (uint32_t c = 0; c < property->len; c++) {
+      if (!s[c]) {
+        data->n_compats++;
+      }
+    }
+  }
+}
+
+void fdt_index_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name) {
+  struct fdt_index_build_data *data = data_ptr;
+  struct fdt_index *index = data->index;
+  if (data->depth >= FDT_INDEX_MAX_DEPTH) {
+    data->overflow = 1;
+    data->depth++;
+    return;
+  }
+
+  uint32_t n = index->n_nodes++;
+  struct fdt_index_node *node = &index->nodes[n];
+  node->name = name;
+  node->first_child = FDT_INDEX_NONE;
+  node->next_sibling = FDT_INDEX_NONE;
+  node->first_prop = index->n_props;
+  node->n_props = 0;
+  node->phandle = 0;
+  node->depth = data->depth;
+  // Defaults from the devicetree specification
+  node->address_cells = 2;
+  node->size_cells = 1;
+
+  if (data->depth == 0) {
+    // The root path is "/", children hash as "/name"
+    node->parent = FDT_INDEX_NONE;
+    node->path_hash = FNV_OFFSET_BASIS;
+  } else {
+    uint32_t parent = data->open_nodes[data->depth - 1];
+    node->parent = parent;
+    node->path_hash = fdt_hash_bytes(fdt_hash_bytes(index->nodes[parent].path_hash, "/", 1), name, strlen(name));
+
+    uint32_t sibling = data->last_child[data->depth - 1];
+    if (sibling == FDT_INDEX_NONE) {
+      index->nodes[parent].first_child = n;
+    } else {
+      index->nodes[sibling].next_sibling = n;
+    }
+    data->last_child[data->depth - 1] = n;
+  }
+
+  data->open_nodes[data->depth] = n;
+  data->last_child[data->depth] = FDT_INDEX_NONE;
+  data->depth++;
+}
+
+void fdt_index_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct fdt_index_build_data *data = data_ptr;
+  data->depth--;
+}
+
+void fdt_index_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
+  struct fdt_index_build_data *data = data_ptr;
+  struct fdt_index *index = data->index;
+  if (!data->depth || data->depth > FDT_INDEX_MAX_DEPTH) {
+    return;
+  }
+
+  uint32_t n = data->open_nodes[data->depth - 1];
+  struct fdt_index_node *node = &index->nodes[n];
+  struct fdt_index_prop *prop = &index->props[index->n_props++];
+  prop->nameoff = property->nameoff;
+  prop->id = property->id;
+  prop->len = property->len;
+  prop->value = property_value;
+  node->n_props++;
+
+  if (!property->len) {
+    return;
+  }
+
+  if (property->id == FDT_PROP_ID_PHANDLE || property->id == FDT_PROP_ID_LINUX_PHANDLE) {
+    node->phandle = fdt_read_cells(property_value, 1);
+  } else if (property->id == FDT_PROP_ID_ADDRESS_CELLS) {
+    node->address_cells = fdt_read_cells(property_value, 1);
+  } else if (property->id == FDT_PROP_ID_SIZE_CELLS) {
+    node->size_cells = fdt_read_cells(property_value, 1);
+  } else if (property->id == FDT_PROP_ID_COMPATIBLE) {
+    // Same walk as the count pass: a string is only taken at its NUL, so an
+    // unterminated tail is dropped and never read past the property
+    const char *s = property_value;
+    uint32_t start = 0;
+    for (uint32_t c = 0; c < property->len; c++) {
+      if (s[c]) {
+        continue;
+      }
+      struct fdt_index_compat *compat = &index->compats[index->n_compats++];
+      compat->compatible = s + start;
+      compat->node = n;
+      compat->next = FDT_INDEX_NONE;
+      start = c + 1;
+    }
+  }
+}
+
+static void fdt_index_insert_phandle(struct fdt_index *index, uint32_t node) {
+  uint32_t phandle = index->nodes[node].phandle;
+  uint32_t i = fdt_hash_u32(phandle) & index->phandles_mask;
+  while (index->phandles[i].value != FDT_INDEX_NONE) {
+    i = (i + 1) & index->phandles_mask;
+  }
+  index->phandles[i].hash = phandle;
+  index->phandles[i].value = node;
+}
+
+static void fdt_index_insert_path(struct fdt_index *index, uint32_t node) {
+  uint32_t hash = index->nodes[node].path_hash;
+  uint32_t i = hash & index->paths_mask;
+  while (index->paths[i].value != FDT_INDEX_NONE) {
+    i = (i + 1) & index->paths_mask;
+  }
+  index->paths[i].hash = hash;
+  index->paths[i].value = node;
+}
+
+static void fdt_index_insert_compat(struct fdt_index *index, uint32_t entry) {
+  const char *compatible = index->compats[entry].compatible;
+  uint32_t hash = fdt_hash_string(compatible);
+  uint32_t i = hash & index->compat_mask;
+  while (index->compat_slots[i].value != FDT_INDEX_NONE) {
+    struct fdt_index_slot *slot = &index->compat_slots[i];
+    if (slot->hash == hash && strcmp(index->compats[slot->value].compatible, compatible) == 0) {
+      // Keep DTB order so that probing is deterministic
+      index->compats[slot->tail].next = entry;
+      slot->tail = entry;
+      return;
+    }
+    i = (i + 1) & index->compat_mask;
+  }
+  index->compat_slots[i].hash = hash;
+  index->compat_slots[i].value = entry;
+  index->compat_slots[i].tail = entry;
+}
+
+int fdt_index_build(struct fdt_index *index, const struct fdt_header *header) {
+  memset(index, 0x00, sizeof(struct fdt_index));
+  if (fdt_check_header(header)) {
+    return -1;
+  }
+
+  struct fdt_index_count_data count;
+  memset(&count, 0x00, sizeof(struct fdt_index_count_data));
+  struct fdt_ops count_ops = {
+    .visit_begin_node = fdt_index_count_begin_node,
+    .visit_property = fdt_index_count_property
+  };
+  fdt_traverse(header, &count_ops, &count);
+  if (!count.n_nodes) {
+    return -1;
+  }
+
+  // Everything lives in a single block
+  index->phandles_mask = fdt_table_mask(count.n_nodes);
+  index->paths_mask = fdt_table_mask(count.n_nodes);
+  index->compat_mask = fdt_table_mask(count.n_compats);
+  size_t nodes_size = fdt_round(count.n_nodes * sizeof(struct fdt_index_node));
+  size_t props_size = fdt_round(count.n_props * sizeof(struct fdt_index_prop));
+  size_t compats_size = fdt_round(count.n_compats * sizeof(struct fdt_index_compat));
+  size_t phandles_size = (index->phandles_mask + 1) * sizeof(struct fdt_index_slot);
+  size_t paths_size = (index->paths_mask + 1) * sizeof(struct fdt_index_slot);
+  size_t compat_slots_size = (index->compat_mask + 1) * sizeof(struct fdt_index_slot);
+
+  void *block = kmalloc(nodes_size + props_size + compats_size + phandles_size + paths_size + compat_slots_size);
+  if (!block) {
+    debug_msg("DTB index: no memory for %d nodes", count.n_nodes);
+    return -1;
+  }
+  index->header = header;
+  index->nodes = block;
+  index->props = block + nodes_size;
+  index->compats = block + nodes_size + props_size;
+  index->phandles = block + nodes_size + props_size + compats_size;
+  index->paths = (void *) index->phandles + phandles_size;
+  index->compat_slots = (void *) index->paths + paths_size;
+  // All ones marks an empty slot
+  memset(index->phandles, 0xFF, phandles_size + paths_size + compat_slots_size);
+
+  struct fdt_index_build_data data;
+  memset(&data, 0x00, sizeof(struct fdt_index_build_data));
+  data.index = index;
+  struct fdt_ops build_ops = {
+    .visit_begin_node = fdt_index_begin_node,
+    .visit_end_node = fdt_index_end_node,
+    .visit_property = fdt_index_property
+  };
+  fdt_traverse(header, &build_ops, &data);
+  if (data.overflow) {
+    debug_msg("DTB index: tree deeper than %d levels", FDT_INDEX_MAX_DEPTH);
+    fdt_index_free(index);
+    return -1;
+  }
+
+  for (uint32_t n = 0; n < index->n_nodes; n++) {
+    fdt_index_insert_path(index, n);
+    if (index->nodes[n].phandle) {
+      fdt_index_insert_phandle(index, n);
+    }
+  }
+  for (uint32_t c = 0; c < index->n_compats; c++) {
+    fdt_index_insert_compat(index, c);
+  }
+  return 0;
+}
+
+void fdt_index_free(struct fdt_index *index) {
+  if (index->nodes) {
+    kfree(index->nodes);
+  }
+  memset(index, 0x00, sizeof(struct fdt_index));
+}
+
+// Compares a path with the names of a node and its ancestors, from the end
+static int fdt_index_path_matches(const struct fdt_index *index, uint32_t node, const char *path, size_t len) {
+  while (node != FDT_INDEX_ROOT) {
+    const char *name = index->nodes[node].name;
+    size_t name_len = strlen(name);
+    if (len < name_len + 1 || memcmp(path + len - name_len, name, name_len) != 0) {
+      return 0;
+    }
+    len -= name_len;
+    if (path[--len] != '/') {
+      return 0;
+    }
+    node = index->nodes[node].parent;
+  }
+  return len == 0;
+}
+
+uint32_t fdt_index_find_path(const struct fdt_index *index, const char *path) {
+  if (!index->n_nodes || path[0] != '/') {
+    return FDT_INDEX_NONE;
+  }
+  size_t len = strlen(path);
+  if (len == 1) {
+    return FDT_INDEX_ROOT;
+  }
+
+  uint32_t hash = fdt_hash_bytes(FNV_OFFSET_BASIS, path, len);
+  uint32_t i = hash & index->paths_mask;
+  while (index->paths[i].value != FDT_INDEX_NONE) {
+    uint32_t node = index->paths[i].value;
+    if (index->paths[i].hash == hash && fdt_index_path_matches(index, node, path, len)) {
+      return node;
+    }
+    i = (i + 1) & index->paths_mask;
+  }
+  return FDT_INDEX_NONE;
+}
+
+uint32_t fdt_index_find_phandle(const struct fdt_index *index, uint32_t phandle) {
+  if (!index->n_nodes || !phandle) {
+    return FDT_INDEX_NONE;
+  }
+  uint32_t i = fdt_hash_u32(phandle) & index->phandles_mask;
+  while (index->phandles[i].value != FDT_INDEX_NONE) {
+    if (index->phandles[i].hash == phandle) {
+      return index->phandles[i].value;
+    }
+    i = (i + 1) & index->phandles_mask;
+  }
+  return FDT_INDEX_NONE;
+}
+
+const struct fdt_index_compat *fdt_index_find_compatible(const struct fdt_index *index, const char *compatible) {
+  if (!index->n_compats) {
+    return NULL;
+  }
+  uint32_t hash = fdt_hash_string(compatible);
+  uint32_t i = hash & index->compat_mask;
+  while (index->compat_slots[i].value != FDT_INDEX_NONE) {
+    const struct fdt_index_compat *entry = &index->compats[index->compat_slots[i].value];
+    if (index->compat_slots[i].hash == hash && strcmp(entry->compatible, compatible) == 0) {
+      return entry;
+    }
+    i = (i + 1) & index->compat_mask;
+  }
+  return NULL;
+}
+
+const struct fdt_index_compat *fdt_index_next_compatible(const struct fdt_index *index, const struct fdt_index_compat *entry) {
+  if (entry->next == FDT_INDEX_NONE) {
+    return NULL;
+  }
+  return &index->compats[entry->next];
+}
+
+const char *fdt_index_prop_name(const struct fdt_index *index, const struct fdt_index_prop *prop) {
+  struct fdt_prop_data data = { .len = prop->len, .nameoff = prop->nameoff, .id = prop->id };
+  return fdt_prop_get_name(index->header, &data);
+}
+
+const struct fdt_index_prop *fdt_index_get_prop_id(const struct fdt_index *index, uint32_t node, enum fdt_prop_id id) {
+  if (node >= index->n_nodes) {
+    return NULL;
+  }
+  const struct fdt_index_node *n = &index->nodes[node];
+  for (uint32_t p = n->first_prop; p < n->first_prop + n->n_props; p++) {
+    if (index->props[p].id == id) {
+      return &index->props[p];
+    }
+  }
+  return NULL;
+}
+
+const struct fdt_index_prop *fdt_index_get_prop(const struct fdt_index *index, uint32_t node, const char *name) {
+  enum fdt_prop_id id = fdt_prop_lookup(name);
+  if (id != FDT_PROP_ID_UNKNOWN) {
+    return fdt_index_get_prop_id(index, node, id);
+  }
+  if (node >= index->n_nodes) {
+    return NULL;
+  }
+  const struct fdt_index_node *n = &index->nodes[node];
+  for (uint32_t p = n->first_prop; p < n->first_prop + n->n_props; p++) {
+    if (strcmp(fdt_index_prop_name(index, &index->props[p]), name) == 0) {
+      return &index->props[p];
+    }
+  }
+  return NULL;
+}
+
+int fdt_index_reg(const struct fdt_index *index, uint32_t node, uint32_t n, uint64_t *address, uint64_t *size) {
+  const struct fdt_index_prop *reg = fdt_index_get_prop_id(index, node, FDT_PROP_ID_REG);
+  if (!reg) {
+    return -1;
+  }
+
+  uint32_t address_cells = 2;
+  uint32_t size_cells = 1;
+  uint32_t parent = index->nodes[node].parent;
+  if (parent != FDT_INDEX_NONE) {
+    address_cells = index->nodes[parent].address_cells;
+    size_cells = index->nodes[parent].size_cells;
+  }
+
+  uint32_t tuple_cells = address_cells + size_cells;
+  if (!tuple_cells || (n + 1) * tuple_cells * sizeof(uint32_t) > reg->len) {
+    return -1;
+  }
+  const uint32_t *cells = (const uint32_t *) reg->value + n * tuple_cells;
+  *address = fdt_read_cells(cells, address_cells);
+  *size = fdt_read_cells(cells + address_cells, size_cells);
+  return 0;
+}
+
+uint32_t fdt_index_interrupt_parent(const struct fdt_index *index, uint32_t node) {
+  if (node >= index->n_nodes) {
+    return FDT_INDEX_NONE;
+  }
+  // Without interrupt-parent the tree parent is used, until an interrupt controller is found
+  do {
+    const struct fdt_index_prop *prop = fdt_index_get_prop_id(index, node, FDT_PROP_ID_INTERRUPT_PARENT);
+    if (prop && prop->len >= sizeof(uint32_t)) {
+      node = fdt_index_find_phandle(index, fdt_read_cells(prop->value, 1));
+    } else {
+      node = index->nodes[node].parent;
+    }
+  } while (node != FDT_INDEX_NONE && !fdt_index_get_prop_id(index, node, FDT_PROP_ID_INTERRUPT_CELLS));
+  return node;
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/dtb/dtb.h>
+#include <kernel/klibc/stdlib.h>
+
+#define FDT_NAMES_HASH_SIZE 64
+
+const struct fdt_prop_name fdt_prop_names[FDT_PROP_ID_COUNT] = {
+  [FDT_PROP_ID_UNKNOWN] = {"", FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_PHANDLE] = {FDT_PROP_PHANDLE, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_LINUX_PHANDLE] = {FDT_PROP_LINUX_PHANDLE, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_INTERRUPT_PARENT] = {FDT_PROP_INTERRUPT_PARENT, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_INTERRUPT_CELLS] = {FDT_PROP_INTERRUPT_CELLS, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_ADDRESS_CELLS] = {FDT_PROP_ADDRESS_CELLS, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_SIZE_CELLS] = {FDT_PROP_SIZE_CELLS, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_CLOCK_CELLS] = {FDT_PROP_CLOCK_CELLS, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_GPIO_CELLS] = {FDT_PROP_GPIO_CELLS, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_BANK_WIDTH] = {FDT_PROP_BANK_WIDTH, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_DEVICE_WIDTH] = {FDT_PROP_DEVICE_WIDTH, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_LINUX_PCI_DOMAIN] = {FDT_PROP_LINUX_PCI_DOMAIN, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_LINUX_CODE] = {FDT_PROP_LINUX_CODE, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_LABEL] = {FDT_PROP_LABEL, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_MODEL] = {FDT_PROP_MODEL, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_DEVICE_TYPE] = {FDT_PROP_DEVICE_TYPE, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_STDOUT_PATH] = {FDT_PROP_STDOUT_PATH, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_COMPATIBLE] = {FDT_PROP_COMPATIBLE, FDT_PROP_TYPE_STRINGLIST},
+  [FDT_PROP_ID_CLOCK_NAMES] = {FDT_PROP_CLOCK_NAMES, FDT_PROP_TYPE_STRINGLIST},
+  [FDT_PROP_ID_CLOCK_OUTPUT_NAMES] = {FDT_PROP_CLOCK_OUTPUT_NAMES, FDT_PROP_TYPE_STRINGLIST},
+  [FDT_PROP_ID_REG] = {FDT_PROP_REG, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_RANGES] = {FDT_PROP_RANGES, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_INTERRUPTS] = {FDT_PROP_INTERRUPTS, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_INTERRUPTS_EXTENDED] = {FDT_PROP_INTERRUPTS_EXTENDED, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_INTERRUPT_CONTROLLER] = {FDT_PROP_INTERRUPT_CONTROLLER, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_INTERRUPT_NAMES] = {FDT_PROP_INTERRUPT_NAMES, FDT_PROP_TYPE_STRINGLIST},
+  [FDT_PROP_ID_STATUS] = {FDT_PROP_STATUS, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_ENABLE_METHOD] = {FDT_PROP_ENABLE_METHOD, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_METHOD] = {FDT_PROP_METHOD, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_CPU_ON] = {FDT_PROP_CPU_ON, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_CPU_OFF] = {FDT_PROP_CPU_OFF, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_CLOCKS] = {FDT_PROP_CLOCKS, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_DMA_COHERENT] = {FDT_PROP_DMA_COHERENT, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_MSI_PARENT] = {FDT_PROP_MSI_PARENT, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_BOOTARGS] = {FDT_PROP_BOOTARGS, FDT_PROP_TYPE_STRING},
+  [FDT_PROP_ID_REG_NAMES] = {FDT_PROP_REG_NAMES, FDT_PROP_TYPE_STRINGLIST},
+  [FDT_PROP_ID_NUMA_NODE_ID] = {FDT_PROP_NUMA_NODE_ID, FDT_PROP_TYPE_U32},
+  [FDT_PROP_ID_DISTANCE_MATRIX] = {FDT_PROP_DISTANCE_MATRIX, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_NO_MAP] = {FDT_PROP_NO_MAP, FDT_PROP_TYPE_GENERIC},
+  [FDT_PROP_ID_CLOCK_FREQUENCY] = {FDT_PROP_CLOCK_FREQUENCY, FDT_PROP_TYPE_U32},
+};
+
+// Collision free slots of fdt_prop_hash for every well known name. Adding a
+// name means searching new coefficients so that all of them stay unique.
+static const uint8_t fdt_prop_slots[FDT_NAMES_HASH_SIZE] = {
+  [1] = FDT_PROP_ID_COMPATIBLE,
+  [2] = FDT_PROP_ID_CPU_ON,
+  [3] = FDT_PROP_ID_RANGES,
+  [4] = FDT_PROP_ID_NUMA_NODE_ID,
+  [5] = FDT_PROP_ID_ENABLE_METHOD,
+  [6] = FDT_PROP_ID_DEVICE_TYPE,
+  [7] = FDT_PROP_ID_MSI_PARENT,
+  [9] = FDT_PROP_ID_MODEL,
+  [11] = FDT_PROP_ID_INTERRUPT_CONTROLLER,
+  [12] = FDT_PROP_ID_PHANDLE,
+  [13] = FDT_PROP_ID_INTERRUPTS,
+  [14] = FDT_PROP_ID_CLOCK_CELLS,
+  [16] = FDT_PROP_ID_METHOD,
+  [18] = FDT_PROP_ID_INTERRUPT_NAMES,
+  [19] = FDT_PROP_ID_REG_NAMES,
+  [20] = FDT_PROP_ID_CLOCKS,
+  [21] = FDT_PROP_ID_GPIO_CELLS,
+  [25] = FDT_PROP_ID_CLOCK_NAMES,
+  [26] = FDT_PROP_ID_INTERRUPT_CELLS,
+  [27] = FDT_PROP_ID_LINUX_PCI_DOMAIN,
+  [30] = FDT_PROP_ID_DMA_COHERENT,
+  [31] = FDT_PROP_ID_INTERRUPT_PARENT,
+  [32] = FDT_PROP_ID_CLOCK_OUTPUT_NAMES,
+  [34] = FDT_PROP_ID_INTERRUPTS_EXTENDED,
+  [35] = FDT_PROP_ID_CPU_OFF,
+  [36] = FDT_PROP_ID_LABEL,
+  [37] = FDT_PROP_ID_CLOCK_FREQUENCY,
+  [38] = FDT_PROP_ID_ADDRESS_CELLS,
+  [40] = FDT_PROP_ID_NO_MAP,
+  [41] = FDT_PROP_ID_LINUX_CODE,
+  [42] = FDT_PROP_ID_SIZE_CELLS,
+  [43] = FDT_PROP_ID_DEVICE_WIDTH,
+  [44] = FDT_PROP_ID_LINUX_PHANDLE,
+  [50] = FDT_PROP_ID_STDOUT_PATH,
+  [51] = FDT_PROP_ID_BANK_WIDTH,
+  [52] = FDT_PROP_ID_BOOTARGS,
+  [61] = FDT_PROP_ID_REG,
+  [62] = FDT_PROP_ID_STATUS,
+  [63] = FDT_PROP_ID_DISTANCE_MATRIX,
+};
+
+static uint32_t fdt_prop_hash(const char *name, size_t len) {
+  const uint8_t *s = (const uint8_t *) name;
+  return (s[0] * 21 + (s[1] + s[2]) * 17 + s[len - 1] * 12 + len) & (FDT_NAMES_HASH_SIZE - 1);
+}
+
+enum fdt_prop_id fdt_prop_lookup(const char *name) {
+  size_t len = strlen(name);
+  // The shortest well known name is "reg"
+  if (len < 3) {
+    return FDT_PROP_ID_UNKNOWN;
+  }
+  uint8_t id = fdt_prop_slots[fdt_prop_hash(name, len)];
+  if (id && strcmp(fdt_prop_names[id].name, name) == 0) {
+    return id;
+  }
+  return FDT_PROP_ID_UNKNOWN;
+}
+
+// Stateless, so walks on several cores or over several blobs never interfere:
+// the perfect hash is a few loads and one strcmp
+enum fdt_prop_id fdt_prop_id(const struct fdt_header *header, uint32_t nameoff) {
+  const char *strings = (const char *) header + fdt_header_get(header, off_dt_strings);
+  return fdt_prop_lookup(strings + nameoff);
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/exception.h>
+#include <kernel/arch/fpsimd.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/ksyms.h>
+#include <kernel/trace.h>
+
+static const char *EXCEPTION_NAMES[] = {"Synchronous", "IRQ", "FIQ", "SError"};
+
+void exception_sync(struct exception_frame *frame) {
+  switch (ESR_EC(frame->esr)) {
+    case ESR_EC_FP_ASIMD:
+      fpsimd_trap();
+      break;
+    default:
+      exception_unhandled(frame, EXCEPTION_SYNC);
+      break;
+  }
+}
+
+void exception_unhandled(struct exception_frame *frame, uint64_t type) {
+  debug_panic_mode();
+  debug_msg("=============== Unhandled Exception =================");
+  debug_msg("Type: %s", EXCEPTION_NAMES[type & 3]);
+  debug_msg("ESR: %#lx (EC: %#x)", frame->esr, (uint32_t) ESR_EC(frame->esr));
+  uint64_t offset = 0;
+  const char *function = ksym_lookup(frame->elr, &offset);
+  debug_msg("ELR: %#lx (%s+%#lx)", frame->elr, function ? function : "?", offset);
+  function = ksym_lookup(frame->x[30], &offset);
+  debug_msg("LR: %#lx (%s+%#lx)", frame->x[30], function ? function : "?", offset);
+  debug_msg("FAR: %#lx", read_sysreg(far_el1));
+  debug_msg("SPSR: %#lx", frame->spsr);
+  debug_msg("=============== Last Trace Records ==================");
+  trace_drain();
+  debug_msg("=====================================================");
+  while (1) {
+    wfe();
+  }
+}
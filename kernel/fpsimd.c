@@ -0,0 +1,63 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/fpsimd.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/kthread.h>
+#include <kernel/smp.h>
+
+// Invariant: the fpsimd_state of a thread that is not running is always up to
+// date, so taking the trap never requires saving somebody else's registers.
+
+static inline void fpsimd_set_access(uint64_t fpen) {
+  uint64_t cpacr = read_sysreg(cpacr_el1);
+  write_sysreg(cpacr_el1, (cpacr & ~CPACR_FPEN_MASK) | fpen);
+  isb();
+}
+
+static inline int fpsimd_enabled() {
+  return (read_sysreg(cpacr_el1) & CPACR_FPEN_MASK) == CPACR_FPEN_ENABLE;
+}
+
+void fpsimd_init() {
+  fpsimd_set_access(CPACR_FPEN_TRAP);
+}
+
+void fpsimd_trap() {
+  fpsimd_set_access(CPACR_FPEN_ENABLE);
+
+  struct cpu *cpu = this_cpu();
+  struct kthread *current = cpu ? cpu->current : NULL;
+  if (!current) {
+    // Scheduler or early boot context, there is no state to preserve
+    if (cpu) {
+      cpu->fpsimd_last = NULL;
+    }
+    return;
+  }
+
+  if (cpu->fpsimd_last == current && current->fpsimd_cpu == cpu->id) {
+    return;
+  }
+
+  __fpsimd_load(&current->fpsimd);
+  current->fpsimd_cpu = cpu->id;
+  cpu->fpsimd_last = current;
+}
+
+void fpsimd_switch_out(struct kthread *thread) {
+  // The registers are only accessible if the thread took the trap (or still owned them)
+  if (fpsimd_enabled() && this_cpu()->fpsimd_last == thread) {
+    __fpsimd_save(&thread->fpsimd);
+  }
+}
+
+void fpsimd_switch_in(struct kthread *thread) {
+  struct cpu *cpu = this_cpu();
+  if (cpu->fpsimd_last == thread && thread->fpsimd_cpu == cpu->id) {
+    fpsimd_set_access(CPACR_FPEN_ENABLE);
+  } else {
+    fpsimd_set_access(CPACR_FPEN_TRAP);
+  }
+}
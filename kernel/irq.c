@@ -0,0 +1,129 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/smp.h>
+
+static const struct irq_chip *irq_chip = NULL;
+
+// Flat dispatch table indexed by INTID, private INTIDs share one handler on every core
+static struct irq_desc irq_descs[IRQ_MAX];
+
+void irq_register_chip(const struct irq_chip *chip) {
+  if (irq_chip) {
+    debug_msg("irq: %s is ignored, %s is already registered", chip->name, irq_chip->name);
+    return;
+  }
+  __atomic_store_n(&irq_chip, chip, __ATOMIC_RELEASE);
+  // Idle cores bring up their CPU interface from the scheduler loop
+  dsb(ish);
+  sev();
+}
+
+int irq_request(uint32_t intid, irq_handler_t handler, void *data) {
+  if (!irq_chip || intid >= IRQ_MAX) {
+    return -1;
+  }
+  irq_descs[intid].data = data;
+  __atomic_store_n(&irq_descs[intid].handler, handler, __ATOMIC_RELEASE);
+  irq_enable(intid);
+  return 0;
+}
+
+// Private interrupts are programmed through the CPU interface of the calling core
+static inline void irq_private_online(uint32_t intid) {
+  if (intid < IRQ_PRIVATE) {
+    irq_cpu_online();
+  }
+}
+
+void irq_enable(uint32_t intid) {
+  if (irq_chip && intid < IRQ_MAX) {
+    irq_private_online(intid);
+    irq_chip->enable(intid);
+  }
+}
+
+void irq_disable(uint32_t intid) {
+  if (irq_chip && intid < IRQ_MAX) {
+    irq_private_online(intid);
+    irq_chip->disable(intid);
+  }
+}
+
+void irq_send_ipi(uint32_t cpu, uint32_t intid) {
+  if (irq_chip && intid < IRQ_PPI_BASE && cpu < SMP_MAX_CPUS) {
+    irq_chip->send_sgi(cpu, intid);
+  }
+}
+
+uint32_t irq_of_node(const struct fdt_index *index, uint32_t node, uint32_t n) {
+  const struct irq_chip *chip = irq_chip;
+  if (!chip || fdt_index_interrupt_parent(index, node) != chip->node) {
+    return IRQ_NONE;
+  }
+
+  const struct fdt_index_prop *cells_prop = fdt_index_get_prop_id(index, chip->node, FDT_PROP_ID_INTERRUPT_CELLS);
+  const struct fdt_index_prop *interrupts = fdt_index_get_prop_id(index, node, FDT_PROP_ID_INTERRUPTS);
+  if (!cells_prop || cells_prop->len < sizeof(uint32_t) || !interrupts) {
+    return IRQ_NONE;
+  }
+  uint32_t n_cells = fdt_read_cells(cells_prop->value, 1);
+  if (!n_cells || (n + 1) * n_cells * sizeof(uint32_t) > interrupts->len) {
+    return IRQ_NONE;
+  }
+
+  uint32_t trigger = IRQ_TRIGGER_LEVEL;
+  uint32_t intid = chip->xlate((const uint32_t *) interrupts->value + n * n_cells, n_cells, &trigger);
+  if (intid < IRQ_MAX) {
+    irq_private_online(intid);
+    chip->set_trigger(intid, trigger);
+  }
+  return intid;
+}
+
+void irq_cpu_online() {
+  struct cpu *cpu = this_cpu();
+  if (cpu->irq_online) {
+    return;
+  }
+  const struct irq_chip *chip = __atomic_load_n(&irq_chip, __ATOMIC_ACQUIRE);
+  if (!chip) {
+    return;
+  }
+  chip->cpu_init();
+  cpu->irq_online = 1;
+  local_irq_enable();
+}
+
+struct irq_frame *irq_current_frame() {
+  struct cpu *cpu = this_cpu();
+  return cpu ? cpu->irq_frame : NULL;
+}
+
+void irq_handle(struct irq_frame *frame) {
+  const struct irq_chip *chip = irq_chip;
+  struct cpu *cpu = this_cpu();
+  cpu->irq_frame = frame;
+  // Serve everything pending before returning, an interrupt costs one exception entry
+  while (1) {
+    uint32_t iar = chip->ack();
+    uint32_t intid = iar & IRQ_INTID_MASK;
+    if (intid >= IRQ_MAX) {
+      break;
+    }
+
+    const struct irq_desc *desc = &irq_descs[intid];
+    if (desc->handler) {
+      desc->handler(intid, desc->data);
+    } else {
+      chip->disable(intid);
+      debug_msg("irq: no handler for INTID %u, disabled", intid);
+    }
+    chip->eoi(iar);
+  }
+  cpu->irq_frame = NULL;
+}
@@ -0,0 +1,404 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <stdarg.h>
+#include <kernel/klibc/stdlib.h>
+
+#define KFMT_LEFT (1 << 0)  // '-'
+#define KFMT_ZERO (1 << 1)  // '0'
+#define KFMT_PLUS (1 << 2)  // '+'
+#define KFMT_SPACE (1 << 3) // ' '
+#define KFMT_ALT (1 << 4)   // '#'
+#define KFMT_UPPER (1 << 5)
+#define KFMT_POINTER (1 << 6)
+
+#define KFMT_NO_PRECISION (-1)
+#define KFMT_MAX_DIGITS 24 // 2^64 takes 22 octal digits
+
+enum kfmt_length {
+  KFMT_LEN_HH,
+  KFMT_LEN_H,
+  KFMT_LEN_INT,
+  KFMT_LEN_L,
+  KFMT_LEN_LL,
+  KFMT_LEN_Z,
+  KFMT_LEN_J,
+  KFMT_LEN_T
+};
+
+// Every pair of decimal digits, so numbers are converted two digits per division
+static const char kfmt_digits2[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char kfmt_nibbles[2][16] = {
+  { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' },
+  { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' }
+};
+
+/**
+ * Arguments come either from a va_list or from an array of 64-bit values
+ */
+struct kfmt_args {
+  va_list ap;
+  const uint64_t *values;
+  size_t n_values;
+  size_t next;
+};
+
+static void kfmt_put(struct kprintf_buffer *out, const char *s, size_t n) {
+  out->total += n;
+  while (n) {
+    if (out->len == out->size) {
+      if (!out->flush) {
+        return;
+      }
+      out->flush(out->buf, out->len);
+      out->len = 0;
+    }
+    size_t chunk = out->size - out->len;
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(out->buf + out->len, s, chunk);
+    out->len += chunk;
+    s += chunk;
+    n -= chunk;
+  }
+}
+
+static void kfmt_pad(struct kprintf_buffer *out, char c, int n) {
+  char pad[16];
+  memset(pad, c, sizeof(pad));
+  while (n > 0) {
+    size_t chunk = n < (int) sizeof(pad) ? (size_t) n : sizeof(pad);
+    kfmt_put(out, pad, chunk);
+    n -= chunk;
+  }
+}
+
+static uint64_t kfmt_next(struct kfmt_args *args, enum kfmt_length length) {
+  if (args->values) {
+    return args->next < args->n_values ? args->values[args->next++] : 0;
+  }
+  switch (length) {
+    case KFMT_LEN_L:
+      return (uint64_t) va_arg(args->ap, long);
+    case KFMT_LEN_LL:
+      return (uint64_t) va_arg(args->ap, long long);
+    case KFMT_LEN_Z:
+      return (uint64_t) va_arg(args->ap, size_t);
+    case KFMT_LEN_J:
+      return (uint64_t) va_arg(args->ap, intmax_t);
+    case KFMT_LEN_T:
+      return (uint64_t) va_arg(args->ap, ptrdiff_t);
+    default:
+      // char and short are promoted to int
+      return (uint64_t) (int64_t) va_arg(args->ap, int);
+  }
+}
+
+static const void *kfmt_next_ptr(struct kfmt_args *args) {
+  if (args->values) {
+    return (const void *) (uintptr_t) kfmt_next(args, KFMT_LEN_L);
+  }
+  return va_arg(args->ap, const void *);
+}
+
+static int64_t kfmt_signed(uint64_t value, enum kfmt_length length) {
+  switch (length) {
+    case KFMT_LEN_HH:
+      return (signed char) value;
+    case KFMT_LEN_H:
+      return (short) value;
+    case KFMT_LEN_INT:
+      return (int) value;
+    default:
+      return (int64_t) value;
+  }
+}
+
+static uint64_t kfmt_unsigned(uint64_t value, enum kfmt_length length) {
+  switch (length) {
+    case KFMT_LEN_HH:
+      return (unsigned char) value;
+    case KFMT_LEN_H:
+      return (unsigned short) value;
+    case KFMT_LEN_INT:
+      return (unsigned int) value;
+    default:
+      return value;
+  }
+}
+
+// Writes the digits of value right-aligned, ending at end, returns how many
+static int kfmt_utoa(char *end, uint64_t value, uint32_t base, uint32_t flags) {
+  char *p = end;
+  if (base == 10) {
+    while (value >= 100) {
+      uint32_t pair = (uint32_t) (value % 100) * 2;
+      value /= 100;
+      p -= 2;
+      p[0] = kfmt_digits2[pair];
+      p[1] = kfmt_digits2[pair + 1];
+    }
+    if (value >= 10) {
+      p -= 2;
+      p[0] = kfmt_digits2[value * 2];
+      p[1] = kfmt_digits2[value * 2 + 1];
+    } else {
+      *--p = (char) ('0' + value);
+    }
+  } else {
+    // Base 8 or 16
+    uint32_t shift = base == 16 ? 4 : 3;
+    const char *nibbles = kfmt_nibbles[(flags & KFMT_UPPER) ? 1 : 0];
+    do {
+      *--p = nibbles[value & (base - 1)];
+      value >>= shift;
+    } while (value);
+  }
+  return end - p;
+}
+
+static void kfmt_number(struct kprintf_buffer *out, uint64_t value, int negative, uint32_t base,
+                        uint32_t flags, int width, int precision) {
+  char digits[KFMT_MAX_DIGITS];
+  char *end = digits + KFMT_MAX_DIGITS;
+  int n_digits = 0;
+  if (value || precision != 0) {
+    n_digits = kfmt_utoa(end, value, base, flags);
+  }
+
+  char prefix[2];
+  int n_prefix = 0;
+  if (base == 10) {
+    if (negative) {
+      prefix[n_prefix++] = '-';
+    } else if (flags & KFMT_PLUS) {
+      prefix[n_prefix++] = '+';
+    } else if (flags & KFMT_SPACE) {
+      prefix[n_prefix++] = ' ';
+    }
+  } else if (flags & KFMT_ALT) {
+    if (base == 16 && (value || (flags & KFMT_POINTER))) {
+      prefix[n_prefix++] = '0';
+      prefix[n_prefix++] = (flags & KFMT_UPPER) ? 'X' : 'x';
+    } else if (base == 8 && (n_digits == 0 || end[-n_digits] != '0') && precision <= n_digits) {
+      // The first digit of an alternate octal is 0
+      precision = n_digits + 1;
+    }
+  }
+
+  int n_zeros = precision > n_digits ? precision - n_digits : 0;
+  int n_pad = width - n_prefix - n_zeros - n_digits;
+  if ((flags & KFMT_ZERO) && !(flags & KFMT_LEFT) && precision == KFMT_NO_PRECISION && n_pad > 0) {
+    n_zeros += n_pad;
+    n_pad = 0;
+  }
+
+  if (!(flags & KFMT_LEFT)) {
+    kfmt_pad(out, ' ', n_pad);
+  }
+  kfmt_put(out, prefix, n_prefix);
+  kfmt_pad(out, '0', n_zeros);
+  kfmt_put(out, end - n_digits, n_digits);
+  if (flags & KFMT_LEFT) {
+    kfmt_pad(out, ' ', n_pad);
+  }
+}
+
+static void kfmt_string(struct kprintf_buffer *out, const char *s, uint32_t flags, int width, int precision) {
+  if (!s) {
+    s = "(null)";
+  }
+  size_t len = 0;
+  while (s[len] && (precision == KFMT_NO_PRECISION || len < (size_t) precision)) {
+    len++;
+  }
+
+  int n_pad = width - (int) len;
+  if (!(flags & KFMT_LEFT)) {
+    kfmt_pad(out, ' ', n_pad);
+  }
+  kfmt_put(out, s, len);
+  if (flags & KFMT_LEFT) {
+    kfmt_pad(out, ' ', n_pad);
+  }
+}
+
+static int kfmt_int(const char **fmt, struct kfmt_args *args) {
+  if (**fmt == '*') {
+    (*fmt)++;
+    return (int) kfmt_next(args, KFMT_LEN_INT);
+  }
+  int n = 0;
+  while (**fmt >= '0' && **fmt <= '9') {
+    n = n * 10 + (*(*fmt)++ - '0');
+  }
+  return n;
+}
+
+static void kfmt(struct kprintf_buffer *out, const char *fmt, struct kfmt_args *args) {
+  while (*fmt) {
+    // Copy literal text in one go
+    const char *text = fmt;
+    while (*fmt && *fmt != '%') {
+      fmt++;
+    }
+    kfmt_put(out, text, fmt - text);
+    if (!*fmt) {
+      break;
+    }
+    const char *spec = fmt++;
+
+    uint32_t flags = 0;
+    while (1) {
+      switch (*fmt) {
+        case '-': flags |= KFMT_LEFT; fmt++; continue;
+        case '0': flags |= KFMT_ZERO; fmt++; continue;
+        case '+': flags |= KFMT_PLUS; fmt++; continue;
+        case ' ': flags |= KFMT_SPACE; fmt++; continue;
+        case '#': flags |= KFMT_ALT; fmt++; continue;
+      }
+      break;
+    }
+
+    int width = kfmt_int(&fmt, args);
+    if (width < 0) {
+      flags |= KFMT_LEFT;
+      width = -width;
+    }
+    int precision = KFMT_NO_PRECISION;
+    if (*fmt == '.') {
+      fmt++;
+      precision = kfmt_int(&fmt, args);
+      if (precision < 0) {
+        precision = KFMT_NO_PRECISION;
+      }
+    }
+
+    enum kfmt_length length = KFMT_LEN_INT;
+    switch (*fmt) {
+      case 'h':
+        fmt++;
+        length = KFMT_LEN_H;
+        if (*fmt == 'h') {
+          fmt++;
+          length = KFMT_LEN_HH;
+        }
+        break;
+      case 'l':
+        fmt++;
+        length = KFMT_LEN_L;
+        if (*fmt == 'l') {
+          fmt++;
+          length = KFMT_LEN_LL;
+        }
+        break;
+      case 'z': fmt++; length = KFMT_LEN_Z; break;
+      case 'j': fmt++; length = KFMT_LEN_J; break;
+      case 't': fmt++; length = KFMT_LEN_T; break;
+    }
+
+    uint64_t value;
+    switch (*fmt) {
+      case 'd':
+      case 'i': {
+        int64_t n = kfmt_signed(kfmt_next(args, length), length);
+        value = n < 0 ? -(uint64_t) n : (uint64_t) n;
+        kfmt_number(out, value, n < 0, 10, flags, width, precision);
+        break;
+      }
+      case 'u':
+        kfmt_number(out, kfmt_unsigned(kfmt_next(args, length), length), 0, 10, flags, width, precision);
+        break;
+      case 'X':
+        flags |= KFMT_UPPER;
+        // fall through
+      case 'x':
+        kfmt_number(out, kfmt_unsigned(kfmt_next(args, length), length), 0, 16, flags, width, precision);
+        break;
+      case 'o':
+        kfmt_number(out, kfmt_unsigned(kfmt_next(args, length), length), 0, 8, flags, width, precision);
+        break;
+      case 'p':
+        value = (uintptr_t) kfmt_next_ptr(args);
+        kfmt_number(out, value, 0, 16, flags | KFMT_ALT | KFMT_POINTER, width, precision);
+        break;
+      case 'c': {
+        char c = (char) kfmt_next(args, KFMT_LEN_INT);
+        int n_pad = width - 1;
+        if (!(flags & KFMT_LEFT)) {
+          kfmt_pad(out, ' ', n_pad);
+        }
+        kfmt_put(out, &c, 1);
+        if (flags & KFMT_LEFT) {
+          kfmt_pad(out, ' ', n_pad);
+        }
+        break;
+      }
+      case 's':
+        kfmt_string(out, kfmt_next_ptr(args), flags, width, precision);
+        break;
+      case '%':
+        kfmt_put(out, "%", 1);
+        break;
+      default:
+        // Unknown conversion: print it as it is
+        if (!*fmt) {
+          kfmt_put(out, spec, fmt - spec);
+          return;
+        }
+        kfmt_put(out, spec, fmt - spec + 1);
+        break;
+    }
+    fmt++;
+  }
+}
+
+int kvbprintf(struct kprintf_buffer *out, const char *fmt, va_list ap) {
+  struct kfmt_args args = { .values = NULL };
+  size_t start = out->total;
+  va_copy(args.ap, ap);
+  kfmt(out, fmt, &args);
+  va_end(args.ap);
+  return (int) (out->total - start);
+}
+
+int kbprintf(struct kprintf_buffer *out, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = kvbprintf(out, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+int kbprintf_values(struct kprintf_buffer *out, const char *fmt, const uint64_t *values, size_t n_values) {
+  struct kfmt_args args = { .values = values, .n_values = n_values };
+  size_t start = out->total;
+  kfmt(out, fmt, &args);
+  return (int) (out->total - start);
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+  // One byte is kept for the terminator
+  struct kprintf_buffer out = { .buf = buf, .size = size ? size - 1 : 0 };
+  int len = kvbprintf(&out, fmt, ap);
+  if (size) {
+    buf[out.len] = '\0';
+  }
+  return len;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = kvsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return len;
+}
@@ -5,139 +5,159 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <kernel/klibc/stdlib.h>
+#ifndef KOS_HOST
+#include <kernel/arch/fpsimd.h>
+#include <kernel/smp.h>
+#endif
 
-const char *const HexDigits = "0123456789ABCDEF";
+#ifndef KOS_HOST
+// Early console: the PL011 of QEMU virt, polled, until a driver takes over
+#define EARLY_UART_BASE 0x09000000
+#define EARLY_UART_FR 0x18
+#define EARLY_UART_FR_TXFF (1 << 5)
 
-volatile unsigned int *const UART0DR = (unsigned int *) 0x09000000;
+static const struct debug_console *debug_console = NULL;
+static volatile uint32_t debug_panicking = 0;
 
-void debug_putc(char c) {
-  *UART0DR = ((unsigned int)c);
+static void debug_early_putc(char c) {
+  volatile uint32_t *uart = (volatile uint32_t *) EARLY_UART_BASE;
+  while (uart[EARLY_UART_FR / sizeof(uint32_t)] & EARLY_UART_FR_TXFF) {}
+  uart[0] = (uint32_t) c;
 }
 
-// Print integer digit by digit
-void debug_write_int(int64_t n) {
-  if (n == 0) {
-    debug_putc('0');
-    return;
-  }
-
-  int64_t d; int64_t r = 0;
-  if (n < 0) {
-    debug_putc('-');
-  }
-
-  // Reverse the number
-  while (n) {
-    d = n % 10;
-    r = r * 10 + d;
-    n /= 10;
-  }
+void debug_set_console(const struct debug_console *console) {
+  __atomic_store_n(&debug_console, console, __ATOMIC_RELEASE);
+}
 
-  // Print reverse number digit by digit
-  while (r) {
-    d = r % 10;
-    r /= 10;
-    debug_putc(d + '0');
+void debug_putc(char c) {
+  const struct debug_console *console = __atomic_load_n(&debug_console, __ATOMIC_ACQUIRE);
+  if (!console) {
+    debug_early_putc(c);
+  } else if (debug_panicking) {
+    console->putc_sync(c);
+  } else {
+    console->putc(c);
   }
 }
 
-void debug_write_ptr(uintptr_t n, int size) {
-  debug_putc('0');
-  debug_putc('x');
-
-  if (n == 0) {
-    debug_putc('0');
-    debug_putc('0');
+void debug_write_buffer(const char *buf, size_t len) {
+  const struct debug_console *console = __atomic_load_n(&debug_console, __ATOMIC_ACQUIRE);
+  if (console && !debug_panicking && console->write) {
+    console->write(buf, len);
     return;
   }
-
-  int n_shifts = (size  * CHAR_BIT) - 4;
-  while(n_shifts >= 0) {
-    uintptr_t d = n >> n_shifts;
-    if (d) {
-      debug_putc(HexDigits[(char) d & 0xF]);
-    }
-    n_shifts -=4;
+  for (size_t i = 0; i < len; i++) {
+    debug_putc(buf[i]);
   }
 }
 
-void debug_write(const char* string) {
-  while(*string) {
-    debug_putc(*string++);
+void debug_putc_sync(char c) {
+  const struct debug_console *console = __atomic_load_n(&debug_console, __ATOMIC_ACQUIRE);
+  if (console) {
+    console->putc_sync(c);
+  } else {
+    debug_early_putc(c);
   }
 }
 
-void debug_printf_valist(const char* fmt, va_list ap) {
-  if (fmt == NULL) {
+void debug_panic_mode() {
+  if (__atomic_exchange_n(&debug_panicking, 1, __ATOMIC_ACQ_REL)) {
     return;
   }
-
-  char* s; char c;
-  int i; long long l;
-  while (*fmt != '\0') {
-    switch (*fmt) {
-      case '%':
-        switch (*++fmt) {
-          // Null ended strings
-          case 's':
-            s = va_arg(ap, char *);
-            debug_write(s);
-            break;
-          // Integers
-          case 'd':
-            i = va_arg(ap, int);
-            debug_write_int(i);
-            break;
-          case 'x':
-            i = va_arg(ap, int);
-            debug_write_ptr(i, sizeof(int));
-            break;
-          case 'p':
-            i = va_arg(ap, uintptr_t);
-            debug_write_ptr(i, sizeof(uintptr_t));
-            break;
-          // Long integers
-          case 'l':
-            l = va_arg(ap, long long);
-            debug_write_int(l);
-            break;
-        }
-        break;
-      default:
-        debug_putc(*fmt);
-        break;
-    }
-    fmt++;
+  // Print what is still buffered before the panic message
+  const struct debug_console *console = __atomic_load_n(&debug_console, __ATOMIC_ACQUIRE);
+  if (console && console->flush) {
+    console->flush();
   }
 }
+#endif
+
+void debug_write(const char* string) {
+  debug_write_buffer(string, strlen(string));
+}
+
+// Messages are formatted on the stack and reach the console in one write
+#define DEBUG_MSG_BUFFER 128
 
-/**
- * Minimal implementation for debug messages, currently uses PL011
- * @param message the message to be printed
- */
 void debug_msg(const char* fmt, ...) {
   if (fmt == NULL) {
     return;
   }
+  char buf[DEBUG_MSG_BUFFER];
+  struct kprintf_buffer out = { .buf = buf, .size = sizeof(buf), .flush = debug_write_buffer };
   va_list ap;
   va_start(ap, fmt);
-  debug_printf_valist(fmt, ap);
+  kvbprintf(&out, fmt, ap);
   va_end(ap);
-  debug_write("\n\r");
+  kbprintf(&out, "\n\r");
+  debug_write_buffer(out.buf, out.len);
 }
 
 void debug_printf(const char* fmt, ...) {
   if (fmt == NULL) {
     return;
   }
-
+  char buf[DEBUG_MSG_BUFFER];
+  struct kprintf_buffer out = { .buf = buf, .size = sizeof(buf), .flush = debug_write_buffer };
   va_list ap;
   va_start(ap, fmt);
-  debug_printf_valist(fmt, ap);
+  kvbprintf(&out, fmt, ap);
   va_end(ap);
+  debug_write_buffer(out.buf, out.len);
 }
 
-void *memset(void *s, int c, size_t len) {
+// Word-at-a-time helpers
+typedef uint64_t __attribute__((may_alias)) word_t;
+#define WORD_SIZE sizeof(word_t)
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+// Large zeroing uses DC ZVA, which needs normal memory (MMU on) and DCZID_EL0.DZP clear
+#define MEMSET_ZVA_THRESHOLD 256
+#define DCZID_DZP (1 << 4)
+
+static size_t memset_zva_size() {
+#ifdef KOS_HOST
+  return 0;
+#else
+  static int64_t zva_size = -1;
+  if (zva_size >= 0) {
+    return zva_size;
+  }
+
+  uint64_t sctlr;
+  __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+  if (!(sctlr & 1)) {
+    return 0;
+  }
+
+  uint64_t dczid;
+  __asm__ volatile("mrs %0, dczid_el0" : "=r"(dczid));
+  zva_size = (dczid & DCZID_DZP) ? 0 : (4 << (dczid & 0xF));
+  return zva_size;
+#endif
+}
+
+// The NEON versions (string_simd.c) pay off on large buffers, and only where
+// the FP/SIMD registers are already live: the running thread owns them (it
+// took the lazy trap) and no IRQ handler is running on top of it
+#ifndef KOS_HOST
+#define KLIBC_SIMD_THRESHOLD 256
+
+static inline int klibc_simd_usable(size_t len) {
+  if (len < KLIBC_SIMD_THRESHOLD) {
+    return 0;
+  }
+  struct cpu *cpu = this_cpu();
+  if (!cpu || !cpu->current || cpu->fpsimd_last != cpu->current || cpu->irq_frame) {
+    return 0;
+  }
+  return (read_sysreg(cpacr_el1) & CPACR_FPEN_MASK) == CPACR_FPEN_ENABLE;
+}
+#endif
+
+void *memset_reference(void *s, int c, size_t len) {
   uint8_t *dst = s;
   while (len > 0) {
     *dst = (uint8_t) c;
@@ -147,6 +167,189 @@ void *memset(void *s, int c, size_t len) {
   return s;
 }
 
+void *memset(void *s, int c, size_t len) {
+  uint8_t *dst = s;
+  if (len < 2 * WORD_SIZE) {
+    return memset_reference(s, c, len);
+  }
+#ifndef KOS_HOST
+  // Zeroing prefers DC ZVA, which does not even read the lines
+  if (klibc_simd_usable(len) && ((uint8_t) c || !memset_zva_size())) {
+    return memset_simd(s, c, len);
+  }
+#endif
+
+  // Align the destination to a word
+  while ((uintptr_t) dst & (WORD_SIZE - 1)) {
+    *dst++ = (uint8_t) c;
+    len--;
+  }
+
+  uint64_t pattern = ONES * (uint8_t) c;
+  if (pattern == 0 && len >= MEMSET_ZVA_THRESHOLD) {
+    size_t zva_size = memset_zva_size();
+    if (zva_size && len >= ((-(uintptr_t) dst) & (zva_size - 1)) + zva_size) {
+      while ((uintptr_t) dst & (zva_size - 1)) {
+        *(word_t *) dst = 0;
+        dst += WORD_SIZE;
+        len -= WORD_SIZE;
+      }
+      while (len >= zva_size) {
+#ifndef KOS_HOST
+        __asm__ volatile("dc zva, %0" : : "r"(dst) : "memory");
+#endif
+        dst += zva_size;
+        len -= zva_size;
+      }
+    }
+  }
+
+  // 32 bytes per iteration (two STPs)
+  while (len >= 4 * WORD_SIZE) {
+    word_t *w = (word_t *) dst;
+    w[0] = pattern;
+    w[1] = pattern;
+    w[2] = pattern;
+    w[3] = pattern;
+    dst += 4 * WORD_SIZE;
+    len -= 4 * WORD_SIZE;
+  }
+  while (len >= WORD_SIZE) {
+    *(word_t *) dst = pattern;
+    dst += WORD_SIZE;
+    len -= WORD_SIZE;
+  }
+  while (len--) {
+    *dst++ = (uint8_t) c;
+  }
+  return s;
+}
+
+void *memcpy(void *restrict dest, const void *restrict src, size_t len) {
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+#ifndef KOS_HOST
+  if (klibc_simd_usable(len)) {
+    return memcpy_simd(dest, src, len);
+  }
+#endif
+
+  if (len >= 2 * WORD_SIZE) {
+    // Align the destination to a word
+    while ((uintptr_t) d & (WORD_SIZE - 1)) {
+      *d++ = *s++;
+      len--;
+    }
+
+    size_t shift = (uintptr_t) s & (WORD_SIZE - 1);
+    if (shift == 0) {
+      // 32 bytes per iteration (two LDP/STP pairs), all loads before the stores
+      while (len >= 4 * WORD_SIZE) {
+        const word_t *sw = (const word_t *) s;
+        word_t *dw = (word_t *) d;
+        uint64_t w0 = sw[0], w1 = sw[1], w2 = sw[2], w3 = sw[3];
+        dw[0] = w0;
+        dw[1] = w1;
+        dw[2] = w2;
+        dw[3] = w3;
+        d += 4 * WORD_SIZE;
+        s += 4 * WORD_SIZE;
+        len -= 4 * WORD_SIZE;
+      }
+      while (len >= WORD_SIZE) {
+        *(word_t *) d = *(const word_t *) s;
+        d += WORD_SIZE;
+        s += WORD_SIZE;
+        len -= WORD_SIZE;
+      }
+    } else {
+      // Misaligned source: aligned loads merged with shifts (little-endian),
+      // every load contains at least one byte that is copied
+      const word_t *sw = (const word_t *) (s - shift);
+      uint64_t lo = *sw++;
+      size_t rshift = shift * 8;
+      size_t lshift = 64 - rshift;
+      while (len >= WORD_SIZE) {
+        uint64_t hi = *sw++;
+        *(word_t *) d = (lo >> rshift) | (hi << lshift);
+        lo = hi;
+        d += WORD_SIZE;
+        s += WORD_SIZE;
+        len -= WORD_SIZE;
+      }
+    }
+  }
+
+  while (len--) {
+    *d++ = *s++;
+  }
+  return dest;
+}
+
+void *memmove(void *dest, const void *src, size_t len) {
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+  if (d == s || len == 0) {
+    return dest;
+  }
+
+  // memcpy copies forward and loads each word before storing it
+  if (d < s || d >= s + len) {
+    return memcpy(dest, src, len);
+  }
+
+  // Overlapping with the destination above the source: copy backwards
+  d += len;
+  s += len;
+  if ((((uintptr_t) d ^ (uintptr_t) s) & (WORD_SIZE - 1)) == 0) {
+    while (len && ((uintptr_t) d & (WORD_SIZE - 1))) {
+      *--d = *--s;
+      len--;
+    }
+    while (len >= WORD_SIZE) {
+      d -= WORD_SIZE;
+      s -= WORD_SIZE;
+      *(word_t *) d = *(const word_t *) s;
+      len -= WORD_SIZE;
+    }
+  }
+  while (len--) {
+    *--d = *--s;
+  }
+  return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t len) {
+  const uint8_t *p1 = s1;
+  const uint8_t *p2 = s2;
+
+  // Skip equal words when both sides share the same alignment
+  if ((((uintptr_t) p1 ^ (uintptr_t) p2) & (WORD_SIZE - 1)) == 0) {
+    while (len && ((uintptr_t) p1 & (WORD_SIZE - 1))) {
+      if (*p1 != *p2) {
+        return *p1 - *p2;
+      }
+      p1++;
+      p2++;
+      len--;
+    }
+    while (len >= WORD_SIZE && *(const word_t *) p1 == *(const word_t *) p2) {
+      p1 += WORD_SIZE;
+      p2 += WORD_SIZE;
+      len -= WORD_SIZE;
+    }
+  }
+
+  while (len--) {
+    if (*p1 != *p2) {
+      return *p1 - *p2;
+    }
+    p1++;
+    p2++;
+  }
+  return 0;
+}
+
 void swap_bytes(void* s, size_t len) {
   char *p = s;
   size_t lo, hi;
@@ -163,50 +366,206 @@ int strcmp(const char* s1, const char* s2) {
     return 0;
   }
 
+  // Compare a word at a time while both strings share the same alignment
+  if ((((uintptr_t) s1 ^ (uintptr_t) s2) & (WORD_SIZE - 1)) == 0) {
+    while ((uintptr_t) s1 & (WORD_SIZE - 1)) {
+      if (*s1 != *s2) {
+        return ((uint8_t) *s1 > (uint8_t) *s2) ? 1 : -1;
+      }
+      if (*s1 == '\0') {
+        return 0;
+      }
+      s1++;
+      s2++;
+    }
+
+    // Aligned loads never cross a page boundary
+    while (1) {
+      uint64_t w1 = *(const word_t *) s1;
+      uint64_t w2 = *(const word_t *) s2;
+      if (w1 != w2 || HAS_ZERO(w1)) {
+        break;
+      }
+      s1 += WORD_SIZE;
+      s2 += WORD_SIZE;
+    }
+  }
+
   while(*s1 || *s2) {
     if (*s1 == *s2) {
       s1++;
       s2++;
     } else {
-      return (*s1 > *s2) ? 1 : -1;
+      return ((uint8_t) *s1 > (uint8_t) *s2) ? 1 : -1;
     }
   }
 
   return 0;
 }
 
+// Critical factorization of the needle (Crochemore-Perrin), see the two-way algorithm
+static size_t strstr_critical_factorization(const uint8_t *needle, size_t len, size_t *period) {
+  size_t max_suffix, max_suffix_rev, j, k, p;
+  uint8_t a, b;
+
+  // Maximal suffix for the "<" order
+  max_suffix = SIZE_MAX;
+  j = 0;
+  k = p = 1;
+  while (j + k < len) {
+    a = needle[j + k];
+    b = needle[max_suffix + k];
+    if (a < b) {
+      j += k;
+      k = 1;
+      p = j - max_suffix;
+    } else if (a == b) {
+      if (k != p) {
+        k++;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      max_suffix = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+
+  // Maximal suffix for the ">" order
+  max_suffix_rev = SIZE_MAX;
+  j = 0;
+  k = p = 1;
+  while (j + k < len) {
+    a = needle[j + k];
+    b = needle[max_suffix_rev + k];
+    if (b < a) {
+      j += k;
+      k = 1;
+      p = j - max_suffix_rev;
+    } else if (a == b) {
+      if (k != p) {
+        k++;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      max_suffix_rev = j++;
+      k = p = 1;
+    }
+  }
+
+  if (max_suffix_rev + 1 < max_suffix + 1) {
+    return max_suffix + 1;
+  }
+  *period = p;
+  return max_suffix_rev + 1;
+}
+
+// Makes sure haystack[0, needed) has no terminator, the known length only grows
+static int strstr_available(const uint8_t *haystack, size_t *known, size_t needed) {
+  while (*known < needed) {
+    if (haystack[*known] == '\0') {
+      return 0;
+    }
+    (*known)++;
+  }
+  return 1;
+}
+
 char *strstr(const char *haystack, const char *needle) {
-  if (haystack == NULL && needle == NULL) {
+  if (haystack == NULL || needle == NULL) {
     return NULL;
   }
 
-  while (*haystack) {
-    if (*haystack == *needle) {
-      const char *s1 = haystack;
-      const char *s2 = needle;
-      while(*s1 || *s2) {
-        if (*s1 == *s2) {
-          s1++;
-          s2++;
-        } else {
-          break;
+  const uint8_t *h = (const uint8_t *) haystack;
+  const uint8_t *n = (const uint8_t *) needle;
+  if (n[0] == '\0') {
+    return (char *) haystack;
+  }
+
+  // Single character needles are a plain scan
+  if (n[1] == '\0') {
+    while (*h && *h != n[0]) {
+      h++;
+    }
+    return *h ? (char *) h : NULL;
+  }
+
+  // Two-way string matching: linear time and constant space
+  size_t len = strlen(needle);
+  size_t known = 0;
+  size_t period, i, j = 0;
+  size_t suffix = strstr_critical_factorization(n, len, &period);
+
+  if (memcmp(n, n + period, suffix) == 0) {
+    // Periodic needle: remember how much of the needle is known to match
+    size_t memory = 0;
+    while (strstr_available(h, &known, j + len)) {
+      i = suffix > memory ? suffix : memory;
+      while (i < len && n[i] == h[i + j]) {
+        i++;
+      }
+      if (i >= len) {
+        i = suffix - 1;
+        while (memory < i + 1 && n[i] == h[i + j]) {
+          i--;
+        }
+        if (i + 1 < memory + 1) {
+          return (char *) (h + j);
         }
+        j += period;
+        memory = len - period;
+      } else {
+        j += i - suffix + 1;
+        memory = 0;
       }
-
-      if (*s2 == '\0') {
-        return (char *) haystack;
+    }
+  } else {
+    period = (suffix > len - suffix ? suffix : len - suffix) + 1;
+    while (strstr_available(h, &known, j + len)) {
+      i = suffix;
+      while (i < len && n[i] == h[i + j]) {
+        i++;
+      }
+      if (i >= len) {
+        i = suffix - 1;
+        while (i != SIZE_MAX && n[i] == h[i + j]) {
+          i--;
+        }
+        if (i == SIZE_MAX) {
+          return (char *) (h + j);
+        }
+        j += period;
+      } else {
+        j += i - suffix + 1;
       }
     }
-    haystack++;
   }
 
   return NULL;
 }
 
 size_t strlen(const char* s) {
-  int c = 0;
-  while(*s) {
-    s++; c++;
+  const char *p = s;
+
+  // Align to a word, then look for a zero byte a word at a time
+  while ((uintptr_t) p & (WORD_SIZE - 1)) {
+    if (*p == '\0') {
+      return p - s;
+    }
+    p++;
   }
-  return c;
-}
\ No newline at end of file
+
+  while (1) {
+    uint64_t w = *(const word_t *) p;
+    uint64_t zero = HAS_ZERO(w);
+    if (zero) {
+      // The lowest flagged byte is always a real zero (little-endian)
+      return (p - s) + (__builtin_ctzl(zero) >> 3);
+    }
+    p += WORD_SIZE;
+  }
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Built with FP/SIMD code generation enabled (see kos_enable_simd)
+
+#include <arm_neon.h>
+#include <kernel/klibc/stdlib.h>
+
+void *memcpy_simd(void *restrict dest, const void *restrict src, size_t len) {
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+
+  // 64 bytes per iteration
+  while (len >= 64) {
+    uint8x16_t v0 = vld1q_u8(s);
+    uint8x16_t v1 = vld1q_u8(s + 16);
+    uint8x16_t v2 = vld1q_u8(s + 32);
+    uint8x16_t v3 = vld1q_u8(s + 48);
+    vst1q_u8(d, v0);
+    vst1q_u8(d + 16, v1);
+    vst1q_u8(d + 32, v2);
+    vst1q_u8(d + 48, v3);
+    d += 64;
+    s += 64;
+    len -= 64;
+  }
+  while (len >= 16) {
+    vst1q_u8(d, vld1q_u8(s));
+    d += 16;
+    s += 16;
+    len -= 16;
+  }
+  memcpy(d, s, len);
+  return dest;
+}
+
+void *memset_simd(void *s, int c, size_t len) {
+  uint8_t *d = s;
+  uint8x16_t v = vdupq_n_u8((uint8_t) c);
+
+  while (len >= 64) {
+    vst1q_u8(d, v);
+    vst1q_u8(d + 16, v);
+    vst1q_u8(d + 32, v);
+    vst1q_u8(d + 48, v);
+    d += 64;
+    len -= 64;
+  }
+  while (len >= 16) {
+    vst1q_u8(d, v);
+    d += 16;
+    len -= 16;
+  }
+  memset(d, c, len);
+  return s;
+}
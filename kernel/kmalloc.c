@@ -4,44 +4,478 @@
 
 #include <kernel/klibc/stdlib.h>
 #include <kernel/kmalloc.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/smp.h>
+#include <kernel/sync/spinlock.h>
 
-#define STARTUP_HEAP_MEMORY (1024*1024*1)
+// Small objects are served from slabs segregated by size class, anything bigger
+// than the largest class goes straight to the page allocator. The slab header
+// takes the first object slots, so objects are aligned to their size, and
+// large classes use multi-page slabs to keep that waste under 1/SLAB_MIN_OBJECTS.
+#define KMALLOC_MIN_SHIFT 4 // 16 bytes
+#define KMALLOC_MAX_SHIFT 10 // 1024 bytes
+#define KMALLOC_N_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_SIZE (1UL << KMALLOC_MAX_SHIFT)
 
-// From: https://moss.cs.iit.edu/cs351/slides/slides-malloc.pdf
-#define ALIGNMENT 8 // must be a power of 2
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#define SLAB_MAGIC 0x51AB51AB
+#define SLAB_MIN_OBJECTS 16
 
-__attribute__((section(".heap"))) static int8_t startup_heap_memory[STARTUP_HEAP_MEMORY];
+// In front of the slabs every core keeps two magazines of objects per class
+// (Bonwick's magazines), traded with a per-class depot when both run dry or full.
+#define MAGAZINE_SIZE 256 // A magazine is an object of the 256 byte class
+#define MAGAZINE_ROUNDS ((MAGAZINE_SIZE - 2 * sizeof(void *)) / sizeof(void *))
+#define DEPOT_MAX_FULL 8  // Full magazines kept per class, the rest go back to the slabs
 
-void *find_fit(size_t size) {
-  int8_t *heap_start = startup_heap_memory;
-  int8_t *heap_end = heap_start+STARTUP_HEAP_MEMORY;
-  int8_t *header = heap_start;
-  while (header < heap_end) {
-    if (!(*header & 1) && *header >= size)
-      return header;
-    header = (int8_t *) header + (*header & ~1L);
+#ifdef KOS_HOST
+// Host threads play the cores, UINT32_MAX for none (see host/host_shim.c)
+extern __thread uint32_t host_cpu_id;
+#endif
+
+struct kmem_cache;
+
+struct kmem_magazine {
+  struct kmem_magazine *next; // In the depot
+  size_t rounds;
+  void *objects[MAGAZINE_ROUNDS];
+};
+
+// Only touched by its core with IRQs masked
+struct kmem_cpu_cache {
+  struct kmem_magazine *loaded;
+  struct kmem_magazine *previous; // Either full or empty
+};
+
+struct slab {
+  uint32_t magic;
+  uint16_t in_use;
+  uint16_t capacity;
+  struct kmem_cache *cache;
+  struct slab *next;
+  struct slab *prev;
+  void *free;   // Free list of released objects
+  uint8_t *unused; // Objects never handed out yet (bump pointer)
+};
+
+struct kmem_cache {
+  struct spinlock lock; // Slabs and depot, kfree may run from interrupt context
+  size_t object_size;
+  size_t header_size;   // The slab header rounded up to whole objects
+  unsigned int slab_order;
+  struct slab *partial; // Slabs with at least one free object
+  struct slab *empty;   // One cached empty slab, to avoid page allocator round trips
+  size_t n_slabs;
+  size_t n_objects;     // Handed out by the slabs, magazines included
+  struct kmem_magazine *depot_full;
+  struct kmem_magazine *depot_empty;
+  size_t n_depot_full;
+  size_t n_depot_empty;
+};
+
+// Per-CPU caches of every class, a cache line apart from the other cores
+struct kmem_cpu {
+  struct kmem_cpu_cache classes[KMALLOC_N_CLASSES];
+} __attribute__((aligned(64)));
+
+static struct kmem_cache caches[KMALLOC_N_CLASSES];
+static struct kmem_cpu kmem_cpus[SMP_MAX_CPUS];
+
+static inline unsigned int size_class(size_t size) {
+  if (size <= (1UL << KMALLOC_MIN_SHIFT)) {
+    return 0;
+  }
+  // ceil(log2(size)) - KMALLOC_MIN_SHIFT
+  return (sizeof(unsigned long) * 8 - __builtin_clzl(size - 1)) - KMALLOC_MIN_SHIFT;
+}
+
+// Every page of a slab points to its header, see slab_create
+static inline struct slab *slab_of(void *ptr) {
+  return page_owner(ptr);
+}
+
+static void partial_push(struct kmem_cache *cache, struct slab *slab) {
+  slab->prev = NULL;
+  slab->next = cache->partial;
+  if (slab->next) {
+    slab->next->prev = slab;
+  }
+  cache->partial = slab;
+}
+
+static void partial_remove(struct kmem_cache *cache, struct slab *slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    cache->partial = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->next = slab->prev = NULL;
+}
+
+static struct slab *slab_create(struct kmem_cache *cache) {
+  struct slab *slab = page_alloc(cache->slab_order);
+  if (!slab) {
+    return NULL;
+  }
+
+  page_set_owner(slab, slab);
+  slab->magic = SLAB_MAGIC;
+  slab->cache = cache;
+  slab->in_use = 0;
+  slab->capacity = ((PAGE_SIZE << cache->slab_order) - cache->header_size) / cache->object_size;
+  slab->next = slab->prev = NULL;
+  slab->free = NULL;
+  slab->unused = (uint8_t *) slab + cache->header_size;
+  cache->n_slabs++;
+  return slab;
+}
+
+static void slab_destroy(struct kmem_cache *cache, struct slab *slab) {
+  slab->magic = 0;
+  cache->n_slabs--;
+  page_free(slab);
+}
+
+static void *cache_alloc_locked(struct kmem_cache *cache) {
+  struct slab *slab = cache->partial;
+  if (!slab) {
+    slab = cache->empty;
+    cache->empty = NULL;
+    if (!slab) {
+      slab = slab_create(cache);
+      if (!slab) {
+        return NULL;
+      }
+    }
+    partial_push(cache, slab);
+  }
+
+  void *object;
+  if (slab->free) {
+    object = slab->free;
+    slab->free = *(void **) object;
+  } else {
+    object = slab->unused;
+    slab->unused += cache->object_size;
   }
-  return NULL;
+
+  slab->in_use++;
+  cache->n_objects++;
+  if (slab->in_use == slab->capacity) {
+    partial_remove(cache, slab);
+  }
+  return object;
+}
+
+static void cache_free_locked(struct kmem_cache *cache, struct slab *slab, void *object) {
+  if (slab->in_use == slab->capacity) {
+    partial_push(cache, slab);
+  }
+
+  *(void **) object = slab->free;
+  slab->free = object;
+  slab->in_use--;
+  cache->n_objects--;
+
+  if (slab->in_use == 0) {
+    partial_remove(cache, slab);
+    if (cache->empty) {
+      slab_destroy(cache, slab);
+    } else {
+      // Reset the bump pointer so the cached slab starts clean
+      slab->free = NULL;
+      slab->unused = (uint8_t *) slab + cache->header_size;
+      cache->empty = slab;
+    }
+  }
+}
+
+static struct kmem_cache *magazine_cache() {
+  return &caches[size_class(MAGAZINE_SIZE)];
+}
+
+// Magazines come straight from the slabs of their class, never from a magazine
+static struct kmem_magazine *magazine_create() {
+  struct kmem_cache *cache = magazine_cache();
+  uint64_t flags = spin_lock_irqsave(&cache->lock);
+  struct kmem_magazine *magazine = cache_alloc_locked(cache);
+  spin_unlock_irqrestore(&cache->lock, flags);
+  if (magazine) {
+    magazine->next = NULL;
+    magazine->rounds = 0;
+  }
+  return magazine;
+}
+
+// Returns the rounds of a magazine to the slabs, with the cache lock held
+static void magazine_flush_locked(struct kmem_cache *cache, struct kmem_magazine *magazine) {
+  while (magazine->rounds) {
+    void *object = magazine->objects[--magazine->rounds];
+    cache_free_locked(cache, slab_of(object), object);
+  }
+}
+
+static inline struct kmem_cpu *kmem_this_cpu() {
+#ifdef KOS_HOST
+  return host_cpu_id < SMP_MAX_CPUS ? &kmem_cpus[host_cpu_id] : NULL;
+#else
+  // TPIDR_EL1 is 0 on the boot core until smp_init
+  struct cpu *cpu = this_cpu();
+  return cpu ? &kmem_cpus[cpu->id] : NULL;
+#endif
+}
+
+static inline uint64_t kmem_irq_save() {
+#ifdef KOS_HOST
+  return 0;
+#else
+  return local_irq_save();
+#endif
+}
+
+static inline void kmem_irq_restore(uint64_t flags) {
+#ifndef KOS_HOST
+  local_irq_restore(flags);
+#endif
+}
+
+static inline void magazine_swap(struct kmem_cpu_cache *cc) {
+  struct kmem_magazine *magazine = cc->loaded;
+  cc->loaded = cc->previous;
+  cc->previous = magazine;
+}
+
+// Both magazines are empty: trade the previous one for a full magazine of the
+// depot, or fill the loaded one from the slabs with a single lock acquisition
+static int magazine_reload(struct kmem_cache *cache, struct kmem_cpu_cache *cc) {
+  if (!cc->loaded && !(cc->loaded = magazine_create())) {
+    return -1;
+  }
+
+  spin_lock(&cache->lock);
+  struct kmem_magazine *full = cache->depot_full;
+  if (full) {
+    cache->depot_full = full->next;
+    cache->n_depot_full--;
+    if (cc->previous) {
+      cc->previous->next = cache->depot_empty;
+      cache->depot_empty = cc->previous;
+      cache->n_depot_empty++;
+    }
+    cc->previous = cc->loaded;
+    cc->loaded = full;
+  } else {
+    struct kmem_magazine *magazine = cc->loaded;
+    while (magazine->rounds < MAGAZINE_ROUNDS) {
+      void *object = cache_alloc_locked(cache);
+      if (!object) {
+        break;
+      }
+      magazine->objects[magazine->rounds++] = object;
+    }
+  }
+  spin_unlock(&cache->lock);
+  return cc->loaded->rounds ? 0 : -1;
+}
+
+// Both magazines are full: trade the previous one for an empty magazine. The depot
+// keeps DEPOT_MAX_FULL full magazines, past that the rounds go back to the slabs,
+// so objects freed by a core other than their allocator do not pile up.
+static int magazine_unload(struct kmem_cache *cache, struct kmem_cpu_cache *cc) {
+  spin_lock(&cache->lock);
+  if (cache->n_depot_full < DEPOT_MAX_FULL) {
+    cc->previous->next = cache->depot_full;
+    cache->depot_full = cc->previous;
+    cache->n_depot_full++;
+    cc->previous = cache->depot_empty;
+    if (cc->previous) {
+      cache->depot_empty = cc->previous->next;
+      cache->n_depot_empty--;
+    }
+  } else {
+    magazine_flush_locked(cache, cc->previous);
+  }
+  spin_unlock(&cache->lock);
+
+  if (!cc->previous && !(cc->previous = magazine_create())) {
+    return -1;
+  }
+  magazine_swap(cc);
+  return 0;
+}
+
+static void *cache_alloc(struct kmem_cache *cache) {
+  struct kmem_cpu *cpu = kmem_this_cpu();
+  if (!cpu) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    void *object = cache_alloc_locked(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return object;
+  }
+
+  // Core-local unless both magazines are empty, IRQs only have to be masked
+  struct kmem_cpu_cache *cc = &cpu->classes[cache - caches];
+  void *object = NULL;
+  uint64_t flags = kmem_irq_save();
+  if (!cc->loaded || !cc->loaded->rounds) {
+    if (cc->previous && cc->previous->rounds) {
+      magazine_swap(cc);
+    } else if (magazine_reload(cache, cc)) {
+      kmem_irq_restore(flags);
+      return NULL;
+    }
+  }
+  object = cc->loaded->objects[--cc->loaded->rounds];
+  kmem_irq_restore(flags);
+  return object;
+}
+
+static void cache_free(struct kmem_cache *cache, struct slab *slab, void *object) {
+  struct kmem_cpu *cpu = kmem_this_cpu();
+  struct kmem_cpu_cache *cc = cpu ? &cpu->classes[cache - caches] : NULL;
+  uint64_t flags = kmem_irq_save();
+  if (cc && (!cc->loaded || cc->loaded->rounds == MAGAZINE_ROUNDS)) {
+    if (!cc->loaded) {
+      cc->loaded = magazine_create();
+    } else if (cc->previous && cc->previous->rounds < MAGAZINE_ROUNDS) {
+      magazine_swap(cc);
+    } else if (!cc->previous) {
+      // Start the pair with an empty magazine
+      cc->previous = magazine_create();
+      if (cc->previous) {
+        magazine_swap(cc);
+      }
+    } else if (magazine_unload(cache, cc)) {
+      cc = NULL;
+    }
+  }
+  if (cc && cc->loaded && cc->loaded->rounds < MAGAZINE_ROUNDS) {
+    cc->loaded->objects[cc->loaded->rounds++] = object;
+    kmem_irq_restore(flags);
+    return;
+  }
+
+  // Not a core yet or no memory for a magazine
+  spin_lock(&cache->lock);
+  cache_free_locked(cache, slab, object);
+  spin_unlock(&cache->lock);
+  kmem_irq_restore(flags);
+}
+
+// Reclaim callback of the page allocator: the rounds of the depots and the cached
+// empty slabs go back. Caches locked by the caller (a slab being created) are
+// skipped, and per-CPU magazines stay with their cores, at most two per class.
+static size_t kmalloc_reclaim() {
+  size_t released = 0;
+  for (unsigned int c = 0; c < KMALLOC_N_CLASSES; c++) {
+    struct kmem_cache *cache = &caches[c];
+    uint64_t flags;
+    if (!spin_trylock_irqsave(&cache->lock, &flags)) {
+      continue;
+    }
+    size_t n_slabs = cache->n_slabs;
+    // Magazines are objects of another class, whose lock may be held: they are kept
+    while (cache->depot_full) {
+      struct kmem_magazine *magazine = cache->depot_full;
+      cache->depot_full = magazine->next;
+      magazine_flush_locked(cache, magazine);
+      magazine->next = cache->depot_empty;
+      cache->depot_empty = magazine;
+      cache->n_depot_empty++;
+    }
+    cache->n_depot_full = 0;
+    if (cache->empty) {
+      slab_destroy(cache, cache->empty);
+      cache->empty = NULL;
+    }
+    released += (n_slabs - cache->n_slabs) << cache->slab_order;
+    spin_unlock_irqrestore(&cache->lock, flags);
+  }
+  return released;
 }
 
 void kmalloc_init() {
   debug_msg("Initializing Heap");
-  memset(startup_heap_memory, 0, sizeof(startup_heap_memory));
-
-  size_t *header = (size_t *) startup_heap_memory;
-  *header = STARTUP_HEAP_MEMORY - SIZE_T_SIZE;
+  memset(caches, 0, sizeof(caches));
+  memset(kmem_cpus, 0, sizeof(kmem_cpus));
+  for (unsigned int c = 0; c < KMALLOC_N_CLASSES; c++) {
+    struct kmem_cache *cache = &caches[c];
+    spin_lock_init(&cache->lock, "kmalloc");
+    cache->object_size = 1UL << (c + KMALLOC_MIN_SHIFT);
+    cache->header_size = (sizeof(struct slab) + cache->object_size - 1) & ~(cache->object_size - 1);
+    while ((PAGE_SIZE << cache->slab_order) < SLAB_MIN_OBJECTS * cache->object_size) {
+      cache->slab_order++;
+    }
+  }
+  page_reclaim_register(kmalloc_reclaim);
+  debug_msg("Heap initialized with %d size classes (up to %lu bytes)", KMALLOC_N_CLASSES, KMALLOC_MAX_SIZE);
+}
 
-  debug_msg("Heap initialized at %p with size %d!", (uintptr_t) header, STARTUP_HEAP_MEMORY);
+static inline unsigned int large_order(size_t size) {
+  size_t n_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  unsigned int order = 0;
+  while ((1UL << order) < n_pages) {
+    order++;
+  }
+  return order;
 }
 
 void *kmalloc(size_t size) {
-  size_t blk_size = ALIGN(size + SIZE_T_SIZE);
-  size_t *header = find_fit(blk_size);
-  if (header) {
-    *header = *header | 1;
-    return header + SIZE_T_SIZE;
-  }
-  return NULL;
-}
\ No newline at end of file
+  if (size == 0) {
+    return NULL;
+  }
+
+  if (size <= KMALLOC_MAX_SIZE) {
+    return cache_alloc(&caches[size_class(size)]);
+  }
+
+  // Large objects: whole pages, always page aligned
+  return page_alloc(large_order(size));
+}
+
+void *kzalloc(size_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+
+  if (size <= KMALLOC_MAX_SIZE) {
+    void *ptr = cache_alloc(&caches[size_class(size)]);
+    if (ptr) {
+      memset(ptr, 0x00, size);
+    }
+    return ptr;
+  }
+
+  // Single pages come pre-zeroed from the pool
+  return page_alloc_flags(large_order(size), PAGE_ALLOC_ZERO);
+}
+
+void kfree(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  // Large objects are blocks of the page allocator, which have no owner
+  struct slab *slab = slab_of(ptr);
+  if (!slab) {
+    page_free(ptr);
+    return;
+  }
+  if (slab->magic != SLAB_MAGIC) {
+    debug_msg("kfree: invalid pointer %p", ptr);
+    return;
+  }
+  cache_free(slab->cache, slab, ptr);
+}
+
+void kmalloc_dump() {
+  debug_msg("=============== Heap =================");
+  for (unsigned int c = 0; c < KMALLOC_N_CLASSES; c++) {
+    const struct kmem_cache *cache = &caches[c];
+    debug_msg("Class %zu bytes: %zu slabs of order %u, %zu objects, depot %zu full / %zu empty magazines",
+              cache->object_size, cache->n_slabs, cache->slab_order, cache->n_objects, cache->n_depot_full,
+              cache->n_depot_empty);
+  }
+  debug_msg("======================================");
+}
@@ -0,0 +1,44 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/ksyms.h>
+
+// Overridden by the generated table of the final link, these keep their space
+// in .rodata so both links lay out the code the same way
+__attribute__((weak)) const uint64_t ksym_count = 0;
+__attribute__((weak)) const struct ksym ksym_table[1] = { { 0, NULL } };
+
+// End of .text (see main.ld)
+extern const char __text_end[];
+
+uint32_t ksym_find(uint64_t address) {
+  uint64_t n = ksym_count;
+  if (!n || address < ksym_table[0].address || address >= (uint64_t) __text_end) {
+    return KSYM_NONE;
+  }
+
+  // Last symbol at or below the address
+  uint64_t low = 0;
+  uint64_t high = n - 1;
+  while (low < high) {
+    uint64_t mid = low + (high - low + 1) / 2;
+    if (ksym_table[mid].address <= address) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return (uint32_t) low;
+}
+
+const char *ksym_lookup(uint64_t address, uint64_t *offset) {
+  uint32_t sym = ksym_find(address);
+  if (sym == KSYM_NONE) {
+    return NULL;
+  }
+  if (offset) {
+    *offset = address - ksym_table[sym].address;
+  }
+  return ksym_table[sym].name;
+}
@@ -0,0 +1,351 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/klibc/stdlib.h>
+#include <kernel/mm/memmap.h>
+#include <kernel/mm/page_alloc.h>
+
+#define MEMORY_DEVICE_TYPE "memory"
+#define RESERVED_MEMORY_NODE_NAME "reserved-memory"
+#define DISTANCE_MAP_NODE_NAME "distance-map"
+
+struct memmap system_memmap;
+
+static inline uint32_t memmap_clamp_node(uint32_t node) {
+  if (node >= MEMMAP_MAX_NODES) {
+    debug_msg("memmap: NUMA node %u out of range, using node 0", node);
+    return 0;
+  }
+  return node;
+}
+
+// Inserts a range keeping the array sorted by start address
+static int memmap_insert(struct memmap_range *ranges, uint32_t *n, uint32_t max, struct memmap_range range) {
+  if (*n >= max) {
+    return -1;
+  }
+  uint32_t i = (*n)++;
+  while (i > 0 && ranges[i - 1].start > range.start) {
+    ranges[i] = ranges[i - 1];
+    i--;
+  }
+  ranges[i] = range;
+  return 0;
+}
+
+static void memmap_add_bank(struct memmap *map, pa_address start, uint64_t size, uint32_t node) {
+  if (!size) {
+    return;
+  }
+  struct memmap_range bank = { .start = start, .end = start + size, .node = memmap_clamp_node(node) };
+  if (memmap_insert(map->banks, &map->n_banks, MEMMAP_MAX_BANKS, bank)) {
+    debug_msg("memmap: too many memory banks, ignoring %#lx - %#lx", bank.start, bank.end);
+    return;
+  }
+  if (bank.node >= map->n_nodes) {
+    map->n_nodes = bank.node + 1;
+  }
+}
+
+void memmap_reserve(struct memmap *map, pa_address start, pa_address end) {
+  if (end <= start) {
+    return;
+  }
+  struct memmap_range range = { .start = PAGE_ALIGN_DOWN(start), .end = PAGE_ALIGN_UP(end) };
+  if (memmap_insert(map->reserved, &map->n_reserved, MEMMAP_MAX_RESERVED, range)) {
+    debug_msg("memmap: too many reserved ranges, ignoring %#lx - %#lx", start, end);
+  }
+}
+
+// Every (address, size) tuple of a reg property
+static void memmap_read_reg(struct memmap *map, const void *reg, uint32_t len, uint32_t address_cells,
+                            uint32_t size_cells, uint32_t node, int reserve) {
+  uint32_t tuple_cells = address_cells + size_cells;
+  if (!reg || !tuple_cells) {
+    return;
+  }
+  const uint32_t *cells = reg;
+  uint32_t n_tuples = len / (tuple_cells * sizeof(uint32_t));
+  for (uint32_t t = 0; t < n_tuples; t++, cells += tuple_cells) {
+    pa_address address = fdt_read_cells(cells, address_cells);
+    uint64_t size = fdt_read_cells(cells + address_cells, size_cells);
+    if (reserve) {
+      memmap_reserve(map, address, address + size);
+    } else {
+      memmap_add_bank(map, address, size, node);
+    }
+  }
+}
+
+// distance-matrix: <from to distance> triplets, the matrix is symmetric
+static void memmap_read_distances(struct memmap *map, const void *value, uint32_t len) {
+  const uint32_t *cells = value;
+  for (uint32_t i = 0; i + 3 <= len / sizeof(uint32_t); i += 3) {
+    uint32_t from = fdt_be32(&cells[i]);
+    uint32_t to = fdt_be32(&cells[i + 1]);
+    uint32_t distance = fdt_be32(&cells[i + 2]);
+    if (from >= MEMMAP_MAX_NODES || to >= MEMMAP_MAX_NODES || distance > UINT8_MAX) {
+      continue;
+    }
+    map->distance[from][to] = distance;
+    map->distance[to][from] = distance;
+  }
+}
+
+// State of the node at the current depth, NULL for nodes too deep to matter
+static inline struct memmap_dtb_node *memmap_dtb_node(struct memmap_dtb_data *data) {
+  return data->depth < MEMMAP_DTB_DEPTH ? &data->nodes[data->depth] : NULL;
+}
+
+void fdt_memmap_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name) {
+  struct memmap_dtb_data *data = data_ptr;
+  data->depth++;
+  if (data->depth == 2) {
+    data->in_reserved_memory = strcmp(name, RESERVED_MEMORY_NODE_NAME) == 0;
+    data->in_distance_map = strstr(name, DISTANCE_MAP_NODE_NAME) == name;
+    // The spec defaults, /reserved-memory must set its own
+    data->reserved_address_cells = 2;
+    data->reserved_size_cells = 1;
+  }
+  struct memmap_dtb_node *node = memmap_dtb_node(data);
+  if (node) {
+    memset(node, 0x00, sizeof(struct memmap_dtb_node));
+  }
+}
+
+void fdt_memmap_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct memmap_dtb_data *data = data_ptr;
+  struct memmap_dtb_node *node = memmap_dtb_node(data);
+  if (node && !node->disabled) {
+    if (data->depth == 2 && node->is_memory) {
+      memmap_read_reg(data->map, node->reg, node->reg_len, data->address_cells, data->size_cells, node->node_id, 0);
+    } else if (data->depth == 3 && data->in_reserved_memory && !data->nodes[2].disabled) {
+      // Dynamic reservations (size without reg) are left to the allocators
+      memmap_read_reg(data->map, node->reg, node->reg_len, data->reserved_address_cells,
+                      data->reserved_size_cells, 0, 1);
+    }
+  }
+  if (data->depth == 2) {
+    data->in_reserved_memory = 0;
+    data->in_distance_map = 0;
+  }
+  data->depth--;
+}
+
+void fdt_memmap_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
+  struct memmap_dtb_data *data = data_ptr;
+  if (!property->len) {
+    return;
+  }
+
+  if (data->depth == 1) {
+    if (property->id == FDT_PROP_ID_ADDRESS_CELLS) {
+      data->address_cells = fdt_read_cells(property_value, 1);
+    } else if (property->id == FDT_PROP_ID_SIZE_CELLS) {
+      data->size_cells = fdt_read_cells(property_value, 1);
+    }
+    return;
+  }
+  struct memmap_dtb_node *node = memmap_dtb_node(data);
+  if (!node) {
+    return;
+  }
+
+  switch (property->id) {
+    case FDT_PROP_ID_DEVICE_TYPE:
+      node->is_memory = data->depth == 2 && strcmp(property_value, MEMORY_DEVICE_TYPE) == 0;
+      break;
+    case FDT_PROP_ID_REG:
+      node->reg = property_value;
+      node->reg_len = property->len;
+      break;
+    case FDT_PROP_ID_NUMA_NODE_ID:
+      node->node_id = fdt_read_cells(property_value, 1);
+      break;
+    case FDT_PROP_ID_STATUS:
+      node->disabled = strcmp(property_value, "okay") != 0 && strcmp(property_value, "ok") != 0;
+      break;
+    case FDT_PROP_ID_ADDRESS_CELLS:
+      if (data->depth == 2 && data->in_reserved_memory) {
+        data->reserved_address_cells = fdt_read_cells(property_value, 1);
+      }
+      break;
+    case FDT_PROP_ID_SIZE_CELLS:
+      if (data->depth == 2 && data->in_reserved_memory) {
+        data->reserved_size_cells = fdt_read_cells(property_value, 1);
+      }
+      break;
+    case FDT_PROP_ID_DISTANCE_MATRIX:
+      if (data->depth == 2 && data->in_distance_map) {
+        memmap_read_distances(data->map, property_value, property->len);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static const struct fdt_ops memmap_ops = {
+  .visit_begin_node = fdt_memmap_begin_node,
+  .visit_end_node = fdt_memmap_end_node,
+  .visit_property = fdt_memmap_property
+};
+
+struct fdt_visitor memmap_dtb_visitor(struct memmap_dtb_data *data, struct memmap *map) {
+  memset(data, 0x00, sizeof(struct memmap_dtb_data));
+  memset(map, 0x00, sizeof(struct memmap));
+  data->map = map;
+  // The spec defaults when the root does not set them
+  data->address_cells = 2;
+  data->size_cells = 1;
+  for (uint32_t from = 0; from < MEMMAP_MAX_NODES; from++) {
+    for (uint32_t to = 0; to < MEMMAP_MAX_NODES; to++) {
+      map->distance[from][to] = from == to ? MEMMAP_LOCAL_DISTANCE : MEMMAP_REMOTE_DISTANCE;
+    }
+  }
+  struct fdt_visitor visitor = { .ops = &memmap_ops, .data_ptr = data };
+  return visitor;
+}
+
+void memmap_reserve_fdt(struct memmap *map, const struct fdt_header *header) {
+  memmap_reserve(map, (pa_address) header, (pa_address) header + fdt_header_get(header, totalsize));
+  const struct fdt_reserve_entry *entry = fdt_mem_rsvmap(header);
+  while (1) {
+    uint64_t address = fdt_be64(&entry->address);
+    uint64_t size = fdt_be64(&entry->size);
+    entry++;
+    if (address == 0 && size == 0) {
+      break;
+    }
+    memmap_reserve(map, address, address + size);
+  }
+}
+
+static void memmap_add_free(struct memmap *map, pa_address start, pa_address end, uint32_t node) {
+  start = PAGE_ALIGN_UP(start);
+  end = PAGE_ALIGN_DOWN(end);
+  if (end <= start) {
+    return;
+  }
+  if (map->n_free >= MEMMAP_MAX_FREE) {
+    debug_msg("memmap: too many free ranges, ignoring %#lx - %#lx", start, end);
+    return;
+  }
+  map->free[map->n_free++] = (struct memmap_range) { .start = start, .end = end, .node = node };
+}
+
+void memmap_build_free(struct memmap *map) {
+  map->n_free = 0;
+  for (uint32_t b = 0; b < map->n_banks; b++) {
+    const struct memmap_range *bank = &map->banks[b];
+    pa_address cursor = bank->start;
+    for (uint32_t r = 0; r < map->n_reserved; r++) {
+      const struct memmap_range *reserved = &map->reserved[r];
+      if (reserved->end <= cursor) {
+        continue;
+      }
+      if (reserved->start >= bank->end) {
+        break;
+      }
+      if (reserved->start > cursor) {
+        memmap_add_free(map, cursor, reserved->start, bank->node);
+      }
+      cursor = reserved->end;
+    }
+    if (cursor < bank->end) {
+      memmap_add_free(map, cursor, bank->end, bank->node);
+    }
+  }
+
+  // Group per node, banks are sorted so each group stays sorted by address
+  for (uint32_t i = 1; i < map->n_free; i++) {
+    struct memmap_range range = map->free[i];
+    uint32_t j = i;
+    while (j > 0 && map->free[j - 1].node > range.node) {
+      map->free[j] = map->free[j - 1];
+      j--;
+    }
+    map->free[j] = range;
+  }
+  memset(map->node_free_first, 0x00, sizeof(map->node_free_first));
+  memset(map->node_free_count, 0x00, sizeof(map->node_free_count));
+  for (uint32_t i = map->n_free; i > 0; i--) {
+    uint32_t node = map->free[i - 1].node;
+    map->node_free_first[node] = i - 1;
+    map->node_free_count[node]++;
+  }
+}
+
+static pa_address memmap_carve_node(struct memmap *map, size_t size, uint32_t node) {
+  for (uint32_t i = 0; i < map->node_free_count[node]; i++) {
+    struct memmap_range *range = &map->free[map->node_free_first[node] + i];
+    if (range->end - range->start >= size) {
+      pa_address address = range->start;
+      range->start += size;
+      memmap_reserve(map, address, address + size);
+      return address;
+    }
+  }
+  return 0;
+}
+
+pa_address memmap_carve(struct memmap *map, size_t size, uint32_t node) {
+  size = PAGE_ALIGN_UP(size);
+  pa_address address = node < MEMMAP_MAX_NODES ? memmap_carve_node(map, size, node) : 0;
+  for (uint32_t n = 0; !address && n < map->n_nodes; n++) {
+    address = memmap_carve_node(map, size, n);
+  }
+  return address;
+}
+
+const struct memmap_range *memmap_node_free(const struct memmap *map, uint32_t node, uint32_t *n) {
+  if (node >= MEMMAP_MAX_NODES) {
+    *n = 0;
+    return NULL;
+  }
+  *n = map->node_free_count[node];
+  return &map->free[map->node_free_first[node]];
+}
+
+uint32_t memmap_node_of(const struct memmap *map, pa_address address) {
+  for (uint32_t b = 0; b < map->n_banks; b++) {
+    if (address >= map->banks[b].start && address < map->banks[b].end) {
+      return map->banks[b].node;
+    }
+  }
+  return 0;
+}
+
+uint32_t memmap_distance(const struct memmap *map, uint32_t from, uint32_t to) {
+  if (from >= MEMMAP_MAX_NODES || to >= MEMMAP_MAX_NODES) {
+    return from == to ? MEMMAP_LOCAL_DISTANCE : MEMMAP_REMOTE_DISTANCE;
+  }
+  return map->distance[from][to];
+}
+
+void memmap_dump(const struct memmap *map) {
+  debug_msg("=============== Memory Map =====================");
+  for (uint32_t b = 0; b < map->n_banks; b++) {
+    debug_msg("RAM: %#lx - %#lx (node %u)", map->banks[b].start, map->banks[b].end, map->banks[b].node);
+  }
+  for (uint32_t r = 0; r < map->n_reserved; r++) {
+    debug_msg("Reserved: %#lx - %#lx", map->reserved[r].start, map->reserved[r].end);
+  }
+  for (uint32_t i = 0; i < map->n_free; i++) {
+    debug_msg("Free: %#lx - %#lx (node %u)", map->free[i].start, map->free[i].end, map->free[i].node);
+  }
+  if (map->n_nodes > 1) {
+    for (uint32_t from = 0; from < map->n_nodes; from++) {
+      char line[64];
+      struct kprintf_buffer out = { .buf = line, .size = sizeof(line), .flush = debug_write_buffer };
+      kbprintf(&out, "Distances from node %u:", from);
+      for (uint32_t to = 0; to < map->n_nodes; to++) {
+        kbprintf(&out, " %u", map->distance[from][to]);
+      }
+      kbprintf(&out, "\n\r");
+      debug_write_buffer(out.buf, out.len);
+    }
+  }
+  debug_msg("================================================");
+}
@@ -0,0 +1,377 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/klibc/stdlib.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/mm/page_zero.h>
+#include <kernel/sync/mcs.h>
+#ifndef KOS_HOST
+#include <kernel/smp.h>
+#endif
+
+// Defined by the linker script
+extern const volatile unsigned int dtb;
+extern const volatile unsigned int kernel_start;
+extern const volatile unsigned int kernel_end;
+
+static struct page_zone zones[PAGE_MAX_ZONES];
+static uint32_t n_zones = 0;
+
+// Zones to try per node, nearest first
+static uint32_t node_zones[MEMMAP_MAX_NODES][PAGE_MAX_ZONES];
+
+// Every core allocates here, idle ones refill the zeroed pool. Pages may be
+// freed from interrupt context (timer callbacks), IRQs are masked while it is held.
+static struct mcs_lock page_lock = MCS_LOCK_INIT("page_alloc");
+
+static page_reclaim_fn_t reclaimers[PAGE_MAX_RECLAIMERS];
+static uint32_t n_reclaimers = 0;
+
+static inline size_t page_index(struct page_zone *z, struct page *page) {
+  return page - z->pages;
+}
+
+static inline pa_address page_address(struct page_zone *z, struct page *page) {
+  return z->base + (page_index(z, page) << PAGE_SHIFT);
+}
+
+static inline struct page *zone_page_of(struct page_zone *z, pa_address addr) {
+  if (addr < z->base) {
+    return NULL;
+  }
+
+  size_t index = (addr - z->base) >> PAGE_SHIFT;
+  if (index >= z->n_pages) {
+    return NULL;
+  }
+  return &z->pages[index];
+}
+
+static struct page *page_of(pa_address addr, struct page_zone **zone) {
+  for (uint32_t i = 0; i < n_zones; i++) {
+    struct page *page = zone_page_of(&zones[i], addr);
+    if (page) {
+      *zone = &zones[i];
+      return page;
+    }
+  }
+  return NULL;
+}
+
+static inline uint32_t page_local_node() {
+#ifdef KOS_HOST
+  return 0;
+#else
+  // TPIDR_EL1 is 0 on the boot core until smp_init
+  struct cpu *cpu = this_cpu();
+  return cpu ? cpu->node : 0;
+#endif
+}
+
+static void free_list_push(struct page_zone *z, struct page *page, unsigned int order) {
+  page->order = order;
+  page->flags = PAGE_FLAG_FREE;
+  page->prev = NULL;
+  page->next = z->free_lists[order];
+  if (page->next) {
+    page->next->prev = page;
+  }
+  z->free_lists[order] = page;
+  z->free_blocks[order]++;
+}
+
+static void free_list_remove(struct page_zone *z, struct page *page) {
+  unsigned int order = page->order;
+  if (page->prev) {
+    page->prev->next = page->next;
+  } else {
+    z->free_lists[order] = page->next;
+  }
+  if (page->next) {
+    page->next->prev = page->prev;
+  }
+  page->next = page->prev = NULL;
+  page->flags = 0;
+  z->free_blocks[order]--;
+}
+
+// Adds [start, end) to the free lists using the largest aligned blocks possible
+static void zone_free_range(struct page_zone *z, size_t start, size_t end) {
+  while (start < end) {
+    unsigned int order = PAGE_MAX_ORDER;
+    while (order > 0 && ((start & ((1UL << order) - 1)) || start + (1UL << order) > end)) {
+      order--;
+    }
+    free_list_push(z, &z->pages[start], order);
+    z->free_pages += 1UL << order;
+    start += 1UL << order;
+  }
+}
+
+static int zone_init(struct page_zone *z, struct memmap *map, const struct memmap_range *bank) {
+  pa_address start = PAGE_ALIGN_UP(bank->start);
+  pa_address end = PAGE_ALIGN_DOWN(bank->end);
+  memset(z, 0x00, sizeof(struct page_zone));
+  if (end <= start) {
+    return -1;
+  }
+
+  // The page descriptors live in the node they describe
+  size_t n_pages = (end - start) >> PAGE_SHIFT;
+  size_t descriptors_size = PAGE_ALIGN_UP(n_pages * sizeof(struct page));
+  pa_address descriptors = memmap_carve(map, descriptors_size, bank->node);
+  if (!descriptors) {
+    debug_msg("Not enough memory for %zu page descriptors", n_pages);
+    return -1;
+  }
+
+  z->base = start;
+  z->node = bank->node;
+  z->n_pages = n_pages;
+  z->pages = (struct page *) descriptors;
+  memset(z->pages, 0x00, n_pages * sizeof(struct page));
+  for (size_t i = 0; i < n_pages; i++) {
+    z->pages[i].flags = PAGE_FLAG_RESERVED;
+  }
+  return 0;
+}
+
+// Orders the zones of every node by distance, by address among equals
+static void zone_build_fallbacks(const struct memmap *map) {
+  for (uint32_t node = 0; node < MEMMAP_MAX_NODES; node++) {
+    uint32_t *order = node_zones[node];
+    for (uint32_t i = 0; i < n_zones; i++) {
+      uint32_t distance = memmap_distance(map, node, zones[i].node);
+      uint32_t j = i;
+      while (j > 0 && memmap_distance(map, node, zones[order[j - 1]].node) > distance) {
+        order[j] = order[j - 1];
+        j--;
+      }
+      order[j] = i;
+    }
+  }
+}
+
+void page_alloc_init(struct memmap *map, const struct fdt_header *header) {
+  n_zones = 0;
+
+  // DTB region and kernel image (see main.ld)
+  memmap_reserve(map, (pa_address) &dtb, (pa_address) &kernel_start);
+  memmap_reserve(map, (pa_address) &kernel_start, (pa_address) &kernel_end);
+  memmap_reserve_fdt(map, header);
+  memmap_build_free(map);
+
+  for (uint32_t b = 0; b < map->n_banks; b++) {
+    if (zone_init(&zones[n_zones], map, &map->banks[b]) == 0) {
+      n_zones++;
+    }
+  }
+
+  // Descriptors were carved out of the free ranges, the rest is released
+  size_t n_pages = 0;
+  size_t free_pages = 0;
+  for (uint32_t i = 0; i < map->n_free; i++) {
+    const struct memmap_range *range = &map->free[i];
+    struct page_zone *z;
+    if (range->end > range->start && page_of(range->start, &z)) {
+      zone_free_range(z, (range->start - z->base) >> PAGE_SHIFT, (range->end - z->base) >> PAGE_SHIFT);
+    }
+  }
+  for (uint32_t i = 0; i < n_zones; i++) {
+    n_pages += zones[i].n_pages;
+    free_pages += zones[i].free_pages;
+  }
+  zone_build_fallbacks(map);
+
+  debug_msg("Page allocator initialized with %zu free pages (of %zu) in %u zones", free_pages, n_pages, n_zones);
+}
+
+static void *zone_alloc(struct page_zone *z, unsigned int order) {
+  unsigned int current = order;
+  while (current <= PAGE_MAX_ORDER && !z->free_lists[current]) {
+    current++;
+  }
+  if (current > PAGE_MAX_ORDER) {
+    return NULL;
+  }
+
+  struct page *page = z->free_lists[current];
+  free_list_remove(z, page);
+
+  // Split the block, returning the upper halves to the lower free lists
+  while (current > order) {
+    current--;
+    free_list_push(z, page + (1UL << current), current);
+  }
+
+  page->order = order;
+  page->flags = PAGE_FLAG_ALLOCATED;
+  page->owner = NULL;
+  z->free_pages -= 1UL << order;
+  return (void *) page_address(z, page);
+}
+
+int page_reclaim_register(page_reclaim_fn_t fn) {
+  if (n_reclaimers >= PAGE_MAX_RECLAIMERS) {
+    return -1;
+  }
+  reclaimers[n_reclaimers] = fn;
+  __atomic_store_n(&n_reclaimers, n_reclaimers + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Out of memory: the zeroed pool is the first reserve, then the caches of other subsystems
+static size_t page_reclaim() {
+  size_t released = page_zero_drain();
+  uint32_t n = __atomic_load_n(&n_reclaimers, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < n; i++) {
+    released += reclaimers[i]();
+  }
+  return released;
+}
+
+static void *zones_alloc(unsigned int order, uint32_t node) {
+  void *addr = NULL;
+  struct mcs_node lock_node;
+  uint64_t flags = mcs_lock_irqsave(&page_lock, &lock_node);
+  for (uint32_t i = 0; i < n_zones && !addr; i++) {
+    addr = zone_alloc(&zones[node_zones[node][i]], order);
+  }
+  mcs_unlock_irqrestore(&page_lock, &lock_node, flags);
+  return addr;
+}
+
+void *page_alloc_node(unsigned int order, uint32_t node) {
+  if (order > PAGE_MAX_ORDER) {
+    return NULL;
+  }
+  if (node >= MEMMAP_MAX_NODES) {
+    node = 0;
+  }
+
+  void *addr = zones_alloc(order, node);
+  if (!addr && page_reclaim()) {
+    addr = zones_alloc(order, node);
+  }
+  return addr;
+}
+
+void *page_alloc(unsigned int order) {
+  return page_alloc_node(order, page_local_node());
+}
+
+void *page_alloc_flags(unsigned int order, uint32_t flags) {
+  uint32_t node = page_local_node();
+  if (!(flags & PAGE_ALLOC_ZERO)) {
+    return page_alloc_node(order, node);
+  }
+
+  void *addr = order == 0 ? page_zero_pop(node) : NULL;
+  if (!addr) {
+    // Synchronous zeroing, only when the pool is empty or for larger blocks
+    addr = page_alloc_node(order, node);
+    for (size_t i = 0; addr && i < (1UL << order); i++) {
+      page_zero_fill((uint8_t *) addr + (i << PAGE_SHIFT));
+    }
+  }
+  return addr;
+}
+
+void page_free(void *addr) {
+  struct page_zone *z;
+  struct mcs_node lock_node;
+  uint64_t flags = mcs_lock_irqsave(&page_lock, &lock_node);
+  // Double frees and pointers into a block (or into a former block) are refused,
+  // pushing them would overlap a block that is already free
+  struct page *page = ((pa_address) addr & ~PAGE_MASK) ? NULL : page_of((pa_address) addr, &z);
+  if (!page || page->flags != PAGE_FLAG_ALLOCATED) {
+    mcs_unlock_irqrestore(&page_lock, &lock_node, flags);
+    debug_msg("page_free: invalid page %p", addr);
+    return;
+  }
+
+  // The page may end up inside the coalesced block, where it is no head
+  page->flags = 0;
+  unsigned int order = page->order;
+  if (page->owner) {
+    // Pages of a block without an owner have none, whatever they held before
+    for (size_t i = 0; i < (1UL << order); i++) {
+      page[i].owner = NULL;
+    }
+  }
+  size_t index = page_index(z, page);
+  z->free_pages += 1UL << order;
+
+  // Coalesce with the buddy while it is free and of the same order
+  while (order < PAGE_MAX_ORDER) {
+    size_t buddy_index = index ^ (1UL << order);
+    if (buddy_index + (1UL << order) > z->n_pages) {
+      break;
+    }
+
+    struct page *buddy = &z->pages[buddy_index];
+    if (!(buddy->flags & PAGE_FLAG_FREE) || buddy->order != order) {
+      break;
+    }
+
+    free_list_remove(z, buddy);
+    index &= ~(1UL << order);
+    order++;
+  }
+
+  free_list_push(z, &z->pages[index], order);
+  mcs_unlock_irqrestore(&page_lock, &lock_node, flags);
+}
+
+void page_set_owner(void *addr, void *owner) {
+  struct page_zone *z;
+  struct page *page = page_of((pa_address) addr, &z);
+  if (!page || page->flags != PAGE_FLAG_ALLOCATED) {
+    debug_msg("page_set_owner: invalid page %p", addr);
+    return;
+  }
+  for (size_t i = 0; i < (1UL << page->order); i++) {
+    page[i].owner = owner;
+  }
+}
+
+void *page_owner(void *addr) {
+  struct page_zone *z;
+  struct page *page = page_of((pa_address) addr, &z);
+  return page ? page->owner : NULL;
+}
+
+unsigned int page_order(void *addr) {
+  struct page_zone *z;
+  struct page *page = page_of((pa_address) addr, &z);
+  return page ? page->order : 0;
+}
+
+uint32_t page_node(void *addr) {
+  struct page_zone *z;
+  return page_of((pa_address) addr, &z) ? z->node : 0;
+}
+
+size_t page_free_count() {
+  size_t free_pages = 0;
+  for (uint32_t i = 0; i < n_zones; i++) {
+    free_pages += zones[i].free_pages;
+  }
+  return free_pages;
+}
+
+void page_alloc_dump() {
+  debug_msg("=============== Page Allocator =================");
+  for (uint32_t i = 0; i < n_zones; i++) {
+    const struct page_zone *z = &zones[i];
+    debug_msg("Zone %u (node %u) Base: %#lx, Pages: %zu, Free: %zu", i, z->node, z->base, z->n_pages, z->free_pages);
+    for (unsigned int order = 0; order <= PAGE_MAX_ORDER; order++) {
+      if (z->free_blocks[order]) {
+        debug_msg("  Order %d: %zu free blocks", order, z->free_blocks[order]);
+      }
+    }
+  }
+  debug_msg("Zeroed pool: %zu pages", page_zero_count());
+  debug_msg("================================================");
+}
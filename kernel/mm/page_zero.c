@@ -0,0 +1,137 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/klibc/stdlib.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/mm/page_zero.h>
+#ifndef KOS_HOST
+#include <kernel/arch/mmu.h>
+#include <kernel/arch/sysreg.h>
+#include <kernel/smp.h>
+#endif
+
+#define DCZID_BS_MASK 0xF
+#define DCZID_DZP (1 << 4)
+
+static struct page_zero_pool pools[MEMMAP_MAX_NODES] = {
+  [0 ... MEMMAP_MAX_NODES - 1] = { .lock = SPINLOCK_INIT("page_zero") }
+};
+
+// Pages may be freed from interrupt context, the pool must not be preempted by it
+static inline uint64_t pool_lock(struct page_zero_pool *pool) {
+  return spin_lock_irqsave(&pool->lock);
+}
+
+static inline void pool_unlock(struct page_zero_pool *pool, uint64_t flags) {
+  spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+static inline uint32_t pool_local_node() {
+#ifdef KOS_HOST
+  return 0;
+#else
+  struct cpu *cpu = this_cpu();
+  return cpu ? cpu->node : 0;
+#endif
+}
+
+void page_zero_fill(void *page) {
+#ifndef KOS_HOST
+  // DC ZVA faults on device memory, which is all memory while the MMU is off
+  uint64_t dczid = read_sysreg(dczid_el0);
+  if (!(dczid & DCZID_DZP) && (read_sysreg(sctlr_el1) & SCTLR_M)) {
+    size_t block = 4UL << (dczid & DCZID_BS_MASK);
+    for (uintptr_t p = (uintptr_t) page; p < (uintptr_t) page + PAGE_SIZE; p += block) {
+      __asm__ volatile("dc zva, %0" : : "r"(p) : "memory");
+    }
+    return;
+  }
+#endif
+  memset(page, 0x00, PAGE_SIZE);
+}
+
+void *page_zero_pop(uint32_t node) {
+  if (node >= MEMMAP_MAX_NODES) {
+    return NULL;
+  }
+  struct page_zero_pool *pool = &pools[node];
+  // Racy peek, an empty pool is the common case once memory runs short
+  if (!__atomic_load_n(&pool->head, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+
+  uint64_t flags = pool_lock(pool);
+  void **page = pool->head;
+  if (page) {
+    pool->head = *page;
+    pool->count--;
+  }
+  pool_unlock(pool, flags);
+
+  if (page) {
+    // The link is the only word that is not zero
+    *page = NULL;
+  }
+  return page;
+}
+
+static void pool_push(struct page_zero_pool *pool, void **page) {
+  uint64_t flags = pool_lock(pool);
+  *page = pool->head;
+  pool->head = page;
+  pool->count++;
+  pool_unlock(pool, flags);
+}
+
+uint32_t page_zero_refill() {
+  uint32_t node = pool_local_node();
+  uint32_t zeroed = 0;
+  while (zeroed < PAGE_ZERO_BATCH && __atomic_load_n(&pools[node].count, __ATOMIC_RELAXED) < PAGE_ZERO_TARGET) {
+    // Never hoard the last free pages, allocations would have to drain the pool
+    if (page_free_count() <= PAGE_ZERO_MIN_FREE) {
+      break;
+    }
+    void *page = page_alloc_node(0, node);
+    if (!page) {
+      break;
+    }
+    if (page_node(page) != node) {
+      // The node is out of memory, keep the remote pages for regular allocations
+      page_free(page);
+      break;
+    }
+    page_zero_fill(page);
+    pool_push(&pools[node], page);
+    zeroed++;
+  }
+  return zeroed;
+}
+
+size_t page_zero_drain() {
+  size_t released = 0;
+  for (uint32_t node = 0; node < MEMMAP_MAX_NODES; node++) {
+    struct page_zero_pool *pool = &pools[node];
+    uint64_t flags = pool_lock(pool);
+    void **page = pool->head;
+    pool->head = NULL;
+    pool->count = 0;
+    pool_unlock(pool, flags);
+
+    while (page) {
+      void **next = *page;
+      page_free(page);
+      page = next;
+      released++;
+    }
+  }
+  return released;
+}
+
+size_t page_zero_count() {
+  size_t count = 0;
+  for (uint32_t node = 0; node < MEMMAP_MAX_NODES; node++) {
+    count += __atomic_load_n(&pools[node].count, __ATOMIC_RELAXED);
+  }
+  return count;
+}
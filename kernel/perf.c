@@ -0,0 +1,188 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/ksyms.h>
+#include <kernel/kthread.h>
+#include <kernel/perf.h>
+#include <kernel/profile.h>
+
+static struct perf_cpu perf_cpus[SMP_MAX_CPUS];
+static uint32_t perf_intid = IRQ_NONE;
+
+// Configuration, cores apply it when its generation changes
+static uint32_t perf_generation = 0;
+static uint32_t perf_active = 0;
+static uint32_t perf_event = PMU_EVENT_CPU_CYCLES;
+static uint32_t perf_period = PERF_DEFAULT_PERIOD;
+
+// Event counters are 32 bits wide: start at -period to overflow after period events
+static inline void perf_arm(const struct perf_cpu *pc) {
+  write_sysreg(pmselr_el0, pc->counter);
+  isb();
+  write_sysreg(pmxevcntr_el0, (uint32_t) -perf_period);
+}
+
+static void perf_irq_handler(uint32_t intid, void *data) {
+  struct cpu *cpu = this_cpu();
+  struct perf_cpu *pc = &perf_cpus[cpu->id];
+  uint32_t bit = 1U << pc->counter;
+  if (!(read_sysreg(pmovsclr_el0) & bit)) {
+    return;
+  }
+  write_sysreg(pmovsclr_el0, bit);
+
+  struct irq_frame *frame = irq_current_frame();
+  if (pc->n_samples < PERF_SAMPLES) {
+    struct perf_sample *sample = &pc->samples[pc->n_samples++];
+    sample->pc = frame->elr;
+    sample->thread = cpu->current ? cpu->current->id : 0;
+  } else {
+    pc->dropped++;
+  }
+  perf_arm(pc);
+  isb();
+}
+
+// Returns -1 if the PMU of the calling core has no counter left by the boot timeline
+static int perf_cpu_apply(struct perf_cpu *pc, uint32_t generation) {
+  uint32_t n = (read_sysreg(pmcr_el0) >> PMCR_N_SHIFT) & PMCR_N_MASK;
+  if (n <= PROFILE_COUNTERS) {
+    pc->generation = generation;
+    return -1;
+  }
+  // Done before masking IRQs, enabling a PPI may bring up the CPU interface
+  if (perf_active && !pc->irq_enabled) {
+    pc->irq_enabled = 1;
+    irq_enable(perf_intid);
+  }
+
+  uint64_t flags = local_irq_save();
+  pc->counter = n - 1;
+  uint32_t bit = 1U << pc->counter;
+  write_sysreg(pmintenclr_el1, bit);
+  write_sysreg(pmcntenclr_el0, bit);
+  write_sysreg(pmovsclr_el0, bit);
+  if (perf_active) {
+    pc->n_samples = 0;
+    pc->dropped = 0;
+    write_sysreg(pmselr_el0, pc->counter);
+    isb();
+    write_sysreg(pmxevtyper_el0, perf_event);
+    perf_arm(pc);
+    write_sysreg(pmintenset_el1, bit);
+    write_sysreg(pmcntenset_el0, bit);
+    write_sysreg(pmcr_el0, read_sysreg(pmcr_el0) | PMCR_E);
+  }
+  isb();
+  pc->generation = generation;
+  local_irq_restore(flags);
+  return 0;
+}
+
+void perf_cpu_sync() {
+  struct perf_cpu *pc = &perf_cpus[this_cpu()->id];
+  uint32_t generation = __atomic_load_n(&perf_generation, __ATOMIC_ACQUIRE);
+  if (pc->generation != generation) {
+    perf_cpu_apply(pc, generation);
+  }
+}
+
+void perf_setup_irq(uint32_t intid) {
+  if (irq_request(intid, perf_irq_handler, NULL)) {
+    debug_msg("perf: cannot request INTID %u", intid);
+    return;
+  }
+  // Only enabled where sampling runs
+  irq_disable(intid);
+  __atomic_store_n(&perf_intid, intid, __ATOMIC_RELEASE);
+#ifdef KOS_PERF
+  // The rest of boot is sampled, see perf_boot_report
+  perf_start(PMU_EVENT_CPU_CYCLES, PERF_DEFAULT_PERIOD);
+#endif
+}
+
+static int perf_configure(uint32_t active, uint32_t event, uint32_t period) {
+  perf_active = active;
+  perf_event = event;
+  perf_period = period;
+  uint32_t generation = __atomic_add_fetch(&perf_generation, 1, __ATOMIC_RELEASE);
+  // Idle cores pick it up from their scheduler loop
+  sev();
+  return perf_cpu_apply(&perf_cpus[this_cpu()->id], generation);
+}
+
+int perf_start(uint32_t event, uint32_t period) {
+  if (__atomic_load_n(&perf_intid, __ATOMIC_ACQUIRE) == IRQ_NONE || !period) {
+    return -1;
+  }
+  if (perf_configure(1, event, period)) {
+    debug_msg("perf: no PMU counter left for sampling");
+    perf_configure(0, event, period);
+    return -1;
+  }
+  return 0;
+}
+
+void perf_stop() {
+  perf_configure(0, perf_event, perf_period);
+}
+
+void perf_report() {
+  // One count per symbol, the last one for samples outside the kernel text
+  uint64_t n_syms = ksym_count;
+  uint32_t *counts = kzalloc((n_syms + 1) * sizeof(uint32_t));
+  if (!counts) {
+    debug_msg("perf: no memory for the report");
+    return;
+  }
+
+  uint32_t total = 0;
+  uint32_t dropped = 0;
+  for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+    const struct perf_cpu *pc = &perf_cpus[c];
+    uint32_t n_samples = __atomic_load_n(&pc->n_samples, __ATOMIC_ACQUIRE);
+    for (uint32_t s = 0; s < n_samples; s++) {
+      uint32_t sym = ksym_find(pc->samples[s].pc);
+      counts[sym == KSYM_NONE ? n_syms : sym]++;
+    }
+    total += n_samples;
+    dropped += pc->dropped;
+  }
+
+  debug_msg("perf: %u samples (%u dropped), event %#x every %u", total, dropped, perf_event, perf_period);
+  if (!total) {
+    kfree(counts);
+    return;
+  }
+  for (uint32_t rank = 0; rank < PERF_REPORT_TOP; rank++) {
+    uint64_t top = 0;
+    for (uint64_t i = 1; i <= n_syms; i++) {
+      if (counts[i] > counts[top]) {
+        top = i;
+      }
+    }
+    if (!counts[top]) {
+      break;
+    }
+    uint32_t share = (uint32_t) ((uint64_t) counts[top] * 10000 / total);
+    debug_msg("  %3u.%02u%% %8u  %s", share / 100, share % 100, counts[top], top < n_syms ? ksym_table[top].name : "[unknown]");
+    counts[top] = 0;
+  }
+  kfree(counts);
+}
+
+#ifdef KOS_PERF
+void perf_boot_report() {
+  if (__atomic_load_n(&perf_intid, __ATOMIC_ACQUIRE) == IRQ_NONE) {
+    debug_msg("perf: no PMU interrupt, boot was not sampled");
+    return;
+  }
+  perf_stop();
+  perf_report();
+}
+#endif
@@ -0,0 +1,180 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#ifdef KOS_PROFILE
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/profile.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+
+static const uint32_t profile_events[PROFILE_COUNTERS] = {
+  PMU_EVENT_INST_RETIRED,
+  PMU_EVENT_L1D_CACHE_REFILL,
+  PMU_EVENT_L1D_TLB_REFILL
+};
+
+static const char *const profile_event_names[PROFILE_COUNTERS] = {
+  "inst",
+  "l1d-refill",
+  "tlb-refill"
+};
+
+static struct profile_region profile_regions[PROFILE_MAX_REGIONS];
+static uint32_t profile_n_regions = 0;
+static uint32_t profile_dropped = 0;
+static uint32_t profile_current = PROFILE_NONE; // Open boot phase
+static uint32_t profile_depth[SMP_MAX_CPUS];    // Open scoped regions per core
+static uint64_t profile_origin = 0;
+static uint32_t profile_n_counters = 0;         // Event counters the PMU has, up to PROFILE_COUNTERS
+static uint64_t profile_supported = 0;          // PMCEID0_EL0
+
+static inline uint32_t profile_cpu_id() {
+  // TPIDR_EL1 is 0 on the boot core until smp_init
+  struct cpu *cpu = this_cpu();
+  return cpu ? cpu->id : 0;
+}
+
+static void profile_sample(struct profile_sample *sample) {
+  sample->cpu = profile_cpu_id();
+  sample->time = read_sysreg(cntvct_el0);
+  sample->cycles = read_sysreg(pmccntr_el0);
+  // PMEVCNTR<n>_EL0 can only be named with a constant n
+  sample->events[0] = profile_n_counters > 0 ? read_sysreg(pmevcntr0_el0) : 0;
+  sample->events[1] = profile_n_counters > 1 ? read_sysreg(pmevcntr1_el0) : 0;
+  sample->events[2] = profile_n_counters > 2 ? read_sysreg(pmevcntr2_el0) : 0;
+}
+
+void profile_cpu_init() {
+  uint64_t pmcr = read_sysreg(pmcr_el0);
+  uint32_t n = (pmcr >> PMCR_N_SHIFT) & PMCR_N_MASK;
+  if (n > PROFILE_COUNTERS) {
+    n = PROFILE_COUNTERS;
+  }
+  // Count at every exception level the kernel runs at
+  write_sysreg(pmccfiltr_el0, 0);
+  if (n > 0) {
+    write_sysreg(pmevtyper0_el0, profile_events[0]);
+  }
+  if (n > 1) {
+    write_sysreg(pmevtyper1_el0, profile_events[1]);
+  }
+  if (n > 2) {
+    write_sysreg(pmevtyper2_el0, profile_events[2]);
+  }
+  write_sysreg(pmcntenset_el0, PMCNTEN_C | ((1U << n) - 1));
+  write_sysreg(pmcr_el0, pmcr | PMCR_E | PMCR_P);
+  isb();
+  profile_n_counters = n;
+}
+
+void profile_init(uint64_t origin) {
+  profile_cpu_init();
+  profile_supported = read_sysreg(pmceid0_el0);
+  profile_origin = origin;
+}
+
+static uint32_t profile_open(const char *name, uint32_t depth) {
+  uint32_t region = __atomic_fetch_add(&profile_n_regions, 1, __ATOMIC_RELAXED);
+  if (region >= PROFILE_MAX_REGIONS) {
+    __atomic_fetch_add(&profile_dropped, 1, __ATOMIC_RELAXED);
+    return PROFILE_NONE;
+  }
+  struct profile_region *r = &profile_regions[region];
+  r->name = name;
+  r->depth = depth;
+  r->done = 0;
+  profile_sample(&r->start);
+  return region;
+}
+
+static void profile_close(uint32_t region) {
+  struct profile_region *r = &profile_regions[region];
+  profile_sample(&r->end);
+  __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+}
+
+void profile_phase(const char *name) {
+  if (profile_current != PROFILE_NONE) {
+    profile_close(profile_current);
+  }
+  profile_current = name ? profile_open(name, 0) : PROFILE_NONE;
+}
+
+uint32_t profile_begin(const char *name) {
+  uint32_t *depth = &profile_depth[profile_cpu_id()];
+  uint32_t region = profile_open(name, *depth + 1);
+  if (region != PROFILE_NONE) {
+    (*depth)++;
+  }
+  return region;
+}
+
+void profile_end(uint32_t region) {
+  if (region == PROFILE_NONE) {
+    return;
+  }
+  profile_close(region);
+  // The region may have moved to another core while blocked
+  uint32_t *depth = &profile_depth[profile_cpu_id()];
+  if (*depth) {
+    (*depth)--;
+  }
+}
+
+static void profile_print_us(struct kprintf_buffer *out, uint64_t ticks) {
+  uint64_t ns = clock_ticks_to_ns(ticks);
+  kbprintf(out, "%7lu.%03lu", ns / NSEC_PER_USEC, ns % NSEC_PER_USEC);
+}
+
+static void profile_print(const struct profile_region *r) {
+  char line[160];
+  struct kprintf_buffer out = { .buf = line, .size = sizeof(line), .flush = debug_write_buffer };
+  kbprintf(&out, "  CPU %u ", r->start.cpu);
+  profile_print_us(&out, r->start.time - profile_origin);
+  profile_print_us(&out, r->end.time - r->start.time);
+  kbprintf(&out, " %*s%-*s", (int) r->depth * 2, "", 20 - (int) r->depth * 2, r->name);
+
+  if (r->start.cpu != r->end.cpu) {
+    kbprintf(&out, " (moved to CPU %u)", r->end.cpu);
+  } else {
+    uint64_t cycles = r->end.cycles - r->start.cycles;
+    kbprintf(&out, " %12lu cycles", cycles);
+    for (uint32_t c = 0; c < PROFILE_COUNTERS; c++) {
+      if (c >= profile_n_counters || !(profile_supported & (1UL << profile_events[c]))) {
+        kbprintf(&out, " %10s %s", "-", profile_event_names[c]);
+        continue;
+      }
+      uint64_t delta = r->end.events[c] - r->start.events[c];
+      kbprintf(&out, " %10lu %s", delta, profile_event_names[c]);
+      if (profile_events[c] == PMU_EVENT_INST_RETIRED && cycles) {
+        // Instructions per cycle, two decimals
+        uint64_t ipc = delta * 100 / cycles;
+        kbprintf(&out, " (IPC %lu.%02lu)", ipc / 100, ipc % 100);
+      }
+    }
+  }
+  kbprintf(&out, "\n\r");
+  debug_write_buffer(out.buf, out.len);
+}
+
+void profile_dump() {
+  uint32_t n = __atomic_load_n(&profile_n_regions, __ATOMIC_ACQUIRE);
+  if (n > PROFILE_MAX_REGIONS) {
+    n = PROFILE_MAX_REGIONS;
+  }
+  debug_msg("Boot timeline (start and duration in us, counters per phase):");
+  for (uint32_t i = 0; i < n; i++) {
+    const struct profile_region *r = &profile_regions[i];
+    if (__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+      profile_print(r);
+    }
+  }
+  if (profile_dropped) {
+    debug_msg("  %u regions dropped, the timeline is full", profile_dropped);
+  }
+}
+
+#endif
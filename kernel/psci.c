@@ -0,0 +1,34 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/psci.h>
+
+static enum psci_conduit psci_conduit = PSCI_CONDUIT_NONE;
+static uint32_t psci_cpu_on_fn = PSCI_FN64_CPU_ON;
+
+static uint64_t psci_call(uint64_t fn, uint64_t arg0, uint64_t arg1, uint64_t arg2) {
+  switch (psci_conduit) {
+    case PSCI_CONDUIT_HVC:
+      return __smccc_hvc(fn, arg0, arg1, arg2);
+    case PSCI_CONDUIT_SMC:
+      return __smccc_smc(fn, arg0, arg1, arg2);
+    default:
+      return (uint64_t) PSCI_NOT_SUPPORTED;
+  }
+}
+
+void psci_init(enum psci_conduit conduit, uint32_t cpu_on_fn) {
+  psci_conduit = conduit;
+  if (cpu_on_fn) {
+    psci_cpu_on_fn = cpu_on_fn;
+  }
+}
+
+int32_t psci_version() {
+  return (int32_t) psci_call(PSCI_FN_PSCI_VERSION, 0, 0, 0);
+}
+
+int32_t psci_cpu_on(uint64_t mpidr, uint64_t entry, uint64_t context_id) {
+  return (int32_t) psci_call(psci_cpu_on_fn, mpidr, entry, context_id);
+}
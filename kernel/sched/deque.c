@@ -0,0 +1,58 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/sched/deque.h>
+
+// From: Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP'13)
+
+int kthread_deque_push(struct kthread_deque *deque, struct kthread *thread) {
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  if (bottom - top >= KTHREAD_DEQUE_SIZE) {
+    return -1;
+  }
+
+  __atomic_store_n(&deque->buffer[bottom & KTHREAD_DEQUE_MASK], thread, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+struct kthread *kthread_deque_pop(struct kthread_deque *deque) {
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  if (top > bottom) {
+    // Empty
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  struct kthread *thread = __atomic_load_n(&deque->buffer[bottom & KTHREAD_DEQUE_MASK], __ATOMIC_RELAXED);
+  if (top == bottom) {
+    // Last element: race against thieves
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      thread = NULL;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return thread;
+}
+
+struct kthread *kthread_deque_steal(struct kthread_deque *deque) {
+  int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom) {
+    return NULL;
+  }
+
+  struct kthread *thread = __atomic_load_n(&deque->buffer[top & KTHREAD_DEQUE_MASK], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return thread;
+}
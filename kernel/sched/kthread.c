@@ -0,0 +1,262 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kmalloc.h>
+#include <kernel/kthread.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/mm/page_zero.h>
+#include <kernel/perf.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
+
+static struct sched_cpu sched_cpus[SMP_MAX_CPUS];
+static struct kthread kmain_thread;
+static uint32_t next_thread_id = 1;
+
+static inline struct sched_cpu *sched_this_cpu() {
+  return &sched_cpus[this_cpu()->id];
+}
+
+static void sched_switch_out(struct kthread *thread) {
+  __kthread_switch(&thread->context, &sched_this_cpu()->context);
+}
+
+static void sched_enqueue(struct kthread *thread) {
+  // IRQ handlers may wake threads, the owner end of the deque is not reentrant
+  uint64_t flags = local_irq_save();
+  int full = kthread_deque_push(&sched_this_cpu()->runqueue, thread);
+  local_irq_restore(flags);
+  if (full) {
+    debug_msg("sched: run queue of CPU %d is full", this_cpu()->id);
+    while (1) {}
+  }
+  // Wake up idle cores so they can steal it
+  sev();
+}
+
+static uint32_t sched_random(struct sched_cpu *sc) {
+  // xorshift32
+  uint32_t x = sc->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sc->rng = x;
+  return x;
+}
+
+static struct kthread *sched_steal(struct cpu *cpu, struct sched_cpu *sc) {
+  if (smp_online_cpus() < 2) {
+    return NULL;
+  }
+
+  // Ids of online cores can have holes left by abandoned ones (their queues stay empty)
+  uint32_t n_slots = smp_cpu_slots();
+  uint32_t start = sched_random(sc) % n_slots;
+  for (uint32_t i = 0; i < n_slots; i++) {
+    uint32_t victim = (start + i) % n_slots;
+    if (victim == cpu->id) {
+      continue;
+    }
+    struct kthread *thread = kthread_deque_steal(&sched_cpus[victim].runqueue);
+    if (thread) {
+      trace("sched: CPU %d stole thread %d from CPU %d", cpu->id, thread->id, victim);
+      return thread;
+    }
+  }
+  return NULL;
+}
+
+static struct kthread *sched_pick(struct cpu *cpu, struct sched_cpu *sc) {
+  struct kthread *thread = NULL;
+  uint64_t flags = local_irq_save();
+
+  // A thread just yielded: take the oldest one so it does not run again right away
+  if (sc->fifo_next) {
+    sc->fifo_next = 0;
+    thread = kthread_deque_steal(&sc->runqueue);
+  }
+  if (!thread) {
+    thread = kthread_deque_pop(&sc->runqueue);
+  }
+  local_irq_restore(flags);
+  if (!thread) {
+    thread = sched_steal(cpu, sc);
+  }
+  return thread;
+}
+
+// Runs in scheduler context once the thread has been switched out
+static void sched_finish_switch(struct sched_cpu *sc, struct kthread *prev) {
+  uint32_t state = __atomic_load_n(&prev->state, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+
+  switch (state) {
+    case KTHREAD_RUNNABLE:
+      sched_enqueue(prev);
+      sc->fifo_next = 1;
+      break;
+    case KTHREAD_DEAD: {
+      struct kthread *joiner = __atomic_exchange_n(&prev->joiner, KTHREAD_EXITED, __ATOMIC_ACQ_REL);
+      if (joiner) {
+        kthread_wake(joiner);
+      } else {
+        sev();
+      }
+      break;
+    }
+    default:
+      // Blocked threads are queued again by kthread_wake
+      break;
+  }
+}
+
+void sched_loop() {
+  struct cpu *cpu = this_cpu();
+  struct sched_cpu *sc = &sched_cpus[cpu->id];
+  sc->rng = 0x9E3779B9 ^ (cpu->id + 1);
+
+  while (1) {
+    // Cores pick up the interrupt controller once its driver is probed
+    irq_cpu_online();
+    timer_cpu_sync();
+    perf_cpu_sync();
+    struct kthread *next = sched_pick(cpu, sc);
+    if (!next) {
+      // Idle time goes to zeroing pages ahead of page_alloc_flags(PAGE_ALLOC_ZERO)
+      if (!page_zero_refill()) {
+        wfe();
+      }
+      continue;
+    }
+
+    next->cpu = cpu->id;
+    next->on_cpu = 1;
+    __atomic_store_n(&next->state, KTHREAD_RUNNING, __ATOMIC_RELAXED);
+    cpu->current = next;
+    fpsimd_switch_in(next);
+    __kthread_switch(&sc->context, &next->context);
+
+    struct kthread *prev = cpu->current;
+    fpsimd_switch_out(prev);
+    cpu->current = NULL;
+    sched_finish_switch(sc, prev);
+    // Threads may switch out with IRQs masked (see kthread_block)
+    if (cpu->irq_online) {
+      local_irq_enable();
+    }
+  }
+}
+
+void sched_init() {
+  // Secondary cores are already looping on their (zeroed) run queues.
+  // The boot core needs a stack for its scheduler, __kos_main keeps the boot stack
+  struct sched_cpu *sc = sched_this_cpu();
+  sc->stack = page_alloc(KTHREAD_STACK_ORDER);
+  if (!sc->stack) {
+    debug_msg("sched: no memory for the scheduler stack");
+    return;
+  }
+  sc->context.sp = (uint64_t) sc->stack + (PAGE_SIZE << KTHREAD_STACK_ORDER);
+  sc->context.lr = (uint64_t) __sched_trampoline;
+
+  memset(&kmain_thread, 0x00, sizeof(struct kthread));
+  kmain_thread.state = KTHREAD_RUNNING;
+  kmain_thread.on_cpu = 1;
+  kmain_thread.fpsimd_cpu = FPSIMD_NO_CPU;
+  this_cpu()->current = &kmain_thread;
+}
+
+void kthread_entry(struct kthread *thread) {
+  kthread_exit(thread->fn(thread->arg));
+}
+
+struct kthread *kthread_spawn(int (*fn)(void *), void *arg) {
+  struct kthread *thread = kmalloc(sizeof(struct kthread));
+  if (!thread) {
+    return NULL;
+  }
+  memset(thread, 0x00, sizeof(struct kthread));
+
+  thread->stack = page_alloc(KTHREAD_STACK_ORDER);
+  if (!thread->stack) {
+    kfree(thread);
+    return NULL;
+  }
+
+  thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+  thread->fn = fn;
+  thread->arg = arg;
+  thread->state = KTHREAD_RUNNABLE;
+  thread->fpsimd_cpu = FPSIMD_NO_CPU;
+  thread->context.sp = (uint64_t) thread->stack + (PAGE_SIZE << KTHREAD_STACK_ORDER);
+  thread->context.lr = (uint64_t) __kthread_trampoline;
+  thread->context.x19 = (uint64_t) thread;
+  trace("sched: thread %d spawned on CPU %d", thread->id, this_cpu()->id);
+  sched_enqueue(thread);
+  return thread;
+}
+
+void kthread_yield() {
+  struct kthread *current = kthread_current();
+  if (!current) {
+    return;
+  }
+  __atomic_store_n(&current->state, KTHREAD_RUNNABLE, __ATOMIC_RELEASE);
+  sched_switch_out(current);
+}
+
+void kthread_exit(int result) {
+  struct kthread *current = kthread_current();
+  current->result = result;
+  __atomic_store_n(&current->state, KTHREAD_DEAD, __ATOMIC_RELEASE);
+  sched_switch_out(current);
+  while (1) {}
+}
+
+void kthread_wake(struct kthread *thread) {
+  // Wait until its context has been saved by the core it ran on
+  while (__atomic_load_n(&thread->on_cpu, __ATOMIC_ACQUIRE)) {
+    __asm__ volatile("yield");
+  }
+  __atomic_store_n(&thread->state, KTHREAD_RUNNABLE, __ATOMIC_RELEASE);
+  sched_enqueue(thread);
+}
+
+void kthread_block() {
+  struct kthread *current = kthread_current();
+  __atomic_store_n(&current->state, KTHREAD_BLOCKED, __ATOMIC_RELEASE);
+  sched_switch_out(current);
+}
+
+int kthread_join(struct kthread *thread) {
+  struct kthread *current = kthread_current();
+  if (current) {
+    struct kthread *expected = NULL;
+    __atomic_store_n(&current->state, KTHREAD_BLOCKED, __ATOMIC_RELEASE);
+    if (__atomic_compare_exchange_n(&thread->joiner, &expected, current, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      // Woken up once the thread is dead
+      sched_switch_out(current);
+    } else {
+      __atomic_store_n(&current->state, KTHREAD_RUNNING, __ATOMIC_RELEASE);
+    }
+  } else {
+    // Not called from a thread: nothing to switch to, just wait
+    while (__atomic_load_n(&thread->joiner, __ATOMIC_ACQUIRE) != KTHREAD_EXITED) {
+      wfe();
+    }
+  }
+
+  int result = thread->result;
+  page_free(thread->stack);
+  kfree(thread);
+  return result;
+}
+
+struct kthread *kthread_current() {
+  return this_cpu()->current;
+}
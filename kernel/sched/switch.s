@@ -0,0 +1,34 @@
+// X0: struct kthread_context *from, X1: struct kthread_context *to
+.global __kthread_switch
+__kthread_switch:
+    mov x9, sp
+    stp x19, x20, [x0, #0]
+    stp x21, x22, [x0, #16]
+    stp x23, x24, [x0, #32]
+    stp x25, x26, [x0, #48]
+    stp x27, x28, [x0, #64]
+    stp x29, x30, [x0, #80]
+    str x9, [x0, #96]
+
+    ldp x19, x20, [x1, #0]
+    ldp x21, x22, [x1, #16]
+    ldp x23, x24, [x1, #32]
+    ldp x25, x26, [x1, #48]
+    ldp x27, x28, [x1, #64]
+    ldp x29, x30, [x1, #80]
+    ldr x9, [x1, #96]
+    mov sp, x9
+    ret
+
+// First switch into a thread, X19: struct kthread *
+.global __kthread_trampoline
+__kthread_trampoline:
+    mov x0, x19
+    bl kthread_entry
+    b .
+
+// First switch into the scheduler of the boot core
+.global __sched_trampoline
+__sched_trampoline:
+    bl sched_loop
+    b .
@@ -0,0 +1,10 @@
+// X0: function ID, X1-X3: arguments. The result is returned in X0.
+.global __smccc_hvc
+__smccc_hvc:
+    hvc #0
+    ret
+
+.global __smccc_smc
+__smccc_smc:
+    smc #0
+    ret
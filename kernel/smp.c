@@ -0,0 +1,208 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/cache.h>
+#include <kernel/arch/fpsimd.h>
+#include <kernel/arch/mmu.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kthread.h>
+#include <kernel/mm/page_alloc.h>
+#include <kernel/profile.h>
+#include <kernel/smp.h>
+
+#define CPUS_NODE_NAME "cpus"
+#define CPU_NODE_PREFIX "cpu@"
+#define PSCI_NODE_NAME "psci"
+
+#define SMP_BOOT_TIMEOUT 10000000
+
+// Defined by the linker script
+extern const volatile unsigned int stack_top;
+
+struct cpu cpus[SMP_MAX_CPUS];
+static uint32_t n_cpus = 1;
+static uint32_t n_slots = 1;
+
+void fdt_smp_begin_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const char *name) {
+  struct smp_dtb_data *data = data_ptr;
+  data->depth++;
+  if (data->depth == 2) {
+    data->in_cpus = strcmp(name, CPUS_NODE_NAME) == 0;
+    data->in_psci = strstr(name, PSCI_NODE_NAME) == name;
+  } else if (data->depth == 3 && data->in_cpus && strstr(name, CPU_NODE_PREFIX) == name) {
+    data->in_cpu = 1;
+    data->current_has_reg = 0;
+    memset(&data->current, 0x00, sizeof(struct smp_cpu_desc));
+  }
+}
+
+void fdt_smp_end_node(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token) {
+  struct smp_dtb_data *data = data_ptr;
+  if (data->depth == 3 && data->in_cpu) {
+    if (data->current_has_reg && data->n_cpus < SMP_MAX_CPUS) {
+      data->cpus[data->n_cpus++] = data->current;
+    }
+    data->in_cpu = 0;
+  } else if (data->depth == 2) {
+    data->seen_cpus |= data->in_cpus;
+    data->seen_psci |= data->in_psci;
+    data->in_cpus = 0;
+    data->in_psci = 0;
+  }
+  data->depth--;
+}
+
+void fdt_smp_property(void *data_ptr, const struct fdt_header *header, const fdt_token_t *token, const struct fdt_prop_data *property, const void *property_value) {
+  struct smp_dtb_data *data = data_ptr;
+  if (!property->len) {
+    return;
+  }
+
+  if (data->depth == 2 && data->in_cpus) {
+    if (property->id == FDT_PROP_ID_ADDRESS_CELLS) {
+      data->cpus_address_cells = fdt_read_cells(property_value, 1);
+    }
+  } else if (data->depth == 3 && data->in_cpu) {
+    if (property->id == FDT_PROP_ID_REG) {
+      data->current.mpidr = fdt_read_cells(property_value, data->cpus_address_cells);
+      data->current_has_reg = 1;
+    } else if (property->id == FDT_PROP_ID_ENABLE_METHOD) {
+      data->current.psci = strcmp(property_value, PSCI_NODE_NAME) == 0;
+    } else if (property->id == FDT_PROP_ID_NUMA_NODE_ID) {
+      data->current.node = fdt_read_cells(property_value, 1);
+    }
+  } else if (data->depth == 2 && data->in_psci) {
+    if (property->id == FDT_PROP_ID_METHOD) {
+      if (strcmp(property_value, "hvc") == 0) {
+        data->conduit = PSCI_CONDUIT_HVC;
+      } else if (strcmp(property_value, "smc") == 0) {
+        data->conduit = PSCI_CONDUIT_SMC;
+      }
+    } else if (property->id == FDT_PROP_ID_CPU_ON) {
+      data->cpu_on_fn = fdt_read_cells(property_value, 1);
+    }
+  }
+}
+
+int fdt_smp_done(void *data_ptr) {
+  struct smp_dtb_data *data = data_ptr;
+  return data->seen_cpus && data->seen_psci;
+}
+
+static const struct fdt_ops smp_ops = {
+  .visit_begin_node = fdt_smp_begin_node,
+  .visit_end_node = fdt_smp_end_node,
+  .visit_property = fdt_smp_property,
+  .done = fdt_smp_done
+};
+
+struct fdt_visitor smp_dtb_visitor(struct smp_dtb_data *data) {
+  memset(data, 0x00, sizeof(struct smp_dtb_data));
+  data->cpus_address_cells = 2;
+  struct fdt_visitor visitor = { .ops = &smp_ops, .data_ptr = data };
+  return visitor;
+}
+
+static int smp_boot_cpu(const struct smp_cpu_desc *desc) {
+  if (n_slots >= SMP_MAX_CPUS) {
+    return -1;
+  }
+  struct cpu *cpu = &cpus[n_slots];
+  memset(cpu, 0x00, sizeof(struct cpu));
+  cpu->id = n_slots;
+  cpu->mpidr = desc->mpidr;
+  cpu->node = desc->node;
+  cpu->stack = page_alloc_node(SMP_STACK_ORDER, cpu->node);
+  if (!cpu->stack) {
+    debug_msg("SMP: no memory for the stack of CPU %d", cpu->id);
+    return -1;
+  }
+  cpu->stack_top = (uint64_t) cpu->stack + (PAGE_SIZE << SMP_STACK_ORDER);
+
+  // The core reads its per-CPU data and the MMU configuration with caches off
+  dcache_clean_range(cpu, sizeof(struct cpu));
+  dcache_clean_range(&mmu_boot_config, sizeof(mmu_boot_config));
+
+  int32_t status = psci_cpu_on(cpu->mpidr, (uint64_t) __kos_secondary_start, (uint64_t) cpu);
+  if (status != PSCI_SUCCESS) {
+    debug_msg("SMP: CPU_ON failed for MPIDR %#x (error %d)", (uint32_t) cpu->mpidr, status);
+    page_free(cpu->stack);
+    return -1;
+  }
+
+  // From here on the core may use its slot and its stack at any time
+  n_slots++;
+  uint32_t timeout = SMP_BOOT_TIMEOUT;
+  while (__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) == CPU_OFFLINE && timeout--) {
+    __asm__ volatile("yield");
+  }
+  // The core may show up right now: whoever moves online first decides
+  uint32_t expected = CPU_OFFLINE;
+  if (__atomic_compare_exchange_n(&cpu->online, &expected, CPU_ABANDONED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    debug_msg("SMP: CPU %d did not come online, its slot is abandoned", cpu->id);
+    return -1;
+  }
+
+  n_cpus++;
+  return 0;
+}
+
+void smp_init(const struct smp_dtb_data *data) {
+  // Per-CPU data of the boot core
+  struct cpu *boot_cpu = &cpus[0];
+  memset(cpus, 0x00, sizeof(cpus));
+  boot_cpu->id = 0;
+  boot_cpu->mpidr = read_sysreg(mpidr_el1) & MPIDR_AFFINITY_MASK;
+  boot_cpu->stack_top = (uint64_t) &stack_top;
+  boot_cpu->online = CPU_ONLINE;
+  for (uint32_t c = 0; c < data->n_cpus; c++) {
+    if ((data->cpus[c].mpidr & MPIDR_AFFINITY_MASK) == boot_cpu->mpidr) {
+      boot_cpu->node = data->cpus[c].node;
+    }
+  }
+  write_sysreg(tpidr_el1, boot_cpu);
+  n_cpus = 1;
+  n_slots = 1;
+
+  if (data->conduit == PSCI_CONDUIT_NONE) {
+    debug_msg("SMP: no PSCI conduit, running on the boot CPU only");
+    return;
+  }
+  psci_init(data->conduit, data->cpu_on_fn);
+
+  for (uint32_t c = 0; c < data->n_cpus; c++) {
+    const struct smp_cpu_desc *desc = &data->cpus[c];
+    if ((desc->mpidr & MPIDR_AFFINITY_MASK) == boot_cpu->mpidr || !desc->psci) {
+      continue;
+    }
+    smp_boot_cpu(desc);
+  }
+
+  debug_msg("SMP: %d of %d CPUs online", n_cpus, data->n_cpus);
+}
+
+uint32_t smp_online_cpus() {
+  return n_cpus;
+}
+
+uint32_t smp_cpu_slots() {
+  return n_slots;
+}
+
+void __kos_secondary_main(struct cpu *cpu) {
+  fpsimd_init();
+  profile_cpu_init();
+  uint32_t expected = CPU_OFFLINE;
+  if (!__atomic_compare_exchange_n(&cpu->online, &expected, CPU_ONLINE, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // Too late, the boot core gave up on it: park with IRQs masked, never scheduled
+    while (1) {
+      wfe();
+    }
+  }
+  cpu_idle();
+}
+
+void cpu_idle() {
+  sched_loop();
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#ifdef KOS_LOCKSTAT
+
+#include <kernel/klibc/stdlib.h>
+#include <kernel/sync/lockstat.h>
+#include <kernel/timer.h>
+
+static struct lockstat *lockstat_registry = NULL;
+
+static void lockstat_register(struct lockstat *stat) {
+  if (__atomic_exchange_n(&stat->registered, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  struct lockstat *head = __atomic_load_n(&lockstat_registry, __ATOMIC_RELAXED);
+  do {
+    stat->next = head;
+  } while (!__atomic_compare_exchange_n(&lockstat_registry, &head, stat, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Readers hold a lock together, every counter is updated atomically
+void lockstat_contended(struct lockstat *stat, uint64_t start) {
+  __atomic_fetch_add(&stat->contended, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stat->wait_ticks, lockstat_now() - start, __ATOMIC_RELAXED);
+}
+
+void lockstat_acquired(struct lockstat *stat, int exclusive) {
+  if (!__atomic_load_n(&stat->registered, __ATOMIC_RELAXED)) {
+    lockstat_register(stat);
+  }
+  __atomic_fetch_add(&stat->acquisitions, 1, __ATOMIC_RELAXED);
+  if (exclusive) {
+    stat->acquired_at = lockstat_now();
+  }
+}
+
+void lockstat_released(struct lockstat *stat) {
+  // Only the exclusive holder gets here, the lock orders it with the next one
+  uint64_t held = lockstat_now() - stat->acquired_at;
+  stat->hold_ticks += held;
+  if (held > stat->max_hold_ticks) {
+    stat->max_hold_ticks = held;
+  }
+}
+
+static void lockstat_print(const struct lockstat *stat) {
+  char line[160];
+  struct kprintf_buffer out = { .buf = line, .size = sizeof(line), .flush = debug_write_buffer };
+  uint64_t acquisitions = stat->acquisitions ? stat->acquisitions : 1;
+  kbprintf(&out, "  %-20s %10lu %10lu %10lu %10lu %10lu",
+           stat->name ? stat->name : "?",
+           stat->acquisitions,
+           stat->contended,
+           clock_ticks_to_ns(stat->wait_ticks) / NSEC_PER_USEC,
+           clock_ticks_to_ns(stat->hold_ticks / acquisitions),
+           clock_ticks_to_ns(stat->max_hold_ticks));
+  kbprintf(&out, " (%p)\n\r", stat);
+  debug_write_buffer(out.buf, out.len);
+}
+
+void lockstat_dump() {
+  debug_msg("Lock statistics (most contended first):");
+  debug_msg("  %-20s %10s %10s %10s %10s %10s", "lock", "acquired", "contended", "wait us", "avg ns", "max ns");
+  // Selection by contention, the registry is a short list
+  const struct lockstat *printed = NULL;
+  uint64_t bound = UINT64_MAX;
+  for (uint32_t rank = 0; rank < LOCKSTAT_REPORT_TOP; rank++) {
+    const struct lockstat *top = NULL;
+    for (const struct lockstat *s = __atomic_load_n(&lockstat_registry, __ATOMIC_ACQUIRE); s; s = s->next) {
+      // Ties are broken by address so every lock is printed once
+      int below = s->contended < bound || (s->contended == bound && printed && s < printed);
+      if (below && (!top || s->contended > top->contended || (s->contended == top->contended && s > top))) {
+        top = s;
+      }
+    }
+    if (!top) {
+      break;
+    }
+    lockstat_print(top);
+    bound = top->contended;
+    printed = top;
+  }
+}
+
+void lockstat_reset() {
+  for (struct lockstat *s = __atomic_load_n(&lockstat_registry, __ATOMIC_ACQUIRE); s; s = s->next) {
+    s->acquisitions = 0;
+    s->contended = 0;
+    s->wait_ticks = 0;
+    s->hold_ticks = 0;
+    s->max_hold_ticks = 0;
+  }
+}
+
+#endif
@@ -0,0 +1,61 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <stddef.h>
+#include <kernel/sync/mcs.h>
+#include <kernel/sync/wait.h>
+#ifndef KOS_HOST
+#include <kernel/arch/sysreg.h>
+#endif
+
+void mcs_lock(struct mcs_lock *lock, struct mcs_node *node) {
+  node->next = NULL;
+  node->locked = 1;
+  struct mcs_node *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+  if (prev) {
+    uint64_t start = lockstat_now();
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    uint32_t locked = __atomic_load_n(&node->locked, __ATOMIC_ACQUIRE);
+    while (locked) {
+      locked = sync_wait_while(&node->locked, locked);
+    }
+    lockstat_contended(&lock->stat, start);
+  }
+  lockstat_acquired(&lock->stat, 1);
+}
+
+void mcs_unlock(struct mcs_lock *lock, struct mcs_node *node) {
+  lockstat_released(&lock->stat);
+  struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  if (!next) {
+    struct mcs_node *expected = node;
+    if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    // A core has queued itself but not linked its entry yet, it is a few instructions away
+    while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+      sync_relax();
+    }
+  }
+  __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t mcs_lock_irqsave(struct mcs_lock *lock, struct mcs_node *node) {
+#ifdef KOS_HOST
+  uint64_t flags = 0;
+#else
+  uint64_t flags = local_irq_save();
+#endif
+  mcs_lock(lock, node);
+  return flags;
+}
+
+void mcs_unlock_irqrestore(struct mcs_lock *lock, struct mcs_node *node, uint64_t flags) {
+  mcs_unlock(lock, node);
+#ifndef KOS_HOST
+  local_irq_restore(flags);
+#else
+  (void) flags;
+#endif
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/sync/rwlock.h>
+#include <kernel/sync/wait.h>
+
+void rwlock_read_lock(struct rwlock *lock) {
+  uint64_t start = 0;
+  uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+  while (1) {
+    if (!(value & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING))) {
+      // On failure value is reloaded, try again right away
+      if (__atomic_compare_exchange_n(&lock->value, &value, value + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        break;
+      }
+      continue;
+    }
+    if (!start) {
+      start = lockstat_now() | 1; // Never 0, it also marks that the caller waited
+    }
+    value = sync_wait_while(&lock->value, value);
+  }
+  if (start) {
+    lockstat_contended(&lock->stat, start);
+  }
+  lockstat_acquired(&lock->stat, 0);
+}
+
+void rwlock_read_unlock(struct rwlock *lock) {
+  __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+}
+
+void rwlock_write_lock(struct rwlock *lock) {
+  uint64_t start = 0;
+  uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+  while (1) {
+    if (!(value & ~RWLOCK_WRITER_WAITING)) {
+      // Free: take it, clearing the waiting bit other writers set again
+      if (__atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        break;
+      }
+      continue;
+    }
+    if (!start) {
+      start = lockstat_now() | 1;
+    }
+    if (!(value & RWLOCK_WRITER_WAITING)) {
+      // Keep new readers out while the current ones drain
+      if (!__atomic_compare_exchange_n(&lock->value, &value, value | RWLOCK_WRITER_WAITING, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        continue;
+      }
+      value |= RWLOCK_WRITER_WAITING;
+    }
+    value = sync_wait_while(&lock->value, value);
+  }
+  if (start) {
+    lockstat_contended(&lock->stat, start);
+  }
+  lockstat_acquired(&lock->stat, 1);
+}
+
+void rwlock_write_unlock(struct rwlock *lock) {
+  lockstat_released(&lock->stat);
+  // Waiting writers keep their bit, readers do not get ahead of them
+  __atomic_fetch_and(&lock->value, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
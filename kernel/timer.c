@@ -0,0 +1,324 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/arch/sysreg.h>
+#include <kernel/irq.h>
+#include <kernel/klibc/stdlib.h>
+#include <kernel/kthread.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+
+#define TIMER_SLOT_MASK (TIMER_LEVEL_SLOTS - 1)
+#define TIMER_HORIZON (1UL << (TIMER_LEVEL_BITS * TIMER_LEVELS))
+
+static uint64_t clock_freq = 0;
+static uint64_t clock_mult = 0;     // ns = (ticks * clock_mult) >> 32
+static uint64_t clock_inv_mult = 0; // ticks = (ns * clock_inv_mult) >> 32, rounded up
+
+static struct timer_base timer_bases[SMP_MAX_CPUS];
+static uint32_t timer_intid = IRQ_NONE;
+
+void clock_set_frequency(uint64_t frequency) {
+  if (!frequency) {
+    return;
+  }
+  clock_freq = frequency;
+  clock_mult = (NSEC_PER_SEC << 32) / frequency;
+  clock_inv_mult = ((frequency << 32) + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+void clock_init() {
+  clock_set_frequency(read_sysreg(cntfrq_el0));
+  if (!clock_freq) {
+    debug_msg("clock: CNTFRQ_EL0 is not set, waiting for the device tree");
+  }
+  for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+    spin_lock_init(&timer_bases[i].lock, "timer_base");
+    timer_bases[i].programmed = TIMER_NEVER;
+  }
+}
+
+uint64_t clock_frequency() {
+  return clock_freq;
+}
+
+uint64_t clock_ticks_to_ns(uint64_t ticks) {
+  return (uint64_t) (((unsigned __int128) ticks * clock_mult) >> 32);
+}
+
+uint64_t clock_ns_to_ticks(uint64_t ns) {
+  return (uint64_t) ((((unsigned __int128) ns * clock_inv_mult) + UINT32_MAX) >> 32);
+}
+
+uint64_t clock_ns() {
+  return clock_ticks_to_ns(read_sysreg(cntvct_el0));
+}
+
+static inline struct timer_base *timer_this_base() {
+  // Timers may be used before smp_init, the boot core is CPU 0
+  struct cpu *cpu = this_cpu();
+  return &timer_bases[cpu ? cpu->id : 0];
+}
+
+// The timer interrupt takes the lock too, it must not preempt a holder on the same core
+static uint64_t timer_lock(struct timer_base *base) {
+  return spin_lock_irqsave(&base->lock);
+}
+
+static void timer_unlock(struct timer_base *base, uint64_t flags) {
+  spin_unlock_irqrestore(&base->lock, flags);
+}
+
+// First occupied slot at or after start, going around the level, 64 if there is none
+static inline uint32_t timer_slot_distance(uint64_t occupied, uint32_t start) {
+  if (!occupied) {
+    return TIMER_LEVEL_SLOTS;
+  }
+  uint64_t rotated = start ? (occupied >> start) | (occupied << (TIMER_LEVEL_SLOTS - start)) : occupied;
+  return __builtin_ctzl(rotated);
+}
+
+/**
+ * Returns the unit of the next event of a wheel: an expiry on level 0 or a
+ * cascade of a higher level, TIMER_NEVER if the wheel is empty
+ */
+static uint64_t timer_next_event(const struct timer_base *base) {
+  uint64_t next = TIMER_NEVER;
+  for (uint32_t level = 0; level < TIMER_LEVELS; level++) {
+    uint64_t occupied = base->occupied[level];
+    if (!occupied) {
+      continue;
+    }
+    uint32_t shift = level * TIMER_LEVEL_BITS;
+    uint64_t unit = base->clk >> shift;
+    // Past its first unit the current slot of a level already cascaded, what is there wrapped around
+    if (base->clk & ((1UL << shift) - 1)) {
+      unit++;
+    }
+    uint64_t event = (unit + timer_slot_distance(occupied, unit & TIMER_SLOT_MASK)) << shift;
+    if (event < next) {
+      next = event;
+    }
+  }
+  return next;
+}
+
+static void timer_enqueue(struct timer_base *base, struct timer *timer) {
+  uint64_t expires = timer->expires >> TIMER_UNIT_SHIFT;
+  if (expires < base->clk) {
+    expires = base->clk;
+  }
+  uint64_t delta = expires - base->clk;
+  if (delta >= TIMER_HORIZON) {
+    // Parked as far as the wheel reaches, queued again from there
+    delta = TIMER_HORIZON - 1;
+    expires = base->clk + delta;
+  }
+
+  // Level l holds the timers expiring 64^l to 64^(l+1) units away
+  uint32_t level = 0;
+  while (level < TIMER_LEVELS - 1 && (delta >> (TIMER_LEVEL_BITS * (level + 1)))) {
+    level++;
+  }
+  uint32_t slot = (expires >> (TIMER_LEVEL_BITS * level)) & TIMER_SLOT_MASK;
+
+  struct timer **head = &base->slots[level][slot];
+  timer->next = *head;
+  if (timer->next) {
+    timer->next->pprev = &timer->next;
+  }
+  timer->pprev = head;
+  *head = timer;
+  timer->base = base;
+  base->occupied[level] |= 1UL << slot;
+}
+
+static void timer_dequeue(struct timer_base *base, struct timer *timer) {
+  struct timer **pprev = timer->pprev;
+  *pprev = timer->next;
+  if (timer->next) {
+    timer->next->pprev = pprev;
+  }
+  timer->pprev = NULL;
+
+  // The slot became empty if the timer was its only entry
+  struct timer **first = &base->slots[0][0];
+  if (!*pprev && pprev >= first && pprev < first + TIMER_LEVELS * TIMER_LEVEL_SLOTS) {
+    size_t index = pprev - first;
+    base->occupied[index / TIMER_LEVEL_SLOTS] &= ~(1UL << (index % TIMER_LEVEL_SLOTS));
+  }
+}
+
+static struct timer *timer_detach_slot(struct timer_base *base, uint32_t level, uint32_t slot) {
+  struct timer *list = base->slots[level][slot];
+  base->slots[level][slot] = NULL;
+  base->occupied[level] &= ~(1UL << slot);
+  return list;
+}
+
+// Loads the next event of the local wheel in the comparator, or stops the timer
+static void timer_program(struct timer_base *base, uint64_t next) {
+  base->programmed = next;
+  if (next == TIMER_NEVER) {
+    // Tickless: an idle core takes no timer interrupts at all
+    write_sysreg(cntv_ctl_el0, 0);
+  } else {
+    write_sysreg(cntv_cval_el0, clock_ns_to_ticks(next << TIMER_UNIT_SHIFT));
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_ENABLE);
+  }
+  isb();
+}
+
+/**
+ * Advances a wheel up to now (in units), jumping from event to event.
+ * Called with the lock held and IRQs masked, callbacks run unlocked.
+ */
+static void timer_run(struct timer_base *base, uint64_t now) {
+  base->running = 1;
+  while (1) {
+    uint64_t event = timer_next_event(base);
+    if (event > now) {
+      break;
+    }
+    base->clk = event;
+
+    // Cascade the slots that start at this unit, coarsest last
+    for (uint32_t level = 1; level < TIMER_LEVELS; level++) {
+      uint32_t shift = level * TIMER_LEVEL_BITS;
+      if (event & ((1UL << shift) - 1)) {
+        break;
+      }
+      struct timer *timer = timer_detach_slot(base, level, (event >> shift) & TIMER_SLOT_MASK);
+      while (timer) {
+        struct timer *next = timer->next;
+        timer_enqueue(base, timer);
+        timer = next;
+      }
+    }
+
+    // One timer at a time: the slot may change while the lock is dropped
+    struct timer *timer;
+    while ((timer = base->slots[0][event & TIMER_SLOT_MASK])) {
+      timer_dequeue(base, timer);
+      if ((timer->expires >> TIMER_UNIT_SHIFT) > event) {
+        // Parked beyond the horizon
+        timer_enqueue(base, timer);
+        continue;
+      }
+      spin_unlock(&base->lock);
+      timer->fn(timer);
+      spin_lock(&base->lock);
+    }
+    base->clk = event + 1;
+  }
+  if (now + 1 > base->clk) {
+    base->clk = now + 1;
+  }
+  base->running = 0;
+}
+
+static void timer_irq_handler(uint32_t intid, void *data) {
+  struct timer_base *base = timer_this_base();
+  uint64_t flags = timer_lock(base);
+  uint64_t now = clock_ns() >> TIMER_UNIT_SHIFT;
+  // The comparator fired, so the programmed event is due even if the conversions rounded below it
+  if (base->programmed != TIMER_NEVER && base->programmed > now) {
+    now = base->programmed;
+  }
+  timer_run(base, now);
+  timer_program(base, timer_next_event(base));
+  timer_unlock(base, flags);
+}
+
+// The timer PPI is banked, every core enables it for itself. Only from the
+// scheduler loop: enabling a PPI before the CPU interface is up brings it up
+// and unmasks IRQs, which timer_add callers may have masked.
+void timer_cpu_sync() {
+  struct cpu *cpu = this_cpu();
+  uint32_t intid = __atomic_load_n(&timer_intid, __ATOMIC_ACQUIRE);
+  if (!cpu || !cpu->irq_online || intid == IRQ_NONE) {
+    return;
+  }
+  struct timer_base *base = &timer_bases[cpu->id];
+  if (!base->irq_enabled) {
+    base->irq_enabled = 1;
+    irq_enable(intid);
+  }
+}
+
+void timer_setup_irq(uint32_t intid) {
+  if (irq_request(intid, timer_irq_handler, NULL)) {
+    debug_msg("timer: cannot request INTID %u", intid);
+    return;
+  }
+  timer_this_base()->irq_enabled = 1;
+  __atomic_store_n(&timer_intid, intid, __ATOMIC_RELEASE);
+}
+
+void timer_init(struct timer *timer, timer_fn_t fn, void *data) {
+  memset(timer, 0x00, sizeof(struct timer));
+  timer->fn = fn;
+  timer->data = data;
+}
+
+int timer_cancel(struct timer *timer) {
+  struct timer_base *base = __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+  if (!base) {
+    return 0;
+  }
+  // The comparator is left alone, an early interrupt just finds nothing to run
+  uint64_t flags = timer_lock(base);
+  int queued = timer->base == base && timer->pprev;
+  if (queued) {
+    timer_dequeue(base, timer);
+  }
+  timer_unlock(base, flags);
+  return queued;
+}
+
+void timer_add(struct timer *timer, uint64_t expires) {
+  timer_cancel(timer);
+  struct timer_base *base = timer_this_base();
+
+  uint64_t flags = timer_lock(base);
+  uint64_t next = timer_next_event(base);
+  uint64_t now = clock_ns() >> TIMER_UNIT_SHIFT;
+  if (!base->running && next == TIMER_NEVER && now > base->clk) {
+    // Nothing queued: catch up, so the timer lands on the finest level it can
+    base->clk = now;
+  }
+  timer->expires = expires;
+  timer_enqueue(base, timer);
+
+  // From a callback, the interrupt handler programs the comparator once done
+  next = timer_next_event(base);
+  if (!base->running && next != base->programmed) {
+    timer_program(base, next);
+  }
+  timer_unlock(base, flags);
+}
+
+static void timer_wake_thread(struct timer *timer) {
+  kthread_wake(timer->data);
+}
+
+void timer_sleep_ns(uint64_t ns) {
+  uint64_t deadline = clock_ns() + ns;
+  struct cpu *cpu = this_cpu();
+  struct kthread *current = cpu ? cpu->current : NULL;
+  if (!current || !cpu->irq_online || __atomic_load_n(&timer_intid, __ATOMIC_ACQUIRE) == IRQ_NONE) {
+    while (clock_ns() < deadline) {
+      kthread_yield();
+    }
+    return;
+  }
+
+  struct timer timer;
+  timer_init(&timer, timer_wake_thread, current);
+  // The timer fires on this core: masked until the thread is off the CPU
+  uint64_t flags = local_irq_save();
+  timer_add(&timer, deadline);
+  kthread_block();
+  local_irq_restore(flags);
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2023, Kellerman Rivero <krsloco@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include <kernel/klibc/stdlib.h>
+#include <kernel/trace.h>
+
+struct trace_buffer trace_buffers[SMP_MAX_CPUS];
+
+static volatile uint32_t trace_draining = 0;
+
+// Copies the record at the tail of a buffer, returns 0 if there is none ready.
+// Records overwritten by the writer are skipped and counted in lost.
+static int trace_peek(struct trace_buffer *buffer, struct trace_record *out, uint32_t *lost) {
+  while (1) {
+    uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = buffer->tail;
+    if (tail == head) {
+      return 0;
+    }
+    if (head - tail > TRACE_RECORDS) {
+      *lost += head - tail - TRACE_RECORDS;
+      tail = head - TRACE_RECORDS;
+      buffer->tail = tail;
+    }
+
+    const struct trace_record *record = &buffer->records[tail & (TRACE_RECORDS - 1)];
+    uint64_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    if (seq != tail + 1) {
+      if (seq > tail + 1) {
+        (*lost)++;
+        buffer->tail = tail + 1;
+        continue;
+      }
+      // Not complete yet
+      return 0;
+    }
+
+    out->seq = seq;
+    out->timestamp = record->timestamp;
+    out->fmt = record->fmt;
+    for (uint32_t a = 0; a < TRACE_MAX_ARGS; a++) {
+      out->args[a] = record->args[a];
+    }
+
+    // The writer may have lapped us while copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) != seq) {
+      (*lost)++;
+      buffer->tail = tail + 1;
+      continue;
+    }
+    return 1;
+  }
+}
+
+#define TRACE_LINE_BUFFER 128
+
+static void trace_print(uint32_t cpu, const struct trace_record *record) {
+  char buf[TRACE_LINE_BUFFER];
+  struct kprintf_buffer out = { .buf = buf, .size = sizeof(buf), .flush = debug_write_buffer };
+  kbprintf(&out, "[%lu] CPU %u: ", record->timestamp, cpu);
+  kbprintf_values(&out, record->fmt, record->args, TRACE_MAX_ARGS);
+  kbprintf(&out, "\n\r");
+  debug_write_buffer(out.buf, out.len);
+}
+
+uint32_t trace_drain() {
+  if (__atomic_exchange_n(&trace_draining, 1, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+
+  struct trace_record next[SMP_MAX_CPUS];
+  uint8_t ready[SMP_MAX_CPUS];
+  uint32_t lost = 0;
+  for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+    ready[c] = trace_peek(&trace_buffers[c], &next[c], &lost);
+  }
+
+  // Merge the cores by timestamp, the oldest ready record goes first
+  uint32_t n_printed = 0;
+  while (1) {
+    uint32_t oldest = SMP_MAX_CPUS;
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+      if (ready[c] && (oldest == SMP_MAX_CPUS || next[c].timestamp < next[oldest].timestamp)) {
+        oldest = c;
+      }
+    }
+    if (oldest == SMP_MAX_CPUS) {
+      break;
+    }
+
+    trace_print(oldest, &next[oldest]);
+    n_printed++;
+    trace_buffers[oldest].tail = next[oldest].seq;
+    ready[oldest] = trace_peek(&trace_buffers[oldest], &next[oldest], &lost);
+  }
+
+  if (lost) {
+    debug_msg("trace: %u records lost", lost);
+  }
+  __atomic_store_n(&trace_draining, 0, __ATOMIC_RELEASE);
+  return n_printed;
+}